@@ -62,6 +62,12 @@ static inline void fclosep(FILE **f) {
 #define strcaseeq(a,b) (strcasecmp((a),(b)) == 0)
 #define strncaseeq(a, b, n) (strncasecmp((a), (b), (n)) == 0)
 
+static inline bool streq_ptr(const char *a, const char *b) {
+        if (a && b)
+                return streq(a, b);
+        return a == b;
+}
+
 static inline const char *strempty(const char *s) {
         return s ?:"";
 }
@@ -18,6 +18,10 @@ struct image_deps {
 struct image_entry {
   char *name;              /* name of the image, e.g. "gcc" */
   struct image_deps *deps;
+  char *sha256;            /* sum from SHA256SUMS, only for remote images */
+  char **deltas;           /* old images with a delta to this one */
+  char *version_key;       /* of deps->sysext_version_id, set by the catalog */
+  char *repository;        /* URL of the repository of a remote image */
   bool remote;
   bool local;
   bool installed;
@@ -27,7 +31,9 @@ struct image_entry {
 extern void free_image_deps(struct image_deps *e);
 extern void free_image_depsp(struct image_deps **e);
 extern void free_image_deps_list(struct image_deps ***images);
+extern int dup_image_deps(const struct image_deps *e, struct image_deps **res);
 extern void dump_image_deps(struct image_deps *e);
 extern void free_image_entry(struct image_entry *list);
 extern void free_image_entryp(struct image_entry **list);
 extern void free_image_entry_list(struct image_entry ***list);
+extern int dup_image_entry(const struct image_entry *e, struct image_entry **res);
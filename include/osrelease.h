@@ -12,3 +12,4 @@ struct osrelease {
 extern void free_os_release(struct osrelease *p);
 extern void free_os_releasep(struct osrelease **p);
 extern int load_os_release(const char *prefix, struct osrelease **res);
+extern int parse_os_release(const char *data, struct osrelease **res);
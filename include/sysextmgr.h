@@ -6,12 +6,31 @@
 #define _VARLINK_SYSEXTMGR_SOCKET _VARLINK_SYSEXTMGR_SOCKET_DIR"/socket"
 
 /* config.c */
+#include <stdint.h>
+
 struct config {
   bool verbose;
   bool verify_signature;
   char *url;
   char *sysext_store_dir;
   char *extensions_dir;
+  char *cache_dir;
+  uint32_t max_parallel_downloads;
+  uint32_t max_parallel_scans;  /* 0 is one per online CPU */
+  uint32_t remote_cache_ttl;   /* seconds */
+  uint32_t idle_exit_timeout;  /* seconds */
+  uint32_t download_retries;
+  uint32_t watch_refresh_interval;  /* seconds, 0 disables the background check */
+  bool sysext_refresh;  /* run "systemd-sysext refresh" after the links changed */
+  char **peers;  /* tried before url for images, in this order */
+  char **mirrors;  /* more URLs of the repository of url */
+  char **repositories;  /* url and the other repositories, highest priority first */
+  char *snapshots_dir;  /* links of the snapshots keep images in the store */
+  uint32_t gc_keep_versions;   /* versions per name, 0 keeps all */
+  uint32_t gc_max_store_size;  /* MiB, 0 is no limit */
+  bool gc_after_update;  /* clean up the store after every Update */
+  bool background_downloads;  /* all downloads with idle CPU and I/O priority */
+  bool drop_page_cache;  /* keep images written to the store out of the page cache */
 };
 
 extern struct config config;
@@ -27,8 +46,16 @@ extern int load_config(const char *defgroup);
 
 extern int parse_image_deps(sd_json_variant *json, struct image_deps **e);
 extern int load_image_json(int fd, const char *path, struct image_deps ***images);
+extern int image_deps_to_json(const struct image_deps *e, sd_json_variant **res);
+
+/* newversion.c */
+
+struct catalog;
+struct host_profile;
 
-extern int get_latest_version(struct image_entry *curr, struct image_entry **new, const char *url, bool verify_signature, const struct osrelease *osrelease, bool verbose);
+extern int get_latest_version(const struct catalog *catalog, const struct image_entry *curr, struct image_entry **new);
+extern int get_latest_version_until(const struct catalog *catalog, const struct image_entry *curr, const char *max_version, struct image_entry **new);
+extern int get_latest_version_for_host(const struct catalog *catalog, const struct image_entry *curr, struct host_profile *host, struct image_entry **new);
 /* main.c */
 extern void oom(void);
 extern void usage(int retval);
@@ -41,6 +68,25 @@ extern int main_check(int argc, char **argv);
 
 /* main-update.c */
 extern int main_update(int argc, char **argv);
+extern int main_prefetch(int argc, char **argv);
 
 /* main-install.c */
 extern int main_install(int argc, char **argv);
+
+/* main-metrics.c */
+extern int main_metrics(int argc, char **argv);
+
+/* main-plan.c */
+extern int main_plan(int argc, char **argv);
+
+/* main-cleanup.c */
+extern int main_cleanup(int argc, char **argv);
+
+/* main-import.c */
+extern int main_import(int argc, char **argv);
+
+/* main-verify.c */
+extern int main_verify(int argc, char **argv);
+
+/* main-batch.c */
+extern int main_batch(int argc, char **argv);
@@ -6,4 +6,5 @@
 
 extern int mkostemp_safe(char *pattern);
 extern void unlink_tempfilep(char (*p)[]);
+extern void unlink_and_free_tempfilep(char **p);
 extern int mkdtemp_malloc(const char *template, char **ret);
@@ -11,15 +11,16 @@
 #include "strv.h"
 
 int
-extension_release_validate(const char *name,
-			   const struct osrelease *host_os_release,
-			   const char *host_extension_scope,
-			   const struct image_deps *extension,
-			   bool verbose)
+extension_release_validate_host(const char *name,
+				const struct osrelease *host_os_release,
+				char *const *host_id_like,
+				const char *host_architecture,
+				const char *host_extension_scope,
+				const struct image_deps *extension,
+				bool verbose)
 {
-  _cleanup_strv_free_ char **id_like_l = NULL;
-
   assert(extension);
+  assert(host_architecture);
 
   if (extension->sysext_scope && host_extension_scope)
     {
@@ -34,11 +35,11 @@ extension_release_validate(const char *name,
   /* When the architecture field is present and not '_any' it must match the host - for now just look at uname but in
    * the future we could check if the kernel also supports 32 bit or binfmt has a translator set up for the architecture */
   if (!isempty(extension->architecture) && !streq(extension->architecture, "_any") &&
-        !streq(architecture_to_string(uname_architecture()), extension->architecture))
+        !streq(host_architecture, extension->architecture))
     {
       if (verbose)
 	printf("Extension '%s' is for architecture '%s', but deployed on top of '%s'.\n",
-	       name, extension->architecture, architecture_to_string(uname_architecture()));
+	       name, extension->architecture, host_architecture);
       return 0;
     }
 
@@ -60,18 +61,7 @@ extension_release_validate(const char *name,
     }
 
   /* Match extension OS ID against host OS ID or ID_LIKE */
-  if (host_os_release->id_like)
-    {
-#if 0 /* XXX */
-      id_like_l = strv_split(host_os_release->id_like, WHITESPACE);
-#else
-      id_like_l = NULL;
-#endif
-      /* XXX if (!id_like_l)
-	 return log_oom(); */
-    }
-
-  if (!streq(host_os_release->id, extension->id) && !strv_contains(id_like_l, extension->id))
+  if (!streq(host_os_release->id, extension->id) && !strv_contains(host_id_like, extension->id))
     {
       if (verbose)
 	printf("Extension '%s' is for OS '%s', but deployed on top of '%s'%s%s%s.\n",
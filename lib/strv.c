@@ -172,11 +172,17 @@ void strv_free_many(char ***strvs, size_t n) {
         free(strvs);
 }
 
+#endif
+
 char** strv_copy_n(char * const *l, size_t m) {
         _cleanup_strv_free_ char **result = NULL;
+        size_t n = strv_length(l);
         char **k;
 
-        result = new(char*, MIN(strv_length(l), m) + 1);
+        if (m < n)
+                n = m;
+
+        result = malloc(sizeof(char*) * (n + 1));
         if (!result)
                 return NULL;
 
@@ -198,6 +204,7 @@ char** strv_copy_n(char * const *l, size_t m) {
         return TAKE_PTR(result);
 }
 
+#if 0
 int strv_copy_unless_empty(char * const *l, char ***ret) {
         assert(ret);
 
@@ -457,6 +464,59 @@ int strv_split_full(char ***t, const char *s, const char *separators, ExtractFla
 }
 #endif
 
+int strv_push_with_size(char ***l, size_t *n, char *value) {
+        /* n is a pointer to a variable to store the size of l.
+         * If not given (i.e. n is NULL or *n is SIZE_MAX), size will be calculated using strv_length().
+         * If n is not NULL, the size after the push will be returned.
+         * If value is empty, no action is taken and *n is not set. */
+
+        if (!value)
+                return 0;
+
+        size_t size = n ? *n : SIZE_MAX;
+        if (size == SIZE_MAX)
+                size = strv_length(*l);
+
+        /* Check for overflow */
+        if (size > SIZE_MAX-2)
+                return -ENOMEM;
+
+        char **c = reallocarray(*l, size + 2, sizeof(char*));
+        if (!c)
+                return -ENOMEM;
+
+        c[size] = value;
+        c[size+1] = NULL;
+
+        *l = c;
+        if (n)
+                *n = size + 1;
+        return 0;
+}
+
+int strv_consume_with_size(char ***l, size_t *n, char *value) {
+        int r;
+
+        r = strv_push_with_size(l, n, value);
+        if (r < 0)
+                free(value);
+
+        return r;
+}
+
+int strv_extend_with_size(char ***l, size_t *n, const char *value) {
+        char *v;
+
+        if (!value)
+                return 0;
+
+        v = strdup(value);
+        if (!v)
+                return -ENOMEM;
+
+        return strv_consume_with_size(l, n, v);
+}
+
 #if 0
 int strv_split_and_extend_full(char ***t, const char *s, const char *separators, bool filter_duplicates, ExtractFlags flags) {
         char **l;
@@ -580,36 +640,6 @@ char* strv_join_full(char * const *l, const char *separator, const char *prefix,
         return r;
 }
 
-int strv_push_with_size(char ***l, size_t *n, char *value) {
-        /* n is a pointer to a variable to store the size of l.
-         * If not given (i.e. n is NULL or *n is SIZE_MAX), size will be calculated using strv_length().
-         * If n is not NULL, the size after the push will be returned.
-         * If value is empty, no action is taken and *n is not set. */
-
-        if (!value)
-                return 0;
-
-        size_t size = n ? *n : SIZE_MAX;
-        if (size == SIZE_MAX)
-                size = strv_length(*l);
-
-        /* Check for overflow */
-        if (size > SIZE_MAX-2)
-                return -ENOMEM;
-
-        char **c = reallocarray(*l, GREEDY_ALLOC_ROUND_UP(size + 2), sizeof(char*));
-        if (!c)
-                return -ENOMEM;
-
-        c[size] = value;
-        c[size+1] = NULL;
-
-        *l = c;
-        if (n)
-                *n = size + 1;
-        return 0;
-}
-
 int strv_push_pair(char ***l, char *a, char *b) {
         char **c;
         size_t n;
@@ -669,16 +699,6 @@ int strv_insert(char ***l, size_t position, char *value) {
         return 0;
 }
 
-int strv_consume_with_size(char ***l, size_t *n, char *value) {
-        int r;
-
-        r = strv_push_with_size(l, n, value);
-        if (r < 0)
-                free(value);
-
-        return r;
-}
-
 int strv_consume_pair(char ***l, char *a, char *b) {
         int r;
 
@@ -714,19 +734,6 @@ int strv_prepend(char ***l, const char *value) {
         return strv_consume_prepend(l, v);
 }
 
-int strv_extend_with_size(char ***l, size_t *n, const char *value) {
-        char *v;
-
-        if (!value)
-                return 0;
-
-        v = strdup(value);
-        if (!v)
-                return -ENOMEM;
-
-        return strv_consume_with_size(l, n, v);
-}
-
 int strv_extend_many_internal(char ***l, const char *value, ...) {
         va_list ap;
         size_t n, m;
@@ -30,6 +30,19 @@ void unlink_tempfilep(char (*p)[]) {
                 (void) unlink(*p);
 }
 
+void unlink_and_free_tempfilep(char **p) {
+        if (!p || !*p)
+                return;
+
+        /* If the file is created with mkstemp(), it will (almost always) change the suffix.
+         * Treat this as a sign that the file was successfully created. We ignore both the rare case
+         * where the original suffix is used and unlink failures. */
+        if (!endswith(*p, ".XXXXXX"))
+                (void) unlink(*p);
+
+        *p = mfree(*p);
+}
+
 int mkdtemp_malloc(const char *template, char **ret) {
         _cleanup_ (freep) char *p = NULL;
 
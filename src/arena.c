@@ -0,0 +1,187 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "basics.h"
+#include "arena.h"
+
+/* large enough for a few hundred image entries */
+#define CHUNK_SIZE (64 * 1024)
+
+struct chunk {
+  struct chunk *next;
+  size_t size;
+  size_t used;
+  alignas(max_align_t) unsigned char data[];
+};
+
+struct cleanup {
+  struct cleanup *next;
+  arena_cleanup_t fn;
+  void *p;
+};
+
+struct arena {
+  struct chunk *chunks;    /* the first one is the current one */
+  struct cleanup *cleanups;
+};
+
+int
+arena_new(struct arena **res)
+{
+  assert(res);
+
+  *res = calloc(1, sizeof(struct arena));
+  if (*res == NULL)
+    return -ENOMEM;
+
+  return 0;
+}
+
+struct arena *
+free_arena(struct arena *a)
+{
+  if (!a)
+    return NULL;
+
+  for (struct cleanup *c = a->cleanups; c; c = c->next)
+    c->fn(c->p);
+
+  while (a->chunks)
+    {
+      struct chunk *next = a->chunks->next;
+      free(a->chunks);
+      a->chunks = next;
+    }
+
+  return mfree(a);
+}
+
+void
+free_arenap(struct arena **a)
+{
+  if (!a || !*a)
+    return;
+
+  *a = free_arena(*a);
+}
+
+void *
+arena_alloc(struct arena *a, size_t size)
+{
+  const size_t align = alignof(max_align_t);
+  struct chunk *c = a->chunks;
+  void *p;
+
+  assert(a);
+
+  size = (size + align - 1) & ~(align - 1);
+  if (size == 0)
+    size = align;
+
+  if (c == NULL || c->size - c->used < size)
+    {
+      /* a large block gets its own chunk, behind the current one
+	 which still has space */
+      size_t n = size > CHUNK_SIZE / 4 ? size : CHUNK_SIZE;
+
+      if (n > SIZE_MAX - sizeof(struct chunk))
+	return NULL;
+      c = calloc(1, sizeof(struct chunk) + n);
+      if (c == NULL)
+	return NULL;
+      c->size = n;
+
+      if (n == size && a->chunks)
+	{
+	  c->next = a->chunks->next;
+	  a->chunks->next = c;
+	}
+      else
+	{
+	  c->next = a->chunks;
+	  a->chunks = c;
+	}
+    }
+
+  p = c->data + c->used;
+  c->used += size;
+
+  return p;
+}
+
+void *
+arena_alloc_array(struct arena *a, size_t n, size_t size)
+{
+  if (size != 0 && n > SIZE_MAX / size)
+    return NULL;
+
+  return arena_alloc(a, n * size);
+}
+
+char *
+arena_strdup(struct arena *a, const char *s)
+{
+  size_t len;
+  char *p;
+
+  if (s == NULL)
+    return NULL;
+
+  len = strlen(s);
+  p = arena_alloc(a, len + 1);
+  if (p)
+    memcpy(p, s, len + 1);
+
+  return p;
+}
+
+char **
+arena_strv_copy(struct arena *a, char *const *l)
+{
+  size_t n = 0;
+  char **r;
+
+  if (l == NULL)
+    return NULL;
+
+  while (l[n])
+    n++;
+
+  r = arena_alloc_array(a, n + 1, sizeof(char *));
+  if (r == NULL)
+    return NULL;
+
+  for (size_t i = 0; i < n; i++)
+    if ((r[i] = arena_strdup(a, l[i])) == NULL)
+      return NULL;
+
+  return r;
+}
+
+int
+arena_add_cleanup(struct arena *a, arena_cleanup_t fn, void *p)
+{
+  struct cleanup *c;
+
+  assert(a);
+  assert(fn);
+
+  c = arena_alloc(a, sizeof(struct cleanup));
+  if (c == NULL)
+    return -ENOMEM;
+
+  c->fn = fn;
+  c->p = p;
+  c->next = a->cleanups;
+  a->cleanups = c;
+
+  return 0;
+}
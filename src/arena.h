@@ -0,0 +1,24 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <stddef.h>
+
+/* Region allocator for data with one common lifetime, e.g. all
+   entries of a catalog. Memory from an arena can not be freed alone,
+   everything gets released with free_arena(). */
+struct arena;
+
+typedef void (*arena_cleanup_t)(void *p);
+
+extern int arena_new(struct arena **res);
+extern struct arena *free_arena(struct arena *a);
+extern void free_arenap(struct arena **a);
+/* returns zeroed memory or NULL */
+extern void *arena_alloc(struct arena *a, size_t size);
+extern void *arena_alloc_array(struct arena *a, size_t n, size_t size);
+extern char *arena_strdup(struct arena *a, const char *s);
+/* copies the string vector including the strings */
+extern char **arena_strv_copy(struct arena *a, char *const *l);
+/* calls fn(p) in free_arena(), e.g. to drop a reference */
+extern int arena_add_cleanup(struct arena *a, arena_cleanup_t fn, void *p);
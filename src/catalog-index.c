@@ -0,0 +1,546 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <search.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "basics.h"
+#include "version-key.h"
+#include "catalog-index.h"
+
+#define INDEX_MAGIC "SXMINDEX"
+/* increase if the layout changes, old files get ignored then */
+#define INDEX_VERSION 1
+
+/* The file is created on one host and read on hosts of all
+   architectures, so all numbers are little endian. Strings are
+   offsets into the file, 0 is NULL, equal strings are stored once.
+   The strings follow the entries. */
+struct index_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t size;
+  uint32_t n_entries;
+  uint32_t entries;
+};
+
+struct index_entry {
+  uint32_t name;
+  uint32_t version_key;
+  uint32_t image_name;
+  uint32_t sysext_version_id;
+  uint32_t sysext_scope;
+  uint32_t id;
+  uint32_t sysext_level;
+  uint32_t version_id;
+  uint32_t architecture;
+};
+
+struct catalog_index {
+  const char *map;
+  size_t size;
+  const struct index_entry *entries;
+  size_t n_entries;
+};
+
+size_t
+image_name_len(const char *fn, size_t len)
+{
+  static const char seps[] = { '.' /* raw */, '.' /* arch */, '-' /* version */ };
+
+  for (size_t i = 0; i < sizeof(seps); i++)
+    {
+      size_t k = len;
+
+      while (k > 0 && fn[k - 1] != seps[i])
+	k--;
+      if (k > 0)
+	len = k - 1;
+    }
+
+  return len;
+}
+
+/* a string of the buffer, s points to the data of the caller */
+struct string {
+  const char *s;
+  uint32_t off;
+};
+
+struct buffer {
+  char *p;
+  size_t n;
+  size_t max;
+  void *strings;  /* tsearch() tree of struct string */
+};
+
+static int
+string_cmp(const void *a, const void *b)
+{
+  const struct string *s_a = a;
+  const struct string *s_b = b;
+
+  return strcmp(s_a->s, s_b->s);
+}
+
+/* returns the offset of the reserved, zeroed space */
+static int
+buffer_reserve(struct buffer *b, size_t size, size_t align, uint32_t *res)
+{
+  size_t off = (b->n + align - 1) & ~(align - 1);
+
+  if (off + size > UINT32_MAX)
+    return -E2BIG;
+
+  if (off + size > b->max)
+    {
+      size_t max = b->max ? b->max : 64 * 1024;
+      char *p;
+
+      while (max < off + size)
+	max *= 2;
+
+      p = realloc(b->p, max);
+      if (p == NULL)
+	return -ENOMEM;
+      b->p = p;
+      b->max = max;
+    }
+
+  memset(b->p + b->n, 0, off + size - b->n);
+  b->n = off + size;
+  *res = (uint32_t) off;
+
+  return 0;
+}
+
+static int
+buffer_add_string(struct buffer *b, const char *s, uint32_t *res)
+{
+  struct string key = { .s = s }, *new, **found;
+  uint32_t off;
+  int r;
+
+  *res = 0;
+  if (s == NULL)
+    return 0;
+
+  found = tfind(&key, &b->strings, string_cmp);
+  if (found)
+    {
+      *res = htole32((*found)->off);
+      return 0;
+    }
+
+  r = buffer_reserve(b, strlen(s) + 1, 1, &off);
+  if (r < 0)
+    return r;
+  strcpy(b->p + off, s);
+
+  new = malloc(sizeof(struct string));
+  if (new == NULL)
+    return -ENOMEM;
+  *new = (struct string) { s, off };
+  if (tsearch(new, &b->strings, string_cmp) == NULL)
+    {
+      free(new);
+      return -ENOMEM;
+    }
+
+  *res = htole32(off);
+
+  return 0;
+}
+
+/* image with its sort keys */
+struct item {
+  const struct image_deps *deps;
+  char *name;
+  char *version_key;
+};
+
+static int
+item_cmp(const void *a, const void *b)
+{
+  const struct item *i_a = a;
+  const struct item *i_b = b;
+  int r;
+
+  r = strcmp(i_a->name, i_b->name);
+  if (r == 0)
+    r = strcmp(strempty(i_a->version_key), strempty(i_b->version_key));
+  if (r == 0)
+    r = strcmp(i_a->deps->image_name, i_b->deps->image_name);
+
+  return r;
+}
+
+static void
+free_items(struct item *items, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    {
+      free(items[i].name);
+      free(items[i].version_key);
+    }
+  free(items);
+}
+
+/* The buffer can move, so entries are addressed by their offset */
+#define ENTRY(b, off) ((struct index_entry *) ((b)->p + (off)))
+#define HEADER(b) ((struct index_header *) (b)->p)
+
+#define ADD_STRING(b, off, f, s)				\
+  do {								\
+    uint32_t o_;						\
+    r = buffer_add_string(b, s, &o_);				\
+    if (r < 0)							\
+      return r;							\
+    ENTRY(b, off)->f = o_;					\
+  } while (0)
+
+static int
+build_index(struct buffer *b, const struct item *items, size_t n)
+{
+  uint32_t off, entries;
+  int r;
+
+  if (n > UINT32_MAX / sizeof(struct index_entry))
+    return -E2BIG;
+
+  r = buffer_reserve(b, sizeof(struct index_header), 8, &off);
+  if (r < 0)
+    return r;
+  r = buffer_reserve(b, n * sizeof(struct index_entry), 8, &entries);
+  if (r < 0)
+    return r;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      const struct image_deps *d = items[i].deps;
+      uint32_t e = entries + i * sizeof(struct index_entry);
+
+      ADD_STRING(b, e, name, items[i].name);
+      ADD_STRING(b, e, version_key, items[i].version_key);
+      ADD_STRING(b, e, image_name, d->image_name);
+      ADD_STRING(b, e, sysext_version_id, d->sysext_version_id);
+      ADD_STRING(b, e, sysext_scope, d->sysext_scope);
+      ADD_STRING(b, e, id, d->id);
+      ADD_STRING(b, e, sysext_level, d->sysext_level);
+      ADD_STRING(b, e, version_id, d->version_id);
+      ADD_STRING(b, e, architecture, d->architecture);
+    }
+
+  memcpy(HEADER(b)->magic, INDEX_MAGIC, sizeof(HEADER(b)->magic));
+  HEADER(b)->version = htole32(INDEX_VERSION);
+  HEADER(b)->size = htole32(b->n);
+  HEADER(b)->n_entries = htole32(n);
+  HEADER(b)->entries = htole32(entries);
+
+  return 0;
+}
+
+/* Entries without image name can not be found and are left out */
+int
+catalog_index_write(int fd, struct image_deps *const *images)
+{
+  struct buffer b = { NULL, 0, 0, NULL };
+  struct item *items;
+  size_t n = 0, max = 0;
+  int r = 0;
+
+  assert(fd >= 0);
+
+  while (images && images[max])
+    max++;
+
+  items = calloc(max + 1, sizeof(struct item));
+  if (items == NULL)
+    return -ENOMEM;
+
+  for (size_t i = 0; i < max && r >= 0; i++)
+    {
+      const struct image_deps *d = images[i];
+      struct item *it = &items[n];
+
+      if (d->image_name == NULL)
+	continue;
+      n++;
+
+      it->deps = d;
+      it->name = strndup(d->image_name,
+			 image_name_len(d->image_name, strlen(d->image_name)));
+      if (it->name == NULL)
+	r = -ENOMEM;
+      else if (d->sysext_version_id)
+	r = version_key_new(d->sysext_version_id, &it->version_key);
+    }
+  if (r < 0)
+    {
+      free_items(items, n);
+      return r;
+    }
+
+  if (n > 1)
+    qsort(items, n, sizeof(struct item), item_cmp);
+
+  r = build_index(&b, items, n);
+  free_items(items, n);
+  tdestroy(b.strings, free);
+
+  for (size_t done = 0; r >= 0 && done < b.n;)
+    {
+      ssize_t k = write(fd, b.p + done, b.n - done);
+      if (k < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  r = -errno;
+	  break;
+	}
+      done += k;
+    }
+  free(b.p);
+
+  return r < 0 ? r : 0;
+}
+
+struct catalog_index *
+free_catalog_index(struct catalog_index *idx)
+{
+  if (!idx)
+    return NULL;
+
+  if (idx->map)
+    (void) munmap((void *) idx->map, idx->size);
+
+  return mfree(idx);
+}
+
+void
+free_catalog_indexp(struct catalog_index **idx)
+{
+  if (!idx || !*idx)
+    return;
+
+  *idx = free_catalog_index(*idx);
+}
+
+/* Only the header gets checked here, the entries are read when they
+   are used. A file which is no index is -EBADMSG. */
+int
+catalog_index_open(int fd, struct catalog_index **res)
+{
+  _cleanup_(free_catalog_indexp) struct catalog_index *idx = NULL;
+  const struct index_header *h;
+  uint32_t entries;
+  struct stat sb;
+  void *map;
+
+  assert(fd >= 0);
+  assert(res);
+
+  if (fstat(fd, &sb) < 0)
+    return -errno;
+
+  if (!S_ISREG(sb.st_mode) || (size_t) sb.st_size < sizeof(struct index_header) ||
+      (uint64_t) sb.st_size > UINT32_MAX)
+    return -EBADMSG;
+
+  map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+    return -errno;
+
+  idx = calloc(1, sizeof(struct catalog_index));
+  if (idx == NULL)
+    {
+      (void) munmap(map, sb.st_size);
+      return -ENOMEM;
+    }
+  idx->map = map;
+  idx->size = sb.st_size;
+
+  h = (const struct index_header *) idx->map;
+  if (memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) != 0)
+    return -EBADMSG;
+  if (le32toh(h->version) != INDEX_VERSION || le32toh(h->size) != idx->size)
+    return -EPROTO;
+
+  entries = le32toh(h->entries);
+  idx->n_entries = le32toh(h->n_entries);
+  if (entries % 8 != 0 || entries < sizeof(struct index_header) ||
+      entries > idx->size ||
+      idx->n_entries > (idx->size - entries) / sizeof(struct index_entry))
+    return -EBADMSG;
+  idx->entries = (const struct index_entry *) (idx->map + entries);
+
+  *res = TAKE_PTR(idx);
+
+  return 0;
+}
+
+size_t
+catalog_index_entries(const struct catalog_index *idx)
+{
+  assert(idx);
+
+  return idx->n_entries;
+}
+
+/* 0 is NULL, everything else needs to be a string inside the file */
+static int
+index_string(const struct catalog_index *idx, uint32_t off, const char **res)
+{
+  off = le32toh(off);
+
+  *res = NULL;
+  if (off == 0)
+    return 0;
+
+  if (off < sizeof(struct index_header) || off >= idx->size ||
+      memchr(idx->map + off, 0, idx->size - off) == NULL)
+    return -EBADMSG;
+
+  *res = idx->map + off;
+
+  return 0;
+}
+
+static int
+index_strdup(const struct catalog_index *idx, uint32_t off, char **res)
+{
+  const char *s;
+  int r;
+
+  r = index_string(idx, off, &s);
+  if (r < 0)
+    return r;
+
+  *res = NULL;
+  if (s == NULL)
+    return 0;
+
+  *res = strdup(s);
+  if (*res == NULL)
+    return -ENOMEM;
+
+  return 0;
+}
+
+#define INDEX_STRDUP(idx, f, v)				\
+  if ((r = index_strdup(idx, v, &(f))) < 0)		\
+    return r
+
+int
+catalog_index_get(const struct catalog_index *idx, size_t i,
+		  struct image_deps **res)
+{
+  _cleanup_(free_image_depsp) struct image_deps *d = NULL;
+  const struct index_entry *e;
+  int r;
+
+  assert(idx);
+  assert(i < idx->n_entries);
+  assert(res);
+
+  e = &idx->entries[i];
+
+  d = calloc(1, sizeof(struct image_deps));
+  if (d == NULL)
+    return -ENOMEM;
+
+  INDEX_STRDUP(idx, d->image_name, e->image_name);
+  INDEX_STRDUP(idx, d->sysext_version_id, e->sysext_version_id);
+  INDEX_STRDUP(idx, d->sysext_scope, e->sysext_scope);
+  INDEX_STRDUP(idx, d->id, e->id);
+  INDEX_STRDUP(idx, d->sysext_level, e->sysext_level);
+  INDEX_STRDUP(idx, d->version_id, e->version_id);
+  INDEX_STRDUP(idx, d->architecture, e->architecture);
+
+  if (d->image_name == NULL)
+    return -EBADMSG;
+
+  *res = TAKE_PTR(d);
+
+  return 0;
+}
+
+/* name of entry i compared with the first len bytes of key */
+static int
+entry_name_cmp(const struct catalog_index *idx, size_t i, const char *key,
+	       size_t len, int *res)
+{
+  const char *name;
+  int r;
+
+  r = index_string(idx, idx->entries[i].name, &name);
+  if (r < 0)
+    return r;
+  if (name == NULL)
+    return -EBADMSG;
+
+  *res = strncmp(name, key, len);
+  if (*res == 0 && name[len] != '\0')
+    *res = 1;
+
+  return 0;
+}
+
+int
+catalog_index_lookup(const struct catalog_index *idx, const char *image_name,
+		     size_t name_len, struct image_deps **res)
+{
+  size_t lo = 0, hi;
+  int r, cmp;
+
+  assert(idx);
+  assert(image_name);
+  assert(res);
+
+  *res = NULL;
+
+  /* the first version of the name, then the versions in order */
+  hi = idx->n_entries;
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      r = entry_name_cmp(idx, mid, image_name, name_len, &cmp);
+      if (r < 0)
+	return r;
+      if (cmp < 0)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  for (size_t i = lo; i < idx->n_entries; i++)
+    {
+      const char *s;
+
+      r = entry_name_cmp(idx, i, image_name, name_len, &cmp);
+      if (r < 0)
+	return r;
+      if (cmp != 0)
+	break;
+
+      r = index_string(idx, idx->entries[i].image_name, &s);
+      if (r < 0)
+	return r;
+      if (s && streq(s, image_name))
+	{
+	  r = catalog_index_get(idx, i, res);
+	  if (r < 0)
+	    return r;
+	  return 1;
+	}
+    }
+
+  return 0;
+}
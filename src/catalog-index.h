@@ -0,0 +1,32 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <stddef.h>
+
+#include "image-deps.h"
+
+/* Binary form of sysext-deps.json for big repositories, created by
+   "sysextmgrcli merge-json -o sysext-deps.idx". The file is mapped
+   and searched without parsing it. Entries are sorted by the name
+   of the image and the version key. */
+#define CATALOG_INDEX "sysext-deps.idx"
+
+struct catalog_index;
+
+extern int catalog_index_write(int fd, struct image_deps *const *images);
+extern int catalog_index_open(int fd, struct catalog_index **res);
+extern struct catalog_index *free_catalog_index(struct catalog_index *idx);
+extern void free_catalog_indexp(struct catalog_index **idx);
+extern size_t catalog_index_entries(const struct catalog_index *idx);
+extern int catalog_index_get(const struct catalog_index *idx, size_t i,
+		struct image_deps **res);
+/* name_len is image_name_len() of image_name. Returns 0 if the image
+   is not in the index, else 1 and a copy of the entry in res. */
+extern int catalog_index_lookup(const struct catalog_index *idx,
+		const char *image_name, size_t name_len,
+		struct image_deps **res);
+
+/* length of "debug-tools" in "debug-tools-23.7.x86-64.raw", the
+   first len bytes of fn are the file name */
+extern size_t image_name_len(const char *fn, size_t len);
@@ -0,0 +1,663 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "basics.h"
+#include "mkdir_p.h"
+#include "tmpfile-util.h"
+#include "catalog-state.h"
+#include "log_msg.h"
+
+#define STATE_MAGIC "SXMSTATE"
+/* increase if the layout changes, old files get ignored then */
+#define STATE_VERSION 3
+/* a file written on a host with another byte order is ignored */
+#define STATE_BYTE_ORDER 0x01020304U
+
+#define STATE_REMOTE_VALID     (1U << 0)
+#define STATE_LOCAL_VALID      (1U << 1)
+#define STATE_VERIFY_SIGNATURE (1U << 2)
+#define STATE_REMOTE_LAZY      (1U << 3)
+
+#define ENTRY_REMOTE     (1U << 0)
+#define ENTRY_LOCAL      (1U << 1)
+#define ENTRY_INSTALLED  (1U << 2)
+#define ENTRY_COMPATIBLE (1U << 3)
+
+/* All strings are offsets into the file, 0 is NULL. The entries of
+   the remote images come first, followed by the local ones. Strings
+   and the delta lists (count followed by the offsets) come after the
+   entries. */
+struct state_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t size;
+  uint64_t remote_time;
+  uint32_t flags;
+  uint32_t host;
+  uint32_t url;
+  uint32_t store;
+  uint32_t store_validator;
+  uint32_t n_remote;
+  uint32_t n_local;
+  uint32_t entries;
+};
+
+struct state_entry {
+  uint32_t name;
+  uint32_t image_name;
+  uint32_t sysext_version_id;
+  uint32_t sysext_scope;
+  uint32_t id;
+  uint32_t sysext_level;
+  uint32_t version_id;
+  uint32_t architecture;
+  uint32_t sha256;
+  uint32_t version_key;
+  uint32_t repository;
+  uint32_t validator;
+  uint32_t deltas;
+  uint32_t flags;
+};
+
+struct catalog_state {
+  unsigned n_ref;
+  const char *map;
+  size_t size;
+  struct catalog_state_data data;
+};
+
+struct buffer {
+  char *p;
+  size_t n;
+  size_t max;
+};
+
+/* returns the offset of the reserved, zeroed space */
+static int
+buffer_reserve(struct buffer *b, size_t size, size_t align, uint32_t *res)
+{
+  size_t off = (b->n + align - 1) & ~(align - 1);
+
+  if (off + size > UINT32_MAX)
+    return -E2BIG;
+
+  if (off + size > b->max)
+    {
+      size_t max = b->max ? b->max : 64 * 1024;
+      char *p;
+
+      while (max < off + size)
+	max *= 2;
+
+      p = realloc(b->p, max);
+      if (p == NULL)
+	return -ENOMEM;
+      b->p = p;
+      b->max = max;
+    }
+
+  memset(b->p + b->n, 0, off + size - b->n);
+  b->n = off + size;
+  *res = (uint32_t) off;
+
+  return 0;
+}
+
+static int
+buffer_add_string(struct buffer *b, const char *s, uint32_t *res)
+{
+  int r;
+
+  *res = 0;
+  if (s == NULL)
+    return 0;
+
+  r = buffer_reserve(b, strlen(s) + 1, 1, res);
+  if (r < 0)
+    return r;
+
+  strcpy(b->p + *res, s);
+
+  return 0;
+}
+
+/* The buffer can move, so entries are addressed by their offset */
+#define ENTRY(b, off) ((struct state_entry *) ((b)->p + (off)))
+
+#define ADD_STRING(b, off, f, s)				\
+  do {								\
+    uint32_t o_;						\
+    r = buffer_add_string(b, s, &o_);				\
+    if (r < 0)							\
+      return r;							\
+    ENTRY(b, off)->f = o_;					\
+  } while (0)
+
+static int
+add_deltas(struct buffer *b, char *const *deltas, uint32_t *res)
+{
+  uint32_t n = 0, list;
+  int r;
+
+  *res = 0;
+  if (deltas == NULL)
+    return 0;
+
+  while (deltas[n])
+    n++;
+
+  r = buffer_reserve(b, (n + 1) * sizeof(uint32_t), sizeof(uint32_t), &list);
+  if (r < 0)
+    return r;
+  ((uint32_t *) (b->p + list))[0] = n;
+
+  for (uint32_t i = 0; i < n; i++)
+    {
+      uint32_t s;
+
+      r = buffer_add_string(b, deltas[i], &s);
+      if (r < 0)
+	return r;
+      ((uint32_t *) (b->p + list))[i + 1] = s;
+    }
+
+  *res = list;
+
+  return 0;
+}
+
+static int
+add_entry(struct buffer *b, uint32_t off, const struct image_entry *e,
+	  const char *validator)
+{
+  uint32_t deltas;
+  int r;
+
+  ADD_STRING(b, off, name, e->name);
+  ADD_STRING(b, off, image_name, e->deps->image_name);
+  ADD_STRING(b, off, sysext_version_id, e->deps->sysext_version_id);
+  ADD_STRING(b, off, sysext_scope, e->deps->sysext_scope);
+  ADD_STRING(b, off, id, e->deps->id);
+  ADD_STRING(b, off, sysext_level, e->deps->sysext_level);
+  ADD_STRING(b, off, version_id, e->deps->version_id);
+  ADD_STRING(b, off, architecture, e->deps->architecture);
+  ADD_STRING(b, off, sha256, e->sha256);
+  ADD_STRING(b, off, version_key, e->version_key);
+  ADD_STRING(b, off, repository, e->repository);
+  ADD_STRING(b, off, validator, validator);
+
+  r = add_deltas(b, e->deltas, &deltas);
+  if (r < 0)
+    return r;
+  ENTRY(b, off)->deltas = deltas;
+
+  ENTRY(b, off)->flags = (e->remote ? ENTRY_REMOTE : 0) |
+    (e->local ? ENTRY_LOCAL : 0) | (e->installed ? ENTRY_INSTALLED : 0) |
+    (e->compatible ? ENTRY_COMPATIBLE : 0);
+
+  return 0;
+}
+
+#define HEADER(b) ((struct state_header *) (b)->p)
+
+static int
+build_state(struct buffer *b, const struct catalog_state_data *d)
+{
+  size_t n_remote = d->remote_valid ? d->n_remote : 0;
+  size_t n_local = d->local_valid ? d->n_local : 0;
+  uint32_t off, entries, s;
+  int r;
+
+  if (n_remote + n_local > UINT32_MAX / sizeof(struct state_entry))
+    return -E2BIG;
+
+  r = buffer_reserve(b, sizeof(struct state_header), 8, &off);
+  if (r < 0)
+    return r;
+  r = buffer_reserve(b, (n_remote + n_local) * sizeof(struct state_entry),
+		     8, &entries);
+  if (r < 0)
+    return r;
+
+  memcpy(HEADER(b)->magic, STATE_MAGIC, sizeof(HEADER(b)->magic));
+  HEADER(b)->version = STATE_VERSION;
+  HEADER(b)->byte_order = STATE_BYTE_ORDER;
+  HEADER(b)->remote_time = d->remote_time;
+  HEADER(b)->flags = (d->remote_valid ? STATE_REMOTE_VALID : 0) |
+    (d->local_valid ? STATE_LOCAL_VALID : 0) |
+    (d->verify_signature ? STATE_VERIFY_SIGNATURE : 0) |
+    (d->remote_lazy ? STATE_REMOTE_LAZY : 0);
+  HEADER(b)->n_remote = n_remote;
+  HEADER(b)->n_local = n_local;
+  HEADER(b)->entries = entries;
+
+#define ADD_HEADER_STRING(f, v)			\
+  r = buffer_add_string(b, v, &s);		\
+  if (r < 0)					\
+    return r;					\
+  HEADER(b)->f = s
+
+  ADD_HEADER_STRING(host, d->host);
+  ADD_HEADER_STRING(url, d->url);
+  ADD_HEADER_STRING(store, d->store);
+  ADD_HEADER_STRING(store_validator, d->store_validator);
+#undef ADD_HEADER_STRING
+
+  for (size_t i = 0; i < n_remote + n_local; i++)
+    {
+      const struct image_entry *e;
+      const char *validator = NULL;
+
+      if (i < n_remote)
+	e = d->remote[i];
+      else
+	{
+	  e = d->local[i - n_remote];
+	  validator = d->local_validators[i - n_remote];
+	}
+
+      r = add_entry(b, entries + i * sizeof(struct state_entry), e, validator);
+      if (r < 0)
+	return r;
+    }
+
+  HEADER(b)->size = b->n;
+
+  return 0;
+}
+
+/* Write the file atomically, readers keep their old mapping */
+int
+catalog_state_write(const char *fn, const struct catalog_state_data *d)
+{
+  _cleanup_(unlink_and_free_tempfilep) char *tmpfn = NULL;
+  _cleanup_free_ char *dir = NULL;
+  _cleanup_close_ int fd = -EBADF;
+  struct buffer b = { NULL, 0, 0 };
+  int r;
+
+  assert(fn);
+  assert(d);
+  assert(d->host);
+
+  r = build_state(&b, d);
+  if (r < 0)
+    {
+      free(b.p);
+      return r;
+    }
+
+  dir = strdup(fn);
+  if (dir == NULL)
+    {
+      free(b.p);
+      return -ENOMEM;
+    }
+
+  r = mkdir_p(dirname(dir), 0755);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Failed to create directory for '%s': %s",
+	      fn, strerror(-r));
+      free(b.p);
+      return r;
+    }
+
+  if (asprintf(&tmpfn, "%s.XXXXXX", fn) < 0)
+    {
+      tmpfn = NULL;
+      free(b.p);
+      return -ENOMEM;
+    }
+
+  fd = mkostemp_safe(tmpfn);
+  if (fd < 0)
+    {
+      log_msg(LOG_ERR, "Failed to create temporary file '%s': %s",
+	      tmpfn, strerror(-fd));
+      free(b.p);
+      return fd;
+    }
+
+  /* the content is not secret and read by unprivileged clients */
+  if (fchmod(fd, 0644) < 0)
+    {
+      free(b.p);
+      return -errno;
+    }
+
+  for (size_t done = 0; done < b.n;)
+    {
+      ssize_t n = write(fd, b.p + done, b.n - done);
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  r = -errno;
+	  free(b.p);
+	  return r;
+	}
+      done += n;
+    }
+  free(b.p);
+
+  /* a crash after the rename must not leave a torn state file */
+  if (fsync(fd) < 0)
+    {
+      r = -errno;
+      log_msg(LOG_ERR, "Failed to sync '%s': %s", tmpfn, strerror(-r));
+      return r;
+    }
+
+  if (rename(tmpfn, fn) < 0)
+    {
+      r = -errno;
+      log_msg(LOG_ERR, "Failed to rename '%s' to '%s': %s",
+	      tmpfn, fn, strerror(-r));
+      return r;
+    }
+  tmpfn = mfree(tmpfn);
+
+  return 0;
+}
+
+struct catalog_state *
+catalog_state_ref(struct catalog_state *st)
+{
+  if (st)
+    st->n_ref++;
+
+  return st;
+}
+
+struct catalog_state *
+catalog_state_unref(struct catalog_state *st)
+{
+  if (!st)
+    return NULL;
+
+  assert(st->n_ref > 0);
+
+  if (--st->n_ref > 0)
+    return NULL;
+
+  if (st->map)
+    (void) munmap((void *) st->map, st->size);
+
+  return mfree(st);
+}
+
+void
+catalog_state_unrefp(struct catalog_state **st)
+{
+  if (!st || !*st)
+    return;
+
+  *st = catalog_state_unref(*st);
+}
+
+/* 0 is NULL, everything else needs to be a string inside the file */
+static int
+state_string(const struct catalog_state *st, uint32_t off, const char **res)
+{
+  *res = NULL;
+  if (off == 0)
+    return 0;
+
+  if (off < sizeof(struct state_header) || off >= st->size ||
+      memchr(st->map + off, 0, st->size - off) == NULL)
+    return -EBADMSG;
+
+  *res = st->map + off;
+
+  return 0;
+}
+
+/* Only the header gets checked here, the entries are read when they
+   are used. A missing file is no error, *res is NULL then. */
+int
+catalog_state_open(const char *fn, struct catalog_state **res)
+{
+  _cleanup_(catalog_state_unrefp) struct catalog_state *st = NULL;
+  _cleanup_close_ int fd = -EBADF;
+  const struct state_header *h;
+  struct stat sb;
+  void *map;
+  int r;
+
+  assert(fn);
+  assert(res);
+
+  *res = NULL;
+
+  fd = open(fn, O_RDONLY|O_CLOEXEC);
+  if (fd < 0)
+    {
+      if (errno == ENOENT)
+	return 0;
+      return -errno;
+    }
+
+  if (fstat(fd, &sb) < 0)
+    return -errno;
+
+  if (!S_ISREG(sb.st_mode) || (size_t) sb.st_size < sizeof(struct state_header) ||
+      (uint64_t) sb.st_size > UINT32_MAX)
+    return -EBADMSG;
+
+  map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+    return -errno;
+
+  st = calloc(1, sizeof(struct catalog_state));
+  if (st == NULL)
+    {
+      (void) munmap(map, sb.st_size);
+      return -ENOMEM;
+    }
+  st->n_ref = 1;
+  st->map = map;
+  st->size = sb.st_size;
+
+  h = (const struct state_header *) st->map;
+  if (memcmp(h->magic, STATE_MAGIC, sizeof(h->magic)) != 0 ||
+      h->version != STATE_VERSION || h->byte_order != STATE_BYTE_ORDER ||
+      h->size != st->size)
+    return -EPROTO;
+
+  if (h->entries % 8 != 0 || h->entries < sizeof(struct state_header) ||
+      h->entries > st->size ||
+      (uint64_t) h->n_remote + h->n_local >
+      (st->size - h->entries) / sizeof(struct state_entry))
+    return -EBADMSG;
+
+  if ((r = state_string(st, h->host, &st->data.host)) < 0 ||
+      (r = state_string(st, h->url, &st->data.url)) < 0 ||
+      (r = state_string(st, h->store, &st->data.store)) < 0 ||
+      (r = state_string(st, h->store_validator, &st->data.store_validator)) < 0)
+    return r;
+
+  if (st->data.host == NULL)
+    return -EBADMSG;
+
+  st->data.remote_valid = h->flags & STATE_REMOTE_VALID;
+  st->data.local_valid = h->flags & STATE_LOCAL_VALID;
+  st->data.verify_signature = h->flags & STATE_VERIFY_SIGNATURE;
+  st->data.remote_lazy = h->flags & STATE_REMOTE_LAZY;
+  st->data.remote_time = h->remote_time;
+  st->data.n_remote = h->n_remote;
+  st->data.n_local = h->n_local;
+
+  *res = TAKE_PTR(st);
+
+  return 0;
+}
+
+const struct catalog_state_data *
+catalog_state_data(const struct catalog_state *st)
+{
+  assert(st);
+
+  return &st->data;
+}
+
+static int
+state_deltas(const struct catalog_state *st, struct arena *a, uint32_t off,
+	     char ***res)
+{
+  const uint32_t *list;
+  char **deltas;
+
+  *res = NULL;
+  if (off == 0)
+    return 0;
+
+  if (off % sizeof(uint32_t) != 0 || off < sizeof(struct state_header) ||
+      off > st->size - sizeof(uint32_t))
+    return -EBADMSG;
+
+  list = (const uint32_t *) (st->map + off);
+  if (list[0] > (st->size - off) / sizeof(uint32_t) - 1)
+    return -EBADMSG;
+
+  deltas = arena_alloc_array(a, list[0] + 1, sizeof(char *));
+  if (deltas == NULL)
+    return -ENOMEM;
+
+  for (uint32_t i = 0; i < list[0]; i++)
+    {
+      int r = state_string(st, list[i + 1], (const char **) &deltas[i]);
+      if (r < 0)
+	return r;
+      if (deltas[i] == NULL)
+	return -EBADMSG;
+    }
+
+  *res = deltas;
+
+  return 0;
+}
+
+#define STATE_STRING(st, f, v)					\
+  if ((r = state_string(st, v, (const char **) &(f))) < 0)	\
+    return r
+
+static int
+state_entry(const struct catalog_state *st, struct arena *a,
+	    const struct state_entry *s, struct image_entry **res,
+	    const char **validator)
+{
+  struct image_entry *e;
+  int r;
+
+  e = arena_alloc(a, sizeof(struct image_entry));
+  if (e == NULL)
+    return -ENOMEM;
+  e->deps = arena_alloc(a, sizeof(struct image_deps));
+  if (e->deps == NULL)
+    return -ENOMEM;
+
+  STATE_STRING(st, e->name, s->name);
+  STATE_STRING(st, e->deps->image_name, s->image_name);
+  STATE_STRING(st, e->deps->sysext_version_id, s->sysext_version_id);
+  STATE_STRING(st, e->deps->sysext_scope, s->sysext_scope);
+  STATE_STRING(st, e->deps->id, s->id);
+  STATE_STRING(st, e->deps->sysext_level, s->sysext_level);
+  STATE_STRING(st, e->deps->version_id, s->version_id);
+  STATE_STRING(st, e->deps->architecture, s->architecture);
+  STATE_STRING(st, e->sha256, s->sha256);
+  STATE_STRING(st, e->version_key, s->version_key);
+  STATE_STRING(st, e->repository, s->repository);
+  STATE_STRING(st, *validator, s->validator);
+  r = state_deltas(st, a, s->deltas, &e->deltas);
+  if (r < 0)
+    return r;
+
+  /* catalogs can not index entries without them */
+  if (e->name == NULL || e->deps->image_name == NULL)
+    return -EBADMSG;
+
+  e->remote = s->flags & ENTRY_REMOTE;
+  e->local = s->flags & ENTRY_LOCAL;
+  e->installed = s->flags & ENTRY_INSTALLED;
+  e->compatible = s->flags & ENTRY_COMPATIBLE;
+
+  *res = e;
+
+  return 0;
+}
+
+static void
+state_unref(void *p)
+{
+  catalog_state_unref(p);
+}
+
+int
+catalog_state_images(struct catalog_state *st, bool local, struct arena *a,
+		     struct image_entry ***images, const char ***validators,
+		     size_t *n)
+{
+  const struct state_header *h = (const struct state_header *) st->map;
+  const struct state_entry *entries;
+  struct image_entry **l;
+  const char **v = NULL;
+  size_t first, count;
+  int r;
+
+  assert(st);
+  assert(a);
+  assert(images);
+  assert(n);
+
+  entries = (const struct state_entry *) (st->map + h->entries);
+  first = local ? h->n_remote : 0;
+  count = local ? h->n_local : h->n_remote;
+
+  l = arena_alloc_array(a, count + 1, sizeof(struct image_entry *));
+  if (l == NULL)
+    return -ENOMEM;
+  if (validators)
+    {
+      v = arena_alloc_array(a, count + 1, sizeof(char *));
+      if (v == NULL)
+	return -ENOMEM;
+    }
+
+  for (size_t i = 0; i < count; i++)
+    {
+      const char *validator = NULL;
+
+      r = state_entry(st, a, &entries[first + i], &l[i], &validator);
+      if (r < 0)
+	return r;
+      if (v)
+	v[i] = validator;
+    }
+
+  /* the strings stay in the mapping */
+  r = arena_add_cleanup(a, state_unref, catalog_state_ref(st));
+  if (r < 0)
+    {
+      catalog_state_unref(st);
+      return r;
+    }
+
+  *images = l;
+  if (validators)
+    *validators = v;
+  *n = count;
+
+  return 0;
+}
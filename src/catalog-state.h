@@ -0,0 +1,50 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "image-deps.h"
+#include "arena.h"
+
+/* Snapshot of the resident image data, written by sysextmgrd on exit
+   and mapped again at the next start. The file is only ever replaced
+   as a whole, so the mapping stays valid. The entries are not
+   checked when the file is opened, the caller validates the parts
+   before using them. */
+struct catalog_state;
+
+/* Header data of a state file. For catalog_state_write() the images
+   and the validators of the local images are set, too. */
+struct catalog_state_data {
+  const char *host;             /* host_profile_fingerprint() */
+  bool remote_valid;
+  const char *url;               /* the repositories of the remote data */
+  bool verify_signature;
+  bool remote_lazy;              /* not all remote images have metadata */
+  uint64_t remote_time;          /* CLOCK_REALTIME of the fetch */
+  struct image_entry *const *remote;
+  size_t n_remote;
+  bool local_valid;
+  const char *store;
+  const char *store_validator;  /* stat_to_validator() of store */
+  struct image_entry *const *local;
+  char *const *local_validators;
+  size_t n_local;
+};
+
+extern int catalog_state_write(const char *fn,
+		const struct catalog_state_data *d);
+extern int catalog_state_open(const char *fn, struct catalog_state **res);
+extern struct catalog_state *catalog_state_ref(struct catalog_state *st);
+extern struct catalog_state *catalog_state_unref(struct catalog_state *st);
+extern void catalog_state_unrefp(struct catalog_state **st);
+extern const struct catalog_state_data *catalog_state_data(
+		const struct catalog_state *st);
+/* The entries get allocated from a, their strings point into the
+   mapping, which a keeps referenced. validators is optional, it is
+   only set for the local images. */
+extern int catalog_state_images(struct catalog_state *st, bool local,
+		struct arena *a, struct image_entry ***images,
+		const char ***validators, size_t *n);
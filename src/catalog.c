@@ -0,0 +1,1270 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "basics.h"
+#include "image-deps.h"
+#include "strv.h"
+#include "images-list.h"
+#include "catalog.h"
+#include "catalog-state.h"
+#include "download.h"
+#include "metadata-cache.h"
+#include "metrics.h"
+#include "mirror.h"
+#include "version-key.h"
+#include "arena.h"
+#include "log_msg.h"
+
+void
+free_catalog(struct catalog *c)
+{
+  if (!c)
+    return;
+
+  free_arenap(&c->arena);
+  c->images = NULL;
+  c->n_images = 0;
+  c->names = NULL;
+  c->n_names = 0;
+  c->by_image_name = NULL;
+  c->by_name = NULL;
+  c->n_slots = 0;
+}
+
+struct catalog *
+catalog_ref(struct catalog *c)
+{
+  if (c)
+    c->n_ref++;
+
+  return c;
+}
+
+struct catalog *
+catalog_unref(struct catalog *c)
+{
+  if (!c)
+    return NULL;
+
+  assert(c->n_ref > 0);
+
+  if (--c->n_ref > 0)
+    return NULL;
+
+  free_catalog(c);
+  return mfree(c);
+}
+
+void
+free_catalogp(struct catalog **c)
+{
+  if (!c || !*c)
+    return;
+
+  *c = catalog_unref(*c);
+}
+
+/* FNV-1a */
+static size_t
+hash_string(const char *s)
+{
+  uint64_t h = 14695981039346656037ULL;
+
+  for (; *s; s++)
+    {
+      h ^= (unsigned char) *s;
+      h *= 1099511628211ULL;
+    }
+
+  return (size_t) h;
+}
+
+static const char *
+image_key(const struct catalog *c, size_t i)
+{
+  return c->images[i]->deps->image_name;
+}
+
+static const char *
+name_key(const struct catalog *c, size_t i)
+{
+  return c->names[i].name;
+}
+
+/* Returns the slot of key, which is either empty or contains it */
+static size_t *
+hash_slot(const struct catalog *c, size_t *table,
+	  const char *(*key)(const struct catalog *, size_t),
+	  const char *k)
+{
+  size_t mask = c->n_slots - 1;
+
+  for (size_t i = hash_string(k) & mask;; i = (i + 1) & mask)
+    if (table[i] == 0 || streq(key(c, table[i] - 1), k))
+      return &table[i];
+}
+
+struct image_entry *
+catalog_find_image(const struct catalog *c, const char *image_name)
+{
+  size_t *slot;
+
+  assert(c);
+  assert(image_name);
+
+  if (c->n_slots == 0)
+    return NULL;
+
+  slot = hash_slot(c, c->by_image_name, image_key, image_name);
+  if (*slot == 0)
+    return NULL;
+
+  return c->images[*slot - 1];
+}
+
+const struct catalog_name *
+catalog_find_name(const struct catalog *c, const char *name)
+{
+  size_t *slot;
+
+  assert(c);
+  assert(name);
+
+  if (c->n_slots == 0)
+    return NULL;
+
+  slot = hash_slot(c, c->by_name, name_key, name);
+  if (*slot == 0)
+    return NULL;
+
+  return &c->names[*slot - 1];
+}
+
+/* images without version after the others */
+static int
+version_key_cmp(const char *a, const char *b)
+{
+  if (a == NULL || b == NULL)
+    return (a == NULL) - (b == NULL);
+
+  return strcmp(a, b);
+}
+
+/* by name, then from the oldest to the newest version */
+static int
+image_cmp(const void *a, const void *b)
+{
+  const struct image_entry *i_a = *(const struct image_entry *const *) a;
+  const struct image_entry *i_b = *(const struct image_entry *const *) b;
+  int r;
+
+  r = strcmp(i_a->name, i_b->name);
+  if (r != 0)
+    return r;
+
+  r = version_key_cmp(i_a->version_key, i_b->version_key);
+  if (r != 0)
+    return r;
+
+  return strcmp(i_a->deps->image_name, i_b->deps->image_name);
+}
+
+/* newest version first, images without version at the end */
+static int
+version_cmp(const void *a, const void *b)
+{
+  const char *v_a = (*(const struct image_entry *const *) a)->version_key;
+  const char *v_b = (*(const struct image_entry *const *) b)->version_key;
+
+  if (v_a == NULL || v_b == NULL)
+    return (v_a == NULL) - (v_b == NULL);
+
+  return strcmp(v_b, v_a);
+}
+
+static void
+json_variant_unref(void *p)
+{
+  sd_json_variant_unref(p);
+}
+
+#define ARENA_DUP(a, n, e, f)					\
+  if ((e)->f && ((n)->f = arena_strdup(a, (e)->f)) == NULL)	\
+    return -ENOMEM
+
+static int
+arena_dup_image_deps(struct arena *a, const struct image_deps *e,
+		     struct image_deps **res)
+{
+  struct image_deps *n;
+  int r;
+
+  n = arena_alloc(a, sizeof(struct image_deps));
+  if (n == NULL)
+    return -ENOMEM;
+
+  ARENA_DUP(a, n, e, image_name);
+  ARENA_DUP(a, n, e, sysext_version_id);
+  ARENA_DUP(a, n, e, sysext_scope);
+  ARENA_DUP(a, n, e, id);
+  ARENA_DUP(a, n, e, sysext_level);
+  ARENA_DUP(a, n, e, version_id);
+  ARENA_DUP(a, n, e, architecture);
+  if (e->sysext)
+    {
+      n->sysext = sd_json_variant_ref(e->sysext);
+      r = arena_add_cleanup(a, json_variant_unref, n->sysext);
+      if (r < 0)
+	{
+	  n->sysext = sd_json_variant_unref(n->sysext);
+	  return r;
+	}
+    }
+
+  *res = n;
+
+  return 0;
+}
+
+/* Copy of e allocated from a, like dup_image_entry() */
+static int
+arena_dup_image_entry(struct arena *a, const struct image_entry *e,
+		      struct image_entry **res)
+{
+  struct image_entry *n;
+  int r;
+
+  n = arena_alloc(a, sizeof(struct image_entry));
+  if (n == NULL)
+    return -ENOMEM;
+
+  ARENA_DUP(a, n, e, name);
+  ARENA_DUP(a, n, e, sha256);
+  ARENA_DUP(a, n, e, version_key);
+  ARENA_DUP(a, n, e, repository);
+  if (e->deltas && (n->deltas = arena_strv_copy(a, e->deltas)) == NULL)
+    return -ENOMEM;
+  if (e->deps)
+    {
+      r = arena_dup_image_deps(a, e->deps, &n->deps);
+      if (r < 0)
+	return r;
+    }
+  n->remote = e->remote;
+  n->local = e->local;
+  n->installed = e->installed;
+  n->compatible = e->compatible;
+
+  *res = n;
+
+  return 0;
+}
+
+/* version keys are parsed once, all sorting and lookups use them */
+static int
+catalog_set_version_key(struct arena *a, struct image_entry *e)
+{
+  _cleanup_free_ char *key = NULL;
+  int r;
+
+  if (e->version_key || e->deps->sysext_version_id == NULL)
+    return 0;
+
+  r = version_key_new(e->deps->sysext_version_id, &key);
+  if (r < 0)
+    return r;
+
+  e->version_key = arena_strdup(a, key);
+  if (e->version_key == NULL)
+    return -ENOMEM;
+
+  return 0;
+}
+
+/* Merge the remote and local images and create the indices. The
+   entries get copied into the arena of the catalog, the lists stay
+   with the caller. */
+int
+catalog_build(struct catalog *c, struct image_entry *const *remote,
+	      size_t n_remote, struct image_entry *const *local,
+	      size_t n_local)
+{
+  size_t max = n_remote + n_local;
+  struct image_entry **versions;
+  int r;
+
+  assert(c);
+  assert(c->arena == NULL);
+
+  r = arena_new(&c->arena);
+  if (r < 0)
+    return r;
+
+  c->images = arena_alloc_array(c->arena, max + 1, sizeof(struct image_entry *));
+  if (c->images == NULL)
+    return -ENOMEM;
+
+  /* twice the number of entries keeps the probe sequences short */
+  c->n_slots = 16;
+  while (c->n_slots < 2 * max)
+    c->n_slots *= 2;
+  c->by_image_name = arena_alloc_array(c->arena, c->n_slots, sizeof(size_t));
+  c->by_name = arena_alloc_array(c->arena, c->n_slots, sizeof(size_t));
+  c->names = arena_alloc_array(c->arena, max + 1, sizeof(struct catalog_name));
+  versions = arena_alloc_array(c->arena, max + 1, sizeof(struct image_entry *));
+  if (c->by_image_name == NULL || c->by_name == NULL || c->names == NULL ||
+      versions == NULL)
+    return -ENOMEM;
+
+  for (size_t i = 0; i < max; i++)
+    {
+      const struct image_entry *e = i < n_remote ? remote[i] : local[i - n_remote];
+      size_t *slot;
+
+      /* nothing to list or compare without metadata */
+      if (e == NULL || e->deps == NULL)
+	continue;
+
+      slot = hash_slot(c, c->by_image_name, image_key, e->deps->image_name);
+      if (*slot == 0)
+	{
+	  struct image_entry *n;
+
+	  r = arena_dup_image_entry(c->arena, e, &n);
+	  if (r < 0)
+	    return r;
+	  r = catalog_set_version_key(c->arena, n);
+	  if (r < 0)
+	    return r;
+	  c->images[c->n_images++] = n;
+	  *slot = c->n_images;
+	}
+      else
+	{
+	  struct image_entry *known = c->images[*slot - 1];
+
+	  /* the same image is available remote and local */
+	  known->local |= e->local;
+	  known->remote |= e->remote;
+	  known->installed |= e->installed;
+	  if (known->sha256 == NULL)
+	    {
+	      ARENA_DUP(c->arena, known, e, sha256);
+	    }
+	  if (known->repository == NULL)
+	    {
+	      ARENA_DUP(c->arena, known, e, repository);
+	    }
+	  if (known->deltas == NULL && e->deltas &&
+	      (known->deltas = arena_strv_copy(c->arena, e->deltas)) == NULL)
+	    return -ENOMEM;
+	}
+    }
+
+  qsort(c->images, c->n_images, sizeof(struct image_entry *), image_cmp);
+
+  /* positions changed, fill the tables again. All images of a name
+     are next to each other now. */
+  memset(c->by_image_name, 0, c->n_slots * sizeof(size_t));
+  for (size_t i = 0; i < c->n_images; i++)
+    {
+      struct catalog_name *n;
+      size_t *slot;
+
+      slot = hash_slot(c, c->by_image_name, image_key, image_key(c, i));
+      *slot = i + 1;
+
+      slot = hash_slot(c, c->by_name, name_key, c->images[i]->name);
+      if (*slot == 0)
+	{
+	  n = &c->names[c->n_names++];
+	  n->name = c->images[i]->name;
+	  n->versions = &versions[i];
+	  *slot = c->n_names;
+	}
+      else
+	n = &c->names[*slot - 1];
+
+      n->versions[n->n_versions++] = c->images[i];
+    }
+
+  for (size_t i = 0; i < c->n_names; i++)
+    qsort(c->names[i].versions, c->names[i].n_versions,
+	  sizeof(struct image_entry *), version_cmp);
+
+  return 0;
+}
+
+/* Entries of a remote fetch or local scan as kept by the cache, all
+   in one arena. Loads using them hold a reference, so a flush of the
+   cache does not free them under their feet. */
+struct image_list {
+  unsigned n_ref;
+  struct arena *arena;
+  struct image_entry **images;
+  size_t n;
+};
+
+static struct image_list *
+image_list_unref(struct image_list *l)
+{
+  if (!l)
+    return NULL;
+
+  assert(l->n_ref > 0);
+
+  if (--l->n_ref > 0)
+    return NULL;
+
+  free_arenap(&l->arena);
+  return mfree(l);
+}
+
+static struct image_list *
+image_list_ref(struct image_list *l)
+{
+  if (l)
+    l->n_ref++;
+
+  return l;
+}
+
+static void
+image_list_unrefp(struct image_list **l)
+{
+  if (!l || !*l)
+    return;
+
+  *l = image_list_unref(*l);
+}
+
+/* copies the entries with metadata */
+static int
+image_list_new(struct image_entry *const *images, size_t n,
+	       struct image_list **res)
+{
+  _cleanup_(image_list_unrefp) struct image_list *l = NULL;
+  int r;
+
+  l = calloc(1, sizeof(struct image_list));
+  if (l == NULL)
+    return -ENOMEM;
+  l->n_ref = 1;
+
+  r = arena_new(&l->arena);
+  if (r < 0)
+    return r;
+
+  l->images = arena_alloc_array(l->arena, n + 1, sizeof(struct image_entry *));
+  if (l->images == NULL)
+    return -ENOMEM;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      if (images[i] == NULL || images[i]->deps == NULL)
+	continue;
+
+      r = arena_dup_image_entry(l->arena, images[i], &l->images[l->n]);
+      if (r < 0)
+	return r;
+      l->n++;
+    }
+
+  *res = TAKE_PTR(l);
+
+  return 0;
+}
+
+/* Entries of the state file, their strings stay in the mapping.
+   validators of local images are returned in the arena, too. */
+static int
+image_list_from_state(struct catalog_state *st, bool local,
+		      struct image_list **res, const char ***validators)
+{
+  _cleanup_(image_list_unrefp) struct image_list *l = NULL;
+  int r;
+
+  l = calloc(1, sizeof(struct image_list));
+  if (l == NULL)
+    return -ENOMEM;
+  l->n_ref = 1;
+
+  r = arena_new(&l->arena);
+  if (r < 0)
+    return r;
+
+  r = catalog_state_images(st, local, l->arena, &l->images, validators, &l->n);
+  if (r < 0)
+    return r;
+
+  *res = TAKE_PTR(l);
+
+  return 0;
+}
+
+/* Resident data of sysextmgrd, only used after catalog_cache_enable() */
+static struct {
+  bool enabled;
+  uint64_t remote_ttl;
+  /* incremented by every flush, data fetched before is outdated */
+  unsigned remote_generation;
+  unsigned local_generation;
+  char *key;                /* repositories_key() of the remote data */
+  bool verify_signature;
+  bool remote_lazy;         /* only enough for lazy loads */
+  struct image_list *remote;
+  uint64_t remote_time;     /* CLOCK_MONOTONIC */
+  bool remote_valid;
+  char *store;
+  struct image_list *local;
+  bool local_valid;
+  struct catalog *catalog;  /* built from remote and local */
+  /* state file of the last run, used by the first load */
+  struct catalog_state *state;
+} cache;
+
+static uint64_t
+clock_usec(clockid_t clock)
+{
+  struct timespec ts;
+
+  (void) clock_gettime(clock, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000ULL + (uint64_t) ts.tv_nsec / 1000;
+}
+
+static uint64_t
+now_usec(void)
+{
+  return clock_usec(CLOCK_MONOTONIC);
+}
+
+static void
+cache_flush_remote(void)
+{
+  cache.remote_generation++;
+  cache.remote_valid = false;
+  cache.remote = image_list_unref(cache.remote);
+  cache.key = mfree(cache.key);
+  free_catalogp(&cache.catalog);
+}
+
+void
+catalog_cache_flush_local(void)
+{
+  cache.local_generation++;
+  cache.local_valid = false;
+  cache.local = image_list_unref(cache.local);
+  cache.store = mfree(cache.store);
+  free_catalogp(&cache.catalog);
+}
+
+void
+catalog_cache_flush(void)
+{
+  cache_flush_remote();
+  catalog_cache_flush_local();
+}
+
+void
+catalog_cache_enable(uint64_t remote_ttl_usec)
+{
+  cache.enabled = true;
+  cache.remote_ttl = remote_ttl_usec;
+}
+
+void
+catalog_cache_free(void)
+{
+  catalog_cache_flush();
+  catalog_state_unrefp(&cache.state);
+  cache.enabled = false;
+}
+
+static int
+path_validator(const char *dir, const char *fn, char **res)
+{
+  _cleanup_free_ char *path = NULL;
+  struct stat st;
+  int r;
+
+  if (fn)
+    {
+      r = join_path(dir, fn, &path);
+      if (r < 0)
+	return r;
+    }
+
+  if (stat(path ? path : dir, &st) < 0)
+    return -errno;
+
+  return stat_to_validator(&st, res);
+}
+
+/* A file added to or removed from the store changes the validator of
+   the directory, a replaced image its own validator */
+static bool
+cache_state_local_valid(const struct image_list *l, const char *store,
+			const char *store_validator, const char **validators)
+{
+  _cleanup_free_ char *v = NULL;
+
+  if (store_validator == NULL || path_validator(store, NULL, &v) < 0 ||
+      !streq(v, store_validator))
+    return false;
+
+  for (size_t i = 0; i < l->n; i++)
+    {
+      v = mfree(v);
+      if (validators[i] == NULL ||
+	  path_validator(store, l->images[i]->deps->image_name, &v) < 0 ||
+	  !streq(v, validators[i]))
+	return false;
+    }
+
+  return true;
+}
+
+/* The state file is only checked by the first load after the start.
+   The images are only used if they got validated against the same
+   host, the remote data only until remote_ttl is reached and the
+   local data only if the store did not change. */
+static void
+cache_use_state(const char *key, bool verify_signature, bool lazy,
+		const char *store, struct host_profile *host)
+{
+  _cleanup_(catalog_state_unrefp) struct catalog_state *st = TAKE_PTR(cache.state);
+  const struct catalog_state_data *d;
+  int r = -ENOMEM;
+
+  if (st == NULL || !cache.enabled)
+    return;
+
+  d = catalog_state_data(st);
+  if (host == NULL || !streq(d->host, host_profile_fingerprint(host)))
+    {
+      log_msg(LOG_DEBUG, "Ignoring state file of another host configuration");
+      return;
+    }
+
+  if (!cache.remote_valid && d->remote_valid && cache.remote_ttl > 0 &&
+      d->verify_signature == verify_signature && streq_ptr(d->url, key) &&
+      (lazy || !d->remote_lazy))
+    {
+      uint64_t now = clock_usec(CLOCK_REALTIME), mono = now_usec();
+      _cleanup_free_ char *k = NULL;
+      struct image_list *l = NULL;
+
+      /* the clock could have been set back */
+      if (d->remote_time > now || now - d->remote_time >= cache.remote_ttl ||
+	  now - d->remote_time > mono)
+	log_msg(LOG_DEBUG, "Remote image data of state file expired");
+      else if ((key == NULL || (k = strdup(key)) != NULL) &&
+	       (r = image_list_from_state(st, false, &l, NULL)) >= 0)
+	{
+	  cache.remote = l;
+	  cache.key = TAKE_PTR(k);
+	  cache.verify_signature = verify_signature;
+	  cache.remote_lazy = d->remote_lazy;
+	  cache.remote_time = mono - (now - d->remote_time);
+	  cache.remote_valid = true;
+	  log_msg(LOG_DEBUG, "Using remote image data of state file");
+	}
+      else
+	log_msg(LOG_WARNING, "Ignoring remote image data of state file: %s",
+		strerror(-r));
+    }
+
+  if (!cache.local_valid && d->local_valid && streq_ptr(d->store, store))
+    {
+      _cleanup_(image_list_unrefp) struct image_list *l = NULL;
+      const char **validators = NULL;
+
+      r = image_list_from_state(st, true, &l, &validators);
+      if (r < 0)
+	log_msg(LOG_WARNING, "Ignoring local image data of state file: %s",
+		strerror(-r));
+      else if (!cache_state_local_valid(l, store, d->store_validator, validators))
+	log_msg(LOG_DEBUG, "Store changed since the state file got written");
+      else if ((cache.store = strdup(store)) != NULL)
+	{
+	  cache.local = TAKE_PTR(l);
+	  cache.local_valid = true;
+	  log_msg(LOG_DEBUG, "Using local image data of state file");
+	}
+    }
+}
+
+/* Map the state file written by catalog_cache_save(), it gets
+   validated and used by the first load_catalog_async() */
+void
+catalog_cache_restore(const char *fn)
+{
+  int r;
+
+  assert(fn);
+
+  catalog_state_unrefp(&cache.state);
+
+  r = catalog_state_open(fn, &cache.state);
+  if (r < 0)
+    log_msg(LOG_INFO, "Ignoring state file '%s': %s", fn, strerror(-r));
+}
+
+/* Write the valid parts of the cache, which were validated against
+   host, into the state file fn */
+int
+catalog_cache_save(const char *fn, const struct host_profile *host)
+{
+  _cleanup_strv_free_ char **validators = NULL;
+  _cleanup_free_ char *store_validator = NULL;
+  struct catalog_state_data d = {
+    .remote_valid = false,
+    .local_valid = false,
+  };
+  int r;
+
+  assert(fn);
+
+  if (!cache.enabled || host == NULL)
+    return 0;
+
+  if (cache.remote_valid && now_usec() - cache.remote_time < cache.remote_ttl)
+    {
+      d.remote_valid = true;
+      d.url = cache.key;
+      d.verify_signature = cache.verify_signature;
+      d.remote_lazy = cache.remote_lazy;
+      d.remote_time = clock_usec(CLOCK_REALTIME) - (now_usec() - cache.remote_time);
+      d.remote = cache.remote->images;
+      d.n_remote = cache.remote->n;
+    }
+
+  if (cache.local_valid &&
+      path_validator(cache.store, NULL, &store_validator) >= 0)
+    {
+      validators = calloc(cache.local->n + 1, sizeof(char *));
+      if (validators == NULL)
+	return -ENOMEM;
+
+      d.local_valid = true;
+      for (size_t i = 0; i < cache.local->n; i++)
+	if (path_validator(cache.store, cache.local->images[i]->deps->image_name,
+			   &validators[i]) < 0)
+	  {
+	    d.local_valid = false;
+	    break;
+	  }
+
+      d.store = cache.store;
+      d.store_validator = store_validator;
+      d.local = cache.local->images;
+      d.local_validators = validators;
+      d.n_local = cache.local->n;
+    }
+
+  if (!d.remote_valid && !d.local_valid)
+    return 0;
+
+  d.host = host_profile_fingerprint(host);
+
+  r = catalog_state_write(fn, &d);
+  if (r < 0)
+    return r;
+
+  log_msg(LOG_DEBUG, "Wrote state file '%s'", fn);
+
+  return 0;
+}
+
+/* The data of a lazy load lacks the metadata of older versions, it
+   is only good for other lazy loads */
+static bool
+cache_remote_usable(const char *key, bool verify_signature, bool lazy)
+{
+  if (!cache.enabled || !cache.remote_valid ||
+      cache.verify_signature != verify_signature ||
+      !streq_ptr(cache.key, key) || (cache.remote_lazy && !lazy))
+    return false;
+
+  if (now_usec() - cache.remote_time >= cache.remote_ttl)
+    {
+      log_msg(LOG_DEBUG, "Cached image data of '%s' expired", strna(key));
+      cache_flush_remote();
+      return false;
+    }
+
+  return true;
+}
+
+static bool
+cache_local_usable(const char *store)
+{
+  return cache.enabled && cache.local_valid && streq_ptr(cache.store, store);
+}
+
+struct catalog_load;
+
+/* Remote images of one repository of a load */
+struct catalog_repo {
+  struct catalog_load *l;
+  const char *url;
+  char **urls;          /* url and its mirrors, in the order to try them */
+  size_t mirror;        /* current entry of urls */
+  struct image_entry **images;
+  size_t n;
+};
+
+struct catalog_load {
+  struct process_pool *pool;
+  struct process_pool *scan_pool;
+  unsigned pending;     /* the remote fetches and the local scan */
+  unsigned remote_pending;
+  int error;
+  struct catalog *c;
+  /* either the result of the fetch or scan or the data of the cache */
+  struct image_entry **remote;
+  size_t n_remote;
+  struct image_entry **local;
+  size_t n_local;
+  struct image_list *remote_cached;
+  struct image_list *local_cached;
+  unsigned remote_generation;
+  unsigned local_generation;
+  bool remote_stored;   /* remote is the data of the cache now */
+  char **repositories;  /* with the highest priority first */
+  char *key;
+  struct catalog_repo *repos;
+  size_t n_repos;
+  char *store;
+  char **filter;
+  bool lazy;
+  bool verify_signature;
+  struct host_profile *host;
+  bool verbose;
+  catalog_done_t done;
+  void *userdata;
+};
+
+static void
+catalog_load_finish(struct catalog_load *l, int r)
+{
+  if (r < 0)
+    l->done(r, NULL, l->userdata);
+  else
+    l->done(0, TAKE_PTR(l->c), l->userdata);
+
+  free_catalogp(&l->c);
+  if (l->remote_cached)
+    image_list_unref(l->remote_cached);
+  else
+    free_image_entry_list(&l->remote);
+  if (l->local_cached)
+    image_list_unref(l->local_cached);
+  else
+    free_image_entry_list(&l->local);
+  for (size_t i = 0; i < l->n_repos; i++)
+    {
+      strv_free(l->repos[i].urls);
+      free_image_entry_list(&l->repos[i].images);
+    }
+  free(l->repos);
+  strv_free(l->repositories);
+  free(l->key);
+  free(l->store);
+  strv_free(l->filter);
+  free(l);
+}
+
+/* A load of other repositories does not evict valid data, e.g. the
+   configured repositories stay cached while a request names others */
+static bool
+cache_remote_replaceable(const char *key)
+{
+  return !cache.remote_valid || streq_ptr(cache.key, key) ||
+    now_usec() - cache.remote_time >= cache.remote_ttl;
+}
+
+/* Store copies of the freshly loaded data, unless the cache got
+   flushed in the meantime. Failures only mean the next request
+   loads again. A load without repositories has no remote data. */
+static void
+catalog_cache_store(struct catalog_load *l)
+{
+  if (!cache.enabled || l->filter)
+    return;
+
+  if (!l->remote_cached && l->n_repos > 0 && cache.remote_ttl > 0 &&
+      l->remote_generation == cache.remote_generation &&
+      cache_remote_replaceable(l->key))
+    {
+      _cleanup_free_ char *key = NULL;
+
+      cache_flush_remote();
+      if ((l->key == NULL || (key = strdup(l->key)) != NULL) &&
+	  image_list_new(l->remote, l->n_remote, &cache.remote) == 0)
+	{
+	  cache.key = TAKE_PTR(key);
+	  cache.verify_signature = l->verify_signature;
+	  cache.remote_lazy = l->lazy;
+	  cache.remote_time = now_usec();
+	  cache.remote_valid = true;
+	  /* only the data of this load is current now */
+	  l->remote_generation = cache.remote_generation;
+	  l->remote_stored = true;
+	}
+    }
+
+  if (!l->local_cached && l->local_generation == cache.local_generation)
+    {
+      catalog_cache_flush_local();
+      cache.store = strdup(l->store);
+      if (cache.store &&
+	  image_list_new(l->local, l->n_local, &cache.local) == 0)
+	{
+	  cache.local_valid = true;
+	  l->local_generation = cache.local_generation;
+	}
+    }
+}
+
+static void
+catalog_load_build(struct catalog_load *l)
+{
+  int r;
+
+  catalog_cache_store(l);
+
+  r = catalog_build(l->c, l->remote, l->n_remote, l->local, l->n_local);
+
+  /* later requests get the same catalog as long as nothing changed */
+  if (r >= 0 && cache.enabled && !l->filter &&
+      (l->remote_cached || l->remote_stored) &&
+      cache.remote_valid && cache.local_valid && cache.catalog == NULL &&
+      l->remote_generation == cache.remote_generation &&
+      l->local_generation == cache.local_generation)
+    cache.catalog = catalog_ref(l->c);
+
+  catalog_load_finish(l, r);
+}
+
+/* Both parts are done, the results are merged in a defined order
+   by catalog_build(), no matter which one finished first */
+static void
+catalog_load_put(struct catalog_load *l)
+{
+  assert(l->pending > 0);
+
+  if (--l->pending > 0)
+    return;
+
+  if (l->error < 0)
+    catalog_load_finish(l, l->error);
+  else
+    catalog_load_build(l);
+}
+
+static void
+catalog_load_fail(struct catalog_load *l, int r)
+{
+  if (l->error == 0)
+    l->error = r;
+
+  catalog_load_put(l);
+}
+
+static void
+catalog_local_done(int r, struct image_entry **images, size_t n, void *userdata)
+{
+  struct catalog_load *l = userdata;
+
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Searching for images in '%s' failed: %s",
+	      l->store, strerror(-r));
+      free_image_entry_list(&images);
+      catalog_load_fail(l, r);
+      return;
+    }
+
+  l->local = images;
+  l->n_local = n;
+
+  catalog_load_put(l);
+}
+
+/* The remote images of all repositories with the highest priority
+   first. catalog_build() keeps the first of several images with the
+   same name, so this repository provides it. */
+static int
+catalog_remote_merge(struct catalog_load *l)
+{
+  size_t n = 0;
+
+  for (size_t i = 0; i < l->n_repos; i++)
+    n += l->repos[i].n;
+
+  l->remote = calloc(n + 1, sizeof(struct image_entry *));
+  if (l->remote == NULL)
+    return -ENOMEM;
+
+  for (size_t i = 0; i < l->n_repos; i++)
+    {
+      struct catalog_repo *repo = &l->repos[i];
+
+      for (size_t k = 0; k < repo->n; k++)
+	if (repo->images[k]->repository == NULL &&
+	    (repo->images[k]->repository = strdup(repo->url)) == NULL)
+	  return -ENOMEM;
+
+      /* the entries belong to the merged list now */
+      for (size_t k = 0; k < repo->n; k++)
+	l->remote[l->n_remote++] = repo->images[k];
+      repo->images = mfree(repo->images);
+      repo->n = 0;
+    }
+
+  return 0;
+}
+
+/* The remote part is done after the last repository */
+static void
+catalog_remote_put(struct catalog_load *l)
+{
+  int r;
+
+  assert(l->remote_pending > 0);
+
+  if (--l->remote_pending > 0)
+    return;
+
+  if (l->error == 0)
+    {
+      r = catalog_remote_merge(l);
+      if (r < 0)
+	{
+	  catalog_load_fail(l, r);
+	  return;
+	}
+    }
+
+  catalog_load_put(l);
+}
+
+static void catalog_remote_done(int r, struct image_entry **images,
+		size_t n, void *userdata);
+
+static void
+catalog_fetch_remote(struct catalog_repo *repo)
+{
+  struct catalog_load *l = repo->l;
+
+  image_remote_metadata_async(l->pool, repo->urls[repo->mirror], l->filter,
+			      l->lazy, l->verify_signature, l->host,
+			      l->verbose, catalog_remote_done, repo);
+}
+
+static void
+catalog_remote_done(int r, struct image_entry **images, size_t n, void *userdata)
+{
+  struct catalog_repo *repo = userdata;
+  struct catalog_load *l = repo->l;
+
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Fetching image data from '%s' failed: %s",
+	      repo->urls[repo->mirror], strerror(-r));
+      mirror_report_failure(repo->urls[repo->mirror]);
+      if (repo->urls[repo->mirror + 1])
+	{
+	  repo->mirror++;
+	  log_msg(LOG_NOTICE, "Trying mirror '%s'", repo->urls[repo->mirror]);
+	  catalog_fetch_remote(repo);
+	  return;
+	}
+      /* an image missing from the catalog would look like an update
+	 of another repository */
+      if (l->error == 0)
+	l->error = r;
+      catalog_remote_put(l);
+      return;
+    }
+
+  repo->images = images;
+  repo->n = n;
+
+  catalog_remote_put(l);
+}
+
+/* Identifies the remote data of a list of repositories in the cache */
+static int
+repositories_key(char *const *repositories, char **res)
+{
+  size_t len = 0;
+  char *p;
+
+  *res = NULL;
+  if (repositories == NULL || repositories[0] == NULL)
+    return 0;
+
+  STRV_FOREACH(r, repositories)
+    len += strlen(*r) + 1;
+
+  *res = p = malloc(len);
+  if (p == NULL)
+    return -ENOMEM;
+
+  STRV_FOREACH(r, repositories)
+    {
+      if (p != *res)
+	*p++ = ' ';
+      p = stpcpy(p, *r);
+    }
+
+  return 0;
+}
+
+/* Fetch SHA256SUMS and the metadata of all remote images once and
+   scan the local store once. repositories is NULL or ordered by
+   priority, they are fetched at the same time and merged into one
+   catalog. An image provided by several repositories is taken from
+   the first one, its URL is the repository of the entry. If filter
+   is set, only images with one of these names are part of the
+   snapshot. With the resident cache enabled, the cached data gets
+   used instead, a complete catalog is also used for filtered
+   requests. With lazy, the metadata of remote images is only
+   fetched until the newest compatible version of every name is
+   found, which is enough for get_latest_version() but not for
+   listing all images or checking other hosts. If fetching from a
+   repository fails, its mirrors are tried. The downloads run in
+   the pool, the local scan at the same time in scan_pool. done gets
+   called exactly once, this can already happen before this function
+   returns. */
+void
+load_catalog_async(struct process_pool *pool, struct process_pool *scan_pool,
+		   char *const *repositories, const char *store,
+		   char *const *filter, bool lazy, bool verify_signature,
+		   struct host_profile *host, bool verbose,
+		   catalog_done_t done, void *userdata)
+{
+  _cleanup_free_ char *key = NULL;
+  struct catalog_load *l;
+  bool oom = false;
+
+  assert(pool);
+  assert(scan_pool);
+  assert(store);
+  assert(done);
+
+  if (repositories_key(repositories, &key) < 0)
+    {
+      done(-ENOMEM, NULL, userdata);
+      return;
+    }
+
+  cache_use_state(key, verify_signature, lazy, store, host);
+
+  if (cache.catalog && cache_remote_usable(key, verify_signature, lazy) &&
+      cache_local_usable(store))
+    {
+      log_msg(LOG_DEBUG, "Using cached image data");
+      metrics_count(METRIC_CATALOG_CACHED, 1);
+      done(0, catalog_ref(cache.catalog), userdata);
+      return;
+    }
+
+  metrics_count(METRIC_CATALOG_LOADED, 1);
+
+  l = calloc(1, sizeof(struct catalog_load));
+  if (l == NULL)
+    {
+      done(-ENOMEM, NULL, userdata);
+      return;
+    }
+
+  l->pool = pool;
+  l->scan_pool = scan_pool;
+  l->lazy = lazy;
+  l->verify_signature = verify_signature;
+  l->host = host;
+  l->verbose = verbose;
+  l->done = done;
+  l->userdata = userdata;
+  l->remote_generation = cache.remote_generation;
+  l->local_generation = cache.local_generation;
+  l->key = TAKE_PTR(key);
+
+  l->c = calloc(1, sizeof(struct catalog));
+  l->store = strdup(store);
+  if (l->key)
+    {
+      l->repositories = strv_copy(repositories);
+      if (l->repositories)
+	l->repos = calloc(strv_length(l->repositories), sizeof(struct catalog_repo));
+      if (l->repos == NULL)
+	oom = true;
+      else
+	STRV_FOREACH(r, l->repositories)
+	  {
+	    struct catalog_repo *repo = &l->repos[l->n_repos++];
+
+	    repo->l = l;
+	    repo->url = *r;
+	    if (mirror_list(*r, &repo->urls) < 0)
+	      oom = true;
+	  }
+    }
+  if (filter)
+    l->filter = strv_copy(filter);
+  if (l->c == NULL || l->store == NULL || oom ||
+      (filter && l->filter == NULL))
+    {
+      catalog_load_finish(l, -ENOMEM);
+      return;
+    }
+  l->c->n_ref = 1;
+
+  /* keeps l until both parts are started, they can finish at once */
+  l->pending = 3;
+
+  if (l->filter == NULL && cache_remote_usable(l->key, verify_signature, lazy))
+    {
+      l->remote_cached = image_list_ref(cache.remote);
+      l->remote = l->remote_cached->images;
+      l->n_remote = l->remote_cached->n;
+      catalog_load_put(l);
+    }
+  else if (l->n_repos > 0)
+    {
+      /* the order for the next requests */
+      mirror_probe(pool);
+      /* keeps the remote part until all fetches are started */
+      l->remote_pending = l->n_repos + 1;
+      for (size_t i = 0; i < l->n_repos; i++)
+	catalog_fetch_remote(&l->repos[i]);
+      catalog_remote_put(l);
+    }
+  else
+    catalog_load_put(l);
+
+  /* the local scan does not depend on the remote data */
+  if (l->filter == NULL && cache_local_usable(l->store))
+    {
+      l->local_cached = image_list_ref(cache.local);
+      l->local = l->local_cached->images;
+      l->n_local = l->local_cached->n;
+      catalog_load_put(l);
+    }
+  else
+    image_local_metadata_async(scan_pool, l->store, l->filter, l->host,
+			       l->verbose, catalog_local_done, l);
+
+  catalog_load_put(l);
+}
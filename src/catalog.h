@@ -0,0 +1,72 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <stdint.h>
+
+#include "image-deps.h"
+#include "host-profile.h"
+#include "process-pool.h"
+#include "arena.h"
+
+/* Images which are available under one name, sorted from the newest
+   to the oldest version */
+struct catalog_name {
+  const char *name;
+  struct image_entry **versions;
+  size_t n_versions;
+};
+
+/* Snapshot of the remote and local images. It is fetched once per
+   request and all lookups of this request are answered from it.
+   An image available remote and local is only contained once, with
+   both flags set. The catalog is reference counted and shared with
+   other requests if the resident cache is enabled, so the entries
+   must not be modified. All entries and tables are allocated from
+   arena and released together with it. */
+struct catalog {
+  unsigned n_ref;
+  struct arena *arena;
+  struct image_entry **images;  /* sorted by name and version */
+  size_t n_images;
+  struct catalog_name *names;
+  size_t n_names;
+  /* hash tables with index + 1 into images and names, 0 is unused */
+  size_t *by_image_name;
+  size_t *by_name;
+  size_t n_slots;               /* power of 2 */
+};
+
+/* r is a negative errno value or 0, the callee owns a reference
+   of catalog */
+typedef void (*catalog_done_t)(int r, struct catalog *catalog, void *userdata);
+
+extern void free_catalog(struct catalog *c);
+extern struct catalog *catalog_ref(struct catalog *c);
+extern struct catalog *catalog_unref(struct catalog *c);
+extern void free_catalogp(struct catalog **c);
+extern int catalog_build(struct catalog *c, struct image_entry *const *remote,
+		size_t n_remote, struct image_entry *const *local, size_t n_local);
+extern struct image_entry *catalog_find_image(const struct catalog *c,
+		const char *image_name);
+extern const struct catalog_name *catalog_find_name(const struct catalog *c,
+		const char *name);
+extern void load_catalog_async(struct process_pool *pool,
+		struct process_pool *scan_pool, char *const *repositories,
+		const char *store, char *const *filter, bool lazy,
+		bool verify_signature, struct host_profile *host, bool verbose,
+		catalog_done_t done, void *userdata);
+
+/* Keep the remote and local image data between calls of
+   load_catalog_async(). The remote data gets fetched again after
+   remote_ttl_usec, 0 disables caching of the remote data. The local
+   data is valid until catalog_cache_flush_local() gets called, the
+   caller needs to watch the store for changes. */
+extern void catalog_cache_enable(uint64_t remote_ttl_usec);
+extern void catalog_cache_flush_local(void);
+extern void catalog_cache_flush(void);
+extern void catalog_cache_free(void);
+/* Keep the valid data of the cache in a state file between two runs
+   of sysextmgrd */
+extern int catalog_cache_save(const char *fn, const struct host_profile *host);
+extern void catalog_cache_restore(const char *fn);
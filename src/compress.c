@@ -0,0 +1,458 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if HAVE_ZLIB
+# include <zlib.h>
+#endif
+#if HAVE_ZSTD
+# include <zstd.h>
+#endif
+
+#include "basics.h"
+#include "compress.h"
+
+#define READ_BUFFER_SIZE (64 * 1024)
+
+bool
+compression_supported(enum compression c)
+{
+  switch (c)
+    {
+    case COMPRESSION_NONE:
+      return true;
+    case COMPRESSION_GZIP:
+      return HAVE_ZLIB;
+    case COMPRESSION_ZSTD:
+      return HAVE_ZSTD;
+    }
+
+  return false;
+}
+
+enum compression
+compression_from_suffix(const char *fn)
+{
+  if (endswith(fn, ".zst"))
+    return COMPRESSION_ZSTD;
+  if (endswith(fn, ".gz"))
+    return COMPRESSION_GZIP;
+
+  return COMPRESSION_NONE;
+}
+
+static enum compression
+compression_from_magic(const uint8_t *p, size_t n)
+{
+  if (n >= 4 && p[0] == 0x28 && p[1] == 0xb5 && p[2] == 0x2f && p[3] == 0xfd)
+    return COMPRESSION_ZSTD;
+  if (n >= 2 && p[0] == 0x1f && p[1] == 0x8b)
+    return COMPRESSION_GZIP;
+
+  return COMPRESSION_NONE;
+}
+
+/* output buffer of the decompression, always with room for the
+   terminating '\0' */
+struct outbuf {
+  char *buf;
+  size_t len;
+  size_t alloc;
+  size_t max_size;
+};
+
+/* room for at least one more byte */
+static int
+outbuf_grow(struct outbuf *o)
+{
+  size_t n;
+  char *p;
+
+  if (o->len < o->alloc - 1)
+    return 0;
+  if (o->len >= o->max_size)
+    return -EFBIG;
+
+  n = o->alloc * 2;
+  if (n > o->max_size + 1)
+    n = o->max_size + 1;
+
+  p = realloc(o->buf, n);
+  if (p == NULL)
+    return -ENOMEM;
+  o->buf = p;
+  o->alloc = n;
+
+  return 0;
+}
+
+static ssize_t
+read_retry(int fd, void *buf, size_t size)
+{
+  ssize_t n;
+
+  do
+    n = read(fd, buf, size);
+  while (n < 0 && errno == EINTR);
+
+  return n < 0 ? -errno : n;
+}
+
+static int
+read_plain(int fd, struct outbuf *o)
+{
+  for (;;)
+    {
+      char probe[1];
+      ssize_t n;
+      int r;
+
+      if (o->len < o->alloc - 1)
+	n = read_retry(fd, o->buf + o->len, o->alloc - 1 - o->len);
+      else
+	{
+	  /* the buffer has the size of the file, usually this is
+	     the end */
+	  n = read_retry(fd, probe, sizeof(probe));
+	  if (n > 0)
+	    {
+	      r = outbuf_grow(o);
+	      if (r < 0)
+		return r;
+	      o->buf[o->len] = probe[0];
+	    }
+	}
+      if (n < 0)
+	return n;
+      if (n == 0)
+	return 0;
+      o->len += n;
+    }
+}
+
+#if HAVE_ZLIB
+static int
+read_gzip(int fd, struct outbuf *o)
+{
+  _cleanup_free_ uint8_t *in = NULL;
+  z_stream z = {};
+  int r = 0, k;
+
+  in = malloc(READ_BUFFER_SIZE);
+  if (in == NULL)
+    return -ENOMEM;
+
+  /* 32: detect gzip or zlib header */
+  if (inflateInit2(&z, 15 + 32) != Z_OK)
+    return -ENOMEM;
+
+  for (;;)
+    {
+      ssize_t n = read_retry(fd, in, READ_BUFFER_SIZE);
+
+      if (n < 0)
+	{
+	  r = n;
+	  break;
+	}
+      if (n == 0)
+	{
+	  /* truncated stream */
+	  if (z.total_in > 0)
+	    r = -EBADMSG;
+	  break;
+	}
+
+      z.next_in = in;
+      z.avail_in = n;
+      /* a full output buffer can leave data behind in z */
+      do
+	{
+	  r = outbuf_grow(o);
+	  if (r < 0)
+	    goto out;
+
+	  z.next_out = (Bytef *) o->buf + o->len;
+	  z.avail_out = o->alloc - 1 - o->len;
+	  k = inflate(&z, Z_NO_FLUSH);
+	  o->len = o->alloc - 1 - z.avail_out;
+	  if (k == Z_STREAM_END)
+	    {
+	      /* another member follows, like "cat a.gz b.gz" */
+	      if (inflateReset(&z) != Z_OK)
+		{
+		  r = -EBADMSG;
+		  goto out;
+		}
+	    }
+	  else if (k != Z_OK && k != Z_BUF_ERROR)
+	    {
+	      r = k == Z_MEM_ERROR ? -ENOMEM : -EBADMSG;
+	      goto out;
+	    }
+	}
+      while (z.avail_in > 0 || z.avail_out == 0);
+    }
+
+ out:
+  inflateEnd(&z);
+  return r;
+}
+#endif
+
+#if HAVE_ZSTD
+static int
+read_zstd(int fd, struct outbuf *o)
+{
+  _cleanup_free_ uint8_t *in = NULL;
+  ZSTD_outBuffer output;
+  ZSTD_DStream *z;
+  size_t k = 0;
+  int r = 0;
+
+  in = malloc(READ_BUFFER_SIZE);
+  if (in == NULL)
+    return -ENOMEM;
+
+  z = ZSTD_createDStream();
+  if (z == NULL)
+    return -ENOMEM;
+
+  for (;;)
+    {
+      ssize_t n = read_retry(fd, in, READ_BUFFER_SIZE);
+      ZSTD_inBuffer input = { in, 0, 0 };
+
+      if (n < 0)
+	{
+	  r = n;
+	  break;
+	}
+      if (n == 0)
+	{
+	  /* k is 0 after a complete frame */
+	  if (k != 0)
+	    r = -EBADMSG;
+	  break;
+	}
+
+      input.size = n;
+      /* a full output buffer can leave data behind in z */
+      do
+	{
+	  r = outbuf_grow(o);
+	  if (r < 0)
+	    goto out;
+
+	  output = (ZSTD_outBuffer) { o->buf, o->alloc - 1, o->len };
+	  k = ZSTD_decompressStream(z, &output, &input);
+	  o->len = output.pos;
+	  if (ZSTD_isError(k))
+	    {
+	      r = -EBADMSG;
+	      goto out;
+	    }
+	}
+      while (input.pos < input.size || output.pos == output.size);
+    }
+
+ out:
+  ZSTD_freeDStream(z);
+  return r;
+}
+#endif
+
+int
+read_decompressed(int fd, size_t max_size, char **res, size_t *size)
+{
+  struct outbuf o = { .max_size = max_size };
+  uint8_t magic[4];
+  struct stat st;
+  ssize_t n;
+  int r;
+
+  assert(fd >= 0);
+  assert(res);
+
+  do
+    n = pread(fd, magic, sizeof(magic), 0);
+  while (n < 0 && errno == EINTR);
+  if (n < 0)
+    return -errno;
+  if (lseek(fd, 0, SEEK_SET) < 0)
+    return -errno;
+
+  /* the size of an uncompressed file, else a guess */
+  o.alloc = READ_BUFFER_SIZE;
+  if (fstat(fd, &st) == 0 && (uint64_t) st.st_size < max_size)
+    o.alloc = st.st_size + 1;
+  if (o.alloc < 2)
+    o.alloc = 2;
+  o.buf = malloc(o.alloc);
+  if (o.buf == NULL)
+    return -ENOMEM;
+
+  switch (compression_from_magic(magic, n))
+    {
+    case COMPRESSION_GZIP:
+#if HAVE_ZLIB
+      r = read_gzip(fd, &o);
+#else
+      r = -EPROTONOSUPPORT;
+#endif
+      break;
+    case COMPRESSION_ZSTD:
+#if HAVE_ZSTD
+      r = read_zstd(fd, &o);
+#else
+      r = -EPROTONOSUPPORT;
+#endif
+      break;
+    default:
+      r = read_plain(fd, &o);
+      break;
+    }
+  if (r < 0)
+    {
+      free(o.buf);
+      return r;
+    }
+
+  o.buf[o.len] = '\0';
+  *res = o.buf;
+  if (size)
+    *size = o.len;
+
+  return 0;
+}
+
+static int
+write_all(int fd, const void *data, size_t size)
+{
+  const uint8_t *p = data;
+
+  while (size > 0)
+    {
+      ssize_t n = write(fd, p, size);
+
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -errno;
+	}
+      p += n;
+      size -= n;
+    }
+
+  return 0;
+}
+
+#if HAVE_ZLIB
+static int
+write_gzip(int fd, const void *data, size_t size)
+{
+  _cleanup_free_ uint8_t *out = NULL;
+  z_stream z = {};
+  int r = 0, k;
+
+  out = malloc(READ_BUFFER_SIZE);
+  if (out == NULL)
+    return -ENOMEM;
+
+  /* 16: gzip header instead of zlib */
+  if (deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+		   Z_DEFAULT_STRATEGY) != Z_OK)
+    return -ENOMEM;
+
+  z.next_in = (Bytef *) data;
+  z.avail_in = size;
+  do
+    {
+      z.next_out = out;
+      z.avail_out = READ_BUFFER_SIZE;
+      k = deflate(&z, Z_FINISH);
+      if (k != Z_OK && k != Z_STREAM_END && k != Z_BUF_ERROR)
+	{
+	  r = -EIO;
+	  break;
+	}
+      r = write_all(fd, out, READ_BUFFER_SIZE - z.avail_out);
+    }
+  while (r >= 0 && k != Z_STREAM_END);
+
+  deflateEnd(&z);
+  return r;
+}
+#endif
+
+#if HAVE_ZSTD
+static int
+write_zstd(int fd, const void *data, size_t size)
+{
+  _cleanup_free_ uint8_t *out = NULL;
+  ZSTD_inBuffer input = { data, size, 0 };
+  size_t out_size = ZSTD_CStreamOutSize();
+  ZSTD_CCtx *z;
+  size_t k;
+  int r = 0;
+
+  out = malloc(out_size);
+  if (out == NULL)
+    return -ENOMEM;
+
+  z = ZSTD_createCCtx();
+  if (z == NULL)
+    return -ENOMEM;
+
+  /* written once by the publisher, read by every machine */
+  (void) ZSTD_CCtx_setParameter(z, ZSTD_c_compressionLevel, 19);
+  (void) ZSTD_CCtx_setParameter(z, ZSTD_c_checksumFlag, 1);
+
+  do
+    {
+      ZSTD_outBuffer output = { out, out_size, 0 };
+
+      k = ZSTD_compressStream2(z, &output, &input, ZSTD_e_end);
+      if (ZSTD_isError(k))
+	{
+	  r = -EIO;
+	  break;
+	}
+      r = write_all(fd, out, output.pos);
+    }
+  while (r >= 0 && k != 0);
+
+  ZSTD_freeCCtx(z);
+  return r;
+}
+#endif
+
+int
+write_compressed(int fd, enum compression c, const void *data, size_t size)
+{
+  switch (c)
+    {
+    case COMPRESSION_GZIP:
+#if HAVE_ZLIB
+      return write_gzip(fd, data, size);
+#else
+      return -EPROTONOSUPPORT;
+#endif
+    case COMPRESSION_ZSTD:
+#if HAVE_ZSTD
+      return write_zstd(fd, data, size);
+#else
+      return -EPROTONOSUPPORT;
+#endif
+    default:
+      return write_all(fd, data, size);
+    }
+}
@@ -0,0 +1,32 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* SHA256SUMS and the index of a repository can be compressed. When
+   reading, the format is detected from the content, the suffix of
+   the file name only selects it when writing. */
+enum compression {
+  COMPRESSION_NONE,
+  COMPRESSION_GZIP,
+  COMPRESSION_ZSTD,
+};
+
+/* the format fetched from repositories, if one is supported */
+#if HAVE_ZSTD
+# define COMPRESSED_SUFFIX ".zst"
+#elif HAVE_ZLIB
+# define COMPRESSED_SUFFIX ".gz"
+#endif
+
+extern bool compression_supported(enum compression c);
+extern enum compression compression_from_suffix(const char *fn);
+/* Read all of fd from the start and decompress it on the fly if it
+   is compressed. res is terminated by '\0', a content larger than
+   max_size bytes is -EFBIG. */
+extern int read_decompressed(int fd, size_t max_size, char **res,
+		size_t *size);
+extern int write_compressed(int fd, enum compression c, const void *data,
+		size_t size);
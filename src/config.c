@@ -2,14 +2,28 @@
 
 #include "config.h"
 
+#include <assert.h>
+#include <errno.h>
 #include <string.h>
 #include <syslog.h>
 #include <libeconf.h>
 
 #include "basics.h"
+#include "strv.h"
 #include "sysextmgr.h"
 #include "log_msg.h"
 
+/* number of systemd-pull processes running at the same time */
+#define MAX_PARALLEL_DOWNLOADS 4
+/* systemd-dissect processes, 0 is one per online CPU */
+#define MAX_PARALLEL_SCANS 0
+#define REMOTE_CACHE_TTL 60 /* seconds */
+#define IDLE_EXIT_TIMEOUT 30 /* seconds */
+#define DOWNLOAD_RETRIES 3
+#define WATCH_REFRESH_INTERVAL 3600 /* seconds */
+/* snapper layout, <dir>/<number>/snapshot */
+#define SNAPSHOTS_DIR "/.snapshots"
+
 struct config config;
 
 static econf_err
@@ -70,6 +84,135 @@ getStringValueDef(econf_file *key_file, const char *group, const char *key, char
   return 0;
 }
 
+static int
+getUIntValueDef(econf_file *key_file, const char *group, const char *key, uint32_t *val, uint32_t def)
+{
+  econf_err error;
+
+  /* first try, special (client, daemon) group */
+  error = econf_getUIntValue(key_file, group, key, val);
+  if (!error)
+    return 0;
+
+  /* second try, use "default" group */
+  if (error && error == ECONF_NOKEY)
+    error = econf_getUIntValueDef(key_file, "default", key, val, def);
+
+  if (error && error != ECONF_NOKEY)
+    {
+      log_msg(LOG_ERR, "ERROR (econf): cannot get key '%s': %s",
+	      key, econf_errString(error));
+      return -1;
+    }
+
+  return 0;
+}
+
+/* split a list of URLs separated by spaces or commas */
+static int
+split_list(char *s, char ***res)
+{
+  char **l, *saveptr = NULL;
+  size_t n = 0;
+
+  *res = NULL;
+  if (s == NULL)
+    return 0;
+
+  /* at most one entry per separator */
+  l = calloc(strlen(s) / 2 + 2, sizeof(char *));
+  if (l == NULL)
+    return -ENOMEM;
+
+  for (char *t = strtok_r(s, " ,", &saveptr); t; t = strtok_r(NULL, " ,", &saveptr))
+    {
+      l[n] = strdup(t);
+      if (l[n] == NULL)
+	{
+	  for (size_t i = 0; i < n; i++)
+	    free(l[i]);
+	  free(l);
+	  return -ENOMEM;
+	}
+      n++;
+    }
+
+  if (n == 0)
+    l = mfree(l);
+  *res = l;
+
+  return 0;
+}
+
+/* url has the highest priority, followed by the repositories in the
+   order they are listed. Duplicates are dropped. */
+static int
+set_repositories(char **extra)
+{
+  size_t n = 0;
+
+  config.repositories = calloc(strv_length(extra) + 2, sizeof(char *));
+  if (config.repositories == NULL)
+    return -ENOMEM;
+
+  if (config.url)
+    {
+      config.repositories[n] = strdup(config.url);
+      if (config.repositories[n] == NULL)
+	return -ENOMEM;
+      n++;
+    }
+
+  STRV_FOREACH(e, extra)
+    {
+      if (strv_contains(config.repositories, *e))
+	continue;
+      config.repositories[n] = strdup(*e);
+      if (config.repositories[n] == NULL)
+	return -ENOMEM;
+      n++;
+    }
+
+  if (n == 0)
+    config.repositories = mfree(config.repositories);
+
+  return 0;
+}
+
+/* used if there is no configuration file at all */
+static int
+set_default_config(void)
+{
+  config.verbose = false;
+  config.verify_signature = true;
+  config.url = NULL;
+  config.sysext_store_dir = strdup(SYSEXT_STORE_DIR);
+  config.extensions_dir = strdup(EXTENSIONS_DIR);
+  config.cache_dir = strdup(SYSEXTMGR_CACHE_DIR);
+  config.max_parallel_downloads = MAX_PARALLEL_DOWNLOADS;
+  config.max_parallel_scans = MAX_PARALLEL_SCANS;
+  config.remote_cache_ttl = REMOTE_CACHE_TTL;
+  config.idle_exit_timeout = IDLE_EXIT_TIMEOUT;
+  config.download_retries = DOWNLOAD_RETRIES;
+  config.watch_refresh_interval = WATCH_REFRESH_INTERVAL;
+  config.sysext_refresh = false;
+  config.peers = NULL;
+  config.mirrors = NULL;
+  config.repositories = NULL;
+  config.snapshots_dir = strdup(SNAPSHOTS_DIR);
+  config.gc_keep_versions = 0;
+  config.gc_max_store_size = 0;
+  config.gc_after_update = false;
+  config.background_downloads = false;
+  config.drop_page_cache = true;
+
+  if (config.sysext_store_dir == NULL || config.extensions_dir == NULL ||
+      config.cache_dir == NULL || config.snapshots_dir == NULL)
+    return -ENOMEM;
+
+  return 0;
+}
+
 int
 load_config(const char *defgroup)
 {
@@ -81,7 +224,7 @@ load_config(const char *defgroup)
     {
       /* ignore if there is no configuration file at all */
       if (error == ECONF_NOFILE)
-	return 0;
+	return set_default_config();
 
       log_msg(LOG_ERR, "econf_readConfig: %s\n",
 	      econf_errString(error));
@@ -109,6 +252,73 @@ load_config(const char *defgroup)
       r = getStringValueDef(key_file, defgroup, "extensions_dir", &config.extensions_dir, EXTENSIONS_DIR);
       if (r < 0)
 	return r;
+      r = getStringValueDef(key_file, defgroup, "cache_dir", &config.cache_dir, SYSEXTMGR_CACHE_DIR);
+      if (r < 0)
+	return r;
+      r = getUIntValueDef(key_file, defgroup, "max_parallel_downloads", &config.max_parallel_downloads, MAX_PARALLEL_DOWNLOADS);
+      if (r < 0)
+	return r;
+      r = getUIntValueDef(key_file, defgroup, "max_parallel_scans", &config.max_parallel_scans, MAX_PARALLEL_SCANS);
+      if (r < 0)
+	return r;
+      r = getUIntValueDef(key_file, defgroup, "remote_cache_ttl", &config.remote_cache_ttl, REMOTE_CACHE_TTL);
+      if (r < 0)
+	return r;
+      r = getUIntValueDef(key_file, defgroup, "idle_exit_timeout", &config.idle_exit_timeout, IDLE_EXIT_TIMEOUT);
+      if (r < 0)
+	return r;
+      r = getUIntValueDef(key_file, defgroup, "download_retries", &config.download_retries, DOWNLOAD_RETRIES);
+      if (r < 0)
+	return r;
+      r = getUIntValueDef(key_file, defgroup, "watch_refresh_interval", &config.watch_refresh_interval, WATCH_REFRESH_INTERVAL);
+      if (r < 0)
+	return r;
+      r = getBoolValueDef(key_file, defgroup, "sysext_refresh", &config.sysext_refresh, false);
+      if (r < 0)
+	return r;
+      _cleanup_free_ char *peers = NULL;
+      r = getStringValueDef(key_file, defgroup, "peers", &peers, NULL);
+      if (r < 0)
+	return r;
+      r = split_list(peers, &config.peers);
+      if (r < 0)
+	return r;
+      _cleanup_free_ char *mirrors = NULL;
+      r = getStringValueDef(key_file, defgroup, "mirrors", &mirrors, NULL);
+      if (r < 0)
+	return r;
+      r = split_list(mirrors, &config.mirrors);
+      if (r < 0)
+	return r;
+      _cleanup_free_ char *repositories = NULL;
+      _cleanup_strv_free_ char **extra = NULL;
+      r = getStringValueDef(key_file, defgroup, "repositories", &repositories, NULL);
+      if (r < 0)
+	return r;
+      r = split_list(repositories, &extra);
+      if (r < 0)
+	return r;
+      r = set_repositories(extra);
+      if (r < 0)
+	return r;
+      r = getStringValueDef(key_file, defgroup, "snapshots_dir", &config.snapshots_dir, SNAPSHOTS_DIR);
+      if (r < 0)
+	return r;
+      r = getUIntValueDef(key_file, defgroup, "gc_keep_versions", &config.gc_keep_versions, 0);
+      if (r < 0)
+	return r;
+      r = getUIntValueDef(key_file, defgroup, "gc_max_store_size", &config.gc_max_store_size, 0);
+      if (r < 0)
+	return r;
+      r = getBoolValueDef(key_file, defgroup, "gc_after_update", &config.gc_after_update, false);
+      if (r < 0)
+	return r;
+      r = getBoolValueDef(key_file, defgroup, "background_downloads", &config.background_downloads, false);
+      if (r < 0)
+	return r;
+      r = getBoolValueDef(key_file, defgroup, "drop_page_cache", &config.drop_page_cache, true);
+      if (r < 0)
+	return r;
     }
   return 0;
 }
@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/* The images linked from extensions_dir. Kept apart from the scans of
+   images-list.c, so that sysextmgrcli can use it without sysextmgrd. */
+
+#include "config.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "basics.h"
+#include "sysextmgr.h"
+#include "log_msg.h"
+#include "discover-images.h"
+
+static int
+readlink_malloc(const char *path, const char *name, char **ret)
+{
+  _cleanup_free_ char *fn = NULL;
+  _cleanup_free_ char *buf = NULL;
+  ssize_t nbytes, bufsiz;
+  struct stat sb;
+
+  if (asprintf(&fn, "%s/%s", path, name) < 0)
+    return -ENOMEM;
+
+  if (lstat(fn, &sb) == -1)
+    {
+      perror("lstat");
+      return -errno;
+    }
+
+  /* Add one to the link size, so that we can determine whether
+     the buffer returnd by readlink() was truncated. */
+  bufsiz = sb.st_size + 1;
+
+  /* Some magic symlinks under (for example) /proc and /sys
+     report 'st_size' as zero. In that case, take PATH_MAX as
+     a "good enough" estimate. */
+  if (sb.st_size == 0)
+    bufsiz = PATH_MAX;
+
+  buf = malloc(bufsiz);
+  if (buf == NULL)
+    return -ENOMEM;
+
+  nbytes = readlink(fn, buf, bufsiz);
+  if (nbytes == -1)
+    return -errno;
+
+  if (nbytes == bufsiz)
+    {
+      log_msg(LOG_CRIT, "Returned buffer may have been truncated!");
+      exit(EXIT_FAILURE);
+    }
+
+  /* It doesn't contain a terminating null byte ('\0'). */
+  buf[nbytes] = '\0';
+
+  *ret = TAKE_PTR(buf);
+
+  return 0;
+}
+
+static int
+image_filter(const struct dirent *de)
+{
+  if (endswith(de->d_name, ".raw") || endswith(de->d_name, ".img"))
+    return 1;
+  return 0;
+}
+
+int
+discover_images(const char *path, char ***result)
+{
+  struct dirent **de = NULL;
+  int r;
+
+  assert(result);
+
+  int num_dirs = scandir(path, &de, image_filter, alphasort);
+  if (num_dirs < 0)
+    return -errno;
+
+  if (num_dirs > 0)
+    {
+      *result = malloc((num_dirs+1) * sizeof(char *));
+      if (*result == NULL)
+	oom();
+      (*result)[num_dirs] = NULL;
+
+      for (int i = 0; i < num_dirs; i++)
+      {
+	if (de[i]->d_type == DT_LNK)
+	  {
+	    _cleanup_free_ char *fn = NULL;
+	    char *p;
+
+	    r = readlink_malloc(path, de[i]->d_name, &fn);
+	    if (r < 0)
+	      return r;
+
+	    p = strrchr(fn, '/');
+	    if (p)
+	      (*result)[i] = strdup(++p);
+	    else
+	      (*result)[i] = strdup(fn);
+	  }
+	else
+	  (*result)[i] = strdup(de[i]->d_name);
+
+	if ((*result)[i] == NULL)
+	  oom();
+	free(de[i]);
+      }
+      free(de);
+    }
+
+  return 0;
+}
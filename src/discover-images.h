@@ -0,0 +1,7 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+/* The file names of the images in path, for links the name of the
+   target. result stays unset if there is none. */
+extern int discover_images(const char *path, char ***result);
@@ -8,11 +8,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/wait.h>
-
 #include "download.h"
 
+#ifndef SYSTEMD_PULL_PATH
 #define SYSTEMD_PULL_PATH "/usr/lib/systemd/systemd-pull"
+#endif
+#define BSPATCH_PATH "/usr/bin/bspatch"
 
 
 int
@@ -39,49 +40,82 @@ join_path(const char *url, const char *suffix, char **ret)
 }
 
 
+/* Queue the download of url/fn to destfn in the pool, done gets
+   called with the exit status of systemd-pull. batch is optional. */
 /* XXX see sysupdate-resource.c/download_manifest */
 int
-download(const char *url, const char *fn, const char *destfn, bool verify_signature)
+download_submit(struct process_pool *pool, struct process_batch *batch,
+		const char *url, const char *fn, const char *destfn,
+		bool verify_signature, process_done_t done, void *userdata)
 {
   _cleanup_(freep) char *fullurl = NULL;
-  pid_t pid;
-  int status, r;
+  int r;
+
+  assert(pool);
 
   r = join_path(url, fn, &fullurl);
   if (r < 0)
     return r;
 
-  /* XXX safe_fork_full() */
-  pid = fork();
-  if (pid < 0)
-    return -errno;
-
-  if (pid == 0)
-    {
-      const char *const cmdline[] = {
-	SYSTEMD_PULL_PATH,
-	"raw",
-	"--direct",                        /* just download the specified URL, don't download anything else */
-	"--verify", verify_signature ? "signature" : "no", /* verify the manifest file */
-	fullurl,
-	destfn,
-	NULL
-      };
-      /* XXX (void) close_all_fds(NULL, 0); */
-      /* XXX r = invoke_callout_binary(SYSTEMD_PULL_PATH, (char *const*) cmdline); */
-
-      execv (SYSTEMD_PULL_PATH, (char *const *)cmdline);
-      fprintf(stderr, "execl(): %s", strerror (errno));
-      exit (0);
-    }
-
-  /* r = wait_for_terminate_and_check("(sd-pull)", pid, WAIT_LOG); */
-  r = waitpid (pid, &status, 0);
-  if (r == -1)
-    return -errno;
-
-  if (status)
-    return status;
+  const char *const cmdline[] = {
+    SYSTEMD_PULL_PATH,
+    "raw",
+    "--direct",                        /* just download the specified URL, don't download anything else */
+    "--verify", verify_signature ? "signature" : "no", /* verify the manifest file */
+    fullurl,
+    destfn,
+    NULL
+  };
+
+  return process_pool_submit(pool, batch, cmdline, -EBADF, done, userdata);
+}
 
-  return 0;
+/* Synchronous download of a single file. Returns a negative errno
+   value or the exit status of systemd-pull. */
+int
+download(const char *url, const char *fn, const char *destfn, bool verify_signature)
+{
+  _cleanup_(free_process_poolp) struct process_pool *pool = NULL;
+  int status = 0, r;
+
+  r = process_pool_new(&pool, NULL, 1);
+  if (r < 0)
+    return r;
+
+  r = download_submit(pool, NULL, url, fn, destfn, verify_signature,
+		      process_store_status, &status);
+  if (r < 0)
+    return r;
+
+  r = process_pool_wait(pool);
+  if (r < 0)
+    return r;
+
+  return status;
+}
+
+/* delta updates need bspatch, which is optional */
+bool
+delta_supported(void)
+{
+  return access(BSPATCH_PATH, X_OK) == 0;
+}
+
+/* Queue the creation of destfn from base and the delta file. */
+int
+delta_submit(struct process_pool *pool, struct process_batch *batch,
+	     const char *base, const char *deltafn, const char *destfn,
+	     process_done_t done, void *userdata)
+{
+  const char *const cmdline[] = {
+    BSPATCH_PATH,
+    base,
+    destfn,
+    deltafn,
+    NULL
+  };
+
+  assert(pool);
+
+  return process_pool_submit(pool, batch, cmdline, -EBADF, done, userdata);
 }
@@ -4,6 +4,17 @@
 
 #include <stdbool.h>
 
+#include "process-pool.h"
+
 extern int join_path(const char *url, const char *suffix, char **ret);
+extern int download_submit(struct process_pool *pool,
+		struct process_batch *batch, const char *url, const char *fn,
+		const char *destfn, bool verify_signature,
+		process_done_t done, void *userdata);
 extern int download(const char *url, const char *fn, const char *dest, bool verify_signature);
+extern bool delta_supported(void);
+extern int delta_submit(struct process_pool *pool,
+		struct process_batch *batch, const char *base,
+		const char *deltafn, const char *destfn,
+		process_done_t done, void *userdata);
 
@@ -8,20 +8,26 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/wait.h>
 
 #include "download.h"
+#include "raw-image.h"
 #include "extract.h"
+#include "log_msg.h"
 
 #define SYSTEMD_DISSECT_PATH "/usr/bin/systemd-dissect"
 
-/* XXX see sysupdate-resource.c/download_manifest */
+/* Write the extension-release file of path/name to outfd, done gets
+   called with the exit status. Simple images are read directly,
+   for all others systemd-dissect gets queued. */
 int
-extract(const char *path, const char *name, int outfd)
+extract_submit(struct process_pool *pool, struct process_batch *batch,
+	       const char *path, const char *name, int outfd,
+	       process_done_t done, void *userdata)
 {
   _cleanup_free_ char *fn = NULL, *erf = NULL;
-  pid_t pid;
-  int status, r;
+  int r;
+
+  assert(pool);
 
   if (!endswith(name, ".raw") && !endswith(name, ".img"))
     return -EINVAL;
@@ -36,41 +42,49 @@ extract(const char *path, const char *name, int outfd)
   /* remove .raw/.img */
   erf[strlen(erf) - 4] = '\0';
 
-  /* XXX safe_fork_full() */
-  pid = fork();
-  if (pid < 0)
-    return -errno;
-
-  if (pid == 0)
+  /* no process, loop device and mount for a single small file */
+  r = raw_image_copy_file(fn, erf, outfd);
+  if (r >= 0)
     {
-      const char *const cmdline[] = {
-	SYSTEMD_DISSECT_PATH,
-	"--copy-from",
-	fn,
-	erf,
-	"-",
-	NULL
-      };
-      close(1);
-      r = dup2(outfd, 1);
-      if (r < 0)
-	return r;
-
-      /* XXX (void) close_all_fds(NULL, 0); */
-      /* XXX r = invoke_callout_binary(SYSTEMD_PULL_PATH, (char *const*) cmdline); */
-
-      execv (SYSTEMD_DISSECT_PATH, (char *const *)cmdline);
-      fprintf(stderr, "execl(): %s", strerror (errno));
-      exit (0);
+      process_pool_complete(pool, batch, 0, done, userdata);
+      return 0;
     }
+  if (r != -EOPNOTSUPP)
+    log_msg(LOG_DEBUG, "Reading '%s' from '%s' failed, using systemd-dissect: %s",
+	    erf, fn, strerror(-r));
+
+  const char *const cmdline[] = {
+    SYSTEMD_DISSECT_PATH,
+    "--copy-from",
+    fn,
+    erf,
+    "-",
+    NULL
+  };
+
+  return process_pool_submit(pool, batch, cmdline, outfd, done, userdata);
+}
 
-  /* r = wait_for_terminate_and_check("(sd-pull)", pid, WAIT_LOG); */
-  r = waitpid (pid, &status, 0);
-  if (r == -1)
-    return -errno;
+/* Synchronous version, returns a negative errno value or the exit
+   status of systemd-dissect */
+int
+extract(const char *path, const char *name, int outfd)
+{
+  _cleanup_(free_process_poolp) struct process_pool *pool = NULL;
+  int status = 0, r;
 
-  if (WIFEXITED(status))
-    return WEXITSTATUS(status);
+  r = process_pool_new(&pool, NULL, 1);
+  if (r < 0)
+    return r;
+
+  r = extract_submit(pool, NULL, path, name, outfd,
+		     process_store_status, &status);
+  if (r < 0)
+    return r;
+
+  r = process_pool_wait(pool);
+  if (r < 0)
+    return r;
 
-  return 0;
+  return status;
 }
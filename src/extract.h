@@ -2,5 +2,11 @@
 
 #pragma once
 
+#include "process-pool.h"
+
+extern int extract_submit(struct process_pool *pool,
+		struct process_batch *batch, const char *path,
+		const char *name, int outfd,
+		process_done_t done, void *userdata);
 extern int extract(const char *path, const char *fn, int outfd);
 
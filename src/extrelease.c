@@ -1,80 +1,161 @@
 /* SPDX-License-Identifier: GPL-2.0-or-later */
 
 #include <assert.h>
+#include <errno.h>
 #include <unistd.h>
-#include <libeconf.h>
 
 #include "basics.h"
 #include "sysextmgr.h"
 #include "extrelease.h"
+#include "log_msg.h"
 
+/* extension-release files are small, same limit as in raw-image.c */
+#define MAX_EXT_RELEASE_SIZE (64*1024)
+
+/* the whole content of fd from the beginning, NUL terminated */
+static int
+read_full_fd(int fd, char **res)
+{
+  _cleanup_free_ char *buf = NULL;
+  size_t len = 0;
+
+  buf = malloc(MAX_EXT_RELEASE_SIZE + 1);
+  if (buf == NULL)
+    return -ENOMEM;
+
+  for (;;)
+    {
+      ssize_t n = pread(fd, buf + len, MAX_EXT_RELEASE_SIZE - len, len);
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -errno;
+	}
+      if (n == 0)
+	break;
+      len += n;
+      if (len == MAX_EXT_RELEASE_SIZE)
+	return -EFBIG;
+    }
+
+  buf[len] = '\0';
+  *res = TAKE_PTR(buf);
+
+  return 0;
+}
+
+/* remove the quotes of a value like in os-release(5), in place */
+static char *
+unquote(char *v)
+{
+  char *end = v + strlen(v);
+
+  while (end > v && strchr(WHITESPACE, end[-1]))
+    *--end = '\0';
+
+  if (*v == '\'' && end - v >= 2 && end[-1] == '\'')
+    {
+      end[-1] = '\0';
+      return v + 1;
+    }
+
+  if (*v == '"' && end - v >= 2 && end[-1] == '"')
+    {
+      char *r = v + 1, *w = v;
+
+      end[-1] = '\0';
+      while (*r)
+	{
+	  if (*r == '\\' && r[1] && strchr("\\\"$`", r[1]))
+	    r++;
+	  *w++ = *r++;
+	}
+      *w = '\0';
+    }
+
+  return v;
+}
+
+/* Parse the extension-release file which a helper wrote to fd,
+   without a round trip through the file system */
 int
-load_ext_release(const char *name, const char *fn, struct image_deps **res)
+load_ext_release(const char *name, int fd, struct image_deps **res)
 {
-  _cleanup_(econf_freeFilep) econf_file *key_file = NULL;
   _cleanup_(free_image_depsp) struct image_deps *e = NULL;
-  econf_err error;
+  _cleanup_free_ char *buf = NULL;
+  char *line, *next;
+  int r;
 
   assert(name);
-  assert(fn);
+  assert(fd >= 0);
   assert(res);
 
   e = calloc(1, sizeof(struct image_deps));
   if (e == NULL)
-    oom();
+    return -ENOMEM;
 
   e->image_name = strdup(name);
   if (e->image_name == NULL)
-    oom();
+    return -ENOMEM;
 
-  if ((error = econf_readFile(&key_file, fn, "=", "#")))
+  r = read_full_fd(fd, &buf);
+  if (r < 0)
     {
-      fprintf(stderr, "ERROR: couldn't read %s: %s\n", fn, econf_errString(error));
-      return -1;
+      log_msg(LOG_ERR, "Couldn't read extension-release of '%s': %s",
+	      name, strerror(-r));
+      return r;
     }
 
-  if ((error = econf_getStringValue(key_file, NULL, "ID", &(e->id))))
-    {
-      fprintf(stderr, "ERROR: couldn't get key 'ID' from %s: %s\n", fn, econf_errString(error));
-      return -1;
-    }
+  const struct {
+    const char *key;
+    char **value;
+  } keys[] = {
+    { "ID",                &e->id },
+    { "VERSION_ID",        &e->version_id },
+    { "SYSEXT_LEVEL",      &e->sysext_level },
+    { "SYSEXT_VERSION_ID", &e->sysext_version_id },
+    { "SYSEXT_SCOPE",      &e->sysext_scope },
+    { "ARCHITECTURE",      &e->architecture },
+  };
 
-  if ((error = econf_getStringValue(key_file, NULL, "VERSION_ID", &(e->version_id))))
+  for (line = buf; line; line = next)
     {
-      fprintf(stderr, "ERROR: couldn't get key 'VERSION_ID' from %s: %s\n", fn, econf_errString(error));
-      return -1;
-    }
+      char *eq, *key;
 
-  if ((error = econf_getStringValue(key_file, NULL, "SYSEXT_LEVEL", &(e->sysext_level)))
-      && error != ECONF_NOKEY)
-    {
-      fprintf(stderr, "ERROR: couldn't get key 'SYSEXT_LEVEL' from %s: %s\n",
-	      fn, econf_errString(error));
-      return -1;
-    }
+      next = strchr(line, '\n');
+      if (next)
+	*next++ = '\0';
 
-  if ((error = econf_getStringValue(key_file, NULL, "SYSEXT_VERSION_ID", &(e->sysext_version_id)))
-      && error != ECONF_NOKEY)
-    {
-      fprintf(stderr, "ERROR: couldn't get key 'SYSEXT_VERSION_ID' from %s: %s\n",
-	      fn, econf_errString(error));
-      return -1;
-    }
+      key = line + strspn(line, WHITESPACE);
+      if (*key == '\0' || *key == '#')
+	continue;
 
-  if ((error = econf_getStringValue(key_file, NULL, "SYSEXT_SCOPE", &(e->sysext_scope)))
-      && error != ECONF_NOKEY)
-    {
-      fprintf(stderr, "ERROR: couldn't get key 'SYSEXT_SCOPE' from %s: %s\n",
-	      fn, econf_errString(error));
-      return -1;
+      eq = strchr(key, '=');
+      if (eq == NULL)
+	continue;
+      *eq = '\0';
+      for (char *p = eq; p > key && strchr(WHITESPACE, p[-1]); p--)
+	p[-1] = '\0';
+
+      for (size_t i = 0; i < sizeof(keys)/sizeof(keys[0]); i++)
+	if (streq(key, keys[i].key))
+	  {
+	    char *v = unquote(eq + 1 + strspn(eq + 1, WHITESPACE));
+
+	    free(*keys[i].value);
+	    *keys[i].value = strdup(v);
+	    if (*keys[i].value == NULL)
+	      return -ENOMEM;
+	    break;
+	  }
     }
 
-  if ((error = econf_getStringValue(key_file, NULL, "ARCHITECTURE", &(e->architecture)))
-      && error != ECONF_NOKEY)
+  if (e->id == NULL || e->version_id == NULL)
     {
-      fprintf(stderr, "ERROR: couldn't get key 'ARCHITECTURE' from %s: %s\n",
-	      fn, econf_errString(error));
-      return -1;
+      log_msg(LOG_ERR, "Key '%s' missing in extension-release of '%s'",
+	      e->id ? "VERSION_ID" : "ID", name);
+      return -EINVAL;
     }
 
   *res = TAKE_PTR(e);
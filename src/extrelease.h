@@ -2,5 +2,4 @@
 
 #pragma once
 
-extern int load_ext_release(const char *name, const char *fn, struct image_deps **res);
-
+extern int load_ext_release(const char *name, int fd, struct image_deps **res);
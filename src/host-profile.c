@@ -0,0 +1,241 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "basics.h"
+#include "architecture.h"
+#include "extension-util.h"
+#include "host-profile.h"
+#include "strv.h"
+
+/* a catalog has only a handful of distinct tuples, more than this
+   get validated without remembering the result */
+#define MAX_MEMO 64
+
+/* values of struct image_deps which decide about the result */
+struct validate_memo {
+  char *id;
+  char *version_id;
+  char *sysext_level;
+  char *architecture;
+  char *sysext_scope;
+  const char *scope;   /* host scope, a static string of the caller */
+  bool valid;
+};
+
+struct host_profile {
+  struct osrelease *osrelease;
+  char **id_like;
+  const char *architecture;
+  char *fingerprint;
+  struct validate_memo memo[MAX_MEMO];
+  size_t n_memo;
+};
+
+static void
+free_validate_memo(struct validate_memo *m)
+{
+  m->id = mfree(m->id);
+  m->version_id = mfree(m->version_id);
+  m->sysext_level = mfree(m->sysext_level);
+  m->architecture = mfree(m->architecture);
+  m->sysext_scope = mfree(m->sysext_scope);
+}
+
+struct host_profile *
+free_host_profile(struct host_profile *p)
+{
+  if (!p)
+    return NULL;
+
+  for (size_t i = 0; i < p->n_memo; i++)
+    free_validate_memo(&p->memo[i]);
+  free_os_releasep(&p->osrelease);
+  strv_free(p->id_like);
+  free(p->fingerprint);
+
+  return mfree(p);
+}
+
+void
+free_host_profilep(struct host_profile **p)
+{
+  if (!p || !*p)
+    return;
+
+  *p = free_host_profile(*p);
+}
+
+static int
+split_id_like(const char *id_like, char ***res)
+{
+  _cleanup_free_ char *s = NULL;
+  char *saveptr = NULL;
+  char **l;
+  size_t n = 0;
+
+  *res = NULL;
+  if (isempty(id_like))
+    return 0;
+
+  s = strdup(id_like);
+  if (s == NULL)
+    return -ENOMEM;
+
+  /* at most one entry per separator */
+  l = calloc(strlen(s) / 2 + 2, sizeof(char *));
+  if (l == NULL)
+    return -ENOMEM;
+
+  for (char *t = strtok_r(s, WHITESPACE, &saveptr); t; t = strtok_r(NULL, WHITESPACE, &saveptr))
+    {
+      l[n] = strdup(t);
+      if (l[n] == NULL)
+	{
+	  strv_free(l);
+	  return -ENOMEM;
+	}
+      n++;
+    }
+
+  *res = l;
+
+  return 0;
+}
+
+int
+host_profile_new(struct osrelease *osrelease, struct host_profile **res)
+{
+  _cleanup_(free_os_releasep) struct osrelease *os = osrelease;
+  _cleanup_(free_host_profilep) struct host_profile *p = NULL;
+  int r;
+
+  assert(osrelease);
+  assert(res);
+
+  p = calloc(1, sizeof(struct host_profile));
+  if (p == NULL)
+    return -ENOMEM;
+
+  r = split_id_like(os->id_like, &p->id_like);
+  if (r < 0)
+    return r;
+
+  p->architecture = architecture_to_string(uname_architecture());
+  if (p->architecture == NULL)
+    return -EINVAL;
+
+  if (asprintf(&p->fingerprint, "%s\n%s\n%s\n%s\n%s", strempty(os->id),
+	       strempty(os->id_like), strempty(os->version_id),
+	       strempty(os->sysext_level), p->architecture) < 0)
+    {
+      p->fingerprint = NULL;
+      return -ENOMEM;
+    }
+
+  p->osrelease = TAKE_PTR(os);
+  *res = TAKE_PTR(p);
+
+  return 0;
+}
+
+/* All values validations depend on, data validated against another
+   host profile can be reused if the fingerprints are equal. */
+const char *
+host_profile_fingerprint(const struct host_profile *p)
+{
+  assert(p);
+
+  return p->fingerprint;
+}
+
+const char *
+host_profile_architecture(const struct host_profile *p)
+{
+  assert(p);
+
+  return p->architecture;
+}
+
+static bool
+memo_matches(const struct validate_memo *m, const char *scope,
+	     const struct image_deps *e)
+{
+  return streq_ptr(m->id, e->id) &&
+    streq_ptr(m->version_id, e->version_id) &&
+    streq_ptr(m->sysext_level, e->sysext_level) &&
+    streq_ptr(m->architecture, e->architecture) &&
+    streq_ptr(m->sysext_scope, e->sysext_scope) &&
+    streq_ptr(m->scope, scope);
+}
+
+static int
+strdup_or_null(const char *s, char **res)
+{
+  *res = NULL;
+  if (s == NULL)
+    return 0;
+
+  *res = strdup(s);
+  if (*res == NULL)
+    return -ENOMEM;
+
+  return 0;
+}
+
+static void
+memo_add(struct host_profile *p, const char *scope,
+	 const struct image_deps *e, bool valid)
+{
+  struct validate_memo *m;
+
+  if (p->n_memo >= MAX_MEMO)
+    return;
+
+  m = &p->memo[p->n_memo];
+  if (strdup_or_null(e->id, &m->id) < 0 ||
+      strdup_or_null(e->version_id, &m->version_id) < 0 ||
+      strdup_or_null(e->sysext_level, &m->sysext_level) < 0 ||
+      strdup_or_null(e->architecture, &m->architecture) < 0 ||
+      strdup_or_null(e->sysext_scope, &m->sysext_scope) < 0)
+    {
+      /* only an optimization */
+      free_validate_memo(m);
+      return;
+    }
+  m->scope = scope;
+  m->valid = valid;
+  p->n_memo++;
+}
+
+/* Like extension_release_validate_host(). With verbose the reason gets
+   printed for every image, so nothing is looked up. */
+int
+host_profile_validate(struct host_profile *p, const char *name,
+		      const char *scope, const struct image_deps *extension,
+		      bool verbose)
+{
+  int r;
+
+  assert(p);
+  assert(extension);
+
+  if (!verbose)
+    for (size_t i = 0; i < p->n_memo; i++)
+      if (memo_matches(&p->memo[i], scope, extension))
+	return p->memo[i].valid;
+
+  r = extension_release_validate_host(name, p->osrelease, p->id_like,
+				      p->architecture, scope, extension,
+				      verbose);
+  if (r >= 0)
+    memo_add(p, scope, extension, r > 0);
+
+  return r;
+}
@@ -0,0 +1,26 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "osrelease.h"
+#include "image-deps.h"
+
+/* The values of the host an extension gets validated against,
+   prepared once: ID_LIKE split, the architecture from uname and the
+   results of earlier validations. Images of a catalog share only a
+   few distinct extension-release tuples. */
+struct host_profile;
+
+extern struct host_profile *free_host_profile(struct host_profile *p);
+extern void free_host_profilep(struct host_profile **p);
+/* takes ownership of osrelease, also on failure */
+extern int host_profile_new(struct osrelease *osrelease,
+		struct host_profile **res);
+extern int host_profile_validate(struct host_profile *p, const char *name,
+		const char *scope, const struct image_deps *extension,
+		bool verbose);
+extern const char *host_profile_fingerprint(const struct host_profile *p);
+/* architecture_to_string() of the host */
+extern const char *host_profile_architecture(const struct host_profile *p);
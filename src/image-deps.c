@@ -1,5 +1,6 @@
 /* SPDX-License-Identifier: GPL-2.0-or-later */
 
+#include <errno.h>
 #include <systemd/sd-json.h>
 
 #include "basics.h"
@@ -44,6 +45,83 @@ free_image_deps_list(struct image_deps ***images)
   free(*images);
 }
 
+int
+dup_image_deps(const struct image_deps *e, struct image_deps **res)
+{
+  _cleanup_(free_image_depsp) struct image_deps *n = NULL;
+
+  n = calloc(1, sizeof(struct image_deps));
+  if (n == NULL)
+    return -ENOMEM;
+
+#define DUP_FIELD(f) \
+  if (e->f && (n->f = strdup(e->f)) == NULL) \
+    return -ENOMEM
+
+  DUP_FIELD(image_name);
+  DUP_FIELD(sysext_version_id);
+  DUP_FIELD(sysext_scope);
+  DUP_FIELD(id);
+  DUP_FIELD(sysext_level);
+  DUP_FIELD(version_id);
+  DUP_FIELD(architecture);
+#undef DUP_FIELD
+
+  if (e->sysext)
+    n->sysext = sd_json_variant_ref(e->sysext);
+
+  *res = TAKE_PTR(n);
+
+  return 0;
+}
+
+int
+dup_image_entry(const struct image_entry *e, struct image_entry **res)
+{
+  _cleanup_(free_image_entryp) struct image_entry *n = NULL;
+  int r;
+
+  n = calloc(1, sizeof(struct image_entry));
+  if (n == NULL)
+    return -ENOMEM;
+
+  if (e->name && (n->name = strdup(e->name)) == NULL)
+    return -ENOMEM;
+  if (e->sha256 && (n->sha256 = strdup(e->sha256)) == NULL)
+    return -ENOMEM;
+  if (e->version_key && (n->version_key = strdup(e->version_key)) == NULL)
+    return -ENOMEM;
+  if (e->repository && (n->repository = strdup(e->repository)) == NULL)
+    return -ENOMEM;
+  if (e->deltas)
+    {
+      size_t k = 0;
+
+      while (e->deltas[k])
+	k++;
+      n->deltas = calloc(k + 1, sizeof(char *));
+      if (n->deltas == NULL)
+	return -ENOMEM;
+      for (size_t i = 0; i < k; i++)
+	if ((n->deltas[i] = strdup(e->deltas[i])) == NULL)
+	  return -ENOMEM;
+    }
+  if (e->deps)
+    {
+      r = dup_image_deps(e->deps, &n->deps);
+      if (r < 0)
+	return r;
+    }
+  n->remote = e->remote;
+  n->local = e->local;
+  n->installed = e->installed;
+  n->compatible = e->compatible;
+
+  *res = TAKE_PTR(n);
+
+  return 0;
+}
+
 void
 dump_image_deps(struct image_deps *e)
 {
@@ -60,6 +138,12 @@ void
 free_image_entry(struct image_entry *e)
 {
   free(e->name);
+  free(e->sha256);
+  free(e->version_key);
+  free(e->repository);
+  for (size_t i = 0; e->deltas && e->deltas[i]; i++)
+    free(e->deltas[i]);
+  free(e->deltas);
   free_image_depsp(&(e->deps));
 }
 
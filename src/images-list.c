@@ -3,474 +3,1462 @@
 #include "config.h"
 
 #include <assert.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include <systemd/sd-json.h>
 
 #include "basics.h"
-#include "extension-util.h"
 #include "sysextmgr.h"
-#include "osrelease.h"
+#include "host-profile.h"
 #include "extrelease.h"
 #include "download.h"
 #include "extract.h"
+#include "sha256.h"
+#include "compress.h"
+#include "catalog-index.h"
 #include "tmpfile-util.h"
 #include "strv.h"
+#include "architecture.h"
+#include "version-key.h"
 #include "images-list.h"
+#include "sums.h"
+#include "discover-images.h"
+#include "metadata-cache.h"
+#include "store-lock.h"
+#include "metrics.h"
 #include "log_msg.h"
 
-static int
-readlink_malloc(const char *path, const char *name, char **ret)
+/* metadata of local and remote images, survives restarts of the daemon */
+static struct metadata_cache *local_cache = NULL;
+static struct metadata_cache *remote_cache = NULL;
+
+static struct metadata_cache *
+get_cache(struct metadata_cache **cache, const char *name)
 {
   _cleanup_free_ char *fn = NULL;
-  _cleanup_free_ char *buf = NULL;
-  ssize_t nbytes, bufsiz;
-  struct stat sb;
   int r;
 
-  r = join_path(path, name, &fn);
+  if (*cache)
+    return *cache;
+
+  r = join_path(config.cache_dir ? config.cache_dir : SYSEXTMGR_CACHE_DIR,
+		name, &fn);
   if (r < 0)
-    return r;
+    return NULL;
+
+  r = metadata_cache_open(fn, cache);
+  if (r < 0)
+    log_msg(LOG_WARNING, "Cannot use metadata cache '%s': %s", fn, strerror(-r));
+
+  return *cache;
+}
 
-  if (lstat(fn, &sb) == -1)
+/* Temporary file which receives the output of a helper process.
+   systemd-pull needs a path it can rename its download to, the
+   output of systemd-dissect only needs a memfd. */
+struct child_output {
+  char tmpfn[sizeof("/tmp/sysext-child.XXXXXX")];  /* empty for a memfd */
+  int fd;
+  int status;   /* exit status of the helper */
+  enum metric_phase phase;
+  uint64_t start;
+};
+
+/* process_done_t of the helpers, the time includes waiting for a
+   free slot in the pool */
+static int
+child_output_done(int status, void *userdata)
+{
+  struct child_output *o = userdata;
+
+  o->status = status;
+  metrics_record(o->phase, o->start, status != 0);
+
+  return 0;
+}
+
+static int
+child_output_init(struct child_output *o)
+{
+  strcpy(o->tmpfn, "/tmp/sysext-child.XXXXXX");
+  o->status = -1;
+  o->fd = mkostemp_safe(o->tmpfn);
+  if (o->fd < 0)
     {
-      perror("lstat");
-      return -errno;
+      int r = o->fd;
+
+      o->tmpfn[0] = '\0';
+      return r;
     }
 
-  /* Add one to the link size, so that we can determine whether
-     the buffer returnd by readlink() was truncated. */
-  bufsiz = sb.st_size + 1;
+  return 0;
+}
 
-  /* Some magic symlinks under (for example) /proc and /sys
-     report 'st_size' as zero. In that case, take PATH_MAX as
-     a "good enough" estimate. */
-  if (sb.st_size == 0)
-    bufsiz = PATH_MAX;
+static int
+child_output_init_memfd(struct child_output *o)
+{
+  o->tmpfn[0] = '\0';
+  o->status = -1;
+  o->fd = memfd_create("sysext-child", MFD_CLOEXEC);
+  if (o->fd < 0)
+    return -errno;
 
-  buf = malloc(bufsiz);
-  if (buf == NULL)
-    return -ENOMEM;
+  return 0;
+}
 
-  nbytes = readlink(fn, buf, bufsiz);
-  if (nbytes == -1)
-    return -errno;
+static void
+child_output_cleanup(struct child_output *o)
+{
+  if (o == NULL)
+    return;
 
-  if (nbytes == bufsiz)
+  if (o->fd >= 0)
+    {
+      close(o->fd);
+      o->fd = -EBADF;
+    }
+  if (!isempty(o->tmpfn))
     {
-      log_msg(LOG_CRIT, "Returned buffer may have been truncated!");
-      exit(EXIT_FAILURE);
+      (void) unlink(o->tmpfn);
+      o->tmpfn[0] = '\0';
     }
+}
+
+/* o must stay valid until the batch is finished */
+static int
+pull_submit(struct process_pool *pool, struct process_batch *batch,
+	    const char *url, const char *fn, bool verify_signature,
+	    enum metric_phase phase, struct child_output *o)
+{
+  int r;
 
-  /* It doesn't contain a terminating null byte ('\0'). */
-  buf[nbytes] = '\0';
+  r = child_output_init(o);
+  if (r < 0)
+    return r;
 
-  *ret = TAKE_PTR(buf);
+  o->phase = phase;
+  o->start = metrics_now();
 
-  return 0;
+  return download_submit(pool, batch, url, fn, o->tmpfn, verify_signature,
+			 child_output_done, o);
+}
+
+static int
+pull_check(const struct child_output *o, const char *url, const char *fn)
+{
+  if (o->status == 0)
+    return 0;
+
+  if (o->status < 0)
+    {
+      log_msg(LOG_ERR, "Failed to download '%s' from '%s': %s",
+	      fn, url, strerror(-o->status));
+      return o->status;
+    }
+
+  log_msg(LOG_ERR, "Failed to download '%s' from '%s': %i", fn, url, o->status);
+  return -EIO;
 }
 
 static int
-image_filter(const struct dirent *de)
+image_json_fn(const char *image_name, char **res)
 {
-  if (endswith(de->d_name, ".raw") || endswith(de->d_name, ".img"))
-    return 1;
+  char *jsonfn;
+
+  jsonfn = malloc(strlen(image_name) + strlen(".json") + 1);
+  if (jsonfn == NULL)
+    return -ENOMEM;
+  char *p = stpcpy(jsonfn, image_name);
+  strcpy(p, ".json");
+
+  *res = jsonfn;
+
   return 0;
 }
 
-int
-discover_images(const char *path, char ***result)
+/* the json file can contain the data of several images */
+static int
+image_json_from_file(int fd, const char *path, const char *jsonfn,
+		     const char *image_name, struct image_deps **res)
 {
-  struct dirent **de = NULL;
+  _cleanup_(free_image_deps_list) struct image_deps **images = NULL;
   int r;
 
-  assert(result);
+  r = load_image_json(fd, path, &images);
+  if (r < 0)
+    return r;
 
-  int num_dirs = scandir(path, &de, image_filter, alphasort);
-  if (num_dirs < 0)
-    return -errno;
+  if (images == NULL || images[0] == NULL)
+    {
+      log_msg(LOG_NOTICE, "No entry with dependencies found (%s)!", jsonfn);
+      return -ENOENT;
+    }
 
-  if (num_dirs > 0)
+  struct image_deps *found = NULL;
+  if (images[1] == NULL)
+    found = images[0];
+  else
     {
-      *result = malloc((num_dirs+1) * sizeof(char *));
-      if (*result == NULL)
-	oom();
-      (*result)[num_dirs] = NULL;
+      /* the file contains the data of several images, search the
+	 correct one */
+      for (size_t i = 0; images[i] != NULL && found == NULL; i++)
+	if (images[i]->image_name && streq(images[i]->image_name, image_name))
+	  found = images[i];
+
+      if (found == NULL)
+	{
+	  log_msg(LOG_NOTICE, "No entry for '%s' found (%s)!", image_name, jsonfn);
+	  return -ENOENT;
+	}
+    }
 
-      for (int i = 0; i < num_dirs; i++)
-      {
-	if (de[i]->d_type == DT_LNK)
-	  {
-	    _cleanup_free_ char *fn = NULL;
-	    char *p;
+  /* we cannot use TAKE_PTR, else the rest of the list will not be free'd */
+  return dup_image_deps(found, res);
+}
 
-	    r = readlink_malloc(path, de[i]->d_name, &fn);
-	    if (r < 0)
-	      return r;
+static int
+image_deps_cmp(const void *a, const void *b)
+{
+  const struct image_deps *const *d_a = a;
+  const struct image_deps *const *d_b = b;
 
-	    p = strrchr(fn, '/');
-	    if (p)
-	      (*result)[i] = strdup(++p);
-	    else
-	      (*result)[i] = strdup(fn);
-	  }
-	else
-	  (*result)[i] = strdup(de[i]->d_name);
+  return strcmp((*d_a)->image_name, (*d_b)->image_name);
+}
 
-	if ((*result)[i] == NULL)
-	  oom();
-	free(de[i]);
-      }
-      free(de);
+/* Repositories can provide the metadata of all images in one file
+   created with "sysextmgrcli merge-json". If this index exists, it
+   is used instead of one <image>.json download per image. A missing
+   or invalid index is not an error, the result is empty then. */
+static int
+image_index_from_file(const struct child_output *o, const char *url,
+		      const char *fn, struct image_deps ***res, size_t *nr)
+{
+  _cleanup_(free_image_deps_list) struct image_deps **images = NULL;
+  size_t n = 0;
+  int r;
+
+  assert(o);
+  assert(res);
+  assert(nr);
+
+  if (o->status < 0)
+    return o->status;
+  else if (o->status > 0)
+    {
+      log_msg(LOG_DEBUG, "No '%s' found at '%s', using json files of the images",
+	      fn, url);
+      return 0;
     }
 
+  r = load_image_json(o->fd, o->tmpfn, &images);
+  if (r < 0)
+    {
+      log_msg(LOG_WARNING, "Ignoring invalid '%s' from '%s': %s",
+	      fn, url, strerror(-r));
+      return 0;
+    }
+
+  /* entries without image name cannot be found, drop them */
+  for (size_t i = 0; images && images[i] != NULL; i++)
+    {
+      if (images[i]->image_name)
+	images[n++] = images[i];
+      else
+	free_image_depsp(&images[i]);
+    }
+  if (images)
+    images[n] = NULL;
+
+  if (n > 0)
+    qsort(images, n, sizeof(struct image_deps *), image_deps_cmp);
+
+  *nr = n;
+  *res = TAKE_PTR(images);
+
   return 0;
 }
 
+static const struct image_deps *
+image_index_lookup(struct image_deps **index, size_t n, const char *image_name)
+{
+  struct image_deps key = {
+    .image_name = (char *)image_name,
+  };
+  const struct image_deps *k = &key;
+  struct image_deps **e;
+
+  if (n == 0)
+    return NULL;
+
+  e = bsearch(&k, index, n, sizeof(struct image_deps *), image_deps_cmp);
+  if (e == NULL)
+    return NULL;
+
+  return *e;
+}
+
+/* Like image_index_from_file() for CATALOG_INDEX, the entries are
+   only read by the lookups */
 static int
-image_read_metadata(const char *image_name, struct image_deps **res)
+binary_index_from_file(const struct child_output *o, const char *url,
+		       struct catalog_index **res)
 {
-  _cleanup_(free_image_depsp) struct image_deps *image = NULL;
-  _cleanup_(unlink_tempfilep) char tmpfn[] = "/tmp/sysext-image-extrelease.XXXXXX";
   _cleanup_close_ int fd = -EBADF;
   int r;
 
-  assert(image_name);
+  assert(o);
   assert(res);
 
-  fd = mkostemp_safe(tmpfn);
+  if (o->status < 0)
+    return o->status;
+  else if (o->status > 0)
+    {
+      log_msg(LOG_DEBUG, "No '%s' found at '%s', using json files of the images",
+	      CATALOG_INDEX, url);
+      return 0;
+    }
+
+  fd = open(o->tmpfn, O_RDONLY|O_CLOEXEC);
+  if (fd < 0)
+    r = -errno;
+  else
+    r = catalog_index_open(fd, res);
+  if (r < 0)
+    log_msg(LOG_WARNING, "Ignoring invalid '%s' from '%s': %s",
+	    CATALOG_INDEX, url, strerror(-r));
+
+  return 0;
+}
+
+/* The signature of SHA256SUMS got verified by systemd-pull, files
+   listed there are downloaded without verification and checked
+   against the sum. Returns 0 if the file matches. */
+static int
+pull_verify_sum(const struct child_output *o, const char *fn, const char *hash)
+{
+  int r;
 
-  r = extract(SYSEXT_STORE_DIR, image_name, fd);
+  r = sha256_file_matches(o->tmpfn, hash);
   if (r < 0)
     {
-      log_msg(LOG_ERR, "Failed to extract extension-release from '%s': %s",
-	      image_name, strerror(-r));
+      log_msg(LOG_ERR, "Failed to hash '%s': %s", fn, strerror(-r));
       return r;
     }
-  else if (r > 0)
+  if (r == 0)
     {
-      log_msg(LOG_ERR, "Failed to extract extension-release from '%s': systemd-dissect failed (%i)",
-	      image_name, r);
-      return -EINVAL;
+      log_msg(LOG_ERR, "SHA256 sum of '%s' does not match SHA256SUMS", fn);
+      return -EBADMSG;
     }
 
-  r = load_ext_release(image_name, tmpfn, &image);
-  if (r < 0)
-    return r;
+  return 0;
+}
 
-  if (image)
-    *res = TAKE_PTR(image);
+/* Delta files are named "<new image>.from-<old image>.bsdiff", e.g.
+   "gcc-30.4.x86-64.raw.from-gcc-30.3.x86-64.raw.bsdiff". res
+   contains the old images for which a delta to image_name exists. */
+static int
+image_deltas(const struct sums *sums, const char *image_name, char ***res)
+{
+  _cleanup_strv_free_ char **l = NULL;
+  size_t len = strlen(image_name), k = 0;
+
+  for (size_t i = 0; i < sums->n_deltas; i++)
+    {
+      const struct sums_entry *d = &sums->deltas[i];
+      const char *old;
+      size_t old_len;
+
+      if (d->image_len != len || !strneq(d->fn, image_name, len))
+	continue;
+      old = d->fn + len + strlen(DELTA_FROM);
+      old_len = strlen(old);
+      if (old_len <= strlen(DELTA_SUFFIX))
+	continue;
+
+      if (l == NULL)
+	{
+	  l = calloc(sums->n_deltas - i + 1, sizeof(char *));
+	  if (l == NULL)
+	    return -ENOMEM;
+	}
+      l[k] = strndup(old, old_len - strlen(DELTA_SUFFIX));
+      if (l[k] == NULL)
+	return -ENOMEM;
+      k++;
+    }
+
+  if (k > 0)
+    *res = TAKE_PTR(l);
 
   return 0;
 }
 
+/* create "debug-tools" from "debug-tools-23.7.x86-64.raw" */
 static int
-image_json_from_url(const char *url, const char *image_name,
-		    struct image_deps **res, bool verify_signature)
+image_name_from_fn(const char *fn, char **res)
 {
-  _cleanup_(unlink_tempfilep) char tmpfn[] = "/tmp/sysext-image-json.XXXXXX";
-  _cleanup_close_ int fd = -EBADF;
-  _cleanup_free_ char *jsonfn = NULL;
-  int r;
+  char *name;
 
-  assert(url);
-  assert(res);
+  name = strndup(fn, image_name_len(fn, strlen(fn)));
+  if (name == NULL)
+    return -ENOMEM;
 
-  fd = mkostemp_safe(tmpfn);
+  *res = name;
 
-  jsonfn = malloc(strlen(image_name) + strlen(".json") + 1);
-  char *p = stpcpy(jsonfn, image_name);
-  strcpy(p, ".json");
+  return 0;
+}
 
-  r = download(url, jsonfn, tmpfn, verify_signature);
-  if (r != 0)
+static void
+validate_images(struct image_entry **images, size_t n,
+		struct host_profile *host, bool verbose)
+{
+  uint64_t start = metrics_now();
+
+  if (host == NULL)
+    return;
+
+  for (size_t i = 0; i < n; i++)
+    if (images[i]->deps)
+      images[i]->compatible =
+	host_profile_validate(host, images[i]->deps->image_name, "system",
+			      images[i]->deps, verbose) > 0;
+
+  metrics_record(METRIC_VALIDATE, start, false);
+}
+
+/* json file of a remote image which is neither in the index nor in
+   the cache */
+struct json_pull {
+  struct child_output out;
+  size_t pos;          /* entry in the result list */
+  const char *image_name;
+  const char *hash;
+  const char *json_hash;  /* verify the json against this sum */
+  char *jsonfn;
+};
+
+/* An image of SHA256SUMS for the lazy fetch of the json files */
+struct remote_candidate {
+  size_t pos;          /* in images and list.images */
+  const char *name;
+  char *version_key;   /* of the version in the file name */
+  bool foreign;        /* the file name has another architecture */
+  bool requested;      /* json file got downloaded */
+};
+
+/* The names of SHA256SUMS and the index, the preferred one first. A
+   repository without one of them is not asked again for it until
+   the restart, the last name is always tried. */
+static const char *const sums_names[] = {
+#ifdef COMPRESSED_SUFFIX
+  "SHA256SUMS" COMPRESSED_SUFFIX,
+#endif
+  "SHA256SUMS",
+};
+static const char *const index_names[] = {
+  CATALOG_INDEX,
+#ifdef COMPRESSED_SUFFIX
+  SYSEXT_DEPS_INDEX COMPRESSED_SUFFIX,
+#endif
+  SYSEXT_DEPS_INDEX,
+};
+#define N_NAMES(l) (sizeof(l) / sizeof((l)[0]))
+static char **missing_sums[N_NAMES(sums_names)];
+static char **missing_index[N_NAMES(index_names)];
+
+struct catalog_file {
+  const char *const *names;
+  char ***missing;  /* URLs without names[i] */
+  size_t n;
+};
+
+static const struct catalog_file sums_file = {
+  sums_names, missing_sums, N_NAMES(sums_names)
+};
+static const struct catalog_file index_file = {
+  index_names, missing_index, N_NAMES(index_names)
+};
+
+/* first name from pos on the repository may have */
+static size_t
+catalog_file_first(const struct catalog_file *f, size_t pos, const char *url)
+{
+  while (pos < f->n - 1 && strv_contains(f->missing[pos], url))
+    pos++;
+
+  return pos;
+}
+
+/* Fetching the remote metadata runs in two steps: SHA256SUMS and
+   the index are downloaded at the same time, afterwards the json
+   files of all images missing in the index and in the cache. At most
+   the limit of the pool systemd-pull processes are running.
+   If the preferred names of SHA256SUMS or the index are missing, the
+   next ones are tried first, this costs one more round trip.
+   With lazy, the json files are downloaded in rounds instead, see
+   remote_scan_next_json(). */
+struct remote_scan {
+  struct process_pool *pool;
+  struct process_batch batch;
+  char *url;
+  char **filter;
+  bool verify_signature;
+  struct host_profile *host;
+  bool verbose;
+  size_t sums_pos;      /* in sums_file */
+  const char *sums_fn;
+  size_t index_pos;     /* in index_file */
+  const char *index_fn;
+  struct child_output sums;
+  struct child_output index_json;
+  struct sums list;
+  struct image_deps **index;
+  size_t n_index;
+  struct catalog_index *bindex;  /* if the index is CATALOG_INDEX */
+  struct image_entry **images;
+  size_t n_images;
+  struct json_pull *jp;
+  size_t n_jp;          /* of the current round */
+  bool lazy;
+  struct metadata_cache_keys seen;  /* entries of remote_cache in use */
+  struct remote_candidate *candidates;  /* by name, newest first */
+  size_t n_candidates;
+  image_list_done_t done;
+  void *userdata;
+};
+
+static void
+free_remote_scan(struct remote_scan *s)
+{
+  if (s == NULL)
+    return;
+
+  child_output_cleanup(&s->sums);
+  child_output_cleanup(&s->index_json);
+  for (size_t i = 0; i < s->n_jp; i++)
+    {
+      child_output_cleanup(&s->jp[i].out);
+      free(s->jp[i].jsonfn);
+    }
+  free(s->jp);
+  for (size_t i = 0; i < s->n_candidates; i++)
+    free(s->candidates[i].version_key);
+  free(s->candidates);
+  free_image_entry_list(&s->images);
+  free_image_deps_list(&s->index);
+  free_catalog_index(s->bindex);
+  free_sums(&s->list);
+  free(s->url);
+  strv_free(s->filter);
+  metadata_cache_keys_free(&s->seen);
+  free(s);
+}
+
+static void
+remote_scan_finish(struct remote_scan *s, int r)
+{
+  int k;
+
+  /* the cache is shared by all repositories, a filtered list does
+     not see all images */
+  if (r >= 0 && s->filter == NULL)
+    {
+      _cleanup_free_ char *prefix = NULL;
+
+      k = join_path(s->url, "", &prefix);
+      if (k >= 0)
+	k = metadata_cache_prune(remote_cache, prefix, &s->seen);
+      if (k < 0)
+	log_msg(LOG_WARNING, "Failed to prune metadata cache: %s", strerror(-k));
+    }
+
+  k = metadata_cache_save(remote_cache);
+  if (k < 0)
+    log_msg(LOG_WARNING, "Failed to write metadata cache: %s", strerror(-k));
+
+  if (r < 0)
+    s->done(r, NULL, 0, s->userdata);
+  else
     {
+      size_t n = s->n_images;
+
+      s->n_images = 0;
+      s->done(0, TAKE_PTR(s->images), n, s->userdata);
+    }
+
+  free_remote_scan(s);
+}
+
+static int
+remote_scan_parse_json(struct remote_scan *s)
+{
+  struct metadata_cache *cache = get_cache(&remote_cache, "remote-meta.json");
+  int r;
+
+  for (size_t i = 0; i < s->n_jp; i++)
+    {
+      struct json_pull *jp = &s->jp[i];
+      struct image_entry *e = s->images[jp->pos];
+
+      r = pull_check(&jp->out, s->url, jp->jsonfn);
       if (r < 0)
+	return r;
+
+      if (jp->json_hash)
 	{
-	  log_msg(LOG_ERR, "Failed to download '%s' from '%s': %s",
-		  jsonfn, url, strerror(-r));
-	  return r;
+	  r = pull_verify_sum(&jp->out, jp->jsonfn, jp->json_hash);
+	  if (r < 0)
+	    return r;
 	}
-      else
+
+      r = image_json_from_file(jp->out.fd, jp->out.tmpfn, jp->jsonfn,
+			       jp->image_name, &e->deps);
+      if (r < 0)
+	return r;
+
+      /* hash is the SHA256 sum of the image from SHA256SUMS. The json
+	 file describes the content of the image, so as long as the
+	 image did not change, a cached copy of the json file is still
+	 valid. */
+      if (cache && !isempty(jp->hash))
 	{
-	  log_msg(LOG_ERR, "Failed to download '%s' from '%s': %i", jsonfn, url, r);
-	  /* XXX
-	     if (WIFEXITED(status)) {
-	     printf("exited, status=%d\n", WEXITSTATUS(status));
-	     } else if (WIFSIGNALED(status)) {
-	     printf("killed by signal %d\n", WTERMSIG(status));
-	     } else if (WIFSTOPPED(status)) {
-	     printf("stopped by signal %d\n", WSTOPSIG(status));
-	     }
-	  */
-	  return -EIO;
+	  _cleanup_free_ char *jsonurl = NULL;
+
+	  r = join_path(s->url, jp->jsonfn, &jsonurl);
+	  if (r < 0)
+	    return r;
+
+	  r = metadata_cache_update(cache, jsonurl, jp->hash, e->deps);
+	  if (r >= 0)
+	    r = metadata_cache_keys_add(&s->seen, jsonurl);
+	  if (r < 0)
+	    log_msg(LOG_WARNING, "Failed to cache metadata of '%s': %s",
+		    jsonurl, strerror(-r));
 	}
     }
 
-  _cleanup_(free_image_deps_list) struct image_deps **images = NULL;
-  r = load_image_json(fd, tmpfn, &images);
+  /* the next round starts with an empty list */
+  for (size_t i = 0; i < s->n_jp; i++)
+    {
+      child_output_cleanup(&s->jp[i].out);
+      s->jp[i].jsonfn = mfree(s->jp[i].jsonfn);
+    }
+  s->n_jp = 0;
+
+  return 0;
+}
+
+/* Adds the json file of image pos to the downloads of this round */
+static int
+remote_scan_queue_json(struct remote_scan *s, size_t pos)
+{
+  const struct sums_entry *l = &s->list.images[pos];
+  struct json_pull *jp = &s->jp[s->n_jp];
+  int r;
+
+  *jp = (struct json_pull) { .out.fd = -EBADF };
+  r = image_json_fn(l->fn, &jp->jsonfn);
   if (r < 0)
     return r;
+  s->n_jp++;
 
-  if (images == NULL || images[0] == NULL)
+  jp->pos = pos;
+  jp->image_name = l->fn;
+  jp->hash = l->hash;
+  if (s->verify_signature)
+    jp->json_hash = sums_json_hash(&s->list, jp->jsonfn);
+
+  return 0;
+}
+
+static void remote_scan_json_done(int error, void *userdata);
+
+/* Download the json files of this round, the batch is done at once
+   if there are none */
+static void
+remote_scan_pull_json(struct remote_scan *s, int r)
+{
+  process_batch_begin(&s->batch, remote_scan_json_done, s);
+  for (size_t i = 0; i < s->n_jp && r >= 0; i++)
+    r = pull_submit(s->pool, &s->batch, s->url, s->jp[i].jsonfn,
+		    s->verify_signature && s->jp[i].json_hash == NULL,
+		    METRIC_JSON_FETCH, &s->jp[i].out);
+  process_batch_end(&s->batch, r);
+}
+
+/* Only the newest compatible version of an image is looked for by
+   Check, Update and Install. Per name the images without metadata
+   are downloaded newest first, one per round, until an image is
+   compatible with the host. Images of another architecture are
+   skipped without download. The order comes from the file names,
+   see image_name_len(). */
+static void
+remote_scan_next_json(struct remote_scan *s)
+{
+  int r = 0;
+
+  for (size_t i = 0; i < s->n_candidates && r >= 0; )
     {
-      log_msg(LOG_NOTICE, "No entry with dependencies found (%s)!", jsonfn);
-      return -ENOENT;
+      const char *name = s->candidates[i].name;
+      bool found = false;
+
+      for (; i < s->n_candidates && streq(s->candidates[i].name, name); i++)
+	{
+	  struct remote_candidate *c = &s->candidates[i];
+	  const struct image_entry *e = s->images[c->pos];
+
+	  if (found || c->foreign)
+	    continue;
+
+	  if (e->deps)
+	    found = host_profile_validate(s->host, e->deps->image_name,
+					  "system", e->deps, false) > 0;
+	  else if (!c->requested)
+	    {
+	      /* the next round decides whether older ones are needed */
+	      r = remote_scan_queue_json(s, c->pos);
+	      if (r < 0)
+		break;
+	      c->requested = true;
+	      found = true;
+	    }
+	}
     }
 
-  if (images[1] == NULL)
-      *res = TAKE_PTR(images[0]);
-  else
+  if (s->n_jp > 0)
+    log_msg(LOG_DEBUG, "Fetching %zu json files from '%s'", s->n_jp, s->url);
+
+  remote_scan_pull_json(s, r);
+}
+
+static void
+remote_scan_json_done(int error, void *userdata)
+{
+  struct remote_scan *s = userdata;
+  bool more = s->lazy && s->n_jp > 0;
+
+  if (error >= 0)
+    error = remote_scan_parse_json(s);
+
+  if (error >= 0 && more)
     {
-      /* XXX go through the list and search the corret image */
-      /* XXX we cannot use TAKE_PTR else the rest of the list will not be free'd */
-      log_msg(LOG_ERR, "More than one entry found, not implemented yet!");
-      exit(EXIT_FAILURE);
+      remote_scan_next_json(s);
+      return;
     }
 
-  return 0;
+  if (error >= 0)
+    {
+      validate_images(s->images, s->n_images, s->host, s->verbose);
+
+      if (s->lazy)
+	for (size_t i = 0; i < s->n_images; i++)
+	  if (s->images[i]->deps == NULL)
+	    metrics_count(METRIC_METADATA_SKIPPED, 1);
+    }
+
+  remote_scan_finish(s, error);
 }
 
 static int
-image_list_from_url(const char *url, char ***result, bool verify_signature)
+remote_candidate_cmp(const void *a, const void *b)
 {
-  _cleanup_(unlink_tempfilep) char tmpfn[] = "/tmp/sysext-SHA256SUMS.XXXXXX";
-  _cleanup_close_ int fd = -EBADF;
-  _cleanup_fclose_ FILE *fp = NULL;
+  const struct remote_candidate *c_a = a;
+  const struct remote_candidate *c_b = b;
   int r;
 
-  assert(url);
-  assert(result);
+  r = strcmp(c_a->name, c_b->name);
+  if (r != 0)
+    return r;
 
-  fd = mkostemp_safe(tmpfn);
+  /* newest first, images without version last */
+  if (c_a->version_key == NULL || c_b->version_key == NULL)
+    return (c_a->version_key == NULL) - (c_b->version_key == NULL);
 
-  r = download(url, "SHA256SUMS", tmpfn, verify_signature);
-  if (r != 0)
+  return strcmp(c_b->version_key, c_a->version_key);
+}
+
+/* Version and architecture of "debug-tools-23.7.x86-64.raw" as cut
+   off by image_name_len(). The architecture only counts if it is a
+   known one, "foo-1.0.raw" has version "1" and no architecture. */
+static int
+remote_candidate_init(struct remote_candidate *c, const struct sums_entry *l,
+		      const char *host_arch)
+{
+  const char *fn = l->fn, *ext, *dot, *version;
+  _cleanup_free_ char *v = NULL;
+  int r;
+
+  ext = strrchr(fn, '.');
+  if (ext == NULL || (size_t) (ext - fn) <= l->name_len)
+    return 0;
+
+  dot = memrchr(fn, '.', ext - fn);
+  if (dot && (size_t) (dot - fn) > l->name_len)
     {
+      _cleanup_free_ char *a = strndup(dot + 1, ext - dot - 1);
+
+      if (a == NULL)
+	return -ENOMEM;
+      c->foreign = architecture_from_string(a) >= 0 && !streq(a, host_arch);
+      ext = dot;
+    }
+
+  version = fn + l->name_len + 1;
+  if (version >= ext)
+    return 0;
+
+  v = strndup(version, ext - version);
+  if (v == NULL)
+    return -ENOMEM;
+
+  r = version_key_new(v, &c->version_key);
+  if (r < 0)
+    return r;
+
+  return 0;
+}
+
+static int
+remote_scan_candidates(struct remote_scan *s)
+{
+  const char *arch = host_profile_architecture(s->host);
+  int r;
+
+  s->candidates = calloc(s->n_images + 1, sizeof(struct remote_candidate));
+  if (s->candidates == NULL)
+    return -ENOMEM;
+
+  for (size_t i = 0; i < s->n_images; i++)
+    {
+      struct remote_candidate *c = &s->candidates[s->n_candidates++];
+
+      c->pos = i;
+      c->name = s->images[i]->name;
+      r = remote_candidate_init(c, &s->list.images[i], arch);
       if (r < 0)
+	return r;
+    }
+
+  if (s->n_candidates > 1)
+    qsort(s->candidates, s->n_candidates, sizeof(struct remote_candidate),
+	  remote_candidate_cmp);
+
+  return 0;
+}
+
+/* Returns 1 and a copy of the entry of l if it is in the index */
+static int
+remote_scan_index_lookup(const struct remote_scan *s,
+			 const struct sums_entry *l, struct image_deps **res)
+{
+  const struct image_deps *d;
+  int r;
+
+  if (s->bindex)
+    {
+      r = catalog_index_lookup(s->bindex, l->fn, l->name_len, res);
+      if (r < 0 && r != -ENOMEM)
 	{
-	  log_msg(LOG_ERR, "Failed to download 'SHA256SUMS' from '%s': %s",
-		  url, strerror(-r));
-	  return r;
+	  /* the json file of the image is used instead */
+	  log_msg(LOG_WARNING, "Ignoring invalid entry of '%s' in '%s': %s",
+		  l->fn, CATALOG_INDEX, strerror(-r));
+	  return 0;
 	}
-      else
+      return r;
+    }
+
+  d = image_index_lookup(s->index, s->n_index, l->fn);
+  if (d == NULL)
+    return 0;
+
+  r = dup_image_deps(d, res);
+  if (r < 0)
+    return r;
+
+  return 1;
+}
+
+/* SHA256SUMS and the index are there, take the metadata from the
+   index or the cache and download the missing json files, with lazy
+   only the needed ones. Returns an error only if no download got
+   started. */
+static int
+remote_scan_fetch_json(struct remote_scan *s)
+{
+  struct metadata_cache *cache;
+  size_t n;
+  int r;
+
+  r = pull_check(&s->sums, s->url, s->sums_fn);
+  if (r < 0)
+    return r;
+
+  r = sums_from_file(s->sums.tmpfn, s->filter, &s->list);
+  if (r < 0)
+    return r;
+
+  /* the list is already filtered */
+  n = s->list.n_images;
+  if (n > 0 && s->verify_signature && s->index_json.status == 0)
+    {
+      const char *hash = sums_json_hash(&s->list, s->index_fn);
+      const char *plain_hash = NULL;
+
+      /* systemd-pull decompresses what it recognizes, then the sum
+	 of the uncompressed index matches */
+      if (compression_from_suffix(s->index_fn) != COMPRESSION_NONE)
+	plain_hash = sums_json_hash(&s->list, SYSEXT_DEPS_INDEX);
+
+      /* without a valid sum the index is not trusted, the json
+	 files of the images are used instead */
+      if (hash == NULL && plain_hash == NULL)
+	{
+	  log_msg(LOG_DEBUG, "'%s' is not in SHA256SUMS, ignoring it", s->index_fn);
+	  s->index_json.status = 1;
+	}
+      else if (plain_hash && (hash == NULL ||
+			      sha256_file_matches(s->index_json.tmpfn, hash) <= 0))
 	{
-	  log_msg(LOG_ERR, "Failed to download 'SHA256SUMS' from '%s': %i", url, r);
-	  /* XXX
-	     if (WIFEXITED(status)) {
-	     printf("exited, status=%d\n", WEXITSTATUS(status));
-	     } else if (WIFSIGNALED(status)) {
-	     printf("killed by signal %d\n", WTERMSIG(status));
-	     } else if (WIFSTOPPED(status)) {
-	     printf("stopped by signal %d\n", WSTOPSIG(status));
-	     }
-	  */
-	  return -EIO;
+	  if (pull_verify_sum(&s->index_json, s->index_fn, plain_hash) < 0)
+	    s->index_json.status = 1;
 	}
+      else if (pull_verify_sum(&s->index_json, s->index_fn, hash) < 0)
+	s->index_json.status = 1;
+    }
+  if (n > 0 && streq(s->index_fn, CATALOG_INDEX))
+    {
+      r = binary_index_from_file(&s->index_json, s->url, &s->bindex);
+      if (r < 0)
+	return r;
+    }
+  else if (n > 0)
+    {
+      r = image_index_from_file(&s->index_json, s->url, s->index_fn,
+				&s->index, &s->n_index);
+      if (r < 0)
+	return r;
     }
 
-  fp = fdopen(fd, "r");
-  if (!fp)
-    return -errno;
-
-  size_t cur_entry = 0, max_entry = 10;
-  *result = malloc((max_entry + 1) * sizeof(char *));
-  if (*result == NULL)
-    oom();
-  (*result)[0] = NULL;
+  s->images = calloc((n+1), sizeof(struct image_entry *));
+  if (s->images == NULL)
+    return -ENOMEM;
+  s->jp = calloc(n+1, sizeof(struct json_pull));
+  if (s->jp == NULL)
+    return -ENOMEM;
 
-  _cleanup_(freep) char *line = NULL;
-  size_t size = 0;
-  ssize_t nread;
+  cache = get_cache(&remote_cache, "remote-meta.json");
 
-  while ((nread = getline(&line, &size, fp)) != -1)
+  for (size_t i = 0; i < n; i++)
     {
-      /* Remove trailing newline character */
-      if (nread && line[nread-1] == '\n')
-	line[nread-1] = '\0';
+      const struct sums_entry *l = &s->list.images[i];
+      struct image_entry *e;
 
-      if (endswith(line, ".raw") || endswith(line, ".img"))
+      e = s->images[s->n_images] = calloc(1, sizeof(struct image_entry));
+      if (e == NULL)
+	return -ENOMEM;
+      s->n_images++;
+      e->name = strndup(l->fn, l->name_len);
+      if (e->name == NULL)
+	return -ENOMEM;
+      e->remote = true;
+      if (!isempty(l->hash))
 	{
-	  /* get image name, skip SHA256SUM hash and spaces */
-	  char *p = strchr(line, ' ');
-	  while (*p == ' ')
-	    ++p;
+	  e->sha256 = strdup(l->hash);
+	  if (e->sha256 == NULL)
+	    return -ENOMEM;
+	}
+      r = image_deltas(&s->list, l->fn, &e->deltas);
+      if (r < 0)
+	return r;
 
-	  if (cur_entry == max_entry)
+      r = remote_scan_index_lookup(s, l, &e->deps);
+      if (r < 0)
+	return r;
+      if (r == 0)
+	{
+	  _cleanup_free_ char *jsonfn = NULL;
+	  _cleanup_free_ char *jsonurl = NULL;
+
+	  r = image_json_fn(l->fn, &jsonfn);
+	  if (r < 0)
+	    return r;
+
+	  r = join_path(s->url, jsonfn, &jsonurl);
+	  if (r < 0)
+	    return r;
+
+	  if (!isempty(l->hash) &&
+	      metadata_cache_lookup(cache, jsonurl, l->hash, &e->deps) > 0)
 	    {
-	      max_entry = max_entry * 2;
-	      *result = realloc(*result, (max_entry + 1) * sizeof(char *));
-	      if (*result == NULL)
-		oom();
+	      log_msg(LOG_DEBUG, "Using cached '%s'", jsonurl);
+	      metrics_count(METRIC_METADATA_CACHED, 1);
+	      r = metadata_cache_keys_add(&s->seen, jsonurl);
+	      if (r < 0)
+		return r;
+	    }
+	  else if (!s->lazy)
+	    {
+	      r = remote_scan_queue_json(s, s->n_images - 1);
+	      if (r < 0)
+		return r;
 	    }
-	  (*result)[cur_entry] = strdup(p);
-	  if ((*result)[cur_entry] == NULL)
-	    oom();
-	  cur_entry++;
-	  (*result)[cur_entry] = NULL;
 	}
     }
 
+  if (s->lazy)
+    {
+      r = remote_scan_candidates(s);
+      if (r < 0)
+	return r;
+
+      remote_scan_next_json(s);
+    }
+  else
+    remote_scan_pull_json(s, 0);
+
   return 0;
 }
 
-int
-image_remote_metadata(const char *url, struct image_entry ***res, size_t *nr,
-		      const char *filter, bool verify_signature,
-		      const struct osrelease *osrelease, bool verbose)
+static int
+remote_scan_refetch(struct remote_scan *s, struct child_output *o,
+		    const struct catalog_file *f, size_t *pos, const char **fn,
+		    enum metric_phase phase, bool verify_signature)
+{
+  int r;
+
+  if (o->status <= 0 || *pos == f->n - 1)
+    return 0;
+
+  r = strv_extend(&f->missing[*pos], s->url);
+  if (r < 0)
+    return r;
+
+  *pos = catalog_file_first(f, *pos + 1, s->url);
+  log_msg(LOG_DEBUG, "No '%s' found at '%s', trying '%s'", *fn, s->url,
+	  f->names[*pos]);
+  *fn = f->names[*pos];
+
+  child_output_cleanup(o);
+  r = pull_submit(s->pool, &s->batch, s->url, *fn, verify_signature,
+		  phase, o);
+  if (r < 0)
+    return r;
+
+  return 1;
+}
+
+static void remote_scan_list_done(int error, void *userdata);
+
+/* Download the next name of SHA256SUMS or the index if the preferred
+   one is missing. Returns > 0 if downloads got started. */
+static int
+remote_scan_fetch_fallback(struct remote_scan *s)
 {
-  _cleanup_strv_free_ char **list = NULL;
-  _cleanup_(free_image_entry_list) struct image_entry **images = NULL;
-  size_t n = 0, pos = 0;
   int r;
 
+  if (!(s->sums.status > 0 && s->sums_pos < sums_file.n - 1) &&
+      !(s->index_json.status > 0 && s->index_pos < index_file.n - 1))
+    return 0;
+
+  process_batch_begin(&s->batch, remote_scan_list_done, s);
+  r = remote_scan_refetch(s, &s->sums, &sums_file, &s->sums_pos,
+			  &s->sums_fn, METRIC_SUMS_FETCH, s->verify_signature);
+  if (r >= 0)
+    r = remote_scan_refetch(s, &s->index_json, &index_file, &s->index_pos,
+			    &s->index_fn, METRIC_INDEX_FETCH, false);
+  process_batch_end(&s->batch, r);
+
+  /* an error is reported by the batch */
+  return 1;
+}
+
+static void
+remote_scan_list_done(int error, void *userdata)
+{
+  struct remote_scan *s = userdata;
+
+  if (error >= 0 && remote_scan_fetch_fallback(s) > 0)
+    return;
+
+  if (error >= 0)
+    error = remote_scan_fetch_json(s);
+
+  if (error < 0)
+    remote_scan_finish(s, error);
+}
+
+/* done gets called exactly once with the result, this can already
+   happen before this function returns. host must stay valid
+   until then. With lazy, only the images which can be the newest
+   compatible version of their name get metadata for sure, the
+   others only if the index or the metadata cache has it. */
+void
+image_remote_metadata_async(struct process_pool *pool, const char *url,
+			    char *const *filter, bool lazy,
+			    bool verify_signature, struct host_profile *host,
+			    bool verbose, image_list_done_t done,
+			    void *userdata)
+{
+  struct remote_scan *s;
+  int r = 0;
+
+  assert(pool);
   assert(url);
+  assert(done);
+
+  s = calloc(1, sizeof(struct remote_scan));
+  if (s == NULL)
+    {
+      done(-ENOMEM, NULL, 0, userdata);
+      return;
+    }
+
+  s->pool = pool;
+  s->sums.fd = -EBADF;
+  s->index_json.fd = -EBADF;
+  s->verify_signature = verify_signature;
+  s->host = host;
+  s->verbose = verbose;
+  /* without host nothing can be told apart */
+  s->lazy = lazy && host;
+  s->done = done;
+  s->userdata = userdata;
+  s->url = strdup(url);
+  if (s->url == NULL)
+    r = -ENOMEM;
+  if (r >= 0 && filter)
+    {
+      s->filter = strv_copy(filter);
+      if (s->filter == NULL)
+	r = -ENOMEM;
+    }
+  if (r < 0)
+    {
+      remote_scan_finish(s, r);
+      return;
+    }
+
+  /* the signature is made over the uncompressed SHA256SUMS */
+  s->sums_pos = verify_signature ? sums_file.n - 1 :
+    catalog_file_first(&sums_file, 0, url);
+  s->sums_fn = sums_file.names[s->sums_pos];
+  s->index_pos = catalog_file_first(&index_file, 0, url);
+  s->index_fn = index_file.names[s->index_pos];
+
+  /* Only the signature of SHA256SUMS gets verified by systemd-pull,
+     all other files are checked against the sums in it. SHA256SUMS is
+     fetched every time, systemd-pull has no conditional requests. */
+  process_batch_begin(&s->batch, remote_scan_list_done, s);
+  r = pull_submit(pool, &s->batch, url, s->sums_fn, verify_signature,
+		  METRIC_SUMS_FETCH, &s->sums);
+  if (r >= 0)
+    r = pull_submit(pool, &s->batch, url, s->index_fn, false,
+		    METRIC_INDEX_FETCH, &s->index_json);
+  process_batch_end(&s->batch, r);
+}
+
+/* extension-release file of a local image which is not in the cache */
+struct dissect {
+  struct child_output out;
+  size_t pos;          /* entry in the result list */
+  const char *image_name;
+  char *validator;
+};
+
+/* Scanning the local store needs one systemd-dissect call per image
+   which is not in the cache, they run in parallel. */
+struct local_scan {
+  struct process_batch batch;
+  struct host_profile *host;
+  bool verbose;
+  bool complete;  /* not filtered, every image got looked up */
+  struct metadata_cache_keys seen;  /* entries of local_cache in use */
+  char **list;
+  struct image_entry **images;
+  size_t n_images;
+  struct dissect *dissects;
+  size_t n_dissects;
+  image_list_done_t done;
+  void *userdata;
+};
+
+static void
+free_local_scan(struct local_scan *s)
+{
+  if (s == NULL)
+    return;
+
+  for (size_t i = 0; i < s->n_dissects; i++)
+    {
+      child_output_cleanup(&s->dissects[i].out);
+      free(s->dissects[i].validator);
+    }
+  free(s->dissects);
+  free_image_entry_list(&s->images);
+  strv_free(s->list);
+  metadata_cache_keys_free(&s->seen);
+  free(s);
+}
+
+static void
+local_scan_finish(struct local_scan *s, int r)
+{
+  int k;
+
+  if (r >= 0 && s->complete)
+    {
+      k = metadata_cache_prune(local_cache, NULL, &s->seen);
+      if (k < 0)
+	log_msg(LOG_WARNING, "Failed to prune metadata cache: %s", strerror(-k));
+    }
+
+  k = metadata_cache_save(local_cache);
+  if (k < 0)
+    log_msg(LOG_WARNING, "Failed to write metadata cache: %s", strerror(-k));
+
+  if (r < 0)
+    s->done(r, NULL, 0, s->userdata);
+  else
+    {
+      size_t n = s->n_images;
+
+      s->n_images = 0;
+      s->done(0, TAKE_PTR(s->images), n, s->userdata);
+    }
+
+  free_local_scan(s);
+}
+
+/* Returns 1 if the metadata of the image is in the cache. Else
+   validator is the value to store the new entry with. */
+static int
+image_cached_metadata(const char *image_name, char **validator,
+		      struct image_deps **res)
+{
+  _cleanup_free_ char *fn = NULL;
+  struct stat st;
+  int r;
+
+  assert(image_name);
+  assert(validator);
   assert(res);
 
-  r = image_list_from_url(url, &list, verify_signature);
+  r = join_path(SYSEXT_STORE_DIR, image_name, &fn);
   if (r < 0)
     return r;
 
-  n = strv_length(list);
-  if (n > 0)
+  if (stat(fn, &st) < 0)
     {
-      images = calloc((n+1), sizeof(struct image_entry *));
-      if (images == NULL)
-	return -ENOMEM;
+      r = -errno;
+      log_msg(LOG_ERR, "Failed to access '%s': %s", fn, strerror(-r));
+      return r;
+    }
 
-      for (size_t i = 0; i < n; i++)
-	{
-	  _cleanup_free_ char *name = NULL;
-	  char *p;
+  r = stat_to_validator(&st, validator);
+  if (r < 0)
+    return r;
 
-	  name = strdup(list[i]);
-	  if (name == NULL)
-	    return -ENOMEM;
+  /* avoid running systemd-dissect if the image did not change */
+  return metadata_cache_lookup(get_cache(&local_cache, "local-meta.json"),
+			       image_name, *validator, res);
+}
 
-	  /* create "debug-tools" from "debug-tools-23.7.x86-64.raw" */
-	  p = strrchr(name, '.'); /* raw */
-	  if (p)
-	    *p = '\0';
-	  p = strrchr(name, '.'); /* arch */
-	  if (p)
-	    *p = '\0';
-	  p = strrchr(name, '-'); /* version */
-	  if (p)
-	    *p = '\0';
-
-	  if (filter && !streq(name, filter))
-	    continue;
+static int
+image_dissect_result(struct dissect *d, struct image_deps **res)
+{
+  _cleanup_(free_image_depsp) struct image_deps *image = NULL;
+  struct metadata_cache *cache;
+  int r;
 
-	  images[pos] = calloc(1, sizeof(struct image_entry));
-	  if (images[pos] == NULL)
-	    return -ENOMEM;
-	  images[pos]->name = strdup(name);
-	  if (images[pos]->name == NULL)
-	    return -ENOMEM;
-	  images[pos]->remote = true;
+  if (d->out.status < 0)
+    {
+      log_msg(LOG_ERR, "Failed to extract extension-release from '%s': %s",
+	      d->image_name, strerror(-d->out.status));
+      return d->out.status;
+    }
+  else if (d->out.status > 0)
+    {
+      log_msg(LOG_ERR, "Failed to extract extension-release from '%s': systemd-dissect failed (%i)",
+	      d->image_name, d->out.status);
+      return -EINVAL;
+    }
+
+  r = load_ext_release(d->image_name, d->out.fd, &image);
+  if (r < 0)
+    return r;
 
-	  r = image_json_from_url(url, list[i], &(images[pos]->deps), verify_signature);
+  if (image)
+    {
+      cache = get_cache(&local_cache, "local-meta.json");
+      if (cache)
+	{
+	  r = metadata_cache_update(cache, d->image_name, d->validator, image);
 	  if (r < 0)
-	    return r;
+	    log_msg(LOG_WARNING, "Failed to cache metadata of '%s': %s",
+		    d->image_name, strerror(-r));
+	}
+      *res = TAKE_PTR(image);
+    }
 
-	  if (images[pos]->deps && osrelease)
-	    images[pos]->compatible =
-	      extension_release_validate(images[pos]->deps->image_name,
-					 osrelease, "system",
-					 images[pos]->deps, verbose);
+  return 0;
+}
 
-	  pos++;
-	}
+static int
+local_scan_parse(struct local_scan *s)
+{
+  int r;
+
+  for (size_t i = 0; i < s->n_dissects; i++)
+    {
+      struct dissect *d = &s->dissects[i];
+
+      r = image_dissect_result(d, &s->images[d->pos]->deps);
+      if (r < 0)
+	return r;
     }
 
-  if (nr)
-    *nr = pos;
-  if (images)
-    *res = TAKE_PTR(images);
+  validate_images(s->images, s->n_images, s->host, s->verbose);
 
   return 0;
 }
 
-int
-image_local_metadata(const char *store, struct image_entry ***res, size_t *nr,
-		     const char *filter, const struct osrelease *osrelease,
-		     bool verbose)
+static void
+local_scan_dissect_done(int error, void *userdata)
 {
-  _cleanup_strv_free_ char **list = NULL;
-  _cleanup_(free_image_entry_list) struct image_entry **images = NULL;
-  size_t n = 0, pos = 0;
+  struct local_scan *s = userdata;
+
+  if (error >= 0)
+    error = local_scan_parse(s);
+
+  local_scan_finish(s, error);
+}
+
+/* Returns an error only if no systemd-dissect got started */
+static int
+local_scan_start(struct process_pool *pool, struct local_scan *s,
+		 const char *store, char *const *filter)
+{
+  _cleanup_close_ int lock = -EBADF;
+  size_t n;
   int r;
 
-  r = discover_images(store, &list);
-  if (r < 0)
-    {
-      if (r == -ENOENT)
-	return 0;
+  /* no image or link gets switched while the list is read */
+  lock = store_lock(config.sysext_store_dir, false);
+  if (lock < 0 && lock != -ENOENT)
+    log_msg(LOG_WARNING, "Failed to lock '%s': %s",
+	    config.sysext_store_dir, strerror(-lock));
 
+  r = discover_images(store, &s->list);
+  if (r < 0 && r != -ENOENT)
+    {
       log_msg(LOG_ERR, "Scan local images failed: %s", strerror(-r));
       return r;
     }
 
-  n = strv_length(list);
-  if (n > 0)
+  n = strv_length(s->list);
+
+  s->images = calloc((n+1), sizeof(struct image_entry *));
+  if (s->images == NULL)
+    return -ENOMEM;
+  s->dissects = calloc(n+1, sizeof(struct dissect));
+  if (s->dissects == NULL)
+    return -ENOMEM;
+
+  for (size_t i = 0; i < n; i++)
     {
-      images = calloc((n+1), sizeof(struct image_entry *));
-      if (images == NULL)
+      _cleanup_free_ char *name = NULL;
+      _cleanup_free_ char *validator = NULL;
+      struct image_entry *e;
+
+      r = image_name_from_fn(s->list[i], &name);
+      if (r < 0)
+	return r;
+
+      if (filter && !strv_contains(filter, name))
+	continue;
+
+      e = s->images[s->n_images] = calloc(1, sizeof(struct image_entry));
+      if (e == NULL)
 	return -ENOMEM;
+      s->n_images++;
+      e->name = TAKE_PTR(name);
+      e->local = true;
+
+      /* the entry stays for every image in the store */
+      r = metadata_cache_keys_add(&s->seen, s->list[i]);
+      if (r < 0)
+	return r;
 
-      for (size_t i = 0; i < n; i++)
+      r = image_cached_metadata(s->list[i], &validator, &e->deps);
+      if (r < 0)
+	return r;
+      if (r == 0)
 	{
-	  _cleanup_free_ char *name = NULL;
-	  char *p;
+	  struct dissect *d = &s->dissects[s->n_dissects++];
 
-	  name = strdup(list[i]);
-	  if (name == NULL)
-	    return -ENOMEM;
+	  d->out.fd = -EBADF;
+	  d->pos = s->n_images - 1;
+	  d->image_name = s->list[i];
+	  d->validator = TAKE_PTR(validator);
+	}
+    }
+  if (lock >= 0)
+    close(TAKE_FD(lock));
 
-	  /* create "debug-tools" from "debug-tools-23.7.x86-64.raw" */
-	  p = strrchr(name, '.'); /* raw */
-	  if (p)
-	    *p = '\0';
-	  p = strrchr(name, '.'); /* arch */
-	  if (p)
-	    *p = '\0';
-	  p = strrchr(name, '-'); /* version */
-	  if (p)
-	    *p = '\0';
-
-	  if (filter && !streq(name, filter))
-	    continue;
+  process_batch_begin(&s->batch, local_scan_dissect_done, s);
+  r = 0;
+  for (size_t i = 0; i < s->n_dissects && r >= 0; i++)
+    {
+      struct dissect *d = &s->dissects[i];
 
-	  images[pos] = calloc(1, sizeof(struct image_entry));
-	  if (images[pos] == NULL)
-	    return -ENOMEM;
-	  images[pos]->name = strdup(name);
-	  if (images[pos]->name == NULL)
-	    return -ENOMEM;
+      r = child_output_init_memfd(&d->out);
+      if (r >= 0)
+	{
+	  d->out.phase = METRIC_DISSECT;
+	  d->out.start = metrics_now();
+	  r = extract_submit(pool, &s->batch, SYSEXT_STORE_DIR, d->image_name,
+			     d->out.fd, child_output_done, &d->out);
+	}
+    }
+  process_batch_end(&s->batch, r);
 
-	  images[pos]->local = true;
+  return 0;
+}
 
-	  r = image_read_metadata(list[i], &(images[pos]->deps));
-	  if (r < 0)
-	    return r;
+/* done gets called exactly once with the result, this can already
+   happen before this function returns. host must stay valid
+   until then. */
+void
+image_local_metadata_async(struct process_pool *pool, const char *store,
+			   char *const *filter, struct host_profile *host,
+			   bool verbose, image_list_done_t done, void *userdata)
+{
+  struct local_scan *s;
+  int r;
 
-	  if (images[pos]->deps && osrelease)
-	    images[pos]->compatible =
-	      extension_release_validate(images[pos]->deps->image_name,
-					 osrelease, "system",
-					 images[pos]->deps, verbose);
+  assert(pool);
+  assert(store);
+  assert(done);
 
-	  pos++;
-	}
+  s = calloc(1, sizeof(struct local_scan));
+  if (s == NULL)
+    {
+      done(-ENOMEM, NULL, 0, userdata);
+      return;
     }
 
-  if (nr)
-    *nr = pos;
-  if (images)
-    *res = TAKE_PTR(images);
+  s->host = host;
+  s->verbose = verbose;
+  s->complete = filter == NULL;
+  s->done = done;
+  s->userdata = userdata;
 
-  return 0;
+  r = local_scan_start(pool, s, store, filter);
+  if (r < 0)
+    local_scan_finish(s, r);
 }
@@ -2,12 +2,24 @@
 
 #pragma once
 
-#include "osrelease.h"
-
-extern int discover_images(const char *path, char ***result);
-extern int image_remote_metadata(const char *url, struct image_entry ***res,
-		size_t *nr, const char *filter, bool verify_signature,
-		const struct osrelease *osrelease, bool verbose);
-extern int image_local_metadata(const char *store, struct image_entry ***res,
-		size_t *nr, const char *filter, const struct osrelease *osrelease,
-		bool verbose);
+#include "host-profile.h"
+#include "image-deps.h"
+#include "process-pool.h"
+
+/* delta file to create an image from an older one:
+   "<new image>" DELTA_FROM "<old image>" DELTA_SUFFIX */
+#define DELTA_FROM ".from-"
+#define DELTA_SUFFIX ".bsdiff"
+
+/* r is a negative errno value or 0, the callee owns images */
+typedef void (*image_list_done_t)(int r, struct image_entry **images,
+		size_t n, void *userdata);
+
+extern void image_remote_metadata_async(struct process_pool *pool,
+		const char *url, char *const *filter, bool lazy,
+		bool verify_signature, struct host_profile *host, bool verbose,
+		image_list_done_t done, void *userdata);
+extern void image_local_metadata_async(struct process_pool *pool,
+		const char *store, char *const *filter,
+		struct host_profile *host, bool verbose,
+		image_list_done_t done, void *userdata);
@@ -4,6 +4,7 @@
 #include <time.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -21,6 +22,7 @@
 #include "basics.h"
 #include "sysextmgr.h"
 #include "image-deps.h"
+#include "compress.h"
 
 int
 parse_image_deps(sd_json_variant *json, struct image_deps **res)
@@ -65,14 +67,54 @@ parse_image_deps(sd_json_variant *json, struct image_deps **res)
   return 0;
 }
 
+/* Create the json format also used by "sysextmgrcli create-json" */
+int
+image_deps_to_json(const struct image_deps *e, sd_json_variant **res)
+{
+  assert(e);
+  assert(res);
+
+  return sd_json_buildo(res,
+			SD_JSON_BUILD_PAIR_STRING("image_name", e->image_name),
+			SD_JSON_BUILD_PAIR("sysext", SD_JSON_BUILD_OBJECT(
+			  SD_JSON_BUILD_PAIR_CONDITION(!!e->id, "ID", SD_JSON_BUILD_STRING(e->id)),
+			  SD_JSON_BUILD_PAIR_CONDITION(!!e->sysext_level, "SYSEXT_LEVEL", SD_JSON_BUILD_STRING(e->sysext_level)),
+			  SD_JSON_BUILD_PAIR_CONDITION(!!e->version_id, "VERSION_ID", SD_JSON_BUILD_STRING(e->version_id)),
+			  SD_JSON_BUILD_PAIR_CONDITION(!!e->sysext_version_id, "SYSEXT_VERSION_ID", SD_JSON_BUILD_STRING(e->sysext_version_id)),
+			  SD_JSON_BUILD_PAIR_CONDITION(!!e->sysext_scope, "SYSEXT_SCOPE", SD_JSON_BUILD_STRING(e->sysext_scope)),
+			  SD_JSON_BUILD_PAIR_CONDITION(!!e->architecture, "ARCHITECTURE", SD_JSON_BUILD_STRING(e->architecture)))));
+}
+
+/* a bigger json file is not accepted, also after decompression */
+#define MAX_JSON_SIZE (256*1024*1024)
+
+/* path is relative to fd, the file can be compressed with gzip or
+   zstd */
 int
 load_image_json(int fd, const char *path, struct image_deps ***images)
 {
   _cleanup_(sd_json_variant_unrefp) sd_json_variant *json = NULL;
+  _cleanup_free_ char *data = NULL;
+  _cleanup_close_ int jfd = -EBADF;
   unsigned line = 0, column = 0;
   int r;
 
-  r = sd_json_parse_file_at(NULL, fd, path, 0, &json, &line, &column);
+  jfd = openat(fd >= 0 ? fd : AT_FDCWD, path, O_RDONLY|O_CLOEXEC);
+  if (jfd < 0)
+    {
+      r = -errno;
+      fprintf(stderr, "Failed to open json file (%s): %s\n", path, strerror(-r));
+      return r;
+    }
+
+  r = read_decompressed(jfd, MAX_JSON_SIZE, &data, NULL);
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to read json file (%s): %s\n", path, strerror(-r));
+      return r;
+    }
+
+  r = sd_json_parse(data, 0, &json, &line, &column);
   if (r < 0)
     {
       fprintf(stderr, "Failed to parse json file (%s) %u:%u: %s\n",
@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "basics.h"
+#include "link-switch.h"
+#include "log_msg.h"
+
+static bool
+link_points_to(int dfd, const char *name, const char *target)
+{
+  char buf[PATH_MAX];
+  ssize_t len;
+
+  len = readlinkat(dfd, name, buf, sizeof(buf) - 1);
+  if (len < 0)
+    return false;
+  buf[len] = '\0';
+
+  return streq(buf, target);
+}
+
+static int
+link_stage(int dfd, struct link_switch *s)
+{
+  if (asprintf(&s->tmpname, ".%s.new", s->name) < 0)
+    {
+      s->tmpname = NULL;
+      return -ENOMEM;
+    }
+
+  /* left over from a crash, nobody else writes with the lock held */
+  if (unlinkat(dfd, s->tmpname, 0) < 0 && errno != ENOENT)
+    return -errno;
+
+  if (symlinkat(s->target, dfd, s->tmpname) < 0)
+    return -errno;
+
+  s->state = LINK_STAGED;
+
+  return 0;
+}
+
+/* With RENAME_EXCHANGE the old link stays under the temporary name
+   until all links are switched, so it can be put back. Filesystems
+   without it get the old link atomically replaced. */
+static int
+link_swap(int dfd, struct link_switch *s, bool replace)
+{
+  if (replace)
+    {
+      if (renameat2(dfd, s->tmpname, dfd, s->name, RENAME_EXCHANGE) == 0)
+	{
+	  s->state = LINK_EXCHANGED;
+	  return 0;
+	}
+      if (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)
+	{
+	  if (renameat(dfd, s->tmpname, dfd, s->name) < 0)
+	    return -errno;
+	  s->state = LINK_REPLACED;
+	  return 0;
+	}
+      if (errno != ENOENT)
+	return -errno;
+    }
+
+  /* there was no link before */
+  if (renameat2(dfd, s->tmpname, dfd, s->name, RENAME_NOREPLACE) < 0)
+    return -errno;
+  s->state = LINK_CREATED;
+
+  return 0;
+}
+
+static void
+link_rollback(int dfd, struct link_switch *s)
+{
+  switch (s->state)
+    {
+    case LINK_EXCHANGED:
+      if (renameat2(dfd, s->tmpname, dfd, s->name, RENAME_EXCHANGE) < 0)
+	log_msg(LOG_ERR, "Failed to restore link '%s': %m", s->name);
+      break;
+    case LINK_CREATED:
+      if (unlinkat(dfd, s->name, 0) < 0)
+	log_msg(LOG_ERR, "Failed to remove link '%s': %m", s->name);
+      break;
+    case LINK_REPLACED:
+      log_msg(LOG_ERR, "Link '%s' already replaced, can not restore it", s->name);
+      break;
+    default:
+      break;
+    }
+}
+
+int
+link_switch_commit(const char *dir, struct link_switch *l, size_t n,
+		   bool replace)
+{
+  _cleanup_close_ int dfd = -EBADF;
+  int changed = 0, r = 0;
+  size_t i;
+
+  assert(dir);
+  assert(l || n == 0);
+
+  dfd = open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+  if (dfd < 0)
+    return -errno;
+
+  for (i = 0; i < n && r >= 0; i++)
+    {
+      l[i].state = LINK_UNCHANGED;
+      if (!link_points_to(dfd, l[i].name, l[i].target))
+	r = link_stage(dfd, &l[i]);
+    }
+
+  for (i = 0; i < n && r >= 0; i++)
+    if (l[i].state == LINK_STAGED)
+      {
+	r = link_swap(dfd, &l[i], replace);
+	if (r >= 0)
+	  changed++;
+	else
+	  log_msg(LOG_ERR, "Failed to switch link '%s': %s", l[i].name, strerror(-r));
+      }
+
+  if (r < 0)
+    for (i = 0; i < n; i++)
+      link_rollback(dfd, &l[i]);
+
+  /* the old links after the exchange, or the new ones on failure */
+  for (i = 0; i < n; i++)
+    if (l[i].tmpname && l[i].state != LINK_CREATED &&
+	l[i].state != LINK_REPLACED)
+      (void) unlinkat(dfd, l[i].tmpname, 0);
+
+  if (r < 0)
+    return r;
+
+  if (changed > 0 && fsync(dfd) < 0)
+    return -errno;
+
+  return changed;
+}
+
+void
+link_switch_done(struct link_switch *l, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    l[i].tmpname = mfree(l[i].tmpname);
+}
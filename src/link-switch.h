@@ -0,0 +1,26 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* One link of a set which gets switched together. The caller sets
+   name and target, the rest belongs to link_switch_commit(). */
+struct link_switch {
+  const char *name;    /* entry of the directory, e.g. "gcc.raw" */
+  const char *target;
+  char *tmpname;
+  enum { LINK_UNCHANGED, LINK_STAGED, LINK_EXCHANGED,
+	 LINK_CREATED, LINK_REPLACED } state;
+};
+
+/* Switch all links of l in dir or none: the new links get created
+   under temporary names and renamed over the old ones, the directory
+   is synced once at the end. Links which already point to their
+   target are left alone. Without replace no existing link may be
+   overwritten. Returns the number of changed links or a negative
+   errno value. The caller needs the exclusive store lock. */
+extern int link_switch_commit(const char *dir, struct link_switch *l,
+		size_t n, bool replace);
+extern void link_switch_done(struct link_switch *l, size_t n);
@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "basics.h"
+#include "sysextmgr.h"
+#include "varlink-client.h"
+
+/* the commands talking to sysextmgrd */
+static const struct {
+  const char *name;
+  int (*main)(int argc, char **argv);
+} commands[] = {
+  { "check",    main_check },
+  { "cleanup",  main_cleanup },
+  { "import",   main_import },
+  { "install",  main_install },
+  { "list",     main_list },
+  { "metrics",  main_metrics },
+  { "plan",     main_plan },
+  { "prefetch", main_prefetch },
+  { "update",   main_update },
+  { "verify",   main_verify },
+  { NULL, NULL }
+};
+
+/* Split line at spaces and tabs, there is no quoting */
+static int
+split_words(char *line, char ***res, int *n)
+{
+  _cleanup_free_ char **argv = NULL;
+  char *saveptr = NULL;
+  size_t max = 8;
+  int argc = 0;
+
+  argv = calloc(max, sizeof(char *));
+  if (argv == NULL)
+    return -ENOMEM;
+
+  for (char *t = strtok_r(line, " \t\n", &saveptr); t; t = strtok_r(NULL, " \t\n", &saveptr))
+    {
+      /* getopt_long() expects argv[argc] to be NULL */
+      if ((size_t) argc + 1 >= max)
+	{
+	  char **p = reallocarray(argv, max * 2, sizeof(char *));
+
+	  if (p == NULL)
+	    return -ENOMEM;
+	  argv = p;
+	  max *= 2;
+	}
+      argv[argc++] = t;
+    }
+  argv[argc] = NULL;
+
+  *res = TAKE_PTR(argv);
+  *n = argc;
+
+  return 0;
+}
+
+static int
+run_command(int argc, char **argv)
+{
+  for (size_t i = 0; commands[i].name; i++)
+    if (streq(argv[0], commands[i].name))
+      {
+	/* start the option parsing of the next command from scratch */
+	optind = 0;
+	return commands[i].main(argc, argv);
+      }
+
+  fprintf(stderr, "Unknown command in batch: %s\n", argv[0]);
+  return EXIT_FAILURE;
+}
+
+/* Run one command per line of the file, all on the same connection to
+   sysextmgrd. Empty lines and lines starting with '#' are ignored. */
+int
+main_batch(int argc, char **argv)
+{
+  struct option const longopts[] = {
+    {"keep-going", no_argument, NULL, 'k'},
+    {NULL, 0, NULL, '\0'}
+  };
+  _cleanup_fclose_ FILE *fp = NULL;
+  _cleanup_free_ char *line = NULL;
+  bool keep_going = false;
+  size_t size = 0;
+  unsigned lineno = 0;
+  int c, ret = EXIT_SUCCESS;
+
+  while ((c = getopt_long(argc, argv, "k", longopts, NULL)) != -1)
+    {
+      switch (c)
+	{
+	case 'k':
+	  keep_going = true;
+	  break;
+	default:
+	  usage(EXIT_FAILURE);
+	  break;
+	}
+    }
+
+  if (argc - optind > 1)
+    {
+      fprintf(stderr, "Unexpected argument: %s\n", argv[optind + 1]);
+      usage(EXIT_FAILURE);
+    }
+
+  if (argc > optind && !streq(argv[optind], "-"))
+    {
+      fp = fopen(argv[optind], "re");
+      if (fp == NULL)
+	{
+	  fprintf(stderr, "Failed to open '%s': %s\n", argv[optind], strerror(errno));
+	  return EXIT_FAILURE;
+	}
+    }
+
+  varlink_batch_begin();
+
+  while (getline(&line, &size, fp ? fp : stdin) >= 0)
+    {
+      _cleanup_free_ char **args = NULL;
+      int n, r;
+
+      lineno++;
+
+      r = split_words(line, &args, &n);
+      if (r < 0)
+	oom();
+      if (n == 0 || args[0][0] == '#')
+	continue;
+
+      r = run_command(n, args);
+      if (r != EXIT_SUCCESS)
+	{
+	  fprintf(stderr, "Line %u: '%s' failed\n", lineno, args[0]);
+	  if (ret == EXIT_SUCCESS)
+	    ret = r;
+	  if (!keep_going)
+	    break;
+	}
+    }
+
+  varlink_batch_end();
+
+  return ret;
+}
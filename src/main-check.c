@@ -185,6 +185,10 @@ main_check(int argc, char **argv)
   char *url = NULL;
   int c, r;
 
+  /* a batch runs several commands */
+  arg_verbose = false;
+  arg_quiet = false;
+
   while ((c = getopt_long(argc, argv, "qu:v", longopts, NULL)) != -1)
     {
       switch (c)
@@ -0,0 +1,158 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "basics.h"
+#include "sysextmgr.h"
+#include "varlink-client.h"
+
+struct cleanup_reply {
+  bool success;
+  char *error;
+  sd_json_variant *removed;
+  uint64_t freed;
+  uint64_t size;
+};
+
+static void
+cleanup_reply_free(struct cleanup_reply *var)
+{
+  var->error = mfree(var->error);
+  var->removed = sd_json_variant_unref(var->removed);
+}
+
+/* keep_versions and max_size are only sent if >= 0 */
+int
+varlink_cleanup(bool dry_run, int64_t keep_versions, int64_t max_size,
+		bool quiet)
+{
+  _cleanup_(cleanup_reply_free) struct cleanup_reply p = {};
+  static const sd_json_dispatch_field dispatch_table[] = {
+    { "Success",    SD_JSON_VARIANT_BOOLEAN,  sd_json_dispatch_stdbool, offsetof(struct cleanup_reply, success), 0 },
+    { "ErrorMsg",   SD_JSON_VARIANT_STRING,   sd_json_dispatch_string,  offsetof(struct cleanup_reply, error), 0 },
+    { "Removed",    SD_JSON_VARIANT_ARRAY,    sd_json_dispatch_variant, offsetof(struct cleanup_reply, removed), 0 },
+    { "FreedBytes", SD_JSON_VARIANT_UNSIGNED, sd_json_dispatch_uint64,  offsetof(struct cleanup_reply, freed), 0 },
+    { "StoreBytes", SD_JSON_VARIANT_UNSIGNED, sd_json_dispatch_uint64,  offsetof(struct cleanup_reply, size), 0 },
+    {}
+  };
+  _cleanup_(sd_varlink_unrefp) sd_varlink *link = NULL;
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *params = NULL;
+  sd_json_variant *result;
+  const char *error_id = NULL;
+  int r;
+
+  r = sd_json_buildo(&params,
+		     SD_JSON_BUILD_PAIR_BOOLEAN("DryRun", dry_run),
+		     SD_JSON_BUILD_PAIR_CONDITION(keep_versions >= 0, "KeepVersions", SD_JSON_BUILD_UNSIGNED(keep_versions)),
+		     SD_JSON_BUILD_PAIR_CONDITION(max_size >= 0, "MaxStoreSize", SD_JSON_BUILD_UNSIGNED(max_size)));
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to build param list: %s\n", strerror(-r));
+      return r;
+    }
+
+  r = connect_to_sysextmgrd(&link, _VARLINK_SYSEXTMGR_SOCKET);
+  if (r < 0)
+    return r;
+
+  r = sd_varlink_call(link, "org.openSUSE.sysextmgr.Cleanup", params, &result, &error_id);
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to call Cleanup method: %s\n", strerror(-r));
+      return r;
+    }
+  /* dispatch before checking error_id, we may need the result for the error
+     message */
+  r = sd_json_dispatch(result, dispatch_table, SD_JSON_ALLOW_EXTENSIONS, &p);
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to parse JSON answer: %s\n", strerror(-r));
+      return r;
+    }
+
+  if (error_id && strlen(error_id) > 0)
+    {
+      fprintf(stderr, "Failed to call Cleanup method: %s\n", p.error ? p.error : error_id);
+      return -EIO;
+    }
+
+  if (quiet)
+    return 0;
+
+  for (size_t i = 0; i < sd_json_variant_elements(p.removed); i++)
+    printf("%s %s\n", dry_run ? "Would remove" : "Removed",
+	   sd_json_variant_string(sd_json_variant_by_index(p.removed, i)));
+  printf("%" PRIu64 " MiB %s, %" PRIu64 " MiB in the store\n",
+	 p.freed / (1024 * 1024), dry_run ? "could be freed" : "freed",
+	 p.size / (1024 * 1024));
+
+  return 0;
+}
+
+int
+main_cleanup(int argc, char **argv)
+{
+  struct option const longopts[] = {
+    {"dry-run", no_argument, NULL, 'n'},
+    {"keep", required_argument, NULL, 'k'},
+    {"max-size", required_argument, NULL, 'm'},
+    {"quiet", no_argument, NULL, 'q'},
+    {NULL, 0, NULL, '\0'}
+  };
+  int64_t keep_versions = -1, max_size = -1;
+  bool dry_run = false, quiet = false;
+  char *end;
+  int c, r;
+
+  while ((c = getopt_long(argc, argv, "k:m:nq", longopts, NULL)) != -1)
+    {
+      switch (c)
+        {
+	case 'n':
+	  dry_run = true;
+	  break;
+	case 'k':
+	  keep_versions = strtoll(optarg, &end, 10);
+	  if (*end != '\0' || keep_versions < 0 || keep_versions > UINT32_MAX)
+	    {
+	      fprintf(stderr, "Invalid number of versions: %s\n", optarg);
+	      usage(EXIT_FAILURE);
+	    }
+	  break;
+	case 'm':
+	  max_size = strtoll(optarg, &end, 10);
+	  if (*end != '\0' || max_size < 0 || max_size > UINT32_MAX)
+	    {
+	      fprintf(stderr, "Invalid size: %s\n", optarg);
+	      usage(EXIT_FAILURE);
+	    }
+	  break;
+	case 'q':
+	  quiet = true;
+	  break;
+        default:
+          usage(EXIT_FAILURE);
+          break;
+        }
+    }
+
+  if (argc > optind)
+    {
+      fprintf(stderr, "Unexpected argument: %s\n", argv[optind]);
+      usage(EXIT_FAILURE);
+    }
+
+  r = varlink_cleanup(dry_run, keep_versions, max_size, quiet);
+  if (r < 0)
+    {
+      if (VARLINK_IS_NOT_RUNNING(r))
+        fprintf(stderr, "sysextmgrd not running!\n");
+      return -r;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "basics.h"
+#include "sysextmgr.h"
+#include "varlink-client.h"
+
+struct import_reply {
+  bool success;
+  char *error;
+  char *sha256;
+};
+
+static void
+import_reply_free(struct import_reply *var)
+{
+  var->error = mfree(var->error);
+  var->sha256 = mfree(var->sha256);
+}
+
+/* The daemon reads the image from the passed file descriptor, so it
+   needs no access to the path. name is the file name in the store,
+   sha256 is optional. */
+int
+varlink_import(const char *path, const char *name, const char *sha256,
+	       bool quiet)
+{
+  _cleanup_(import_reply_free) struct import_reply p = {};
+  static const sd_json_dispatch_field dispatch_table[] = {
+    { "Success",  SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool, offsetof(struct import_reply, success), 0 },
+    { "ErrorMsg", SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct import_reply, error), 0 },
+    { "SHA256",   SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct import_reply, sha256), 0 },
+    {}
+  };
+  _cleanup_(sd_varlink_unrefp) sd_varlink *link = NULL;
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *params = NULL;
+  _cleanup_close_ int fd = -EBADF;
+  sd_json_variant *result;
+  const char *error_id = NULL;
+  int r;
+
+  fd = open(path, O_RDONLY|O_CLOEXEC);
+  if (fd < 0)
+    {
+      r = -errno;
+      fprintf(stderr, "Failed to open '%s': %s\n", path, strerror(-r));
+      return r;
+    }
+
+  r = sd_json_buildo(&params,
+		     SD_JSON_BUILD_PAIR_STRING("Name", name),
+		     SD_JSON_BUILD_PAIR_CONDITION(sha256 != NULL, "SHA256", SD_JSON_BUILD_STRING(sha256)));
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to build param list: %s\n", strerror(-r));
+      return r;
+    }
+
+  /* the timeout and the passed fd must not leak into other calls
+     of a batch */
+  r = connect_to_sysextmgrd_private(&link, _VARLINK_SYSEXTMGR_SOCKET);
+  if (r < 0)
+    return r;
+
+  r = sd_varlink_set_allow_fd_passing_output(link, true);
+  if (r >= 0)
+    r = sd_varlink_push_fd(link, fd);
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to pass file descriptor: %s\n", strerror(-r));
+      return r;
+    }
+  fd = -EBADF;  /* owned by link */
+
+  /* copying a large image without reflink support takes a while */
+  r = sd_varlink_set_relative_timeout(link, UINT64_MAX);
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to disable timeout: %s\n", strerror(-r));
+      return r;
+    }
+
+  r = sd_varlink_call(link, "org.openSUSE.sysextmgr.Import", params, &result, &error_id);
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to call Import method: %s\n", strerror(-r));
+      return r;
+    }
+  /* dispatch before checking error_id, we may need the result for the error
+     message */
+  r = sd_json_dispatch(result, dispatch_table, SD_JSON_ALLOW_EXTENSIONS, &p);
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to parse JSON answer: %s\n", strerror(-r));
+      return r;
+    }
+
+  if (error_id && strlen(error_id) > 0)
+    {
+      fprintf(stderr, "Failed to call Import method: %s\n", p.error ? p.error : error_id);
+      return -EIO;
+    }
+
+  if (!quiet)
+    printf("Imported %s (%s)\n", name, p.sha256 ? p.sha256 : "-");
+
+  return 0;
+}
+
+int
+main_import(int argc, char **argv)
+{
+  struct option const longopts[] = {
+    {"name", required_argument, NULL, 'n'},
+    {"sha256", required_argument, NULL, 's'},
+    {"quiet", no_argument, NULL, 'q'},
+    {NULL, 0, NULL, '\0'}
+  };
+  const char *name = NULL, *sha256 = NULL;
+  bool quiet = false;
+  int c, r;
+
+  while ((c = getopt_long(argc, argv, "n:qs:", longopts, NULL)) != -1)
+    {
+      switch (c)
+        {
+	case 'n':
+	  name = optarg;
+	  break;
+	case 'q':
+	  quiet = true;
+	  break;
+	case 's':
+	  sha256 = optarg;
+	  break;
+        default:
+          usage(EXIT_FAILURE);
+          break;
+        }
+    }
+
+  if (argc - optind != 1)
+    {
+      fprintf(stderr, "Exactly one image file expected\n");
+      usage(EXIT_FAILURE);
+    }
+
+  if (name == NULL)
+    {
+      name = strrchr(argv[optind], '/');
+      name = name ? name + 1 : argv[optind];
+    }
+
+  r = varlink_import(argv[optind], name, sha256, quiet);
+  if (r < 0)
+    {
+      if (VARLINK_IS_NOT_RUNNING(r))
+        fprintf(stderr, "sysextmgrd not running!\n");
+      return -r;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -14,18 +14,18 @@ static bool arg_quiet = false;
 struct install {
   bool success;
   char *error;
-  char *installed;
+  sd_json_variant *installed;
 };
 
 static void
 install_free (struct install *var)
 {
   var->error = mfree(var->error);
-  var->installed = mfree(var->installed);
+  var->installed = sd_json_variant_unref(var->installed);
 }
 
 int
-varlink_install (const char *name, const char *url)
+varlink_install (char **names, const char *url)
 {
   _cleanup_(install_free) struct install p = {
     .success = false,
@@ -35,7 +35,7 @@ varlink_install (const char *name, const char *url)
   static const sd_json_dispatch_field dispatch_table[] = {
     { "Success",   SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool, offsetof(struct install, success), 0 },
     { "ErrorMsg",  SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct install, error), 0 },
-    { "Installed", SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct install, installed), 0 },
+    { "Installed", SD_JSON_VARIANT_ARRAY,   sd_json_dispatch_variant, offsetof(struct install, installed), 0 },
     {}
   };
   _cleanup_(sd_varlink_unrefp) sd_varlink *link = NULL;
@@ -49,7 +49,7 @@ varlink_install (const char *name, const char *url)
     return r;
 
   r = sd_json_buildo(&params,
-		     SD_JSON_BUILD_PAIR("Install", SD_JSON_BUILD_STRING(name)));
+		     SD_JSON_BUILD_PAIR("Names", SD_JSON_BUILD_STRV(names)));
   if (r < 0)
     {
       fprintf(stderr, "Failed to build parameter list: %s\n", strerror(-r));
@@ -95,8 +95,20 @@ varlink_install (const char *name, const char *url)
       return -EIO;
     }
 
-  if (!arg_quiet)
-    printf("%s\n", p.installed);
+  if (arg_quiet || p.installed == NULL)
+    return 0;
+
+  for (size_t i = 0; i < sd_json_variant_elements(p.installed); i++)
+    {
+      sd_json_variant *entry = sd_json_variant_by_index(p.installed, i);
+
+      if (!sd_json_variant_is_string(entry))
+	{
+	  fprintf(stderr, "entry is no string!\n");
+	  return -EINVAL;
+	}
+      printf("%s\n", sd_json_variant_string(entry));
+    }
 
   return 0;
 }
@@ -112,6 +124,9 @@ main_install(int argc, char **argv)
   char *url = NULL;
   int c, r;
 
+  /* a batch runs several commands */
+  arg_quiet = false;
+
   while ((c = getopt_long(argc, argv, "qu:", longopts, NULL)) != -1)
     {
       switch (c)
@@ -134,16 +149,14 @@ main_install(int argc, char **argv)
       usage(EXIT_FAILURE);
     }
 
+  /* all images in one call, so that the repository gets read only once */
   printf("Installed:\n");
-  for (int i = optind; i < argc; i++)
+  r = varlink_install(&argv[optind], url);
+  if (r < 0)
     {
-      r = varlink_install(argv[i], url);
-      if (r < 0)
-	{
-	  if (VARLINK_IS_NOT_RUNNING(r))
-	    fprintf(stderr, "sysextmgrd not running!\n");
-	  return -r;
-	}
+      if (VARLINK_IS_NOT_RUNNING(r))
+	fprintf(stderr, "sysextmgrd not running!\n");
+      return -r;
     }
 
   return EXIT_SUCCESS;
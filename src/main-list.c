@@ -2,14 +2,22 @@
 
 #include "config.h"
 
+#include <assert.h>
+#include <errno.h>
 #include <getopt.h>
 #include <stdbool.h>
+#include <sys/stat.h>
 
 #include "basics.h"
 #include "sysextmgr.h"
 #include "varlink-client.h"
+#include "discover-images.h"
+#include "metadata-cache.h"
+#include "image-deps.h"
+#include "strv.h"
 
 static bool arg_verbose = false;
+static bool arg_local = false;
 
 struct list_images {
   bool success;
@@ -200,10 +208,92 @@ varlink_list_images (const char *url)
   return 0;
 }
 
+static void
+print_cached_metadata(struct metadata_cache *cache, const char *image_name)
+{
+  _cleanup_(free_image_depsp) struct image_deps *deps = NULL;
+  _cleanup_free_ char *fn = NULL;
+  _cleanup_free_ char *validator = NULL;
+  struct stat st;
+
+  /* same key and validator as sysextmgrd uses for local images */
+  if (cache == NULL ||
+      asprintf(&fn, "%s/%s", SYSEXT_STORE_DIR, image_name) < 0 ||
+      stat(fn, &st) < 0 ||
+      stat_to_validator(&st, &validator) < 0 ||
+      metadata_cache_lookup(cache, image_name, validator, &deps) <= 0)
+    {
+      printf("    (no cached metadata)\n");
+      return;
+    }
+
+  printf("    SYSEXT_VERSION_ID=%s\n", strna(deps->sysext_version_id));
+  printf("    SYSEXT_SCOPE=%s\n", strna(deps->sysext_scope));
+  printf("    ID=%s\n", strna(deps->id));
+  printf("    SYSEXT_LEVEL=%s\n", strna(deps->sysext_level));
+  printf("    VERSION_ID=%s\n", strna(deps->version_id));
+  printf("    ARCHITECTURE=%s\n", strna(deps->architecture));
+}
+
+/* The installed images without sysextmgrd: the links in
+   extensions_dir and the metadata sysextmgrd cached for them. Neither
+   the network nor systemd-dissect is used, images not in the cache
+   stay without metadata. */
+static int
+list_installed(void)
+{
+  _cleanup_(free_metadata_cachep) struct metadata_cache *cache = NULL;
+  _cleanup_strv_free_ char **images = NULL;
+  _cleanup_free_ char *fn = NULL;
+  int r;
+
+  r = load_config("sysextmgrd");
+  if (r < 0)
+    {
+      fprintf(stderr, "Couldn't load configuration file: %s\n", strerror(-r));
+      return r;
+    }
+
+  r = discover_images(config.extensions_dir, &images);
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to read '%s': %s\n", config.extensions_dir,
+	      strerror(-r));
+      return r;
+    }
+
+  if (strv_isempty(images))
+    {
+      printf("No images installed\n");
+      return 0;
+    }
+
+  if (arg_verbose)
+    {
+      if (asprintf(&fn, "%s/local-meta.json",
+		   config.cache_dir ? config.cache_dir : SYSEXTMGR_CACHE_DIR) < 0)
+	oom();
+      r = metadata_cache_open(fn, &cache);
+      if (r < 0)
+	fprintf(stderr, "Cannot use metadata cache '%s': %s\n", fn, strerror(-r));
+    }
+
+  STRV_FOREACH(image, images)
+    {
+      printf("%s\n", *image);
+      if (arg_verbose)
+	print_cached_metadata(cache, *image);
+    }
+
+  return 0;
+}
+
 int
 main_list(int argc, char **argv)
 {
   struct option const longopts[] = {
+    {"installed", no_argument, NULL, 'l'},
+    {"local", no_argument, NULL, 'l'},
     {"url", required_argument, NULL, 'u'},
     {"verbose", no_argument, NULL, 'v'},
     {NULL, 0, NULL, '\0'}
@@ -211,10 +301,17 @@ main_list(int argc, char **argv)
   char *url = NULL;
   int c, r;
 
-  while ((c = getopt_long(argc, argv, "u:v", longopts, NULL)) != -1)
+  /* a batch runs several commands */
+  arg_verbose = false;
+  arg_local = false;
+
+  while ((c = getopt_long(argc, argv, "lu:v", longopts, NULL)) != -1)
     {
       switch (c)
         {
+	case 'l':
+	  arg_local = true;
+	  break;
         case 'u':
           url = optarg;
           break;
@@ -233,6 +330,17 @@ main_list(int argc, char **argv)
       usage(EXIT_FAILURE);
     }
 
+  if (arg_local)
+    {
+      if (url)
+	{
+	  fprintf(stderr, "--local does not use a URL\n");
+	  usage(EXIT_FAILURE);
+	}
+      r = list_installed();
+      return r < 0 ? r : EXIT_SUCCESS;
+    }
+
   r = varlink_list_images(url);
   if (r < 0)
     {
@@ -0,0 +1,256 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "basics.h"
+#include "sysextmgr.h"
+#include "varlink-client.h"
+
+static bool arg_json = false;
+
+struct bucket {
+  uint64_t le;
+  uint64_t count;
+};
+
+struct phase {
+  char *name;
+  uint64_t count;
+  uint64_t failed;
+  uint64_t total_usec;
+  uint64_t max_usec;
+  sd_json_variant *buckets;
+};
+
+static void
+phase_free(struct phase *var)
+{
+  var->name = mfree(var->name);
+  var->buckets = sd_json_variant_unref(var->buckets);
+}
+
+struct counter {
+  char *name;
+  uint64_t value;
+};
+
+static void
+counter_free(struct counter *var)
+{
+  var->name = mfree(var->name);
+}
+
+/* Prometheus wants underscores, names of the daemon use dashes */
+static void
+print_name(const char *prefix, const char *name, const char *suffix)
+{
+  fputs(prefix, stdout);
+  for (const char *p = name; *p; p++)
+    putchar(*p == '-' ? '_' : *p);
+  fputs(suffix, stdout);
+}
+
+/* Prometheus wants the lines of a metric together, so this gets
+   called once for the histogram and once for the failures */
+static int
+print_phase(sd_json_variant *entry, bool failures)
+{
+  static const sd_json_dispatch_field phase_table[] = {
+    { "Name",      SD_JSON_VARIANT_STRING,   sd_json_dispatch_string,  offsetof(struct phase, name), SD_JSON_MANDATORY },
+    { "Count",     SD_JSON_VARIANT_UNSIGNED, sd_json_dispatch_uint64,  offsetof(struct phase, count), 0 },
+    { "Failed",    SD_JSON_VARIANT_UNSIGNED, sd_json_dispatch_uint64,  offsetof(struct phase, failed), 0 },
+    { "TotalUSec", SD_JSON_VARIANT_UNSIGNED, sd_json_dispatch_uint64,  offsetof(struct phase, total_usec), 0 },
+    { "MaxUSec",   SD_JSON_VARIANT_UNSIGNED, sd_json_dispatch_uint64,  offsetof(struct phase, max_usec), 0 },
+    { "Buckets",   SD_JSON_VARIANT_ARRAY,    sd_json_dispatch_variant, offsetof(struct phase, buckets), 0 },
+    {}
+  };
+  static const sd_json_dispatch_field bucket_table[] = {
+    { "LE",    SD_JSON_VARIANT_UNSIGNED, sd_json_dispatch_uint64, offsetof(struct bucket, le), SD_JSON_MANDATORY },
+    { "Count", SD_JSON_VARIANT_UNSIGNED, sd_json_dispatch_uint64, offsetof(struct bucket, count), SD_JSON_MANDATORY },
+    {}
+  };
+  _cleanup_(phase_free) struct phase p = {};
+  int r;
+
+  r = sd_json_dispatch(entry, phase_table, SD_JSON_ALLOW_EXTENSIONS, &p);
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to parse JSON phase entry: %s\n", strerror(-r));
+      return r;
+    }
+
+  if (failures)
+    {
+      printf("sysextmgr_phase_failures_total{phase=\"%s\"} %" PRIu64 "\n",
+	     p.name, p.failed);
+      return 0;
+    }
+
+  for (size_t i = 0; i < sd_json_variant_elements(p.buckets); i++)
+    {
+      struct bucket b = {};
+
+      r = sd_json_dispatch(sd_json_variant_by_index(p.buckets, i),
+			   bucket_table, SD_JSON_ALLOW_EXTENSIONS, &b);
+      if (r < 0)
+	{
+	  fprintf(stderr, "Failed to parse JSON bucket entry: %s\n", strerror(-r));
+	  return r;
+	}
+      printf("sysextmgr_phase_duration_seconds_bucket{phase=\"%s\",le=\"%g\"} %" PRIu64 "\n",
+	     p.name, (double) b.le / 1e6, b.count);
+    }
+  printf("sysextmgr_phase_duration_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %" PRIu64 "\n",
+	 p.name, p.count);
+  printf("sysextmgr_phase_duration_seconds_sum{phase=\"%s\"} %g\n",
+	 p.name, (double) p.total_usec / 1e6);
+  printf("sysextmgr_phase_duration_seconds_count{phase=\"%s\"} %" PRIu64 "\n",
+	 p.name, p.count);
+
+  return 0;
+}
+
+static int
+print_counter(sd_json_variant *entry)
+{
+  static const sd_json_dispatch_field counter_table[] = {
+    { "Name",  SD_JSON_VARIANT_STRING,   sd_json_dispatch_string, offsetof(struct counter, name), SD_JSON_MANDATORY },
+    { "Value", SD_JSON_VARIANT_UNSIGNED, sd_json_dispatch_uint64, offsetof(struct counter, value), 0 },
+    {}
+  };
+  _cleanup_(counter_free) struct counter c = {};
+  int r;
+
+  r = sd_json_dispatch(entry, counter_table, SD_JSON_ALLOW_EXTENSIONS, &c);
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to parse JSON counter entry: %s\n", strerror(-r));
+      return r;
+    }
+
+  print_name("# TYPE sysextmgr_", c.name, "_total counter\n");
+  print_name("sysextmgr_", c.name, "_total");
+  printf(" %" PRIu64 "\n", c.value);
+
+  return 0;
+}
+
+/* Print the metrics in the Prometheus text format */
+static int
+print_prometheus(sd_json_variant *result)
+{
+  sd_json_variant *phases = sd_json_variant_by_key(result, "Phases");
+  sd_json_variant *counters = sd_json_variant_by_key(result, "Counters");
+  int r;
+
+  if (sd_json_variant_is_array(phases))
+    {
+      printf("# HELP sysextmgr_phase_duration_seconds Time of the phases of sysextmgrd requests\n");
+      printf("# TYPE sysextmgr_phase_duration_seconds histogram\n");
+      for (size_t i = 0; i < sd_json_variant_elements(phases); i++)
+	{
+	  r = print_phase(sd_json_variant_by_index(phases, i), false);
+	  if (r < 0)
+	    return r;
+	}
+      printf("# TYPE sysextmgr_phase_failures_total counter\n");
+      for (size_t i = 0; i < sd_json_variant_elements(phases); i++)
+	{
+	  r = print_phase(sd_json_variant_by_index(phases, i), true);
+	  if (r < 0)
+	    return r;
+	}
+    }
+
+  if (sd_json_variant_is_array(counters))
+    for (size_t i = 0; i < sd_json_variant_elements(counters); i++)
+      {
+	r = print_counter(sd_json_variant_by_index(counters, i));
+	if (r < 0)
+	  return r;
+      }
+
+  return 0;
+}
+
+int
+varlink_metrics(bool json)
+{
+  _cleanup_(sd_varlink_unrefp) sd_varlink *link = NULL;
+  sd_json_variant *result;
+  const char *error_id = NULL;
+  int r;
+
+  r = connect_to_sysextmgrd(&link, _VARLINK_SYSEXTMGR_SOCKET);
+  if (r < 0)
+    return r;
+
+  r = sd_varlink_call(link, "org.openSUSE.sysextmgr.GetMetrics", NULL, &result, &error_id);
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to call GetMetrics method: %s\n", strerror(-r));
+      return r;
+    }
+
+  if (error_id && strlen(error_id) > 0)
+    {
+      fprintf(stderr, "Failed to call GetMetrics method: %s\n", error_id);
+      return -EIO;
+    }
+
+  if (json)
+    {
+      r = sd_json_variant_dump(result, SD_JSON_FORMAT_NEWLINE|SD_JSON_FORMAT_PRETTY_AUTO, stdout, NULL);
+      if (r < 0)
+	fprintf(stderr, "Failed to write json data: %s\n", strerror(-r));
+      return r;
+    }
+
+  return print_prometheus(result);
+}
+
+int
+main_metrics(int argc, char **argv)
+{
+  struct option const longopts[] = {
+    {"json", no_argument, NULL, 'j'},
+    {NULL, 0, NULL, '\0'}
+  };
+  int c, r;
+
+  /* a batch runs several commands */
+  arg_json = false;
+
+  while ((c = getopt_long(argc, argv, "j", longopts, NULL)) != -1)
+    {
+      switch (c)
+        {
+	case 'j':
+	  arg_json = true;
+	  break;
+        default:
+          usage(EXIT_FAILURE);
+          break;
+        }
+    }
+
+  if (argc > optind)
+    {
+      fprintf(stderr, "Unexpected argument: %s\n", argv[optind]);
+      usage(EXIT_FAILURE);
+    }
+
+  r = varlink_metrics(arg_json);
+  if (r < 0)
+    {
+      if (VARLINK_IS_NOT_RUNNING(r))
+        fprintf(stderr, "sysextmgrd not running!\n");
+      return -r;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,303 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <getopt.h>
+#include <stdbool.h>
+
+#include "basics.h"
+#include "sysextmgr.h"
+#include "varlink-client.h"
+
+static bool arg_verbose = false;
+
+struct plan_reply {
+  bool success;
+  char *error;
+  sd_json_variant *plans;
+};
+
+static void
+plan_reply_free(struct plan_reply *var)
+{
+  var->error = mfree(var->error);
+  var->plans = sd_json_variant_unref(var->plans);
+}
+
+struct target_plan {
+  uint64_t index;
+  char *root;
+  char *error;
+  sd_json_variant *images;
+};
+
+static void
+target_plan_free(struct target_plan *var)
+{
+  var->root = mfree(var->root);
+  var->error = mfree(var->error);
+  var->images = sd_json_variant_unref(var->images);
+}
+
+struct image_data {
+  char *old_name;
+  char *new_name;
+};
+
+static void
+image_data_free(struct image_data *var)
+{
+  var->old_name = mfree(var->old_name);
+  var->new_name = mfree(var->new_name);
+}
+
+/* the whole os-release file of another system */
+static int
+read_os_release(const char *fn, char **res)
+{
+  _cleanup_fclose_ FILE *fp = NULL;
+  size_t size = 0;
+
+  fp = fopen(fn, "re");
+  if (fp == NULL)
+    return -errno;
+
+  *res = NULL;
+  if (getdelim(res, &size, '\0', fp) < 0)
+    {
+      *res = mfree(*res);
+      return feof(fp) ? -ENODATA : -errno;
+    }
+
+  return 0;
+}
+
+static int
+print_target_plan(sd_json_variant *entry, char **roots, char **os_releases)
+{
+  static const sd_json_dispatch_field plan_table[] = {
+    { "Index",    SD_JSON_VARIANT_UNSIGNED, sd_json_dispatch_uint64,  offsetof(struct target_plan, index), SD_JSON_MANDATORY },
+    { "Root",     SD_JSON_VARIANT_STRING,   sd_json_dispatch_string,  offsetof(struct target_plan, root), SD_JSON_NULLABLE },
+    { "ErrorMsg", SD_JSON_VARIANT_STRING,   sd_json_dispatch_string,  offsetof(struct target_plan, error), SD_JSON_NULLABLE },
+    { "Images",   SD_JSON_VARIANT_ARRAY,    sd_json_dispatch_variant, offsetof(struct target_plan, images), SD_JSON_NULLABLE },
+    {}
+  };
+  static const sd_json_dispatch_field image_table[] = {
+    { "OldImage", SD_JSON_VARIANT_STRING, sd_json_dispatch_string, offsetof(struct image_data, old_name), SD_JSON_MANDATORY },
+    { "NewImage", SD_JSON_VARIANT_STRING, sd_json_dispatch_string, offsetof(struct image_data, new_name), SD_JSON_NULLABLE },
+    {}
+  };
+  _cleanup_(target_plan_free) struct target_plan t = {};
+  const char *name;
+  size_t n_roots = 0, n_os_releases = 0;
+  int r;
+
+  while (roots[n_roots])
+    n_roots++;
+  while (os_releases[n_os_releases])
+    n_os_releases++;
+
+  r = sd_json_dispatch(entry, plan_table, SD_JSON_ALLOW_EXTENSIONS, &t);
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to parse JSON plan entry: %s\n", strerror(-r));
+      return r;
+    }
+
+  /* the roots are sent first, then the os-release files */
+  if (t.index < n_roots)
+    name = roots[t.index];
+  else if (t.index - n_roots < n_os_releases)
+    name = os_releases[t.index - n_roots];
+  else
+    name = "?";
+
+  printf("%s:\n", name);
+  if (t.error)
+    {
+      printf("  %s\n", t.error);
+      return 0;
+    }
+  if (sd_json_variant_elements(t.images) == 0)
+    {
+      printf("  No installed images found\n");
+      return 0;
+    }
+
+  for (size_t i = 0; i < sd_json_variant_elements(t.images); i++)
+    {
+      _cleanup_(image_data_free) struct image_data e = {};
+
+      r = sd_json_dispatch(sd_json_variant_by_index(t.images, i),
+			   image_table, SD_JSON_ALLOW_EXTENSIONS, &e);
+      if (r < 0)
+	{
+	  fprintf(stderr, "Failed to parse JSON sysext image entry: %s\n", strerror(-r));
+	  return r;
+	}
+
+      if (e.new_name)
+	printf("  %s -> %s\n", e.old_name, e.new_name);
+      else if (arg_verbose)
+	printf("  %s -> No compatible newer version found\n", e.old_name);
+    }
+
+  return 0;
+}
+
+int
+varlink_plan(const char *url, char **roots, char **os_releases)
+{
+  _cleanup_(plan_reply_free) struct plan_reply p = {};
+  static const sd_json_dispatch_field dispatch_table[] = {
+    { "Success",  SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool, offsetof(struct plan_reply, success), 0 },
+    { "ErrorMsg", SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct plan_reply, error), 0 },
+    { "Plans",    SD_JSON_VARIANT_ARRAY,   sd_json_dispatch_variant, offsetof(struct plan_reply, plans), 0 },
+    {}
+  };
+  _cleanup_(sd_varlink_unrefp) sd_varlink *link = NULL;
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *params = NULL;
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *targets = NULL;
+  sd_json_variant *result;
+  const char *error_id = NULL;
+  int r;
+
+  for (char **root = roots; *root; root++)
+    {
+      r = sd_json_variant_append_arraybo(&targets, SD_JSON_BUILD_PAIR_STRING("Root", *root));
+      if (r < 0)
+	{
+	  fprintf(stderr, "Failed to build target list: %s\n", strerror(-r));
+	  return r;
+	}
+    }
+  for (char **fn = os_releases; *fn; fn++)
+    {
+      _cleanup_free_ char *data = NULL;
+
+      r = read_os_release(*fn, &data);
+      if (r < 0)
+	{
+	  fprintf(stderr, "Failed to read '%s': %s\n", *fn, strerror(-r));
+	  return r;
+	}
+      r = sd_json_variant_append_arraybo(&targets, SD_JSON_BUILD_PAIR_STRING("OsRelease", data));
+      if (r < 0)
+	{
+	  fprintf(stderr, "Failed to build target list: %s\n", strerror(-r));
+	  return r;
+	}
+    }
+
+  r = sd_json_buildo(&params,
+		     SD_JSON_BUILD_PAIR_VARIANT("Targets", targets),
+		     SD_JSON_BUILD_PAIR_CONDITION(url != NULL, "URL", SD_JSON_BUILD_STRING(url)),
+		     SD_JSON_BUILD_PAIR_CONDITION(arg_verbose, "Verbose", SD_JSON_BUILD_BOOLEAN(arg_verbose)));
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to build param list: %s\n", strerror(-r));
+      return r;
+    }
+
+  r = connect_to_sysextmgrd(&link, _VARLINK_SYSEXTMGR_SOCKET);
+  if (r < 0)
+    return r;
+
+  r = sd_varlink_call(link, "org.openSUSE.sysextmgr.Plan", params, &result, &error_id);
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to call Plan method: %s\n", strerror(-r));
+      return r;
+    }
+  /* dispatch before checking error_id, we may need the result for the error
+     message */
+  r = sd_json_dispatch(result, dispatch_table, SD_JSON_ALLOW_EXTENSIONS, &p);
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to parse JSON answer: %s\n", strerror(-r));
+      return r;
+    }
+
+  if (error_id && strlen(error_id) > 0)
+    {
+      fprintf(stderr, "Failed to call Plan method: %s\n", p.error ? p.error : error_id);
+      return -EIO;
+    }
+
+  for (size_t i = 0; i < sd_json_variant_elements(p.plans); i++)
+    {
+      r = print_target_plan(sd_json_variant_by_index(p.plans, i), roots, os_releases);
+      if (r < 0)
+	return r;
+    }
+
+  return 0;
+}
+
+int
+main_plan(int argc, char **argv)
+{
+  struct option const longopts[] = {
+    {"url", required_argument, NULL, 'u'},
+    {"root", required_argument, NULL, 'r'},
+    {"os-release", required_argument, NULL, 'o'},
+    {"verbose", no_argument, NULL, 'v'},
+    {NULL, 0, NULL, '\0'}
+  };
+  /* the arguments itself, NULL terminated */
+  _cleanup_free_ char **roots = calloc(argc + 1, sizeof(char *));
+  _cleanup_free_ char **os_releases = calloc(argc + 1, sizeof(char *));
+  size_t n_roots = 0, n_os_releases = 0;
+  char *url = NULL;
+  int c, r;
+
+  if (roots == NULL || os_releases == NULL)
+    oom();
+
+  /* a batch runs several commands */
+  arg_verbose = false;
+
+  while ((c = getopt_long(argc, argv, "o:r:u:v", longopts, NULL)) != -1)
+    {
+      switch (c)
+        {
+        case 'u':
+          url = optarg;
+          break;
+	case 'r':
+	  roots[n_roots++] = optarg;
+	  break;
+	case 'o':
+	  os_releases[n_os_releases++] = optarg;
+	  break;
+	case 'v':
+	  arg_verbose = true;
+	  break;
+        default:
+          usage(EXIT_FAILURE);
+          break;
+        }
+    }
+
+  if (argc > optind)
+    {
+      fprintf(stderr, "Unexpected argument: %s\n", argv[optind]);
+      usage(EXIT_FAILURE);
+    }
+
+  if (n_roots == 0 && n_os_releases == 0)
+    {
+      fprintf(stderr, "No target given, use --root or --os-release\n");
+      usage(EXIT_FAILURE);
+    }
+
+  r = varlink_plan(url, roots, os_releases);
+  if (r < 0)
+    {
+      if (VARLINK_IS_NOT_RUNNING(r))
+        fprintf(stderr, "sysextmgrd not running!\n");
+      return -r;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -3,6 +3,7 @@
 #include "config.h"
 
 #include <getopt.h>
+#include <inttypes.h>
 #include <stdbool.h>
 
 #include "basics.h"
@@ -36,8 +37,75 @@ image_data_free (struct image_data *var)
   var->new_name = mfree(var->new_name);
 }
 
-int
-varlink_update (const char *url)
+struct progress {
+  char *image;
+  char *old_image;
+  char *state;
+  uint64_t bytes_done;
+  uint64_t bytes_total;
+};
+
+static void
+progress_free (struct progress *var)
+{
+  var->image = mfree(var->image);
+  var->old_image = mfree(var->old_image);
+  var->state = mfree(var->state);
+}
+
+/* print the intermediate replies of the daemon as they arrive */
+static void
+print_progress (sd_json_variant *parameters, void _unused_(*userdata))
+{
+  _cleanup_(progress_free) struct progress p = {
+    .image = NULL,
+    .old_image = NULL,
+    .state = NULL,
+    .bytes_done = 0,
+    .bytes_total = 0,
+  };
+  static const sd_json_dispatch_field dispatch_table[] = {
+    { "Image",      SD_JSON_VARIANT_STRING,   sd_json_dispatch_string, offsetof(struct progress, image), SD_JSON_MANDATORY },
+    { "OldImage",   SD_JSON_VARIANT_STRING,   sd_json_dispatch_string, offsetof(struct progress, old_image), 0 },
+    { "State",      SD_JSON_VARIANT_STRING,   sd_json_dispatch_string, offsetof(struct progress, state), SD_JSON_MANDATORY },
+    { "BytesDone",  SD_JSON_VARIANT_UNSIGNED, sd_json_dispatch_uint64, offsetof(struct progress, bytes_done), 0 },
+    { "BytesTotal", SD_JSON_VARIANT_UNSIGNED, sd_json_dispatch_uint64, offsetof(struct progress, bytes_total), 0 },
+    {}
+  };
+  sd_json_variant *v;
+  int r;
+
+  if (arg_quiet)
+    return;
+
+  v = sd_json_variant_by_key(parameters, "Progress");
+  if (v == NULL)
+    return;
+
+  r = sd_json_dispatch(v, dispatch_table, SD_JSON_ALLOW_EXTENSIONS, &p);
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to parse progress message: %s\n", strerror(-r));
+      return;
+    }
+
+  if (streq(p.state, "resolved") && p.old_image)
+    printf("%s: update to %s found\n", p.old_image, p.image);
+  else if (streq(p.state, "downloading"))
+    printf("%s: %" PRIu64 " KiB downloaded\n", p.image, p.bytes_done / 1024);
+  else if (streq(p.state, "downloaded") && p.bytes_total > 0)
+    printf("%s: downloaded (%" PRIu64 " KiB)\n", p.image, p.bytes_total / 1024);
+  else
+    printf("%s: %s\n", p.image, p.state);
+
+  /* let tools reading our output see the progress immediately */
+  fflush(stdout);
+}
+
+/* Update and Prefetch have the same arguments and replies, only
+   the name of the array differs */
+static int
+call_update (const char *method, const char *url, bool prefetch)
 {
   _cleanup_(update_free) struct update p = {
     .success = false,
@@ -50,10 +118,17 @@ varlink_update (const char *url)
     { "Updated",    SD_JSON_VARIANT_ARRAY,   sd_json_dispatch_variant, offsetof(struct update, contents_json), 0 },
     {}
   };
+  static const sd_json_dispatch_field prefetch_dispatch_table[] = {
+    { "Success",    SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool, offsetof(struct update, success), 0 },
+    { "ErrorMsg",   SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct update, error), 0 },
+    { "Prefetched", SD_JSON_VARIANT_ARRAY,   sd_json_dispatch_variant, offsetof(struct update, contents_json), 0 },
+    {}
+  };
+  _cleanup_free_ char *method_name = NULL;
   _cleanup_(sd_varlink_unrefp) sd_varlink *link = NULL;
   _cleanup_(sd_json_variant_unrefp) sd_json_variant *params = NULL;
-  sd_json_variant *result;
-  const char *error_id = NULL;
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *result = NULL;
+  _cleanup_free_ char *error_id = NULL;
   int r;
 
   r = connect_to_sysextmgrd(&link, _VARLINK_SYSEXTMGR_SOCKET);
@@ -70,15 +145,20 @@ varlink_update (const char *url)
           fprintf(stderr, "Failed to build param list: %s\n", strerror(-r));
         }
     }
-  r = sd_varlink_call(link, "org.openSUSE.sysextmgr.Update", params, &result, &error_id);
+  if (asprintf(&method_name, "org.openSUSE.sysextmgr.%s", method) < 0)
+    return -ENOMEM;
+
+  r = varlink_call_more(link, method_name, params,
+			print_progress, NULL, &result, &error_id);
   if (r < 0)
     {
-      fprintf(stderr, "Failed to call Update method: %s\n", strerror(-r));
+      fprintf(stderr, "Failed to call %s method: %s\n", method, strerror(-r));
       return r;
     }
   /* dispatch before checking error_id, we may need the result for the error
      message */
-  r = sd_json_dispatch(result, dispatch_table, SD_JSON_ALLOW_EXTENSIONS, &p);
+  r = sd_json_dispatch(result, prefetch ? prefetch_dispatch_table : dispatch_table,
+		       SD_JSON_ALLOW_EXTENSIONS, &p);
   if (r < 0)
     {
       fprintf(stderr, "Failed to parse JSON answer: %s\n", strerror(-r));
@@ -94,7 +174,7 @@ varlink_update (const char *url)
       else
         error = error_id;
 
-      fprintf(stderr, "Failed to call Update method: %s\n", error);
+      fprintf(stderr, "Failed to call %s method: %s\n", method, error);
       return -EIO;
     }
 
@@ -148,7 +228,19 @@ varlink_update (const char *url)
 }
 
 int
-main_update(int argc, char **argv)
+varlink_update (const char *url)
+{
+  return call_update("Update", url, false);
+}
+
+int
+varlink_prefetch (const char *url)
+{
+  return call_update("Prefetch", url, true);
+}
+
+static int
+update_main(int argc, char **argv, bool prefetch)
 {
   struct option const longopts[] = {
     {"url", required_argument, NULL, 'u'},
@@ -158,6 +250,9 @@ main_update(int argc, char **argv)
   char *url = NULL;
   int c, r;
 
+  /* a batch runs several commands */
+  arg_quiet = false;
+
   while ((c = getopt_long(argc, argv, "qu:", longopts, NULL)) != -1)
     {
       switch (c)
@@ -180,7 +275,10 @@ main_update(int argc, char **argv)
       usage(EXIT_FAILURE);
     }
 
-  r = varlink_update(url);
+  if (prefetch)
+    r = varlink_prefetch(url);
+  else
+    r = varlink_update(url);
   if (r < 0)
     {
       if (VARLINK_IS_NOT_RUNNING(r))
@@ -190,3 +288,16 @@ main_update(int argc, char **argv)
 
   return EXIT_SUCCESS;
 }
+
+int
+main_update(int argc, char **argv)
+{
+  return update_main(argc, argv, false);
+}
+
+/* download the updates now, a later "update" only switches to them */
+int
+main_prefetch(int argc, char **argv)
+{
+  return update_main(argc, argv, true);
+}
@@ -0,0 +1,150 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <assert.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "basics.h"
+#include "strv.h"
+#include "sysextmgr.h"
+#include "varlink-client.h"
+
+struct verify_reply {
+  bool success;
+  char *error;
+  sd_json_variant *images;
+  uint64_t failed;
+};
+
+static void
+verify_reply_free(struct verify_reply *var)
+{
+  var->error = mfree(var->error);
+  var->images = sd_json_variant_unref(var->images);
+}
+
+struct verified_image {
+  const char *image;
+  const char *state;
+  const char *sha256;
+};
+
+/* returns -EBADMSG if an image is corrupt or unreadable */
+int
+varlink_verify(char **names, bool quiet)
+{
+  _cleanup_(verify_reply_free) struct verify_reply p = {};
+  static const sd_json_dispatch_field dispatch_table[] = {
+    { "Success",  SD_JSON_VARIANT_BOOLEAN,  sd_json_dispatch_stdbool, offsetof(struct verify_reply, success), 0 },
+    { "ErrorMsg", SD_JSON_VARIANT_STRING,   sd_json_dispatch_string,  offsetof(struct verify_reply, error), 0 },
+    { "Images",   SD_JSON_VARIANT_ARRAY,    sd_json_dispatch_variant, offsetof(struct verify_reply, images), 0 },
+    { "Failed",   SD_JSON_VARIANT_UNSIGNED, sd_json_dispatch_uint64,  offsetof(struct verify_reply, failed), 0 },
+    {}
+  };
+  static const sd_json_dispatch_field dispatch_image_table[] = {
+    { "Image",  SD_JSON_VARIANT_STRING, sd_json_dispatch_const_string, offsetof(struct verified_image, image), SD_JSON_MANDATORY },
+    { "State",  SD_JSON_VARIANT_STRING, sd_json_dispatch_const_string, offsetof(struct verified_image, state), SD_JSON_MANDATORY },
+    { "SHA256", SD_JSON_VARIANT_STRING, sd_json_dispatch_const_string, offsetof(struct verified_image, sha256), SD_JSON_NULLABLE },
+    {}
+  };
+  _cleanup_(sd_varlink_unrefp) sd_varlink *link = NULL;
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *params = NULL;
+  sd_json_variant *result;
+  const char *error_id = NULL;
+  int r;
+
+  r = sd_json_buildo(&params,
+		     SD_JSON_BUILD_PAIR_CONDITION(!strv_isempty(names), "Names", SD_JSON_BUILD_STRV(names)));
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to build param list: %s\n", strerror(-r));
+      return r;
+    }
+
+  r = connect_to_sysextmgrd(&link, _VARLINK_SYSEXTMGR_SOCKET);
+  if (r < 0)
+    return r;
+
+  r = sd_varlink_call(link, "org.openSUSE.sysextmgr.Verify", params, &result, &error_id);
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to call Verify method: %s\n", strerror(-r));
+      return r;
+    }
+  /* dispatch before checking error_id, we may need the result for the error
+     message */
+  r = sd_json_dispatch(result, dispatch_table, SD_JSON_ALLOW_EXTENSIONS, &p);
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to parse JSON answer: %s\n", strerror(-r));
+      return r;
+    }
+
+  if (error_id && strlen(error_id) > 0)
+    {
+      fprintf(stderr, "Failed to call Verify method: %s\n", p.error ? p.error : error_id);
+      return -EIO;
+    }
+
+  for (size_t i = 0; !quiet && i < sd_json_variant_elements(p.images); i++)
+    {
+      sd_json_variant *entry = sd_json_variant_by_index(p.images, i);
+      struct verified_image e = {};
+
+      r = sd_json_dispatch(entry, dispatch_image_table, SD_JSON_ALLOW_EXTENSIONS, &e);
+      if (r < 0)
+	{
+	  fprintf(stderr, "Failed to parse JSON image entry: %s\n", strerror(-r));
+	  return r;
+	}
+
+      /* only the images which need attention */
+      if (!streq(e.state, "ok"))
+	printf("%-10s %s\n", e.state, e.image);
+    }
+
+  if (!quiet)
+    printf("%zu images verified, %" PRIu64 " failed\n",
+	   sd_json_variant_elements(p.images), p.failed);
+
+  return p.failed > 0 ? -EBADMSG : 0;
+}
+
+int
+main_verify(int argc, char **argv)
+{
+  struct option const longopts[] = {
+    {"quiet", no_argument, NULL, 'q'},
+    {NULL, 0, NULL, '\0'}
+  };
+  bool quiet = false;
+  int c, r;
+
+  while ((c = getopt_long(argc, argv, "q", longopts, NULL)) != -1)
+    {
+      switch (c)
+        {
+	case 'q':
+	  quiet = true;
+	  break;
+        default:
+          usage(EXIT_FAILURE);
+          break;
+        }
+    }
+
+  r = varlink_verify(&argv[optind], quiet);
+  if (r == -EBADMSG)
+    return EXIT_FAILURE;
+  if (r < 0)
+    {
+      if (VARLINK_IS_NOT_RUNNING(r))
+        fprintf(stderr, "sysextmgrd not running!\n");
+      return -r;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,486 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <search.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <systemd/sd-json.h>
+
+#include "basics.h"
+#include "sysextmgr.h"
+#include "mkdir_p.h"
+#include "tmpfile-util.h"
+#include "metadata-cache.h"
+#include "log_msg.h"
+
+/* increase if the format of the entries changes, old caches get
+   discarded then */
+#define METADATA_CACHE_VERSION 1
+
+struct cache_entry {
+  char *key;
+  sd_json_variant *v;  /* { "validator": ..., "deps": ... } */
+};
+
+struct metadata_cache {
+  char *fn;
+  struct cache_entry **entries;  /* in the order of the file */
+  size_t n_entries;
+  size_t n_alloc;
+  void *index;                   /* tsearch() tree of the entries */
+  bool dirty;
+};
+
+static int
+cache_entry_cmp(const void *a, const void *b)
+{
+  const struct cache_entry *e_a = a;
+  const struct cache_entry *e_b = b;
+
+  return strcmp(e_a->key, e_b->key);
+}
+
+static int
+key_cmp(const void *a, const void *b)
+{
+  return strcmp(a, b);
+}
+
+static void
+free_cache_entry(struct cache_entry *e)
+{
+  free(e->key);
+  sd_json_variant_unref(e->v);
+  free(e);
+}
+
+static void
+noop_free(void *p _unused_)
+{
+}
+
+struct metadata_cache *
+free_metadata_cache(struct metadata_cache *c)
+{
+  if (!c)
+    return NULL;
+
+  tdestroy(c->index, noop_free);
+  for (size_t i = 0; i < c->n_entries; i++)
+    free_cache_entry(c->entries[i]);
+  free(c->entries);
+  c->fn = mfree(c->fn);
+
+  return mfree(c);
+}
+
+void
+free_metadata_cachep(struct metadata_cache **c)
+{
+  if (!c || !*c)
+    return;
+
+  *c = free_metadata_cache(*c);
+}
+
+static struct cache_entry *
+cache_find(struct metadata_cache *c, const char *key)
+{
+  struct cache_entry k = { .key = (char *) key }, **found;
+
+  found = tfind(&k, &c->index, cache_entry_cmp);
+
+  return found ? *found : NULL;
+}
+
+/* key must not be in the cache yet */
+static int
+cache_add(struct metadata_cache *c, const char *key, sd_json_variant *v)
+{
+  struct cache_entry *e;
+
+  if (c->n_entries == c->n_alloc)
+    {
+      size_t n = c->n_alloc ? c->n_alloc * 2 : 64;
+      struct cache_entry **p = reallocarray(c->entries, n,
+					    sizeof(struct cache_entry *));
+      if (p == NULL)
+	return -ENOMEM;
+      c->entries = p;
+      c->n_alloc = n;
+    }
+
+  e = calloc(1, sizeof(struct cache_entry));
+  if (e == NULL)
+    return -ENOMEM;
+  e->key = strdup(key);
+  if (e->key == NULL)
+    {
+      free(e);
+      return -ENOMEM;
+    }
+  e->v = sd_json_variant_ref(v);
+
+  if (tsearch(e, &c->index, cache_entry_cmp) == NULL)
+    {
+      free_cache_entry(e);
+      return -ENOMEM;
+    }
+  c->entries[c->n_entries++] = e;
+
+  return 0;
+}
+
+/* A missing or unusable cache file is not an error, we start with an
+   empty cache in this case. */
+int
+metadata_cache_open(const char *fn, struct metadata_cache **res)
+{
+  _cleanup_(free_metadata_cachep) struct metadata_cache *c = NULL;
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *json = NULL;
+  unsigned line = 0, column = 0;
+  int r;
+
+  assert(fn);
+  assert(res);
+
+  c = calloc(1, sizeof(struct metadata_cache));
+  if (c == NULL)
+    return -ENOMEM;
+
+  c->fn = strdup(fn);
+  if (c->fn == NULL)
+    return -ENOMEM;
+
+  r = sd_json_parse_file(NULL, fn, 0, &json, &line, &column);
+  if (r < 0)
+    {
+      if (r != -ENOENT)
+	log_msg(LOG_WARNING, "Ignoring cache file '%s' (%u:%u): %s",
+		fn, line, column, strerror(-r));
+    }
+  else
+    {
+      sd_json_variant *v = sd_json_variant_by_key(json, "version");
+      sd_json_variant *e = sd_json_variant_by_key(json, "entries");
+
+      if (v && sd_json_variant_is_unsigned(v) &&
+	  sd_json_variant_unsigned(v) == METADATA_CACHE_VERSION &&
+	  e && sd_json_variant_is_object(e))
+	{
+	  /* the elements of an object are alternately key and value */
+	  for (size_t i = 0; i + 1 < sd_json_variant_elements(e); i += 2)
+	    {
+	      const char *key = sd_json_variant_string(sd_json_variant_by_index(e, i));
+
+	      if (cache_find(c, key))
+		continue;
+	      r = cache_add(c, key, sd_json_variant_by_index(e, i + 1));
+	      if (r < 0)
+		return r;
+	    }
+	}
+      else
+	log_msg(LOG_INFO, "Ignoring cache file '%s' with unknown format", fn);
+    }
+
+  *res = TAKE_PTR(c);
+
+  return 0;
+}
+
+/* Returns 1 and the cached data if an entry with a matching validator
+   exists, else 0. */
+int
+metadata_cache_lookup(struct metadata_cache *c, const char *key,
+		      const char *validator, struct image_deps **res)
+{
+  struct cache_entry *ce;
+  sd_json_variant *v, *d;
+  int r;
+
+  assert(key);
+  assert(validator);
+  assert(res);
+
+  if (c == NULL)
+    return 0;
+
+  ce = cache_find(c, key);
+  if (ce == NULL)
+    return 0;
+
+  v = sd_json_variant_by_key(ce->v, "validator");
+  if (v == NULL || !sd_json_variant_is_string(v) ||
+      !streq(sd_json_variant_string(v), validator))
+    return 0;
+
+  d = sd_json_variant_by_key(ce->v, "deps");
+  if (d == NULL || !sd_json_variant_is_object(d))
+    return 0;
+
+  r = parse_image_deps(d, res);
+  if (r < 0)
+    {
+      log_msg(LOG_INFO, "Ignoring invalid cache entry for '%s'", key);
+      return 0;
+    }
+
+  return 1;
+}
+
+int
+metadata_cache_update(struct metadata_cache *c, const char *key,
+		      const char *validator, const struct image_deps *deps)
+{
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *d = NULL;
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *e = NULL;
+  struct cache_entry *ce;
+  int r;
+
+  assert(c);
+  assert(key);
+  assert(validator);
+  assert(deps);
+
+  r = image_deps_to_json(deps, &d);
+  if (r < 0)
+    return r;
+
+  r = sd_json_buildo(&e,
+		     SD_JSON_BUILD_PAIR_STRING("validator", validator),
+		     SD_JSON_BUILD_PAIR_VARIANT("deps", d));
+  if (r < 0)
+    return r;
+
+  ce = cache_find(c, key);
+  if (ce)
+    {
+      sd_json_variant_unref(ce->v);
+      ce->v = TAKE_PTR(e);
+    }
+  else
+    {
+      r = cache_add(c, key, e);
+      if (r < 0)
+	return r;
+    }
+
+  c->dirty = true;
+
+  return 0;
+}
+
+int
+metadata_cache_keys_add(struct metadata_cache_keys *k, const char *key)
+{
+  char *s;
+
+  assert(k);
+  assert(key);
+
+  if (tfind(key, &k->root, key_cmp))
+    return 0;
+
+  s = strdup(key);
+  if (s == NULL)
+    return -ENOMEM;
+  if (tsearch(s, &k->root, key_cmp) == NULL)
+    {
+      free(s);
+      return -ENOMEM;
+    }
+
+  return 0;
+}
+
+void
+metadata_cache_keys_free(struct metadata_cache_keys *k)
+{
+  tdestroy(k->root, free);
+  k->root = NULL;
+}
+
+/* Drop the entries below prefix (all with NULL) which are not in
+   seen, the keys one scan looked up or updated. Only call this after
+   a complete listing, else entries of images which still exist get
+   lost. */
+int
+metadata_cache_prune(struct metadata_cache *c, const char *prefix,
+		     const struct metadata_cache_keys *seen)
+{
+  size_t n = 0;
+
+  assert(seen);
+
+  if (c == NULL)
+    return 0;
+
+  for (size_t i = 0; i < c->n_entries; i++)
+    {
+      struct cache_entry *e = c->entries[i];
+
+      if ((prefix && !startswith(e->key, prefix)) ||
+	  tfind(e->key, &seen->root, key_cmp))
+	c->entries[i - n] = e;
+      else
+	{
+	  tdelete(e, &c->index, cache_entry_cmp);
+	  free_cache_entry(e);
+	  n++;
+	}
+    }
+  c->n_entries -= n;
+
+  if (n == 0)
+    return 0;
+
+  log_msg(LOG_DEBUG, "Removing %zu stale entries from '%s'", n, c->fn);
+  c->dirty = true;
+
+  return 0;
+}
+
+static int
+cache_to_json(struct metadata_cache *c, sd_json_variant **ret)
+{
+  _cleanup_free_ sd_json_variant **a = NULL;
+  size_t n = 0;
+  int r;
+
+  a = calloc(c->n_entries * 2 + 1, sizeof(sd_json_variant *));
+  if (a == NULL)
+    return -ENOMEM;
+
+  r = 0;
+  for (size_t i = 0; i < c->n_entries && r >= 0; i++)
+    {
+      r = sd_json_variant_new_string(&a[n], c->entries[i]->key);
+      if (r >= 0)
+	{
+	  n++;
+	  a[n++] = sd_json_variant_ref(c->entries[i]->v);
+	}
+    }
+  if (r >= 0)
+    r = sd_json_variant_new_object(ret, a, n);
+
+  for (size_t i = 0; i < n; i++)
+    sd_json_variant_unref(a[i]);
+
+  return r;
+}
+
+/* Write the cache atomically, but only if something changed */
+int
+metadata_cache_save(struct metadata_cache *c)
+{
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *json = NULL;
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *entries = NULL;
+  _cleanup_(unlink_and_free_tempfilep) char *tmpfn = NULL;
+  _cleanup_free_ char *dir = NULL;
+  _cleanup_fclose_ FILE *fp = NULL;
+  int fd, r;
+
+  if (c == NULL || !c->dirty)
+    return 0;
+
+  /* built once, adding the fields one by one copies the object every time */
+  r = cache_to_json(c, &entries);
+  if (r < 0)
+    return r;
+
+  r = sd_json_buildo(&json,
+		     SD_JSON_BUILD_PAIR_UNSIGNED("version", METADATA_CACHE_VERSION),
+		     SD_JSON_BUILD_PAIR_VARIANT("entries", entries));
+  if (r < 0)
+    return r;
+
+  dir = strdup(c->fn);
+  if (dir == NULL)
+    return -ENOMEM;
+
+  r = mkdir_p(dirname(dir), 0755);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Failed to create directory for '%s': %s",
+	      c->fn, strerror(-r));
+      return r;
+    }
+
+  if (asprintf(&tmpfn, "%s.XXXXXX", c->fn) < 0)
+    {
+      tmpfn = NULL;
+      return -ENOMEM;
+    }
+
+  fd = mkostemp_safe(tmpfn);
+  if (fd < 0)
+    {
+      log_msg(LOG_ERR, "Failed to create temporary file '%s': %s",
+	      tmpfn, strerror(-fd));
+      return fd;
+    }
+
+  fp = fdopen(fd, "w");
+  if (fp == NULL)
+    {
+      r = -errno;
+      close(fd);
+      return r;
+    }
+
+  /* the content is not secret and read by unprivileged clients */
+  if (fchmod(fd, 0644) < 0)
+    return -errno;
+
+  r = sd_json_variant_dump(json, SD_JSON_FORMAT_NEWLINE, fp, NULL);
+  if (r < 0)
+    return r;
+
+  if (fflush(fp) != 0)
+    return -errno;
+
+  /* else a crash can leave an empty file behind the rename */
+  if (fsync(fd) < 0)
+    {
+      r = -errno;
+      log_msg(LOG_ERR, "Failed to sync '%s': %s", tmpfn, strerror(-r));
+      return r;
+    }
+
+  if (rename(tmpfn, c->fn) < 0)
+    {
+      r = -errno;
+      log_msg(LOG_ERR, "Failed to rename '%s' to '%s': %s",
+	      tmpfn, c->fn, strerror(-r));
+      return r;
+    }
+  tmpfn = mfree(tmpfn);
+
+  c->dirty = false;
+
+  return 0;
+}
+
+/* Images are immutable once they are in the store, so device, inode,
+   size and mtime are enough to detect a replaced file. */
+int
+stat_to_validator(const struct stat *st, char **res)
+{
+  assert(st);
+  assert(res);
+
+  if (asprintf(res, "%" PRIu64 ":%" PRIu64 ":%" PRIu64 ":%" PRIu64 ".%09ld",
+	       (uint64_t) st->st_dev, (uint64_t) st->st_ino,
+	       (uint64_t) st->st_size, (uint64_t) st->st_mtim.tv_sec,
+	       st->st_mtim.tv_nsec) < 0)
+    return -ENOMEM;
+
+  return 0;
+}
@@ -0,0 +1,32 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <sys/stat.h>
+
+#include "image-deps.h"
+
+/* Persistent cache of image metadata. Every entry is stored under a
+   key (e.g. the image name) together with a validator string. A
+   lookup only succeeds if the validator still matches, so the caller
+   decides what invalidates an entry. */
+struct metadata_cache;
+
+/* Keys one scan looked up or updated, see metadata_cache_prune() */
+struct metadata_cache_keys {
+  void *root;  /* tsearch() tree */
+};
+
+extern struct metadata_cache *free_metadata_cache(struct metadata_cache *c);
+extern void free_metadata_cachep(struct metadata_cache **c);
+extern int metadata_cache_open(const char *fn, struct metadata_cache **res);
+extern int metadata_cache_lookup(struct metadata_cache *c, const char *key,
+		const char *validator, struct image_deps **res);
+extern int metadata_cache_update(struct metadata_cache *c, const char *key,
+		const char *validator, const struct image_deps *deps);
+extern int metadata_cache_keys_add(struct metadata_cache_keys *k, const char *key);
+extern void metadata_cache_keys_free(struct metadata_cache_keys *k);
+extern int metadata_cache_prune(struct metadata_cache *c, const char *prefix,
+		const struct metadata_cache_keys *seen);
+extern int metadata_cache_save(struct metadata_cache *c);
+extern int stat_to_validator(const struct stat *st, char **res);
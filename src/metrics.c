@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+
+#include "basics.h"
+#include "metrics.h"
+
+/* upper bounds of the histogram buckets in usec, a last bucket
+   counts everything slower */
+static const uint64_t bucket_limits[] = {
+  1000, 10000, 100000, 1000000, 10000000, 60000000, 600000000,
+};
+#define N_BUCKETS (sizeof(bucket_limits)/sizeof(bucket_limits[0]) + 1)
+
+struct phase {
+  uint64_t count;
+  uint64_t failed;
+  uint64_t total_usec;
+  uint64_t max_usec;
+  uint64_t buckets[N_BUCKETS];
+};
+
+static const char *const phase_names[_METRIC_PHASE_MAX] = {
+  [METRIC_SUMS_FETCH]  = "sums-fetch",
+  [METRIC_INDEX_FETCH] = "index-fetch",
+  [METRIC_JSON_FETCH]  = "json-fetch",
+  [METRIC_DISSECT]     = "dissect",
+  [METRIC_VALIDATE]    = "validate",
+  [METRIC_DOWNLOAD]    = "download",
+  [METRIC_LINK]        = "link",
+};
+
+static const char *const counter_names[_METRIC_COUNTER_MAX] = {
+  [METRIC_DOWNLOAD_BYTES]   = "download-bytes",
+  [METRIC_CATALOG_CACHED]   = "catalog-cached",
+  [METRIC_CATALOG_LOADED]   = "catalog-loaded",
+  [METRIC_METADATA_CACHED]  = "metadata-cached",
+  [METRIC_METADATA_SKIPPED] = "metadata-skipped",
+};
+
+static struct phase phases[_METRIC_PHASE_MAX];
+static uint64_t counters[_METRIC_COUNTER_MAX];
+
+uint64_t
+metrics_now(void)
+{
+  struct timespec ts;
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000ULL + (uint64_t) ts.tv_nsec / 1000;
+}
+
+void
+metrics_record(enum metric_phase phase, uint64_t start, bool failed)
+{
+  struct phase *p;
+  uint64_t now = metrics_now(), usec;
+  size_t b = 0;
+
+  assert(phase < _METRIC_PHASE_MAX);
+
+  usec = now > start ? now - start : 0;
+  while (b < N_BUCKETS - 1 && usec > bucket_limits[b])
+    b++;
+
+  p = &phases[phase];
+  p->count++;
+  if (failed)
+    p->failed++;
+  p->total_usec += usec;
+  if (usec > p->max_usec)
+    p->max_usec = usec;
+  p->buckets[b]++;
+}
+
+void
+metrics_count(enum metric_counter counter, uint64_t n)
+{
+  assert(counter < _METRIC_COUNTER_MAX);
+
+  counters[counter] += n;
+}
+
+/* The buckets are cumulative like Prometheus histograms, the
+   slowest one is Count */
+static int
+phase_to_json(size_t i, sd_json_variant **res)
+{
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *buckets = NULL;
+  const struct phase *p = &phases[i];
+  uint64_t sum = 0;
+  int r;
+
+  for (size_t b = 0; b < N_BUCKETS - 1; b++)
+    {
+      sum += p->buckets[b];
+      r = sd_json_variant_append_arraybo(&buckets,
+					 SD_JSON_BUILD_PAIR_UNSIGNED("LE", bucket_limits[b]),
+					 SD_JSON_BUILD_PAIR_UNSIGNED("Count", sum));
+      if (r < 0)
+	return r;
+    }
+
+  return sd_json_buildo(res,
+			SD_JSON_BUILD_PAIR_STRING("Name", phase_names[i]),
+			SD_JSON_BUILD_PAIR_UNSIGNED("Count", p->count),
+			SD_JSON_BUILD_PAIR_UNSIGNED("Failed", p->failed),
+			SD_JSON_BUILD_PAIR_UNSIGNED("TotalUSec", p->total_usec),
+			SD_JSON_BUILD_PAIR_UNSIGNED("MaxUSec", p->max_usec),
+			SD_JSON_BUILD_PAIR_VARIANT("Buckets", buckets));
+}
+
+int
+metrics_to_json(sd_json_variant **res)
+{
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *p = NULL;
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *c = NULL;
+  uint64_t download_usec = phases[METRIC_DOWNLOAD].total_usec;
+  int r;
+
+  assert(res);
+
+  for (size_t i = 0; i < _METRIC_PHASE_MAX; i++)
+    {
+      _cleanup_(sd_json_variant_unrefp) sd_json_variant *v = NULL;
+
+      r = phase_to_json(i, &v);
+      if (r < 0)
+	return r;
+      r = sd_json_variant_append_array(&p, v);
+      if (r < 0)
+	return r;
+    }
+
+  for (size_t i = 0; i < _METRIC_COUNTER_MAX; i++)
+    {
+      r = sd_json_variant_append_arraybo(&c,
+					 SD_JSON_BUILD_PAIR_STRING("Name", counter_names[i]),
+					 SD_JSON_BUILD_PAIR_UNSIGNED("Value", counters[i]));
+      if (r < 0)
+	return r;
+    }
+
+  /* failed attempts count, too: the rate the downloads achieved */
+  return sd_json_buildo(res,
+			SD_JSON_BUILD_PAIR_VARIANT("Phases", p),
+			SD_JSON_BUILD_PAIR_VARIANT("Counters", c),
+			SD_JSON_BUILD_PAIR_UNSIGNED("DownloadBytesPerSecond",
+						    download_usec > 0 ?
+						    counters[METRIC_DOWNLOAD_BYTES] * 1000000ULL / download_usec : 0));
+}
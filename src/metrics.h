@@ -0,0 +1,36 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <systemd/sd-json.h>
+
+/* Counters and latency histograms of the phases of all requests
+   since the start of sysextmgrd, reported by GetMetrics */
+enum metric_phase {
+  METRIC_SUMS_FETCH,    /* SHA256SUMS of the repository */
+  METRIC_INDEX_FETCH,   /* sysext-deps.json */
+  METRIC_JSON_FETCH,    /* json file of one image */
+  METRIC_DISSECT,       /* extension-release of one local image */
+  METRIC_VALIDATE,      /* all images of one scan against the host */
+  METRIC_DOWNLOAD,      /* one attempt to download an image */
+  METRIC_LINK,          /* switch of the links of one request */
+  _METRIC_PHASE_MAX
+};
+
+enum metric_counter {
+  METRIC_DOWNLOAD_BYTES,
+  METRIC_CATALOG_CACHED,    /* loads answered by the resident cache */
+  METRIC_CATALOG_LOADED,    /* loads which fetched or scanned something */
+  METRIC_METADATA_CACHED,   /* json files not fetched thanks to the cache */
+  METRIC_METADATA_SKIPPED,  /* json files not needed by a lazy fetch */
+  _METRIC_COUNTER_MAX
+};
+
+/* CLOCK_MONOTONIC in usec, the start time for metrics_record() */
+extern uint64_t metrics_now(void);
+extern void metrics_record(enum metric_phase phase, uint64_t start,
+		bool failed);
+extern void metrics_count(enum metric_counter counter, uint64_t n);
+extern int metrics_to_json(sd_json_variant **res);
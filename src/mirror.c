@@ -0,0 +1,333 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "basics.h"
+#include "sysextmgr.h"
+#include "download.h"
+#include "log_msg.h"
+#include "mirror.h"
+#include "strv.h"
+#include "tmpfile-util.h"
+
+#define USEC_PER_SEC  ((uint64_t) 1000000ULL)
+/* latency gets measured again after this time */
+#define PROBE_INTERVAL_USEC (10 * 60 * USEC_PER_SEC)
+/* a failed mirror is not used before this time, doubled for every
+   further failure in a row */
+#define FAILURE_BACKOFF_USEC (30 * USEC_PER_SEC)
+/* weight of a new measurement in 1/8 */
+#define EWMA_WEIGHT 3
+
+struct probe {
+  char tmpfn[sizeof("/tmp/sysext-probe.XXXXXX")];
+  size_t idx;
+  uint64_t start;
+};
+
+struct mirror {
+  char *url;
+  uint64_t latency;      /* usec, 0 if not measured yet */
+  uint64_t throughput;   /* bytes per second, 0 if not measured yet */
+  unsigned failures;     /* in a row */
+  uint64_t retry_after;  /* CLOCK_MONOTONIC */
+  uint64_t probed;       /* CLOCK_MONOTONIC of the last probe */
+  struct probe *probe;   /* running probe */
+};
+
+static struct mirror *mirrors = NULL;
+static size_t n_mirrors = 0;
+
+static uint64_t
+now_usec(void)
+{
+  struct timespec ts;
+
+  (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * USEC_PER_SEC + (uint64_t) ts.tv_nsec / 1000;
+}
+
+static uint64_t
+ewma(uint64_t old, uint64_t value)
+{
+  if (old == 0)
+    return value;
+
+  return (old * (8 - EWMA_WEIGHT) + value * EWMA_WEIGHT) / 8;
+}
+
+/* config.url and config.mirrors */
+static int
+mirrors_init(void)
+{
+  size_t n;
+
+  if (mirrors || config.url == NULL)
+    return 0;
+
+  n = 1 + strv_length(config.mirrors);
+  mirrors = calloc(n, sizeof(struct mirror));
+  if (mirrors == NULL)
+    return -ENOMEM;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      mirrors[i].url = strdup(i == 0 ? config.url : config.mirrors[i - 1]);
+      if (mirrors[i].url == NULL)
+	{
+	  n_mirrors = i;
+	  mirror_free();
+	  return -ENOMEM;
+	}
+    }
+  n_mirrors = n;
+
+  return 0;
+}
+
+static struct mirror *
+find_mirror(const char *url)
+{
+  for (size_t i = 0; i < n_mirrors; i++)
+    if (streq(mirrors[i].url, url))
+      return &mirrors[i];
+
+  return NULL;
+}
+
+static bool
+mirror_healthy(const struct mirror *m, uint64_t now)
+{
+  return m->failures == 0 || now >= m->retry_after;
+}
+
+static uint64_t sort_now;
+
+/* healthy mirrors first, then the faster one. The throughput of
+   image downloads counts more than the latency of the probes, it
+   is what matters for the images. Unmeasured mirrors keep the
+   order of the configuration. */
+static int
+mirror_cmp(const void *a, const void *b)
+{
+  const struct mirror *m1 = *(const struct mirror * const *) a;
+  const struct mirror *m2 = *(const struct mirror * const *) b;
+  bool h1 = mirror_healthy(m1, sort_now);
+  bool h2 = mirror_healthy(m2, sort_now);
+
+  if (h1 != h2)
+    return h1 ? -1 : 1;
+
+  if (!h1 && m1->failures != m2->failures)
+    return m1->failures < m2->failures ? -1 : 1;
+
+  if (m1->throughput > 0 && m2->throughput > 0 &&
+      m1->throughput != m2->throughput)
+    return m1->throughput > m2->throughput ? -1 : 1;
+
+  if (m1->latency > 0 && m2->latency > 0 && m1->latency != m2->latency)
+    return m1->latency < m2->latency ? -1 : 1;
+
+  return m1 < m2 ? -1 : (m1 > m2);
+}
+
+/* All URLs of the repository in the order to try them. If url is
+   not the configured repository, it is the only entry. */
+int
+mirror_list(const char *url, char ***res)
+{
+  _cleanup_free_ struct mirror **order = NULL;
+  char **l;
+  int r;
+
+  assert(url);
+  assert(res);
+
+  r = mirrors_init();
+  if (r < 0)
+    return r;
+
+  if (n_mirrors == 0 || !streq(url, mirrors[0].url))
+    {
+      l = calloc(2, sizeof(char *));
+      if (l == NULL)
+	return -ENOMEM;
+      l[0] = strdup(url);
+      if (l[0] == NULL)
+	{
+	  free(l);
+	  return -ENOMEM;
+	}
+      *res = l;
+      return 0;
+    }
+
+  order = calloc(n_mirrors, sizeof(struct mirror *));
+  l = calloc(n_mirrors + 1, sizeof(char *));
+  if (order == NULL || l == NULL)
+    {
+      free(l);
+      return -ENOMEM;
+    }
+
+  for (size_t i = 0; i < n_mirrors; i++)
+    order[i] = &mirrors[i];
+  sort_now = now_usec();
+  qsort(order, n_mirrors, sizeof(struct mirror *), mirror_cmp);
+
+  for (size_t i = 0; i < n_mirrors; i++)
+    {
+      l[i] = strdup(order[i]->url);
+      if (l[i] == NULL)
+	{
+	  strv_free(l);
+	  return -ENOMEM;
+	}
+    }
+
+  *res = l;
+
+  return 0;
+}
+
+void
+mirror_report_failure(const char *url)
+{
+  struct mirror *m = find_mirror(url);
+  uint64_t delay;
+
+  if (m == NULL)
+    return;
+
+  delay = FAILURE_BACKOFF_USEC << (m->failures < 6 ? m->failures : 6);
+  m->failures++;
+  m->retry_after = now_usec() + delay;
+
+  if (n_mirrors > 1)
+    log_msg(LOG_NOTICE, "Mirror '%s' failed, not using it for %" PRIu64 "s",
+	    url, delay / USEC_PER_SEC);
+}
+
+/* a complete image download, bytes in usec */
+void
+mirror_report_download(const char *url, uint64_t bytes, uint64_t usec)
+{
+  struct mirror *m = find_mirror(url);
+
+  if (m == NULL)
+    return;
+
+  m->failures = 0;
+  if (usec > 0 && bytes > 0)
+    m->throughput = ewma(m->throughput, bytes * USEC_PER_SEC / usec);
+}
+
+static void
+free_probe(struct probe *p)
+{
+  if (p == NULL)
+    return;
+
+  if (!isempty(p->tmpfn))
+    (void) unlink(p->tmpfn);
+  free(p);
+}
+
+/* process_done_t of the SHA256SUMS download */
+static int
+probe_done(int status, void *userdata)
+{
+  struct probe *p = userdata;
+  struct mirror *m = &mirrors[p->idx];
+
+  m->probe = NULL;
+
+  if (status == 0)
+    {
+      uint64_t usec = now_usec() - p->start;
+
+      m->latency = ewma(m->latency, usec > 0 ? usec : 1);
+      m->failures = 0;
+      log_msg(LOG_DEBUG, "Mirror '%s' answered in %" PRIu64 "ms", m->url,
+	      usec / 1000);
+    }
+  else
+    mirror_report_failure(m->url);
+
+  free_probe(p);
+
+  return 0;
+}
+
+/* Measure the latency of all mirrors by downloading SHA256SUMS
+   without verification, if the last measurement is too old.
+   Probes only influence the order of later requests, so errors are
+   only logged. */
+void
+mirror_probe(struct process_pool *pool)
+{
+  uint64_t now = now_usec();
+
+  if (mirrors_init() < 0 || n_mirrors < 2)
+    return;
+
+  for (size_t i = 0; i < n_mirrors; i++)
+    {
+      struct mirror *m = &mirrors[i];
+      struct probe *p;
+      int fd, r;
+
+      if (m->probe || (m->probed > 0 && now - m->probed < PROBE_INTERVAL_USEC))
+	continue;
+
+      p = calloc(1, sizeof(struct probe));
+      if (p == NULL)
+	return;
+      p->idx = i;
+      strcpy(p->tmpfn, "/tmp/sysext-probe.XXXXXX");
+      fd = mkostemp_safe(p->tmpfn);
+      if (fd < 0)
+	{
+	  p->tmpfn[0] = '\0';
+	  free_probe(p);
+	  return;
+	}
+      close(fd);
+
+      m->probed = now;
+      p->start = now;
+      m->probe = p;
+      r = download_submit(pool, NULL, m->url, "SHA256SUMS", p->tmpfn,
+			  false, probe_done, p);
+      if (r < 0)
+	{
+	  log_msg(LOG_WARNING, "Failed to probe mirror '%s': %s",
+		  m->url, strerror(-r));
+	  m->probe = NULL;
+	  free_probe(p);
+	}
+    }
+}
+
+/* The process pool needs to be freed before, a running probe does
+   not call probe_done() afterwards. */
+void
+mirror_free(void)
+{
+  for (size_t i = 0; i < n_mirrors; i++)
+    {
+      free(mirrors[i].url);
+      free_probe(mirrors[i].probe);
+    }
+  mirrors = mfree(mirrors);
+  n_mirrors = 0;
+}
@@ -0,0 +1,18 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <stdint.h>
+
+#include "process-pool.h"
+
+/* The repository of config.url is maybe also available from the
+   mirrors in config.mirrors. Every URL gets a score from the latency
+   of small probe downloads and the throughput of image downloads,
+   URLs which failed recently are only used after the others. */
+extern int mirror_list(const char *url, char ***res);
+extern void mirror_report_failure(const char *url);
+extern void mirror_report_download(const char *url, uint64_t bytes,
+		uint64_t usec);
+extern void mirror_probe(struct process_pool *pool);
+extern void mirror_free(void);
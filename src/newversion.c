@@ -3,122 +3,113 @@
 #include "config.h"
 
 #include <assert.h>
+#include <errno.h>
 
 #include "basics.h"
 #include "image-deps.h"
-#include "images-list.h"
+#include "catalog.h"
+#include "host-profile.h"
 #include "sysextmgr.h"
+#include "log_msg.h"
+#include "version-key.h"
 
-static int
-check_if_newer(struct image_entry *old, struct image_entry *new,
-	       struct image_entry **update)
+static bool
+same_architecture(const struct image_deps *a, const struct image_deps *b)
 {
-  assert(update);
-
-  /* new image is not compatible */
-  if (!new->compatible)
-    return 0;
+  if (a->architecture == NULL || b->architecture == NULL)
+    return a->architecture == b->architecture;
 
-  if (!streq(old->name, new->name))
-      return 0;
+  return streq(a->architecture, b->architecture);
+}
 
-  if (!streq(old->deps->architecture,
-	    new->deps->architecture))
-    return 0;
+/* Index of the first entry of the sorted versions which is not newer
+   than max_key. Images without version are behind all others. */
+static size_t
+first_not_newer(const struct catalog_name *n, const char *max_key)
+{
+  size_t lo = 0, hi = n->n_versions;
 
-  /* both images are identical, make sure flags are identical, too */
-  if (*update &&
-      streq((*update)->deps->image_name, new->deps->image_name) &&
-      streq((*update)->deps->sysext_version_id,
-	    new->deps->sysext_version_id))
+  while (lo < hi)
     {
-      if (new->local)
-	(*update)->local = new->local;
-      if (new->remote)
-	(*update)->remote = new->remote;
-      if (new->installed)
-	(*update)->installed = new->installed;
-      if (new->compatible)
-	(*update)->compatible = new->compatible;
-    }
-  /* old->deps->sysext_version_id is not set if this is image is not installed */
-  else if (old->deps->sysext_version_id == NULL ||
-	   strverscmp(old->deps->sysext_version_id,
-		      new->deps->sysext_version_id) < 0)
-    {
-      /* don't update with older version */
-      if (*update)
-	{
-	  if (strverscmp((*update)->deps->sysext_version_id,
-			 new->deps->sysext_version_id) >= 0)
-	    return 0;
-	  free_image_entryp(update);
-	}
+      size_t mid = lo + (hi - lo) / 2;
+      const char *k = n->versions[mid]->version_key;
 
-      *update = calloc(1, sizeof(struct image_entry));
-      if (*update == NULL)
-	return -ENOMEM;
-      (*update)->name = strdup(new->name);
-      (*update)->deps = TAKE_PTR(new->deps);
-      (*update)->local = new->local;
-      (*update)->remote = new->remote;
-      (*update)->installed = new->installed;
-      (*update)->compatible = new->compatible;
+      if (k && strcmp(k, max_key) > 0)
+	lo = mid + 1;
+      else
+	hi = mid;
     }
 
-  return 0;
+  return lo;
 }
 
-int
-get_latest_version(struct image_entry *curr, struct image_entry **new,
-		   const char *url, bool verify_signature,
-		   const struct osrelease *osrelease, bool verbose)
+/* Compatible with the host the catalog was loaded for, or with
+   another one if host is set */
+static bool
+is_compatible(const struct image_entry *e, struct host_profile *host)
+{
+  if (host == NULL)
+    return e->compatible;
+
+  return host_profile_validate(host, e->deps->image_name, "system",
+			       e->deps, false) > 0;
+}
+
+static int
+latest_version(const struct catalog *catalog,
+	       const struct image_entry *curr, const char *max_version,
+	       struct host_profile *host, struct image_entry **new)
 {
   _cleanup_(free_image_entryp) struct image_entry *update = NULL;
-  _cleanup_(free_image_entry_list) struct image_entry **images_remote = NULL;
-  _cleanup_(free_image_entry_list) struct image_entry **images_local = NULL;
-  size_t n_remote = 0, n_local = 0;
+  _cleanup_free_ char *curr_key = NULL, *max_key = NULL;
+  const struct catalog_name *n;
+  size_t first = 0;
   int r;
 
-  if (url)
+  assert(catalog);
+  assert(curr);
+  assert(new);
+
+  n = catalog_find_name(catalog, curr->name);
+  if (n == NULL)
+    return 0;
+
+  /* curr->deps->sysext_version_id is not set if this image is not installed */
+  if (curr->deps->sysext_version_id)
     {
-      r = image_remote_metadata(url, &images_remote, &n_remote, curr->name,
-				verify_signature, osrelease, verbose);
+      r = version_key_new(curr->deps->sysext_version_id, &curr_key);
       if (r < 0)
-	{
-	  fprintf(stderr, "Fetching image data from '%s' failed: %s\n",
-		  url, strerror(-r));
-	  return r;
-	}
+	return r;
     }
-
-  for (size_t i = 0; i < n_remote; i++)
+  if (max_version)
     {
-      r = check_if_newer(curr, images_remote[i], &update);
+      r = version_key_new(max_version, &max_key);
       if (r < 0)
-	{
-	  fprintf(stderr, "Image check failed: %s\n", strerror(-r));
-	  return r;
-	}
+	return r;
+      first = first_not_newer(n, max_key);
     }
 
-  /* now do the same with local images */
-  r = image_local_metadata(SYSEXT_STORE_DIR, &images_local, &n_local, curr->name, osrelease, verbose);
-  if (r < 0)
+  for (size_t i = first; i < n->n_versions; i++)
     {
-      fprintf(stderr, "Searching for images in '%s' failed: %s\n",
-	      SYSEXT_STORE_DIR, strerror(-r));
-      return r;
-    }
+      const struct image_entry *e = n->versions[i];
 
-  for (size_t i = 0; i < n_local; i++)
-    {
-      r = check_if_newer(curr, images_local[i], &update);
+      if (!is_compatible(e, host) || !same_architecture(curr->deps, e->deps))
+	continue;
+
+      /* all following versions are older */
+      if (e->version_key == NULL ||
+	  (curr_key && strcmp(curr_key, e->version_key) >= 0))
+	break;
+
+      /* the catalog is shared by all lookups and requests,
+	 so copy the data instead of stealing it */
+      r = dup_image_entry(e, &update);
       if (r < 0)
 	{
-	  fprintf(stderr, "Image check failed: %s\n", strerror(-r));
+	  log_msg(LOG_ERR, "Image check failed: %s", strerror(-r));
 	  return r;
 	}
+      break;
     }
 
   if (update)
@@ -126,3 +117,35 @@ get_latest_version(struct image_entry *curr, struct image_entry **new,
 
   return 0;
 }
+
+/* Search the catalog for the newest compatible version of curr which
+   is not newer than max_version, NULL means no limit.
+   No data is fetched, so this can be called for every installed
+   image without additional costs. The versions of a name are
+   sorted, so usually the first entry is already the result. */
+int
+get_latest_version_until(const struct catalog *catalog,
+			 const struct image_entry *curr,
+			 const char *max_version, struct image_entry **new)
+{
+  return latest_version(catalog, curr, max_version, NULL, new);
+}
+
+/* Same as get_latest_version() for another host, e.g. a snapshot,
+   without loading the catalog again */
+int
+get_latest_version_for_host(const struct catalog *catalog,
+			    const struct image_entry *curr,
+			    struct host_profile *host, struct image_entry **new)
+{
+  assert(host);
+
+  return latest_version(catalog, curr, NULL, host, new);
+}
+
+int
+get_latest_version(const struct catalog *catalog,
+		   const struct image_entry *curr, struct image_entry **new)
+{
+  return get_latest_version_until(catalog, curr, NULL, new);
+}
@@ -1,6 +1,8 @@
 /* SPDX-License-Identifier: GPL-2.0-or-later */
 
 #include <errno.h>
+#include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <unistd.h>
 #include <libeconf.h>
@@ -34,20 +36,33 @@ int
 load_os_release(const char *prefix, struct osrelease **res)
 {
   _cleanup_(econf_freeFilep) econf_file *key_file = NULL;
+  _cleanup_free_ char *etc = NULL;
+  _cleanup_free_ char *usr = NULL;
   econf_err error;
 
   assert(res);
 
   *res = calloc(1, sizeof(struct osrelease));
-  if (res == NULL)
+  if (*res == NULL)
     return -ENOMEM;
 
-  /* XXX add prefix to look in snapshots */
+  /* prefix is the root of e.g. a snapshot */
+  if (asprintf(&etc, "%s/etc/os-release", strempty(prefix)) < 0)
+    {
+      etc = NULL;
+      return -ENOMEM;
+    }
+  if (asprintf(&usr, "%s/usr/lib/os-release", strempty(prefix)) < 0)
+    {
+      usr = NULL;
+      return -ENOMEM;
+    }
+
   const char *osrelease = NULL;
-  if (access("/etc/os-release", F_OK) == 0)
-    osrelease = "/etc/os-release";
+  if (access(etc, F_OK) == 0)
+    osrelease = etc;
   else
-    osrelease = "/usr/lib/os-release";
+    osrelease = usr;
 
   if ((error = econf_readFile(&key_file, osrelease, "=", "#")))
     {
@@ -85,3 +100,89 @@ load_os_release(const char *prefix, struct osrelease **res)
 
   return 0;
 }
+
+static char *
+unquote(const char *v, size_t len)
+{
+  char *s, *p;
+
+  if (len >= 2 && (v[0] == '"' || v[0] == '\'') && v[len - 1] == v[0])
+    {
+      v++;
+      len -= 2;
+    }
+
+  s = p = malloc(len + 1);
+  if (s == NULL)
+    return NULL;
+
+  for (size_t i = 0; i < len; i++)
+    {
+      if (v[i] == '\\' && i + 1 < len)
+	i++;
+      *p++ = v[i];
+    }
+  *p = '\0';
+
+  return s;
+}
+
+/* Same as load_os_release() for the content of an os-release file,
+   e.g. of another machine. Only ID is required. */
+int
+parse_os_release(const char *data, struct osrelease **res)
+{
+  _cleanup_(free_os_releasep) struct osrelease *o = NULL;
+  const char *line, *next;
+
+  assert(data);
+  assert(res);
+
+  o = calloc(1, sizeof(struct osrelease));
+  if (o == NULL)
+    return -ENOMEM;
+
+  for (line = data; line && *line; line = next)
+    {
+      const char *eq, *end;
+      char **field = NULL;
+
+      next = strchr(line, '\n');
+      end = next ? next++ : line + strlen(line);
+      while (end > line && (end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'))
+	end--;
+      while (line < end && (*line == ' ' || *line == '\t'))
+	line++;
+
+      if (line == end || *line == '#')
+	continue;
+      eq = memchr(line, '=', end - line);
+      if (eq == NULL)
+	continue;
+
+#define KEY(k) ((size_t) (eq - line) == strlen(k) && strneq(line, k, strlen(k)))
+      if (KEY("ID"))
+	field = &o->id;
+      else if (KEY("ID_LIKE"))
+	field = &o->id_like;
+      else if (KEY("VERSION_ID"))
+	field = &o->version_id;
+      else if (KEY("SYSEXT_LEVEL"))
+	field = &o->sysext_level;
+#undef KEY
+      if (field == NULL)
+	continue;
+
+      free(*field);
+      *field = unquote(eq + 1, end - eq - 1);
+      if (*field == NULL)
+	return -ENOMEM;
+    }
+
+  if (isempty(o->id))
+    return -EINVAL;
+
+  *res = TAKE_PTR(o);
+
+  return 0;
+}
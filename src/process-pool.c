@@ -0,0 +1,479 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "basics.h"
+#include "strv.h"
+#include "process-pool.h"
+#include "log_msg.h"
+
+struct process {
+  struct process *next;
+  struct process_pool *pool;
+  char **argv;             /* only the name for a func */
+  process_func_t func;
+  void *arg;
+  int outfd;               /* stdout of the child, -EBADF to inherit */
+  sd_event_source *child;
+  struct process_batch *batch;
+  process_done_t done;
+  void *userdata;
+};
+
+struct process_pool {
+  sd_event *event;
+  unsigned max_parallel;
+  unsigned running;
+  struct process *queue;   /* not yet started, in order of submission */
+  struct process *queue_tail;
+  struct process *active;  /* currently running */
+  int error;               /* first error reported by a callback */
+};
+
+static struct process *
+free_process(struct process *p)
+{
+  if (!p)
+    return NULL;
+
+  /* kills and reaps the child if it is still running */
+  p->child = sd_event_source_unref(p->child);
+  p->argv = strv_free(p->argv);
+
+  return mfree(p);
+}
+
+static void
+free_process_list(struct process *p)
+{
+  while (p)
+    {
+      struct process *next = p->next;
+      free_process(p);
+      p = next;
+    }
+}
+
+struct process_pool *
+free_process_pool(struct process_pool *pool)
+{
+  if (!pool)
+    return NULL;
+
+  free_process_list(pool->queue);
+  free_process_list(pool->active);
+  pool->event = sd_event_unref(pool->event);
+
+  return mfree(pool);
+}
+
+void
+free_process_poolp(struct process_pool **pool)
+{
+  if (!pool || !*pool)
+    return;
+
+  *pool = free_process_pool(*pool);
+}
+
+/* If event is NULL, the pool uses a private event loop which is
+   driven by process_pool_wait(). */
+int
+process_pool_new(struct process_pool **res, sd_event *event,
+		 unsigned max_parallel)
+{
+  _cleanup_(free_process_poolp) struct process_pool *pool = NULL;
+  sigset_t ss;
+  int r;
+
+  assert(res);
+
+  /* sd-event requires SIGCHLD to be blocked for child sources */
+  if (sigemptyset(&ss) < 0 || sigaddset(&ss, SIGCHLD) < 0)
+    return -errno;
+  r = sigprocmask(SIG_BLOCK, &ss, NULL);
+  if (r < 0)
+    return -errno;
+
+  pool = calloc(1, sizeof(struct process_pool));
+  if (pool == NULL)
+    return -ENOMEM;
+
+  pool->max_parallel = max_parallel > 0 ? max_parallel : 1;
+
+  if (event)
+    pool->event = sd_event_ref(event);
+  else
+    {
+      r = sd_event_new(&pool->event);
+      if (r < 0)
+	return r;
+    }
+
+  *res = TAKE_PTR(pool);
+
+  return 0;
+}
+
+/* from linux/ioprio.h */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+
+/* Called in the child. Failing is not fatal, the process only
+   competes with the rest of the system then. */
+static void
+set_background_priority(void)
+{
+  struct sched_param sp = { .sched_priority = 0 };
+
+  (void) sched_setscheduler(0, SCHED_IDLE, &sp);
+  (void) syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+		 IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+}
+
+static void
+remove_active(struct process_pool *pool, struct process *p)
+{
+  for (struct process **i = &pool->active; *i; i = &(*i)->next)
+    if (*i == p)
+      {
+	*i = p->next;
+	p->next = NULL;
+	return;
+      }
+}
+
+static void process_pool_dispatch(struct process_pool *pool);
+
+static void
+process_batch_put(struct process_batch *batch)
+{
+  assert(batch->pending > 0);
+
+  if (--batch->pending == 0)
+    batch->done(batch->error, batch->userdata);
+}
+
+static void
+process_report(struct process_pool *pool, struct process_batch *batch,
+	       process_done_t done, void *userdata, int status)
+{
+  if (done)
+    {
+      int r = done(status, userdata);
+      if (r < 0 && pool->error == 0)
+	pool->error = r;
+      if (r < 0 && batch && batch->error == 0)
+	batch->error = r;
+    }
+}
+
+static void
+process_finish(struct process *p, int status)
+{
+  struct process_batch *batch = p->batch;
+
+  process_report(p->pool, batch, p->done, p->userdata, status);
+
+  free_process(p);
+
+  if (batch)
+    process_batch_put(batch);
+}
+
+static int
+process_exited(sd_event_source _unused_(*s), const siginfo_t *si, void *userdata)
+{
+  struct process *p = userdata;
+  struct process_pool *pool = p->pool;
+  int status;
+
+  if (si->si_code == CLD_EXITED)
+    status = si->si_status;
+  else
+    status = 128 + si->si_status;
+
+  log_msg(LOG_DEBUG, "%s exited with %i", p->argv[0], status);
+
+  remove_active(pool, p);
+  pool->running--;
+  /* the child is already reaped, don't kill it again */
+  (void) sd_event_source_set_child_process_own(p->child, false);
+
+  process_finish(p, status);
+  process_pool_dispatch(pool);
+
+  return 0;
+}
+
+static int
+process_start(struct process *p)
+{
+  struct process_pool *pool = p->pool;
+  pid_t pid;
+  int r;
+
+  /* XXX safe_fork_full() */
+  pid = fork();
+  if (pid < 0)
+    return -errno;
+
+  if (pid == 0)
+    {
+      sigset_t ss;
+
+      /* don't leak the blocked SIGCHLD to the child */
+      sigemptyset(&ss);
+      sigprocmask(SIG_SETMASK, &ss, NULL);
+
+      if (p->outfd >= 0 && dup2(p->outfd, STDOUT_FILENO) < 0)
+	_exit(EXIT_FAILURE);
+
+      if (p->batch && p->batch->background)
+	set_background_priority();
+
+      if (p->func)
+	_exit(p->func(p->arg));
+
+      /* XXX (void) close_all_fds(NULL, 0); */
+      execv(p->argv[0], p->argv);
+      fprintf(stderr, "execv(%s): %s\n", p->argv[0], strerror(errno));
+      _exit(127);
+    }
+
+  r = sd_event_add_child(pool->event, &p->child, pid, WEXITED, process_exited, p);
+  if (r < 0)
+    {
+      (void) kill(pid, SIGKILL);
+      (void) waitpid(pid, NULL, 0);
+      return r;
+    }
+  (void) sd_event_source_set_child_process_own(p->child, true);
+
+  p->next = pool->active;
+  pool->active = p;
+  pool->running++;
+
+  return 0;
+}
+
+/* start queued processes until the limit is reached */
+static void
+process_pool_dispatch(struct process_pool *pool)
+{
+  while (pool->queue && pool->running < pool->max_parallel)
+    {
+      struct process *p = pool->queue;
+      int r;
+
+      pool->queue = p->next;
+      if (pool->queue == NULL)
+	pool->queue_tail = NULL;
+      p->next = NULL;
+
+      r = process_start(p);
+      if (r < 0)
+	{
+	  log_msg(LOG_ERR, "Failed to start %s: %s", p->argv[0], strerror(-r));
+	  process_finish(p, r);
+	}
+    }
+}
+
+static void
+process_enqueue(struct process_pool *pool, struct process *p)
+{
+  if (pool->queue_tail)
+    pool->queue_tail->next = p;
+  else
+    pool->queue = p;
+  pool->queue_tail = p;
+
+  if (p->batch)
+    p->batch->pending++;
+
+  process_pool_dispatch(pool);
+}
+
+static struct process *
+process_new(struct process_pool *pool, struct process_batch *batch,
+	    const char *const *argv, int outfd, process_done_t done,
+	    void *userdata)
+{
+  struct process *p;
+
+  p = calloc(1, sizeof(struct process));
+  if (p == NULL)
+    return NULL;
+
+  p->argv = strv_copy((char *const *) argv);
+  if (p->argv == NULL)
+    return mfree(p);
+  p->pool = pool;
+  p->batch = batch;
+  p->outfd = outfd;
+  p->done = done;
+  p->userdata = userdata;
+
+  return p;
+}
+
+/* outfd is not closed and needs to stay valid until the child is
+   started. batch is optional. */
+int
+process_pool_submit(struct process_pool *pool, struct process_batch *batch,
+		    const char *const *argv, int outfd,
+		    process_done_t done, void *userdata)
+{
+  struct process *p;
+
+  assert(pool);
+  assert(argv && argv[0]);
+
+  p = process_new(pool, batch, argv, outfd, done, userdata);
+  if (p == NULL)
+    return -ENOMEM;
+
+  process_enqueue(pool, p);
+
+  return 0;
+}
+
+/* For CPU bound work of the daemon itself, e.g. hashing: func runs
+   in a forked child with a copy of the memory, so it can use arg but
+   can not pass anything back except the exit status. name is only
+   used for logging. */
+int
+process_pool_submit_func(struct process_pool *pool,
+			 struct process_batch *batch, const char *name,
+			 process_func_t func, void *arg,
+			 process_done_t done, void *userdata)
+{
+  const char *argv[] = { name, NULL };
+  struct process *p;
+
+  assert(pool);
+  assert(name);
+  assert(func);
+
+  p = process_new(pool, batch, argv, -EBADF, done, userdata);
+  if (p == NULL)
+    return -ENOMEM;
+  p->func = func;
+  p->arg = arg;
+
+  process_enqueue(pool, p);
+
+  return 0;
+}
+
+/* For jobs which could be done without a helper process: done gets
+   called immediately with status, as if a process had exited. */
+void
+process_pool_complete(struct process_pool *pool, struct process_batch *batch,
+		      int status, process_done_t done, void *userdata)
+{
+  assert(pool);
+
+  if (batch)
+    batch->pending++;
+
+  process_report(pool, batch, done, userdata, status);
+
+  if (batch)
+    process_batch_put(batch);
+}
+
+/* Run the event loop until all submitted processes are finished.
+   Returns the first error reported by a callback. */
+int
+process_pool_wait(struct process_pool *pool)
+{
+  int r;
+
+  assert(pool);
+
+  while (pool->running > 0 || pool->queue)
+    {
+      r = sd_event_run(pool->event, UINT64_MAX);
+      if (r < 0)
+	return r;
+    }
+
+  r = pool->error;
+  pool->error = 0;
+
+  return r;
+}
+
+/* process_done_t which stores the status in the int userdata points to */
+int
+process_store_status(int status, void *userdata)
+{
+  int *ret = userdata;
+
+  *ret = status;
+
+  return 0;
+}
+
+bool
+process_pool_busy(const struct process_pool *pool)
+{
+  return pool && (pool->running > 0 || pool->queue);
+}
+
+/* The batch holds a reference until process_batch_end(), so that done
+   cannot be called while the processes are still submitted. */
+void
+process_batch_begin(struct process_batch *batch,
+		    process_batch_done_t done, void *userdata)
+{
+  assert(batch);
+  assert(done);
+
+  batch->pending = 1;
+  batch->error = 0;
+  batch->background = false;
+  batch->done = done;
+  batch->userdata = userdata;
+}
+
+void
+process_batch_end(struct process_batch *batch, int error)
+{
+  assert(batch);
+
+  if (error < 0 && batch->error == 0)
+    batch->error = error;
+
+  process_batch_put(batch);
+}
+
+/* Keep done from being called while there is no process of the
+   batch running, e.g. while waiting to start one again later. */
+void
+process_batch_hold(struct process_batch *batch)
+{
+  assert(batch);
+  assert(batch->pending > 0);
+
+  batch->pending++;
+}
+
+void
+process_batch_release(struct process_batch *batch)
+{
+  assert(batch);
+
+  process_batch_put(batch);
+}
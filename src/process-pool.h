@@ -0,0 +1,60 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+#include <systemd/sd-event.h>
+
+/* Runs child processes (e.g. systemd-pull) with a limit of
+   processes running at the same time. The children are reaped via
+   sd-event child sources. */
+struct process_pool;
+
+/* status is the exit code of the child, 128 + signal number if the
+   child got killed or a negative errno value if it could not be
+   started. A negative return value gets reported by
+   process_pool_wait(). */
+typedef int (*process_done_t)(int status, void *userdata);
+
+/* Runs in a forked child instead of a program, the return value is
+   the exit status */
+typedef int (*process_func_t)(void *arg);
+
+/* error is the first negative value returned by a process_done_t
+   callback of this batch or passed to process_batch_end(). */
+typedef void (*process_batch_done_t)(int error, void *userdata);
+
+/* Groups the processes of one step of a job. done gets called once
+   after process_batch_end() and after all processes of the batch
+   are finished. This can already happen in process_batch_end(),
+   and done is allowed to free the memory of the batch. */
+struct process_batch {
+  unsigned pending;
+  int error;
+  bool background;  /* run the processes with idle CPU and I/O priority */
+  process_batch_done_t done;
+  void *userdata;
+};
+
+extern struct process_pool *free_process_pool(struct process_pool *pool);
+extern void free_process_poolp(struct process_pool **pool);
+extern int process_pool_new(struct process_pool **res, sd_event *event,
+		unsigned max_parallel);
+extern int process_pool_submit(struct process_pool *pool,
+		struct process_batch *batch, const char *const *argv,
+		int outfd, process_done_t done, void *userdata);
+extern int process_pool_submit_func(struct process_pool *pool,
+		struct process_batch *batch, const char *name,
+		process_func_t func, void *arg,
+		process_done_t done, void *userdata);
+extern void process_pool_complete(struct process_pool *pool,
+		struct process_batch *batch, int status,
+		process_done_t done, void *userdata);
+extern int process_pool_wait(struct process_pool *pool);
+extern int process_store_status(int status, void *userdata);
+extern bool process_pool_busy(const struct process_pool *pool);
+extern void process_batch_begin(struct process_batch *batch,
+		process_batch_done_t done, void *userdata);
+extern void process_batch_end(struct process_batch *batch, int error);
+extern void process_batch_hold(struct process_batch *batch);
+extern void process_batch_release(struct process_batch *batch);
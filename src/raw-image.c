@@ -0,0 +1,460 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "basics.h"
+#include "raw-image.h"
+
+/* Reads single small files from the most common layout of sysext
+   images without loop device and mount: no partition table or a GPT
+   with exactly one partition, containing an EROFS filesystem whose
+   directories and file are stored uncompressed. Verity and signature
+   partitions, squashfs and compressed files are left to
+   systemd-dissect. */
+
+#define GPT_SIGNATURE "EFI PART"
+#define GPT_HEADER_SIZE 92
+#define GPT_ENTRY_MIN_SIZE 128
+#define GPT_MAX_ENTRIES 1024
+
+#define EROFS_SUPER_OFFSET 1024
+#define EROFS_SUPER_SIZE 128
+#define EROFS_SUPER_MAGIC 0xE0F5E1E2U
+/* incompat features which don't change the flat inode layouts */
+#define EROFS_KNOWN_INCOMPAT 0x7FU
+#define EROFS_SLOT_SIZE 32
+#define EROFS_INODE_COMPACT_SIZE 32
+#define EROFS_INODE_EXTENDED_SIZE 64
+#define EROFS_INODE_FLAT_PLAIN 0
+#define EROFS_INODE_FLAT_INLINE 2
+#define EROFS_DIRENT_SIZE 12
+
+/* extension-release files are small, directories on the path too */
+#define MAX_FILE_SIZE (64*1024)
+#define MAX_DIR_SIZE (16*1024*1024)
+
+struct erofs {
+  int fd;
+  uint64_t offset;    /* start of the filesystem in the image */
+  uint64_t size;      /* size of the partition */
+  unsigned blkszbits;
+  uint64_t meta_addr; /* byte offset of the inode area */
+  uint64_t root_nid;
+};
+
+struct erofs_inode {
+  uint16_t mode;
+  unsigned layout;
+  uint64_t size;
+  uint64_t data_pos;   /* byte offset of the first data block */
+  uint64_t inline_pos; /* byte offset of the tail stored after the inode */
+};
+
+static uint16_t
+get_le16(const uint8_t *p)
+{
+  return (uint16_t) p[0] | (uint16_t) p[1] << 8;
+}
+
+static uint32_t
+get_le32(const uint8_t *p)
+{
+  return (uint32_t) get_le16(p) | (uint32_t) get_le16(p + 2) << 16;
+}
+
+static uint64_t
+get_le64(const uint8_t *p)
+{
+  return (uint64_t) get_le32(p) | (uint64_t) get_le32(p + 4) << 32;
+}
+
+static int
+read_at(int fd, uint64_t pos, void *buf, size_t len)
+{
+  ssize_t l;
+
+  l = pread(fd, buf, len, (off_t) pos);
+  if (l < 0)
+    return -errno;
+  if ((size_t) l != len)
+    return -EBADMSG; /* truncated image */
+
+  return 0;
+}
+
+/* offset and size of the filesystem inside the image */
+static int
+find_filesystem(int fd, uint64_t image_size, uint64_t *ret_offset,
+		uint64_t *ret_size)
+{
+  static const uint64_t sector_sizes[] = { 512, 4096 };
+  uint8_t hdr[GPT_HEADER_SIZE];
+  int r;
+
+  for (size_t i = 0; i < sizeof(sector_sizes)/sizeof(sector_sizes[0]); i++)
+    {
+      uint64_t ss = sector_sizes[i];
+      _cleanup_free_ uint8_t *entries = NULL;
+      uint64_t entries_lba, first = 0, last = 0;
+      uint32_t n_entries, entry_size;
+      unsigned found = 0;
+
+      if (image_size < ss + GPT_HEADER_SIZE)
+	continue;
+
+      r = read_at(fd, ss, hdr, sizeof(hdr));
+      if (r < 0)
+	return r;
+      if (memcmp(hdr, GPT_SIGNATURE, 8) != 0)
+	continue;
+
+      entries_lba = get_le64(hdr + 72);
+      n_entries = get_le32(hdr + 80);
+      entry_size = get_le32(hdr + 84);
+      if (entry_size < GPT_ENTRY_MIN_SIZE || entry_size > 4096 ||
+	  n_entries > GPT_MAX_ENTRIES)
+	return -EOPNOTSUPP;
+      if (entries_lba > image_size / ss ||
+	  (uint64_t) n_entries * entry_size > image_size - entries_lba * ss)
+	return -EBADMSG;
+
+      entries = malloc((size_t) n_entries * entry_size);
+      if (entries == NULL)
+	return -ENOMEM;
+
+      r = read_at(fd, entries_lba * ss, entries, (size_t) n_entries * entry_size);
+      if (r < 0)
+	return r;
+
+      for (uint32_t n = 0; n < n_entries; n++)
+	{
+	  const uint8_t *e = entries + (size_t) n * entry_size;
+	  static const uint8_t unused[16] = { 0 };
+
+	  if (memcmp(e, unused, sizeof(unused)) == 0)
+	    continue;
+
+	  found++;
+	  first = get_le64(e + 32);
+	  last = get_le64(e + 40);
+	}
+
+      /* more than one partition means verity, signatures or
+	 something else we don't understand */
+      if (found != 1)
+	return -EOPNOTSUPP;
+      if (last < first || last >= image_size / ss)
+	return -EBADMSG;
+
+      *ret_offset = first * ss;
+      *ret_size = (last - first + 1) * ss;
+      return 0;
+    }
+
+  /* no partition table, the image is the filesystem */
+  *ret_offset = 0;
+  *ret_size = image_size;
+
+  return 0;
+}
+
+static int
+erofs_read(const struct erofs *e, uint64_t pos, void *buf, size_t len)
+{
+  if (pos > e->size || len > e->size - pos)
+    return -EBADMSG;
+
+  return read_at(e->fd, e->offset + pos, buf, len);
+}
+
+static int
+erofs_open(struct erofs *e)
+{
+  uint8_t sb[EROFS_SUPER_SIZE];
+  uint32_t meta_blkaddr;
+  int r;
+
+  if (e->size < EROFS_SUPER_OFFSET + EROFS_SUPER_SIZE)
+    return -EOPNOTSUPP;
+
+  r = erofs_read(e, EROFS_SUPER_OFFSET, sb, sizeof(sb));
+  if (r < 0)
+    return r;
+
+  /* squashfs or something else */
+  if (get_le32(sb) != EROFS_SUPER_MAGIC)
+    return -EOPNOTSUPP;
+
+  e->blkszbits = sb[12];
+  if (e->blkszbits < 9 || e->blkszbits > 16)
+    return -EBADMSG;
+  if ((get_le32(sb + 80) & ~EROFS_KNOWN_INCOMPAT) != 0)
+    return -EOPNOTSUPP;
+  /* directory blocks larger than the filesystem blocks */
+  if (sb[90] != 0)
+    return -EOPNOTSUPP;
+
+  e->root_nid = get_le16(sb + 14);
+  meta_blkaddr = get_le32(sb + 40);
+  e->meta_addr = (uint64_t) meta_blkaddr << e->blkszbits;
+  if (e->meta_addr >= e->size)
+    return -EBADMSG;
+
+  return 0;
+}
+
+static int
+erofs_read_inode(const struct erofs *e, uint64_t nid, struct erofs_inode *ret)
+{
+  uint8_t buf[EROFS_INODE_EXTENDED_SIZE];
+  uint64_t pos;
+  uint16_t format, xattr_icount;
+  size_t isize, xattr_size;
+  int r;
+
+  if (nid > (e->size - e->meta_addr) / EROFS_SLOT_SIZE)
+    return -EBADMSG;
+  pos = e->meta_addr + nid * EROFS_SLOT_SIZE;
+
+  r = erofs_read(e, pos, buf, EROFS_INODE_COMPACT_SIZE);
+  if (r < 0)
+    return r;
+
+  format = get_le16(buf);
+  xattr_icount = get_le16(buf + 2);
+  ret->mode = get_le16(buf + 4);
+  ret->layout = (format >> 1) & 0x7;
+
+  if (format & 1)
+    {
+      isize = EROFS_INODE_EXTENDED_SIZE;
+      r = erofs_read(e, pos, buf, EROFS_INODE_EXTENDED_SIZE);
+      if (r < 0)
+	return r;
+      ret->size = get_le64(buf + 8);
+    }
+  else
+    {
+      isize = EROFS_INODE_COMPACT_SIZE;
+      ret->size = get_le32(buf + 8);
+    }
+
+  /* compressed or chunk based files */
+  if (ret->layout != EROFS_INODE_FLAT_PLAIN &&
+      ret->layout != EROFS_INODE_FLAT_INLINE)
+    return -EOPNOTSUPP;
+
+  xattr_size = xattr_icount ? 12 + (xattr_icount - 1) * 4 : 0;
+  ret->data_pos = (uint64_t) get_le32(buf + 16) << e->blkszbits;
+  ret->inline_pos = pos + isize + xattr_size;
+
+  return 0;
+}
+
+/* the caller makes sure that off + len <= inode size */
+static int
+erofs_read_data(const struct erofs *e, const struct erofs_inode *i,
+		uint64_t off, uint8_t *buf, size_t len)
+{
+  uint64_t blksz = (uint64_t) 1 << e->blkszbits;
+  uint64_t tail_start = i->size;
+  int r;
+
+  /* with FLAT_INLINE the last block is stored after the inode */
+  if (i->layout == EROFS_INODE_FLAT_INLINE && i->size > 0)
+    {
+      tail_start = ((i->size - 1) >> e->blkszbits) << e->blkszbits;
+      if ((i->inline_pos & (blksz - 1)) + (i->size - tail_start) > blksz)
+	return -EBADMSG;
+    }
+
+  while (len > 0)
+    {
+      uint64_t pos;
+      size_t n;
+
+      if (off >= tail_start)
+	{
+	  n = len;
+	  pos = i->inline_pos + (off - tail_start);
+	}
+      else
+	{
+	  n = tail_start - off < len ? tail_start - off : len;
+	  pos = i->data_pos + off;
+	}
+
+      r = erofs_read(e, pos, buf, n);
+      if (r < 0)
+	return r;
+
+      buf += n;
+      off += n;
+      len -= n;
+    }
+
+  return 0;
+}
+
+static int
+erofs_lookup(const struct erofs *e, const struct erofs_inode *dir,
+	     const char *name, size_t namelen, uint64_t *ret_nid)
+{
+  size_t blksz = (size_t) 1 << e->blkszbits;
+  _cleanup_free_ uint8_t *buf = NULL;
+
+  if (!S_ISDIR(dir->mode))
+    return -ENOTDIR;
+  if (dir->size > MAX_DIR_SIZE)
+    return -EOPNOTSUPP;
+
+  buf = malloc(blksz);
+  if (buf == NULL)
+    return -ENOMEM;
+
+  for (uint64_t off = 0; off < dir->size; off += blksz)
+    {
+      size_t len = dir->size - off < blksz ? dir->size - off : blksz;
+      size_t n;
+      int r;
+
+      r = erofs_read_data(e, dir, off, buf, len);
+      if (r < 0)
+	return r;
+
+      if (len < EROFS_DIRENT_SIZE)
+	return -EBADMSG;
+
+      /* the names follow the array of entries */
+      n = get_le16(buf + 8);
+      if (n < EROFS_DIRENT_SIZE || n > len || n % EROFS_DIRENT_SIZE != 0)
+	return -EBADMSG;
+      n /= EROFS_DIRENT_SIZE;
+
+      for (size_t k = 0; k < n; k++)
+	{
+	  const uint8_t *d = buf + k * EROFS_DIRENT_SIZE;
+	  size_t start = get_le16(d + 8);
+	  size_t end = k + 1 < n ? get_le16(d + EROFS_DIRENT_SIZE + 8) : len;
+
+	  if (start > end || end > len)
+	    return -EBADMSG;
+
+	  /* the last name of a block is padded with NUL bytes */
+	  if (strnlen((const char *) buf + start, end - start) == namelen &&
+	      memcmp(buf + start, name, namelen) == 0)
+	    {
+	      *ret_nid = get_le64(d);
+	      return 0;
+	    }
+	}
+    }
+
+  return -ENOENT;
+}
+
+static int
+write_all(int fd, const uint8_t *buf, size_t len)
+{
+  while (len > 0)
+    {
+      ssize_t l = write(fd, buf, len);
+
+      if (l < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -errno;
+	}
+
+      buf += l;
+      len -= l;
+    }
+
+  return 0;
+}
+
+/* Copy path (relative to the root of the filesystem) from the image
+   to outfd. Returns -EOPNOTSUPP if the layout of the image is not
+   supported, the caller should use systemd-dissect then. outfd is
+   only written to after the whole file got read. */
+int
+raw_image_copy_file(const char *image, const char *path, int outfd)
+{
+  _cleanup_close_ int fd = -EBADF;
+  _cleanup_free_ uint8_t *data = NULL;
+  struct erofs e = { .fd = -EBADF };
+  struct erofs_inode inode;
+  struct stat st;
+  const char *p;
+  int r;
+
+  assert(image);
+  assert(path);
+
+  fd = open(image, O_RDONLY|O_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+
+  if (fstat(fd, &st) < 0)
+    return -errno;
+  if (!S_ISREG(st.st_mode))
+    return -EOPNOTSUPP;
+
+  e.fd = fd;
+  r = find_filesystem(fd, st.st_size, &e.offset, &e.size);
+  if (r < 0)
+    return r;
+
+  r = erofs_open(&e);
+  if (r < 0)
+    return r;
+
+  r = erofs_read_inode(&e, e.root_nid, &inode);
+  if (r < 0)
+    return r;
+
+  p = path;
+  while (*p)
+    {
+      size_t len = strcspn(p, "/");
+      uint64_t nid;
+
+      if (len > 0)
+	{
+	  r = erofs_lookup(&e, &inode, p, len, &nid);
+	  if (r < 0)
+	    return r;
+
+	  r = erofs_read_inode(&e, nid, &inode);
+	  if (r < 0)
+	    return r;
+	}
+
+      p += len;
+      if (*p == '/')
+	p++;
+    }
+
+  /* symlinks would need to be resolved inside of the image */
+  if (!S_ISREG(inode.mode))
+    return -EOPNOTSUPP;
+  if (inode.size > MAX_FILE_SIZE)
+    return -EFBIG;
+
+  data = malloc(inode.size + 1);
+  if (data == NULL)
+    return -ENOMEM;
+
+  r = erofs_read_data(&e, &inode, 0, data, inode.size);
+  if (r < 0)
+    return r;
+
+  return write_all(outfd, data, inode.size);
+}
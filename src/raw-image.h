@@ -0,0 +1,5 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+extern int raw_image_copy_file(const char *image, const char *path, int outfd);
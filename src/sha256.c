@@ -0,0 +1,378 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/* SHA-256 as specified in FIPS 180-4 */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <cpuid.h>
+# include <immintrin.h>
+# define HAVE_SHA256_X86 1
+#elif defined(__aarch64__)
+# include <arm_neon.h>
+# include <sys/auxv.h>
+# ifndef HWCAP_SHA2
+#  define HWCAP_SHA2 (1 << 6)
+# endif
+# define HAVE_SHA256_ARM 1
+#endif
+
+#include "sha256.h"
+
+static const uint32_t k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+typedef void (*sha256_blocks_t)(uint32_t state[8], const uint8_t *data, size_t n);
+
+static void
+sha256_transform(uint32_t state[8], const uint8_t block[64])
+{
+  uint32_t w[64], a, b, c, d, e, f, g, h;
+
+  for (int i = 0; i < 16; i++)
+    w[i] = (uint32_t) block[4*i] << 24 | (uint32_t) block[4*i+1] << 16 |
+      (uint32_t) block[4*i+2] << 8 | (uint32_t) block[4*i+3];
+  for (int i = 16; i < 64; i++)
+    {
+      uint32_t s0 = ROR(w[i-15], 7) ^ ROR(w[i-15], 18) ^ (w[i-15] >> 3);
+      uint32_t s1 = ROR(w[i-2], 17) ^ ROR(w[i-2], 19) ^ (w[i-2] >> 10);
+      w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+
+  a = state[0]; b = state[1]; c = state[2]; d = state[3];
+  e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+  for (int i = 0; i < 64; i++)
+    {
+      uint32_t t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) +
+	((e & f) ^ (~e & g)) + k[i] + w[i];
+      uint32_t t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) +
+	((a & b) ^ (a & c) ^ (b & c));
+
+      h = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+
+  state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+  state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+static void
+sha256_blocks_generic(uint32_t state[8], const uint8_t *data, size_t n)
+{
+  for (; n > 0; n--, data += 64)
+    sha256_transform(state, data);
+}
+
+#ifdef HAVE_SHA256_X86
+/* SHA extensions (SHA-NI). The state is kept as ABEF and CDGH like
+   the sha256rnds2 instruction needs it. */
+__attribute__((target("sha,sse4.1")))
+static void
+sha256_blocks_x86(uint32_t state[8], const uint8_t *data, size_t n)
+{
+  const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i state0, state1, tmp, msg, w[4];
+
+  tmp = _mm_loadu_si128((const __m128i *) &state[0]);
+  state1 = _mm_loadu_si128((const __m128i *) &state[4]);
+  tmp = _mm_shuffle_epi32(tmp, 0xB1);             /* CDAB */
+  state1 = _mm_shuffle_epi32(state1, 0x1B);       /* EFGH */
+  state0 = _mm_alignr_epi8(tmp, state1, 8);       /* ABEF */
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);    /* CDGH */
+
+  for (; n > 0; n--, data += 64)
+    {
+      __m128i abef = state0, cdgh = state1;
+
+      for (int i = 0; i < 16; i++)
+	{
+	  if (i < 4)
+	    w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16 * i)), mask);
+	  else
+	    {
+	      tmp = _mm_sha256msg1_epu32(w[i % 4], w[(i - 3) % 4]);
+	      tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(w[(i - 1) % 4], w[(i - 2) % 4], 4));
+	      w[i % 4] = _mm_sha256msg2_epu32(tmp, w[(i - 1) % 4]);
+	    }
+
+	  msg = _mm_add_epi32(w[i % 4], _mm_loadu_si128((const __m128i *) &k[4 * i]));
+	  state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+	  msg = _mm_shuffle_epi32(msg, 0x0E);
+	  state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+	}
+
+      state0 = _mm_add_epi32(state0, abef);
+      state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B);          /* FEBA */
+  state1 = _mm_shuffle_epi32(state1, 0xB1);       /* DCHG */
+  state0 = _mm_blend_epi16(tmp, state1, 0xF0);    /* DCBA */
+  state1 = _mm_alignr_epi8(state1, tmp, 8);       /* HGFE */
+
+  _mm_storeu_si128((__m128i *) &state[0], state0);
+  _mm_storeu_si128((__m128i *) &state[4], state1);
+}
+
+static bool
+cpu_has_sha256(void)
+{
+  unsigned a, b, c, d;
+
+  if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSE4_1) || !(c & bit_SSSE3))
+    return false;
+  if (!__get_cpuid_count(7, 0, &a, &b, &c, &d))
+    return false;
+
+  return b & (1U << 29);  /* SHA */
+}
+#endif
+
+#ifdef HAVE_SHA256_ARM
+/* ARMv8 cryptography extensions */
+__attribute__((target("+crypto")))
+static void
+sha256_blocks_arm(uint32_t state[8], const uint8_t *data, size_t n)
+{
+  uint32x4_t state0, state1, w[4];
+
+  state0 = vld1q_u32(&state[0]);
+  state1 = vld1q_u32(&state[4]);
+
+  for (; n > 0; n--, data += 64)
+    {
+      uint32x4_t abcd = state0, efgh = state1;
+
+      for (int i = 0; i < 16; i++)
+	{
+	  uint32x4_t msg, tmp;
+
+	  if (i < 4)
+	    w[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * i)));
+	  else
+	    w[i % 4] = vsha256su1q_u32(vsha256su0q_u32(w[i % 4], w[(i - 3) % 4]),
+				       w[(i - 2) % 4], w[(i - 1) % 4]);
+
+	  msg = vaddq_u32(w[i % 4], vld1q_u32(&k[4 * i]));
+	  tmp = state0;
+	  state0 = vsha256hq_u32(state0, state1, msg);
+	  state1 = vsha256h2q_u32(state1, tmp, msg);
+	}
+
+      state0 = vaddq_u32(state0, abcd);
+      state1 = vaddq_u32(state1, efgh);
+    }
+
+  vst1q_u32(&state[0], state0);
+  vst1q_u32(&state[4], state1);
+}
+
+static bool
+cpu_has_sha256(void)
+{
+  return getauxval(AT_HWCAP) & HWCAP_SHA2;
+}
+#endif
+
+static const struct {
+  const char *name;
+  sha256_blocks_t blocks;
+  bool (*supported)(void);  /* NULL if it works everywhere */
+} implementations[] = {
+  { "generic", sha256_blocks_generic, NULL },
+#if defined(HAVE_SHA256_X86)
+  { "x86-sha", sha256_blocks_x86, cpu_has_sha256 },
+#elif defined(HAVE_SHA256_ARM)
+  { "arm-sha2", sha256_blocks_arm, cpu_has_sha256 },
+#endif
+};
+
+#define N_IMPLEMENTATIONS (sizeof(implementations) / sizeof(implementations[0]))
+
+static sha256_blocks_t impl = NULL;
+
+/* the instructions of the CPU if it has them */
+static sha256_blocks_t
+sha256_blocks(void)
+{
+  if (impl)
+    return impl;
+
+  impl = sha256_blocks_generic;
+  for (size_t i = 1; i < N_IMPLEMENTATIONS; i++)
+    if (implementations[i].supported())
+      impl = implementations[i].blocks;
+
+  return impl;
+}
+
+const char *
+sha256_implementation(size_t i)
+{
+  return i < N_IMPLEMENTATIONS ? implementations[i].name : NULL;
+}
+
+int
+sha256_use_implementation(const char *name)
+{
+  for (size_t i = 0; i < N_IMPLEMENTATIONS; i++)
+    if (strcmp(implementations[i].name, name) == 0)
+      {
+	if (implementations[i].supported && !implementations[i].supported())
+	  return -EOPNOTSUPP;
+	impl = implementations[i].blocks;
+	return 0;
+      }
+
+  return -ENOENT;
+}
+
+void
+sha256_init(struct sha256_ctx *ctx)
+{
+  static const uint32_t init[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+
+  memcpy(ctx->state, init, sizeof(init));
+  ctx->count = 0;
+}
+
+void
+sha256_update(struct sha256_ctx *ctx, const void *data, size_t len)
+{
+  const uint8_t *p = data;
+  size_t used = ctx->count % 64;
+
+  ctx->count += len;
+
+  if (used > 0)
+    {
+      size_t n = 64 - used < len ? 64 - used : len;
+
+      memcpy(ctx->buffer + used, p, n);
+      p += n;
+      len -= n;
+      if (used + n < 64)
+	return;
+      sha256_blocks()(ctx->state, ctx->buffer, 1);
+    }
+
+  if (len >= 64)
+    {
+      sha256_blocks()(ctx->state, p, len / 64);
+      p += len & ~(size_t) 63;
+      len &= 63;
+    }
+
+  memcpy(ctx->buffer, p, len);
+}
+
+void
+sha256_final(struct sha256_ctx *ctx, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+  uint64_t bits = ctx->count * 8;
+  size_t used = ctx->count % 64;
+
+  ctx->buffer[used++] = 0x80;
+  if (used > 56)
+    {
+      memset(ctx->buffer + used, 0, 64 - used);
+      sha256_blocks()(ctx->state, ctx->buffer, 1);
+      used = 0;
+    }
+  memset(ctx->buffer + used, 0, 56 - used);
+  for (int i = 0; i < 8; i++)
+    ctx->buffer[56 + i] = (uint8_t) (bits >> (56 - 8 * i));
+  sha256_blocks()(ctx->state, ctx->buffer, 1);
+
+  for (int i = 0; i < 8; i++)
+    {
+      digest[4*i] = (uint8_t) (ctx->state[i] >> 24);
+      digest[4*i+1] = (uint8_t) (ctx->state[i] >> 16);
+      digest[4*i+2] = (uint8_t) (ctx->state[i] >> 8);
+      digest[4*i+3] = (uint8_t) ctx->state[i];
+    }
+}
+
+/* lower case hex digits like in SHA256SUMS */
+void
+sha256_hex(const uint8_t digest[SHA256_DIGEST_SIZE],
+	   char hex[2 * SHA256_DIGEST_SIZE + 1])
+{
+  static const char digits[] = "0123456789abcdef";
+
+  for (size_t i = 0; i < SHA256_DIGEST_SIZE; i++)
+    {
+      hex[2*i] = digits[digest[i] >> 4];
+      hex[2*i+1] = digits[digest[i] & 0xf];
+    }
+  hex[2 * SHA256_DIGEST_SIZE] = '\0';
+}
+
+/* hash the content of fd from the current position to the end */
+int
+sha256_fd(int fd, char hex[2 * SHA256_DIGEST_SIZE + 1])
+{
+  struct sha256_ctx ctx;
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  uint8_t buf[64 * 1024];
+  ssize_t n;
+
+  sha256_init(&ctx);
+
+  while ((n = read(fd, buf, sizeof(buf))) != 0)
+    {
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -errno;
+	}
+      sha256_update(&ctx, buf, n);
+    }
+
+  sha256_final(&ctx, digest);
+  sha256_hex(digest, hex);
+
+  return 0;
+}
+
+/* Returns 1 if the content of path has the SHA256 sum expected (hex
+   digits as in SHA256SUMS), 0 if not. */
+int
+sha256_file_matches(const char *path, const char *expected)
+{
+  char sum[2 * SHA256_DIGEST_SIZE + 1];
+  int fd, r;
+
+  fd = open(path, O_RDONLY|O_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+
+  r = sha256_fd(fd, sum);
+  close(fd);
+  if (r < 0)
+    return r;
+
+  return strcasecmp(sum, expected) == 0;
+}
@@ -0,0 +1,28 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+
+struct sha256_ctx {
+  uint32_t state[8];
+  uint64_t count;          /* bytes processed */
+  uint8_t buffer[64];
+};
+
+extern void sha256_init(struct sha256_ctx *ctx);
+extern void sha256_update(struct sha256_ctx *ctx, const void *data, size_t len);
+extern void sha256_final(struct sha256_ctx *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+extern void sha256_hex(const uint8_t digest[SHA256_DIGEST_SIZE],
+		char hex[2 * SHA256_DIGEST_SIZE + 1]);
+extern int sha256_fd(int fd, char hex[2 * SHA256_DIGEST_SIZE + 1]);
+extern int sha256_file_matches(const char *path, const char *expected);
+/* Names of the block functions compiled in, NULL after the last. By
+   default the fastest one the CPU supports is used. Selecting one is
+   for tests: -ENOENT if it is not compiled in, -EOPNOTSUPP if the
+   CPU does not have the instructions. */
+extern const char *sha256_implementation(size_t i);
+extern int sha256_use_implementation(const char *name);
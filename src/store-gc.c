@@ -0,0 +1,232 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "basics.h"
+#include "strv.h"
+#include "log_msg.h"
+#include "store.h"
+#include "store-gc.h"
+
+/* image of the store which could be removed */
+struct candidate {
+  const char *image_name;
+  size_t rank;     /* newer versions of the same name in the store */
+  uint64_t bytes;  /* of the inode, shared with images of the same content */
+  dev_t dev;
+  ino_t ino;
+  nlink_t nlink;
+  bool keep;       /* linked or the newest version */
+  bool removed;
+};
+
+void
+store_gc_result_free(struct store_gc_result *res)
+{
+  res->removed = strv_free(res->removed);
+}
+
+static uint64_t
+stat_bytes(const struct stat *st)
+{
+  return (uint64_t) st->st_blocks * 512;
+}
+
+/* Objects whose image is gone have no other link. Returns the bytes
+   of these objects. */
+static uint64_t
+sweep_objects(int dfd, bool dry_run)
+{
+  _cleanup_close_ int fd = -EBADF;
+  struct dirent *de;
+  uint64_t bytes = 0;
+  DIR *d;
+
+  fd = openat(dfd, STORE_OBJECTS_DIR, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+  if (fd < 0)
+    return 0;
+
+  d = fdopendir(fd);
+  if (d == NULL)
+    return 0;
+  fd = -EBADF;  /* owned by d */
+
+  while ((de = readdir(d)) != NULL)
+    {
+      struct stat st;
+
+      if (de->d_name[0] == '.')
+	continue;
+      if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+	  !S_ISREG(st.st_mode) || st.st_nlink > 1)
+	continue;
+
+      if (!dry_run && unlinkat(dirfd(d), de->d_name, 0) < 0)
+	{
+	  log_msg(LOG_WARNING, "Failed to remove object '%s': %s",
+		  de->d_name, strerror(errno));
+	  continue;
+	}
+      bytes += stat_bytes(&st);
+    }
+  closedir(d);
+
+  return bytes;
+}
+
+/* The bytes of an inode are freed with its last name. Names outside
+   the catalog keep it, only the image names and the object are known. */
+static bool
+inode_freed(const struct candidate *c, size_t n, const struct candidate *cand)
+{
+  nlink_t names = 1;  /* the object */
+
+  for (size_t i = 0; i < n; i++)
+    {
+      if (c[i].ino != cand->ino || c[i].dev != cand->dev)
+	continue;
+      if (!c[i].removed)
+	return false;
+      names++;
+    }
+
+  return cand->nlink <= names;
+}
+
+static int
+remove_candidate(int dfd, struct candidate *c, size_t n,
+		 struct candidate *cand, bool dry_run,
+		 struct store_gc_result *res)
+{
+  if (!dry_run && unlinkat(dfd, cand->image_name, 0) < 0 && errno != ENOENT)
+    {
+      log_msg(LOG_WARNING, "Failed to remove '%s': %s", cand->image_name,
+	      strerror(errno));
+      cand->keep = true;
+      return 0;
+    }
+
+  log_msg(LOG_INFO, "%s '%s'", dry_run ? "Would remove" : "Removed",
+	  cand->image_name);
+
+  cand->keep = true;
+  cand->removed = true;
+  if (inode_freed(c, n, cand))
+    {
+      res->freed += cand->bytes;
+      res->size -= cand->bytes;
+    }
+
+  return strv_extend(&res->removed, cand->image_name);
+}
+
+int
+store_gc(const char *store, const struct catalog *catalog,
+	 const struct store_refs *refs, const struct store_gc_policy *policy,
+	 bool dry_run, struct store_gc_result *res)
+{
+  _cleanup_free_ struct candidate *c = NULL;
+  _cleanup_close_ int dfd = -EBADF;
+  size_t n = 0;
+  int r;
+
+  assert(store);
+  assert(catalog);
+  assert(refs);
+  assert(policy);
+  assert(res);
+
+  *res = (struct store_gc_result) {};
+
+  dfd = open(store, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+  if (dfd < 0)
+    return -errno;
+
+  c = calloc(catalog->n_images + 1, sizeof(struct candidate));
+  if (c == NULL)
+    return -ENOMEM;
+
+  /* the versions of a name are sorted from the newest to the oldest */
+  for (size_t i = 0; i < catalog->n_names; i++)
+    {
+      const struct catalog_name *cn = &catalog->names[i];
+      size_t rank = 0;
+
+      for (size_t v = 0; v < cn->n_versions; v++)
+	{
+	  const struct image_entry *e = cn->versions[v];
+	  bool seen = false;
+	  struct stat st;
+
+	  if (e->deps == NULL || e->deps->image_name == NULL)
+	    continue;
+	  if (fstatat(dfd, e->deps->image_name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+	      !S_ISREG(st.st_mode))
+	    continue;
+
+	  /* the same content under several names is stored once */
+	  for (size_t k = 0; k < n && !seen; k++)
+	    seen = c[k].ino == st.st_ino && c[k].dev == st.st_dev;
+	  if (!seen)
+	    res->size += stat_bytes(&st);
+
+	  c[n] = (struct candidate) {
+	    .image_name = e->deps->image_name,
+	    .rank = rank,
+	    .bytes = stat_bytes(&st),
+	    .dev = st.st_dev,
+	    .ino = st.st_ino,
+	    .nlink = st.st_nlink,
+	    .keep = rank == 0 || store_refs_contains(refs, e->deps->image_name),
+	  };
+	  rank++;
+	  n++;
+	}
+    }
+
+  /* leftovers of earlier runs or other tools */
+  res->freed += sweep_objects(dfd, dry_run);
+
+  if (policy->keep_versions > 0)
+    for (size_t i = 0; i < n; i++)
+      if (!c[i].keep && c[i].rank >= policy->keep_versions)
+	{
+	  r = remove_candidate(dfd, c, n, &c[i], dry_run, res);
+	  if (r < 0)
+	    return r;
+	}
+
+  /* the oldest versions go first */
+  while (policy->max_size > 0 && res->size > policy->max_size)
+    {
+      struct candidate *oldest = NULL;
+
+      for (size_t i = 0; i < n; i++)
+	if (!c[i].keep && (oldest == NULL || c[i].rank > oldest->rank))
+	  oldest = &c[i];
+      if (oldest == NULL)
+	{
+	  log_msg(LOG_NOTICE, "Store '%s' stays above the size limit, all remaining images are in use", store);
+	  break;
+	}
+
+      r = remove_candidate(dfd, c, n, oldest, dry_run, res);
+      if (r < 0)
+	return r;
+    }
+
+  /* the objects of the removed images, counted already */
+  if (!dry_run && !strv_isempty(res->removed))
+    (void) sweep_objects(dfd, false);
+
+  return 0;
+}
@@ -0,0 +1,32 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "catalog.h"
+#include "store-refs.h"
+
+/* Retention policy of the store. Images linked from the running
+   system or a snapshot and the newest version of every name are
+   never removed. */
+struct store_gc_policy {
+  uint32_t keep_versions;  /* versions per name, 0 keeps all */
+  uint64_t max_size;       /* bytes, 0 is no limit */
+};
+
+struct store_gc_result {
+  char **removed;     /* image names */
+  uint64_t freed;     /* bytes */
+  uint64_t size;      /* of the store afterwards */
+};
+
+extern void store_gc_result_free(struct store_gc_result *res);
+/* The images of the store are grouped by the names and versions of
+   catalog, images which it does not know are kept. The caller holds
+   the exclusive store lock. With dry_run nothing gets removed. */
+extern int store_gc(const char *store, const struct catalog *catalog,
+		const struct store_refs *refs,
+		const struct store_gc_policy *policy, bool dry_run,
+		struct store_gc_result *res);
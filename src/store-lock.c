@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#include "basics.h"
+#include "store-lock.h"
+
+#define STORE_LOCK_FILE ".lock"
+
+/* Only writers create the lock file, readers can be unprivileged.
+   Without the file nobody changed the store yet, readers get
+   -ENOENT and don't need a lock. */
+int
+store_lock(const char *store, bool exclusive)
+{
+  _cleanup_free_ char *fn = NULL;
+  _cleanup_close_ int fd = -EBADF;
+
+  assert(store);
+
+  if (asprintf(&fn, "%s/"STORE_LOCK_FILE, store) < 0)
+    return -ENOMEM;
+
+  if (exclusive)
+    fd = open(fn, O_RDWR|O_CREAT|O_NOFOLLOW|O_CLOEXEC, 0644);
+  else
+    fd = open(fn, O_RDONLY|O_NOFOLLOW|O_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+
+  while (flock(fd, exclusive ? LOCK_EX : LOCK_SH) < 0)
+    if (errno != EINTR)
+      return -errno;
+
+  return TAKE_FD(fd);
+}
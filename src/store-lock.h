@@ -0,0 +1,13 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+
+/* Readers of the store and of extensions_dir hold a shared lock,
+   moving images into the store and switching the links in
+   extensions_dir happens with an exclusive one. It is a flock() of
+   <store>/.lock, so it works across processes. Locks are only held
+   for short, synchronous steps. Returns the fd which releases the
+   lock when closed. */
+extern int store_lock(const char *store, bool exclusive);
@@ -0,0 +1,411 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "basics.h"
+#include "strv.h"
+#include "tmpfile-util.h"
+#include "log_msg.h"
+#include "images-list.h"
+#include "discover-images.h"
+#include "metadata-cache.h"
+#include "store-refs.h"
+
+#define STORE_REFS_FILE ".refs"
+
+static void
+store_ref_root_free(struct store_ref_root *e)
+{
+  e->root = mfree(e->root);
+  e->validator = mfree(e->validator);
+  e->images = strv_free(e->images);
+}
+
+void
+store_refs_free(struct store_refs *refs)
+{
+  for (size_t i = 0; i < refs->n; i++)
+    store_ref_root_free(&refs->roots[i]);
+  refs->roots = mfree(refs->roots);
+  refs->n = 0;
+}
+
+static struct store_ref_root *
+find_root(const struct store_refs *refs, const char *root)
+{
+  for (size_t i = 0; i < refs->n; i++)
+    if (streq(refs->roots[i].root, root))
+      return &refs->roots[i];
+
+  return NULL;
+}
+
+/* takes the strings of e */
+static int
+append_root(struct store_refs *refs, struct store_ref_root *e)
+{
+  struct store_ref_root *l;
+
+  l = realloc(refs->roots, (refs->n + 1) * sizeof(struct store_ref_root));
+  if (l == NULL)
+    return -ENOMEM;
+
+  refs->roots = l;
+  refs->roots[refs->n++] = *e;
+  *e = (struct store_ref_root) {};
+
+  return 0;
+}
+
+static void
+remove_root(struct store_refs *refs, struct store_ref_root *e)
+{
+  size_t i = e - refs->roots;
+
+  store_ref_root_free(e);
+  memmove(&refs->roots[i], &refs->roots[i + 1],
+	  (refs->n - i - 1) * sizeof(struct store_ref_root));
+  refs->n--;
+}
+
+/* one line per root: root, validator and the images separated by
+   '/', which is not possible in a file name */
+static int
+parse_line(char *line, struct store_ref_root *e)
+{
+  char *root, *validator, *images;
+
+  root = strsep(&line, "\t");
+  validator = strsep(&line, "\t");
+  images = line;
+  if (validator == NULL || images == NULL)
+    return -EINVAL;
+
+  e->root = strdup(root);
+  e->validator = strdup(validator);
+  if (e->root == NULL || e->validator == NULL)
+    return -ENOMEM;
+
+  for (char *img; (img = strsep(&images, "/")) != NULL;)
+    if (!isempty(img) && strv_extend(&e->images, img) < 0)
+      return -ENOMEM;
+
+  return 0;
+}
+
+int
+store_refs_load(const char *store, struct store_refs *refs)
+{
+  _cleanup_free_ char *fn = NULL;
+  _cleanup_free_ char *line = NULL;
+  _cleanup_fclose_ FILE *fp = NULL;
+  size_t size = 0;
+  ssize_t len;
+  int r;
+
+  assert(store);
+  assert(refs);
+
+  *refs = (struct store_refs) {};
+
+  if (asprintf(&fn, "%s/"STORE_REFS_FILE, store) < 0)
+    return -ENOMEM;
+
+  fp = fopen(fn, "re");
+  if (fp == NULL)
+    return errno == ENOENT ? 0 : -errno;
+
+  while ((len = getline(&line, &size, fp)) > 0)
+    {
+      struct store_ref_root e = {};
+
+      if (line[len - 1] == '\n')
+	line[len - 1] = '\0';
+
+      r = parse_line(line, &e);
+      if (r == 0)
+	r = append_root(refs, &e);
+      store_ref_root_free(&e);
+      if (r == -EINVAL)
+	{
+	  /* everything gets read again */
+	  log_msg(LOG_WARNING, "Ignoring invalid entry in '%s'", fn);
+	  continue;
+	}
+      if (r < 0)
+	{
+	  store_refs_free(refs);
+	  return r;
+	}
+    }
+
+  return 0;
+}
+
+int
+store_refs_save(const char *store, const struct store_refs *refs)
+{
+  _cleanup_(unlink_and_free_tempfilep) char *tmpfn = NULL;
+  _cleanup_free_ char *fn = NULL;
+  _cleanup_fclose_ FILE *fp = NULL;
+  int fd, r;
+
+  assert(store);
+  assert(refs);
+
+  if (asprintf(&fn, "%s/"STORE_REFS_FILE, store) < 0)
+    return -ENOMEM;
+  if (asprintf(&tmpfn, "%s.XXXXXX", fn) < 0)
+    {
+      tmpfn = NULL;
+      return -ENOMEM;
+    }
+
+  fd = mkostemp_safe(tmpfn);
+  if (fd < 0)
+    return fd;
+
+  fp = fdopen(fd, "w");
+  if (fp == NULL)
+    {
+      r = -errno;
+      close(fd);
+      return r;
+    }
+
+  if (fchmod(fd, 0644) < 0)
+    return -errno;
+
+  for (size_t i = 0; i < refs->n; i++)
+    {
+      fprintf(fp, "%s\t%s\t", refs->roots[i].root, refs->roots[i].validator);
+      STRV_FOREACH(img, refs->roots[i].images)
+	fprintf(fp, "%s%s", img == refs->roots[i].images ? "" : "/", *img);
+      fputc('\n', fp);
+    }
+
+  if (fflush(fp) != 0)
+    return -errno;
+
+  if (rename(tmpfn, fn) < 0)
+    return -errno;
+  tmpfn = mfree(tmpfn);
+
+  return 0;
+}
+
+/* both lists are sorted by discover_images() */
+static bool
+images_equal(char *const *a, char *const *b)
+{
+  for (; a && *a && b && *b; a++, b++)
+    if (!streq(*a, *b))
+      return false;
+
+  return (a == NULL || *a == NULL) && (b == NULL || *b == NULL);
+}
+
+/* Returns 1 if the entry of root changed. The validator is only
+   good enough for snapshots: a switch with RENAME_EXCHANGE keeps the
+   size and the mtime can stay the same, so with force the links get
+   read in any case. */
+int
+store_refs_update_root(struct store_refs *refs, const char *root,
+		       const char *extensions_dir, bool force)
+{
+  struct store_ref_root *e = find_root(refs, root);
+  struct store_ref_root n = {};
+  _cleanup_free_ char *path = NULL;
+  _cleanup_free_ char *validator = NULL;
+  char **images = NULL;
+  struct stat st;
+  int r;
+
+  assert(refs);
+  assert(root);
+  assert(extensions_dir);
+
+  if (asprintf(&path, "%s%s", root, extensions_dir) < 0)
+    return -ENOMEM;
+
+  if (stat(path, &st) < 0)
+    {
+      if (errno != ENOENT)
+	return -errno;
+      if (e == NULL)
+	return 0;
+      remove_root(refs, e);
+      return 1;
+    }
+
+  r = stat_to_validator(&st, &validator);
+  if (r < 0)
+    return r;
+
+  if (e && !force && streq(e->validator, validator))
+    return 0;
+
+  r = discover_images(path, &images);
+  if (r < 0 && r != -ENOENT)
+    return r;
+
+  if (e && streq(e->validator, validator) && images_equal(e->images, images))
+    {
+      strv_free(images);
+      return 0;
+    }
+
+  if (e)
+    {
+      free(e->validator);
+      e->validator = TAKE_PTR(validator);
+      strv_free(e->images);
+      e->images = images;
+      return 1;
+    }
+
+  n.root = strdup(root);
+  if (n.root == NULL)
+    {
+      strv_free(images);
+      return -ENOMEM;
+    }
+  n.validator = TAKE_PTR(validator);
+  n.images = images;
+
+  r = append_root(refs, &n);
+  store_ref_root_free(&n);
+  if (r < 0)
+    return r;
+
+  return 1;
+}
+
+/* moves the entry of root from old to new and updates it there */
+static int
+sync_root(struct store_refs *old, struct store_refs *new, const char *root,
+	  const char *extensions_dir, bool force)
+{
+  struct store_ref_root *e = find_root(old, root);
+  int r;
+
+  if (e && find_root(new, root) == NULL)
+    {
+      size_t i = e - old->roots;
+
+      r = append_root(new, e);
+      if (r < 0)
+	return r;
+      memmove(&old->roots[i], &old->roots[i + 1],
+	      (old->n - i - 1) * sizeof(struct store_ref_root));
+      old->n--;
+    }
+
+  return store_refs_update_root(new, root, extensions_dir, force);
+}
+
+static int
+sync_snapshots(struct store_refs *old, struct store_refs *new,
+	       const char *extensions_dir, const char *snapshots_dir)
+{
+  struct dirent *de;
+  DIR *d;
+  int changed = 0, r = 0;
+
+  d = opendir(snapshots_dir);
+  if (d == NULL)
+    return errno == ENOENT ? 0 : -errno;
+
+  while ((de = readdir(d)) != NULL)
+    {
+      _cleanup_free_ char *root = NULL;
+
+      if (de->d_name[0] == '.')
+	continue;
+
+      if (asprintf(&root, "%s/%s/snapshot", snapshots_dir, de->d_name) < 0)
+	{
+	  root = NULL;
+	  r = -ENOMEM;
+	  break;
+	}
+
+      r = sync_root(old, new, root, extensions_dir, false);
+      if (r < 0)
+	break;
+      changed += r;
+    }
+  closedir(d);
+
+  return r < 0 ? r : changed;
+}
+
+/* Returns the number of changed roots */
+int
+store_refs_sync(struct store_refs *refs, const char *extensions_dir,
+		const char *snapshots_dir)
+{
+  _cleanup_(store_refs_free) struct store_refs new = {};
+  int changed = 0, r;
+
+  assert(refs);
+  assert(extensions_dir);
+
+  /* the links of the running system are switched by other tools, too */
+  r = sync_root(refs, &new, "", extensions_dir, true);
+  if (r < 0)
+    return r;
+  changed += r;
+
+  if (!isempty(snapshots_dir))
+    {
+      r = sync_snapshots(refs, &new, extensions_dir, snapshots_dir);
+      if (r < 0)
+	return r;
+      changed += r;
+    }
+
+  /* what is left are removed snapshots */
+  changed += refs->n;
+  store_refs_free(refs);
+  *refs = new;
+  new = (struct store_refs) {};
+
+  return changed;
+}
+
+bool
+store_refs_contains(const struct store_refs *refs, const char *image_name)
+{
+  for (size_t i = 0; i < refs->n; i++)
+    if (strv_contains(refs->roots[i].images, image_name))
+      return true;
+
+  return false;
+}
+
+int
+store_refs_update(const char *store, const char *extensions_dir)
+{
+  _cleanup_(store_refs_free) struct store_refs refs = {};
+  int r;
+
+  r = store_refs_load(store, &refs);
+  if (r < 0)
+    return r;
+
+  r = store_refs_update_root(&refs, "", extensions_dir, true);
+  if (r <= 0)
+    return r;
+
+  return store_refs_save(store, &refs);
+}
@@ -0,0 +1,40 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+
+/* Index of the images of the store which are linked from the
+   extensions_dir of the running system and of every snapshot, kept
+   in <store>/.refs. Every snapshot is stored with the validator of
+   its extensions_dir, so only new or changed ones get read again.
+   Snapshots are read-only, the running system is always read. The
+   caller holds the exclusive
+   store lock while reading and writing the index. */
+struct store_ref_root {
+  char *root;       /* "" for the running system */
+  char *validator;  /* stat_to_validator() of its extensions_dir */
+  char **images;
+};
+
+struct store_refs {
+  struct store_ref_root *roots;
+  size_t n;
+};
+
+extern void store_refs_free(struct store_refs *refs);
+extern int store_refs_load(const char *store, struct store_refs *refs);
+extern int store_refs_save(const char *store, const struct store_refs *refs);
+/* read the links of root again if its extensions_dir changed, with
+   force always */
+extern int store_refs_update_root(struct store_refs *refs, const char *root,
+		const char *extensions_dir, bool force);
+/* the running system and every <snapshots_dir>/<N>/snapshot, roots
+   which no longer exist get dropped */
+extern int store_refs_sync(struct store_refs *refs, const char *extensions_dir,
+		const char *snapshots_dir);
+extern bool store_refs_contains(const struct store_refs *refs,
+		const char *image_name);
+/* store_refs_update_root() of the running system after its links
+   changed, "load, update, save" */
+extern int store_refs_update(const char *store, const char *extensions_dir);
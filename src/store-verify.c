@@ -0,0 +1,302 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "basics.h"
+#include "strv.h"
+#include "download.h"
+#include "sha256.h"
+#include "store.h"
+#include "store-verify.h"
+
+/* big enough that the disk and not the syscalls are the limit */
+#define VERIFY_BUFFER_SIZE (1024 * 1024)
+
+const char *
+verify_state_to_string(enum verify_state state)
+{
+  switch (state)
+    {
+    case VERIFY_OK:
+      return "ok";
+    case VERIFY_CORRUPT:
+      return "corrupt";
+    case VERIFY_UNREADABLE:
+      return "unreadable";
+    case VERIFY_REMOVED:
+      return "removed";
+    case VERIFY_UNKNOWN:
+      return "unknown";
+    }
+
+  return "unreadable";
+}
+
+void
+store_sums_free(struct store_sum *sums, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    {
+      free(sums[i].image_name);
+      free(sums[i].sha256);
+    }
+  free(sums);
+}
+
+struct object {
+  ino_t ino;
+  dev_t dev;
+  char *sha256;
+};
+
+static int
+object_cmp(const void *a, const void *b)
+{
+  const struct object *o_a = a;
+  const struct object *o_b = b;
+
+  if (o_a->dev != o_b->dev)
+    return o_a->dev < o_b->dev ? -1 : 1;
+  if (o_a->ino != o_b->ino)
+    return o_a->ino < o_b->ino ? -1 : 1;
+
+  return 0;
+}
+
+static void
+objects_free(struct object *o, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    free(o[i].sha256);
+  free(o);
+}
+
+/* the objects sorted by inode, a missing directory is no error */
+static int
+list_objects(int dfd, struct object **res, size_t *n)
+{
+  _cleanup_close_ int fd = -EBADF;
+  struct object *o = NULL;
+  size_t max = 0;
+  struct dirent *de;
+  DIR *d;
+
+  *res = NULL;
+  *n = 0;
+
+  fd = openat(dfd, STORE_OBJECTS_DIR, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+  if (fd < 0)
+    return errno == ENOENT ? 0 : -errno;
+
+  d = fdopendir(fd);
+  if (d == NULL)
+    return -errno;
+  fd = -EBADF;  /* owned by d */
+
+  while ((de = readdir(d)) != NULL)
+    {
+      struct stat st;
+
+      if (!store_valid_sha256(de->d_name))
+	continue;
+      if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+	  !S_ISREG(st.st_mode))
+	continue;
+
+      if (*n == max)
+	{
+	  struct object *p;
+
+	  max = max ? max * 2 : 64;
+	  p = reallocarray(o, max, sizeof(struct object));
+	  if (p == NULL)
+	    goto oom;
+	  o = p;
+	}
+      o[*n].ino = st.st_ino;
+      o[*n].dev = st.st_dev;
+      o[*n].sha256 = strdup(de->d_name);
+      if (o[*n].sha256 == NULL)
+	goto oom;
+      (*n)++;
+    }
+  closedir(d);
+
+  if (*n > 0)
+    qsort(o, *n, sizeof(struct object), object_cmp);
+  *res = o;
+
+  return 0;
+
+ oom:
+  closedir(d);
+  objects_free(o, *n);
+  *n = 0;
+  return -ENOMEM;
+}
+
+static int
+sum_cmp(const void *a, const void *b)
+{
+  return strcmp(((const struct store_sum *) a)->image_name,
+		((const struct store_sum *) b)->image_name);
+}
+
+static bool
+is_image_name(const char *name)
+{
+  return name[0] != '.' && (endswith(name, ".raw") || endswith(name, ".img"));
+}
+
+int
+store_list_sums(const char *store, char *const *names,
+		struct store_sum **res, size_t *n)
+{
+  _cleanup_close_ int dfd = -EBADF;
+  struct store_sum *sums = NULL;
+  struct object *objects = NULL;
+  size_t n_objects = 0, n_sums = 0, max = 0;
+  struct dirent *de;
+  DIR *d;
+  int r;
+
+  assert(store);
+  assert(res);
+  assert(n);
+
+  dfd = open(store, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+  if (dfd < 0)
+    return -errno;
+
+  r = list_objects(dfd, &objects, &n_objects);
+  if (r < 0)
+    return r;
+
+  d = fdopendir(dfd);
+  if (d == NULL)
+    {
+      objects_free(objects, n_objects);
+      return -errno;
+    }
+  dfd = -EBADF;  /* owned by d */
+
+  r = 0;
+  while ((de = readdir(d)) != NULL)
+    {
+      struct object key, *o;
+      struct stat st;
+
+      if (!is_image_name(de->d_name) ||
+	  (names && !strv_contains(names, de->d_name)))
+	continue;
+      if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+	  !S_ISREG(st.st_mode))
+	continue;
+
+      if (n_sums == max)
+	{
+	  struct store_sum *p;
+
+	  max = max ? max * 2 : 64;
+	  p = reallocarray(sums, max, sizeof(struct store_sum));
+	  if (p == NULL)
+	    {
+	      r = -ENOMEM;
+	      break;
+	    }
+	  sums = p;
+	}
+
+      key = (struct object) { .ino = st.st_ino, .dev = st.st_dev };
+      o = n_objects ? bsearch(&key, objects, n_objects, sizeof(struct object), object_cmp) : NULL;
+
+      sums[n_sums] = (struct store_sum) {
+	.image_name = strdup(de->d_name),
+	.sha256 = o ? strdup(o->sha256) : NULL,
+	.state = VERIFY_UNKNOWN,
+      };
+      n_sums++;
+      if (sums[n_sums - 1].image_name == NULL || (o && sums[n_sums - 1].sha256 == NULL))
+	{
+	  r = -ENOMEM;
+	  break;
+	}
+    }
+  closedir(d);
+  objects_free(objects, n_objects);
+
+  if (r < 0)
+    {
+      store_sums_free(sums, n_sums);
+      return r;
+    }
+
+  if (n_sums > 0)
+    qsort(sums, n_sums, sizeof(struct store_sum), sum_cmp);
+
+  *res = sums;
+  *n = n_sums;
+
+  return 0;
+}
+
+/* Runs in a helper process, so it only returns the state */
+enum verify_state
+store_verify_image(const char *store, const struct store_sum *s,
+		   bool drop_cache)
+{
+  _cleanup_free_ uint8_t *buf = NULL;
+  _cleanup_free_ char *fn = NULL;
+  _cleanup_close_ int fd = -EBADF;
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  char hex[2 * SHA256_DIGEST_SIZE + 1];
+  struct sha256_ctx ctx;
+  ssize_t n;
+
+  if (s->sha256 == NULL)
+    return VERIFY_UNKNOWN;
+
+  if (join_path(store, s->image_name, &fn) < 0)
+    return VERIFY_UNREADABLE;
+
+  fd = open(fn, O_RDONLY|O_CLOEXEC);
+  if (fd < 0)
+    return errno == ENOENT ? VERIFY_REMOVED : VERIFY_UNREADABLE;
+
+  buf = malloc(VERIFY_BUFFER_SIZE);
+  if (buf == NULL)
+    return VERIFY_UNREADABLE;
+
+  (void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  sha256_init(&ctx);
+  while ((n = read(fd, buf, VERIFY_BUFFER_SIZE)) != 0)
+    {
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return VERIFY_UNREADABLE;
+	}
+      sha256_update(&ctx, buf, n);
+    }
+  sha256_final(&ctx, digest);
+  sha256_hex(digest, hex);
+
+  /* like the downloads, an audit should not evict the workload */
+  if (drop_cache)
+    (void) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+  return strcaseeq(hex, s->sha256) ? VERIFY_OK : VERIFY_CORRUPT;
+}
@@ -0,0 +1,37 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Result of checking an image of the store against the sum it was
+   stored with. The values are the exit status of the helper
+   process running store_verify_image(). */
+enum verify_state {
+  VERIFY_OK = 0,
+  VERIFY_CORRUPT = 1,     /* content does not match the sum */
+  VERIFY_UNREADABLE = 2,
+  VERIFY_REMOVED = 3,     /* removed since the store got listed */
+  VERIFY_UNKNOWN = 4,     /* no object, the sum is not known */
+};
+
+/* An image of the store with the name of its object in
+   STORE_OBJECTS_DIR, which is the sum from SHA256SUMS or computed by
+   Import. The sum is NULL if the image is not linked to an object. */
+struct store_sum {
+  char *image_name;
+  char *sha256;
+  enum verify_state state;
+};
+
+extern const char *verify_state_to_string(enum verify_state state);
+extern void store_sums_free(struct store_sum *sums, size_t n);
+/* All images directly in the store, sorted by name. If names is
+   set, only these images. */
+extern int store_list_sums(const char *store, char *const *names,
+		struct store_sum **res, size_t *n);
+/* Hash the image with large sequential reads. With drop_cache the
+   pages are dropped from the page cache afterwards. */
+extern enum verify_state store_verify_image(const char *store,
+		const struct store_sum *s, bool drop_cache);
@@ -0,0 +1,348 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <linux/falloc.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "basics.h"
+#include "download.h"
+#include "mkdir_p.h"
+#include "store.h"
+
+/* the sum comes from the remote SHA256SUMS file and is used as
+   file name, so accept only 64 hex digits */
+bool
+store_valid_sha256(const char *sha256)
+{
+  size_t i;
+
+  if (sha256 == NULL)
+    return false;
+
+  for (i = 0; sha256[i]; i++)
+    if (!((sha256[i] >= '0' && sha256[i] <= '9') ||
+	  (sha256[i] >= 'a' && sha256[i] <= 'f') ||
+	  (sha256[i] >= 'A' && sha256[i] <= 'F')))
+      return false;
+
+  return i == 64;
+}
+
+int
+store_object_path(const char *store, const char *sha256, char **res)
+{
+  assert(store);
+  assert(res);
+
+  if (!store_valid_sha256(sha256))
+    return -EINVAL;
+
+  if (asprintf(res, "%s/"STORE_OBJECTS_DIR"/%s", store, sha256) < 0)
+    {
+      *res = NULL;
+      return -ENOMEM;
+    }
+
+  return 0;
+}
+
+/* Register the image fn in the store under its sum. An existing
+   object with this sum is kept. */
+int
+store_add_object(const char *store, const char *fn, const char *sha256)
+{
+  _cleanup_free_ char *dir = NULL;
+  _cleanup_free_ char *obj = NULL;
+  int r;
+
+  assert(store);
+  assert(fn);
+
+  r = store_object_path(store, sha256, &obj);
+  if (r < 0)
+    return r;
+
+  r = join_path(store, STORE_OBJECTS_DIR, &dir);
+  if (r < 0)
+    return r;
+
+  r = mkdir_p(dir, 0755);
+  if (r < 0)
+    return r;
+
+  if (link(fn, obj) < 0 && errno != EEXIST)
+    return -errno;
+
+  return 0;
+}
+
+/* Create fn as hard link of the object with this sum. Returns 1 if
+   the object exists and fn got created, 0 if a download is needed. */
+int
+store_reuse_object(const char *store, const char *sha256, const char *fn)
+{
+  _cleanup_free_ char *obj = NULL;
+  int r;
+
+  assert(store);
+  assert(fn);
+
+  if (!store_valid_sha256(sha256))
+    return 0;
+
+  r = store_object_path(store, sha256, &obj);
+  if (r < 0)
+    return r;
+
+  if (link(obj, fn) < 0)
+    {
+      if (errno == ENOENT)
+	return 0;
+      return -errno;
+    }
+
+  return 1;
+}
+
+/* bytes per copy_file_range() call, the copied range gets hashed
+   afterwards while it is still in the page cache */
+#define COPY_CHUNK_SIZE (8 * 1024 * 1024)
+#define COPY_BUFFER_SIZE (256 * 1024)
+
+/* hash len bytes of fd starting at off, len 0 means until the end.
+   Returns the number of bytes hashed. */
+static ssize_t
+hash_range(int fd, off_t off, size_t len, struct sha256_ctx *ctx,
+	   uint8_t *buf)
+{
+  size_t done = 0;
+
+  while (len == 0 || done < len)
+    {
+      size_t size = COPY_BUFFER_SIZE;
+      ssize_t n;
+
+      if (len > 0 && len - done < size)
+	size = len - done;
+
+      n = pread(fd, buf, size, off + done);
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -errno;
+	}
+      if (n == 0)
+	break;
+
+      sha256_update(ctx, buf, n);
+      done += n;
+    }
+
+  return done;
+}
+
+static ssize_t
+write_range(int fd, off_t off, const uint8_t *buf, size_t len)
+{
+  size_t done = 0;
+
+  while (done < len)
+    {
+      ssize_t n = pwrite(fd, buf + done, len - done, off + done);
+
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -errno;
+	}
+      done += n;
+    }
+
+  return done;
+}
+
+/* copy_file_range() is not possible between these files */
+static bool
+copy_range_unsupported(int err)
+{
+  return err == EXDEV || err == EINVAL || err == ENOSYS ||
+    err == EOPNOTSUPP || err == EBADF;
+}
+
+/* Reserve the blocks of an image of about size bytes before it gets
+   written, so it does not get fragmented and a full file system is
+   noticed early. The file size does not change, writers still see
+   an empty file. store_flush_file() releases what was not needed. */
+void
+store_preallocate(int fd, uint64_t size)
+{
+  if (size == 0)
+    return;
+
+  /* not supported by every file system, only an optimization */
+  (void) fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size);
+}
+
+/* Images are written once and only read again by the loop devices of
+   systemd-sysext, so keeping them in the page cache only evicts the
+   pages of the running workload. Called periodically for a growing
+   file: drops what got written back since the last call and starts
+   the writeback of the new data. synced is the end of the data
+   already submitted for writeback. */
+void
+store_writeback(int fd, uint64_t *synced)
+{
+  struct stat st;
+
+  if (fd < 0 || fstat(fd, &st) < 0)
+    return;
+
+  /* the file got truncated for another attempt */
+  if ((uint64_t) st.st_size < *synced)
+    *synced = 0;
+
+  /* pages still under writeback stay, they go with the next call */
+  if (*synced > 0)
+    (void) posix_fadvise(fd, 0, *synced, POSIX_FADV_DONTNEED);
+
+  if ((uint64_t) st.st_size > *synced)
+    {
+      (void) sync_file_range(fd, *synced, st.st_size - *synced,
+			     SYNC_FILE_RANGE_WRITE);
+      *synced = st.st_size;
+    }
+}
+
+/* A complete image: release the preallocated blocks behind the end,
+   write it back, so it is complete after a crash once it got renamed
+   into the store, and drop it from the page cache if drop_cache. */
+int
+store_flush_file(int fd, bool drop_cache)
+{
+  struct stat st;
+
+  if (fstat(fd, &st) < 0)
+    return -errno;
+
+  if (ftruncate(fd, st.st_size) < 0)
+    return -errno;
+
+  if (fdatasync(fd) < 0)
+    return -errno;
+
+  if (drop_cache)
+    (void) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+  return 0;
+}
+
+/* Copy the content of infd into the empty file outfd and calculate
+   its SHA256 sum in the same pass. A reflink shares the data blocks
+   and is tried first, else copy_file_range() copies inside of the
+   kernel and only the hashing reads the data. read() and write()
+   are the last resort. With drop_cache the copied ranges of both
+   files get dropped from the page cache while copying. The file
+   offsets of infd and outfd are not used. */
+int
+store_copy_fd(int infd, int outfd, bool drop_cache,
+	      char hex[2 * SHA256_DIGEST_SIZE + 1])
+{
+  _cleanup_free_ uint8_t *buf = NULL;
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  struct sha256_ctx ctx;
+  bool copy_range = true;
+  uint64_t synced = 0;
+  struct stat st;
+  off_t off = 0;
+  ssize_t n, r;
+
+  buf = malloc(COPY_BUFFER_SIZE);
+  if (buf == NULL)
+    return -ENOMEM;
+
+  sha256_init(&ctx);
+
+  if (ioctl(outfd, FICLONE, infd) == 0)
+    {
+      n = hash_range(infd, 0, 0, &ctx, buf);
+      if (n < 0)
+	return n;
+      if (drop_cache)
+	(void) posix_fadvise(infd, 0, 0, POSIX_FADV_DONTNEED);
+      sha256_final(&ctx, digest);
+      sha256_hex(digest, hex);
+      return 0;
+    }
+
+  if (fstat(infd, &st) == 0)
+    store_preallocate(outfd, st.st_size);
+
+  for (;;)
+    {
+      if (copy_range)
+	{
+	  loff_t in = off, out = off;
+
+	  n = copy_file_range(infd, &in, outfd, &out, COPY_CHUNK_SIZE, 0);
+	  if (n < 0 && copy_range_unsupported(errno))
+	    {
+	      copy_range = false;
+	      continue;
+	    }
+	  if (n < 0)
+	    {
+	      if (errno == EINTR)
+		continue;
+	      return -errno;
+	    }
+	  if (n == 0)
+	    break;
+
+	  r = hash_range(infd, off, n, &ctx, buf);
+	  if (r < 0)
+	    return r;
+	  /* the source got shorter meanwhile */
+	  if (r != n)
+	    return -EIO;
+	}
+      else
+	{
+	  n = pread(infd, buf, COPY_BUFFER_SIZE, off);
+	  if (n < 0)
+	    {
+	      if (errno == EINTR)
+		continue;
+	      return -errno;
+	    }
+	  if (n == 0)
+	    break;
+
+	  sha256_update(&ctx, buf, n);
+	  n = write_range(outfd, off, buf, n);
+	  if (n < 0)
+	    return n;
+	}
+
+      if (drop_cache)
+	{
+	  (void) posix_fadvise(infd, off, n, POSIX_FADV_DONTNEED);
+	  store_writeback(outfd, &synced);
+	}
+      off += n;
+    }
+
+  sha256_final(&ctx, digest);
+  sha256_hex(digest, hex);
+
+  return 0;
+}
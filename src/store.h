@@ -0,0 +1,26 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sha256.h"
+
+/* Images in the store are additionally hard linked under the SHA256
+   sum from SHA256SUMS into <store>/.sha256/, so that the same
+   content published under another name needs no download. */
+#define STORE_OBJECTS_DIR ".sha256"
+
+extern bool store_valid_sha256(const char *sha256);
+extern int store_object_path(const char *store, const char *sha256,
+		char **res);
+extern int store_add_object(const char *store, const char *fn,
+		const char *sha256);
+extern int store_reuse_object(const char *store, const char *sha256,
+		const char *fn);
+extern void store_preallocate(int fd, uint64_t size);
+extern void store_writeback(int fd, uint64_t *synced);
+extern int store_flush_file(int fd, bool drop_cache);
+extern int store_copy_fd(int infd, int outfd, bool drop_cache,
+		char hex[2 * SHA256_DIGEST_SIZE + 1]);
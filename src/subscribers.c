@@ -0,0 +1,104 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "basics.h"
+#include "log_msg.h"
+#include "subscribers.h"
+
+static sd_varlink **subscribers = NULL;
+static size_t n_subscribers = 0;
+
+int
+subscriber_add(sd_varlink *link)
+{
+  sd_varlink **l;
+
+  assert(link);
+
+  l = reallocarray(subscribers, n_subscribers + 1, sizeof(sd_varlink *));
+  if (l == NULL)
+    return -ENOMEM;
+  subscribers = l;
+  subscribers[n_subscribers++] = sd_varlink_ref(link);
+
+  return 0;
+}
+
+static void
+subscriber_drop(size_t i)
+{
+  sd_varlink_unref(subscribers[i]);
+  memmove(&subscribers[i], &subscribers[i + 1],
+	  (n_subscribers - i - 1) * sizeof(sd_varlink *));
+  n_subscribers--;
+}
+
+/* Returns true if link was a subscriber */
+bool
+subscriber_remove(sd_varlink *link)
+{
+  for (size_t i = 0; i < n_subscribers; i++)
+    if (subscribers[i] == link)
+      {
+	subscriber_drop(i);
+	return true;
+      }
+
+  return false;
+}
+
+size_t
+subscriber_count(void)
+{
+  return n_subscribers;
+}
+
+int
+subscriber_notify(sd_varlink *link, const char *event, const char *image,
+		  const char *old_image)
+{
+  assert(link);
+  assert(event);
+
+  return sd_varlink_notifybo(link,
+			     SD_JSON_BUILD_PAIR_STRING("Event", event),
+			     SD_JSON_BUILD_PAIR_CONDITION(!!image, "Image", SD_JSON_BUILD_STRING(image)),
+			     SD_JSON_BUILD_PAIR_CONDITION(!!old_image, "OldImage", SD_JSON_BUILD_STRING(old_image)));
+}
+
+void
+subscribers_notify(const char *event, const char *image,
+		   const char *old_image)
+{
+  assert(event);
+
+  if (n_subscribers > 0)
+    log_msg(LOG_DEBUG, "Event '%s' for '%s'", event, strna(image));
+
+  /* backwards, a failed client gets removed */
+  for (size_t i = n_subscribers; i > 0; i--)
+    {
+      int r;
+
+      r = subscriber_notify(subscribers[i - 1], event, image, old_image);
+      if (r < 0)
+	{
+	  log_msg(LOG_DEBUG, "Dropping subscriber: %s", strerror(-r));
+	  subscriber_drop(i - 1);
+	}
+    }
+}
+
+void
+subscribers_free(void)
+{
+  while (n_subscribers > 0)
+    subscriber_drop(n_subscribers - 1);
+  subscribers = mfree(subscribers);
+}
@@ -0,0 +1,19 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <systemd/sd-varlink.h>
+
+/* Clients which called Watch with "more". Every event gets sent to
+   all of them as a further reply to this call. */
+extern int subscriber_add(sd_varlink *link);
+extern bool subscriber_remove(sd_varlink *link);
+extern size_t subscriber_count(void);
+/* image and old_image are optional */
+extern int subscriber_notify(sd_varlink *link, const char *event,
+		const char *image, const char *old_image);
+extern void subscribers_notify(const char *event, const char *image,
+		const char *old_image);
+extern void subscribers_free(void);
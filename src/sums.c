@@ -0,0 +1,203 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "basics.h"
+#include "strv.h"
+#include "compress.h"
+#include "catalog-index.h"
+#include "images-list.h"
+#include "sums.h"
+
+/* SHA256SUMS of big repositories has many thousand lines, a bigger
+   file is not accepted */
+#define MAX_SUMS_SIZE (256*1024*1024)
+
+void
+free_sums(struct sums *s)
+{
+  s->buf = mfree(s->buf);
+  s->images = mfree(s->images);
+  s->deltas = mfree(s->deltas);
+  s->jsons = mfree(s->jsons);
+  s->n_images = s->n_deltas = s->n_jsons = 0;
+}
+
+static bool
+filter_match(char *const *filter, const char *name, size_t len)
+{
+  if (filter == NULL)
+    return true;
+
+  STRV_FOREACH(f, filter)
+    if (strlen(*f) == len && strneq(*f, name, len))
+      return true;
+
+  return false;
+}
+
+static int
+sums_append(struct sums_entry **l, size_t *n, size_t *max,
+	    const struct sums_entry *e)
+{
+  if (*n == *max)
+    {
+      size_t m = *max ? *max * 2 : 64;
+      struct sums_entry *t = reallocarray(*l, m, sizeof(struct sums_entry));
+      if (t == NULL)
+	return -ENOMEM;
+      *l = t;
+      *max = m;
+    }
+
+  (*l)[(*n)++] = *e;
+
+  return 0;
+}
+
+static int
+sums_entry_cmp(const void *a, const void *b)
+{
+  const struct sums_entry *e_a = a;
+  const struct sums_entry *e_b = b;
+
+  return strcmp(e_a->fn, e_b->fn);
+}
+
+static bool
+is_index_fn(const char *fn)
+{
+  return STR_IN_SET(fn, CATALOG_INDEX, SYSEXT_DEPS_INDEX,
+		    SYSEXT_DEPS_INDEX ".zst", SYSEXT_DEPS_INDEX ".gz");
+}
+
+int
+sums_parse(char *buf, char *const *filter, struct sums *res)
+{
+  size_t max_images = 0, max_deltas = 0, max_jsons = 0;
+  char *line, *next;
+  int r;
+
+  assert(buf);
+  assert(res);
+
+  res->buf = buf;
+
+  for (line = res->buf; line; line = next)
+    {
+      enum { SUMS_IMAGE, SUMS_DELTA, SUMS_JSON } kind;
+      struct sums_entry e;
+      size_t len;
+      char *p;
+
+      next = strchr(line, '\n');
+      if (next)
+	*next++ = '\0';
+
+      len = strlen(line);
+      if (len > 0 && line[len - 1] == '\r')
+	line[--len] = '\0';
+
+      if (endswith(line, ".raw") || endswith(line, ".img"))
+	kind = SUMS_IMAGE;
+      else if (endswith(line, DELTA_SUFFIX))
+	kind = SUMS_DELTA;
+      else if (endswith(line, ".json") || endswith(line, CATALOG_INDEX) ||
+	       endswith(line, SYSEXT_DEPS_INDEX ".zst") ||
+	       endswith(line, SYSEXT_DEPS_INDEX ".gz"))
+	kind = SUMS_JSON;
+      else
+	continue;
+
+      /* the SHA256SUM hash, spaces and the binary mode marker */
+      p = strchr(line, ' ');
+      if (p == NULL)
+	continue;
+      *p++ = '\0';
+      while (*p == ' ')
+	++p;
+      if (*p == '*')
+	++p;
+
+      e.hash = line;
+      e.fn = p;
+      e.image_len = strlen(p);
+      if (kind == SUMS_DELTA)
+	{
+	  const char *from = strstr(p, DELTA_FROM);
+
+	  if (from == NULL)
+	    continue;
+	  e.image_len = from - p;
+	}
+      else if (kind == SUMS_JSON)
+	e.image_len -= strlen(".json");
+      e.name_len = image_name_len(p, e.image_len);
+
+      if (!filter_match(filter, p, e.name_len) &&
+	  !(kind == SUMS_JSON && is_index_fn(p)))
+	continue;
+
+      if (kind == SUMS_DELTA)
+	r = sums_append(&res->deltas, &res->n_deltas, &max_deltas, &e);
+      else if (kind == SUMS_JSON)
+	r = sums_append(&res->jsons, &res->n_jsons, &max_jsons, &e);
+      else
+	r = sums_append(&res->images, &res->n_images, &max_images, &e);
+      if (r < 0)
+	return r;
+    }
+
+  if (res->n_jsons > 1)
+    qsort(res->jsons, res->n_jsons, sizeof(struct sums_entry), sums_entry_cmp);
+
+  return 0;
+}
+
+int
+sums_from_file(const char *path, char *const *filter, struct sums *res)
+{
+  _cleanup_close_ int fd = -EBADF;
+  char *buf = NULL;
+  int r;
+
+  assert(path);
+  assert(res);
+
+  /* systemd-pull may replace the file, the fd of child_output can be
+     stale */
+  fd = open(path, O_RDONLY|O_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+
+  r = read_decompressed(fd, MAX_SUMS_SIZE, &buf, NULL);
+  if (r < 0)
+    return r;
+
+  return sums_parse(buf, filter, res);
+}
+
+const char *
+sums_json_hash(const struct sums *sums, const char *fn)
+{
+  const struct sums_entry key = { .fn = fn };
+  const struct sums_entry *e;
+
+  if (sums->n_jsons == 0)
+    return NULL;
+
+  e = bsearch(&key, sums->jsons, sums->n_jsons, sizeof(struct sums_entry),
+	      sums_entry_cmp);
+  if (e == NULL || isempty(e->hash))
+    return NULL;
+
+  return e->hash;
+}
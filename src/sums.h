@@ -0,0 +1,44 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <stddef.h>
+
+/* metadata of all images of a repository, see "sysextmgrcli merge-json" */
+#define SYSEXT_DEPS_INDEX "sysext-deps.json"
+
+/* An image, delta or json line of SHA256SUMS. All strings point into the
+   buffer of struct sums. */
+struct sums_entry {
+  const char *fn;
+  const char *hash;  /* empty if the line has none */
+  size_t name_len;   /* the image name is the start of fn, for deltas
+			the name of the new image */
+  size_t image_len;  /* deltas and json files: length of the image at
+			the start of fn */
+};
+
+/* The whole SHA256SUMS is read into buf at once and split in place,
+   there is no allocation per line. */
+struct sums {
+  char *buf;
+  struct sums_entry *images;
+  size_t n_images;
+  struct sums_entry *deltas;
+  size_t n_deltas;
+  struct sums_entry *jsons;  /* sorted by fn */
+  size_t n_jsons;
+};
+
+extern void free_sums(struct sums *s);
+/* Parse SHA256SUMS in one pass. Only images, deltas and json files
+   of images matching filter are kept, the rest costs no memory. buf
+   must be NUL terminated, it gets split in place and is owned by res
+   afterwards, also on failure. */
+extern int sums_parse(char *buf, char *const *filter, struct sums *res);
+/* sums_parse() of a file, a compressed SHA256SUMS gets decompressed
+   while reading */
+extern int sums_from_file(const char *path, char *const *filter,
+		struct sums *res);
+/* SHA256 sum of a json file or NULL */
+extern const char *sums_json_hash(const struct sums *sums, const char *fn);
@@ -0,0 +1,232 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+/* Read-only HTTP export of the images in the store for peers.
+   Started by systemd for every connection (Accept=yes), stdin and
+   stdout are the connection. Only "GET /<image>" and "HEAD /<image>"
+   of images directly in the store are served. The peers verify the
+   images against the SHA256SUMS of the repository. */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "basics.h"
+#include "sysextmgr.h"
+#include "log_msg.h"
+#include "store-lock.h"
+
+/* a client has this much time to send the request */
+#define REQUEST_TIMEOUT_SEC 30
+/* a transfer may take any time, but the peer has to accept data at
+   least this often */
+#define SEND_TIMEOUT_SEC 60
+#define MAX_REQUEST_SIZE 8192
+
+static int
+write_all(int fd, const char *buf, size_t len)
+{
+  while (len > 0)
+    {
+      ssize_t n = write(fd, buf, len);
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -errno;
+	}
+      buf += n;
+      len -= n;
+    }
+
+  return 0;
+}
+
+static int
+reply_status(int code, const char *reason)
+{
+  char buf[256];
+  int len;
+
+  len = snprintf(buf, sizeof(buf),
+		 "HTTP/1.0 %i %s\r\n"
+		 "Content-Length: 0\r\n"
+		 "Connection: close\r\n"
+		 "\r\n", code, reason);
+
+  return write_all(STDOUT_FILENO, buf, len);
+}
+
+/* read the request line and all header lines */
+static int
+read_request(char *buf, size_t size)
+{
+  size_t len = 0;
+
+  while (len < size - 1)
+    {
+      ssize_t n = read(STDIN_FILENO, buf + len, size - 1 - len);
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -errno;
+	}
+      if (n == 0)
+	break;
+      len += n;
+      buf[len] = '\0';
+      if (strstr(buf, "\r\n\r\n") || strstr(buf, "\n\n"))
+	return 0;
+    }
+
+  buf[len] = '\0';
+  return len > 0 ? 0 : -EBADMSG;
+}
+
+/* image names only, nothing in sub directories, no temporary files
+   of downloads */
+static bool
+valid_image_name(const char *name)
+{
+  if (isempty(name) || name[0] == '.' || strchr(name, '/'))
+    return false;
+
+  return endswith(name, ".raw") || endswith(name, ".img");
+}
+
+/* a stalled peer makes sendfile() fail with EAGAIN instead of
+   blocking forever */
+static int
+set_send_timeout(int fd)
+{
+  struct timeval tv = { .tv_sec = SEND_TIMEOUT_SEC };
+
+  if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0)
+    return errno == ENOTSOCK ? 0 : -errno;  /* e.g. a pipe in tests */
+
+  return 0;
+}
+
+static int
+serve(const char *store)
+{
+  _cleanup_close_ int fd = -EBADF;
+  char req[MAX_REQUEST_SIZE];
+  char header[256];
+  char *method, *path, *saveptr = NULL;
+  bool head;
+  struct stat st;
+  off_t offset = 0;
+  int len, lock, r;
+
+  r = read_request(req, sizeof(req));
+  /* the timeout is only for the request, big images take longer */
+  alarm(0);
+  if (r < 0)
+    return reply_status(400, "Bad Request");
+
+  r = set_send_timeout(STDOUT_FILENO);
+  if (r < 0)
+    log_msg(LOG_WARNING, "Failed to set send timeout: %s", strerror(-r));
+
+  method = strtok_r(req, " ", &saveptr);
+  path = strtok_r(NULL, " \r\n", &saveptr);
+  if (method == NULL || path == NULL || path[0] != '/')
+    return reply_status(400, "Bad Request");
+
+  if (streq(method, "HEAD"))
+    head = true;
+  else if (streq(method, "GET"))
+    head = false;
+  else
+    return reply_status(405, "Method Not Allowed");
+
+  path++;
+  if (!valid_image_name(path))
+    return reply_status(404, "Not Found");
+
+  _cleanup_close_ int dfd = open(store, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+  if (dfd < 0)
+    return reply_status(404, "Not Found");
+
+  /* an open image stays valid, only opening needs the lock */
+  lock = store_lock(store, false);
+  if (lock < 0)
+    log_msg(LOG_WARNING, "Failed to lock store '%s': %s", store, strerror(-lock));
+  fd = openat(dfd, path, O_RDONLY|O_NOFOLLOW|O_CLOEXEC);
+  if (lock >= 0)
+    close(TAKE_FD(lock));
+  if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+    return reply_status(404, "Not Found");
+
+  log_msg(LOG_INFO, "Sending '%s'", path);
+
+  len = snprintf(header, sizeof(header),
+		 "HTTP/1.0 200 OK\r\n"
+		 "Content-Type: application/octet-stream\r\n"
+		 "Content-Length: %" PRIu64 "\r\n"
+		 "Connection: close\r\n"
+		 "\r\n", (uint64_t) st.st_size);
+  r = write_all(STDOUT_FILENO, header, len);
+  if (r < 0 || head)
+    return r;
+
+  while (offset < st.st_size)
+    {
+      ssize_t n = sendfile(STDOUT_FILENO, fd, &offset, st.st_size - offset);
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -errno;
+	}
+      if (n == 0)
+	return -EIO;  /* file got truncated */
+    }
+
+  return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  int r;
+
+  r = load_config("sysextmgrd");
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Couldn't load configuration file");
+      return EXIT_FAILURE;
+    }
+
+  if (argc > 1)
+    {
+      fprintf(stderr, "Usage: %s\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  /* a peer gone away should not kill us with SIGPIPE before we
+     logged it */
+  signal(SIGPIPE, SIG_IGN);
+  alarm(REQUEST_TIMEOUT_SEC);
+
+  r = serve(config.sysext_store_dir);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Serving request failed: %s", strerror(-r));
+      return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -2,6 +2,7 @@
 
 #include "config.h"
 
+#include <fcntl.h>
 #include <getopt.h>
 
 #include <libeconf.h>
@@ -9,6 +10,8 @@
 
 #include "basics.h"
 #include "sysextmgr.h"
+#include "compress.h"
+#include "catalog-index.h"
 
 void
 oom(void)
@@ -23,7 +26,13 @@ usage(int retval)
   FILE *output = (retval != EXIT_SUCCESS) ? stderr : stdout;
 
   fputs("Usage: sysextmgrcli [command] [options]\n", output);
-  fputs("Commands: create-json, check, dump-json, install, list, merge-json, update\n\n", output);
+  fputs("Commands: batch, create-json, check, cleanup, dump-json, import, install, list, merge-json, metrics, plan, prefetch, update, verify\n\n", output);
+
+  fputs("batch - Run the commands of FILE, one per line, on one connection to sysextmgrd\n", output);
+  fputs("Options for batch:\n", output);
+  fputs("  -k, --keep-going      Continue after a command failed\n", output);
+  fputs("  <file>                File with the commands, default is stdin\n", output);
+  fputs("\n", output);
 
   fputs("create-json - create json file from release file\n", output);
   fputs("Options for create-json:\n", output);
@@ -36,11 +45,27 @@ usage(int retval)
   fputs("Options for check:\n", output);
   fputs("  -q, --quiet           Return 0 if updates exist, else ENODATA\n", output);
 
-  fputs("dump-json - dump content of json file\n", output);
+  fputs("cleanup - Remove images from the store which are no longer needed\n", output);
+  fputs("Options for cleanup:\n", output);
+  fputs("  -n, --dry-run         Only print what would be removed\n", output);
+  fputs("  -k, --keep N          Keep N versions of every image, 0 keeps all\n", output);
+  fputs("  -m, --max-size MiB    Remove the oldest versions above this size\n", output);
+  fputs("  -q, --quiet           Don't print the removed images\n", output);
+  fputs("\n", output);
+
+  fputs("dump-json - dump content of json file or binary index\n", output);
   fputs("Options for dump-json:\n", output);
   fputs("  <file 1> <file 2>...  Input files in json format\n", output);
   fputs("\n", output);
 
+  fputs("import - Copy a local image file into the store\n", output);
+  fputs("Options for import:\n", output);
+  fputs("  -n, --name NAME       File name in the store, default is the name of the file\n", output);
+  fputs("  -s, --sha256 SUM      Expected SHA256 sum of the image\n", output);
+  fputs("  -q, --quiet           Don't print the SHA256 sum of the imported image\n", output);
+  fputs("  <file>                Image file to import\n", output);
+  fputs("\n", output);
+
   fputs("install - Install newest compatible sysext image\n", output);
   fputs("Options for install:\n", output);
   fputs("  -u, --url URL         Remote directory with sysext images\n", output);
@@ -48,23 +73,52 @@ usage(int retval)
   fputs("\n", output);
 
   fputs("list - list all images and if they are compatible\n", output);
-  fputs("Options for merge-json:\n", output);
+  fputs("Options for list:\n", output);
+  fputs("  -l, --local, --installed\n", output);
+  fputs("                        Only the installed images, without sysextmgrd\n", output);
   fputs("  -u, --url URL         Remote directory with sysext images\n", output);
   fputs("  -v, --verbose         Verbose output\n", output);
   fputs("\n", output);
 
   fputs("merge-json - merge serveral json files into one json array\n", output);
   fputs("Options for merge-json:\n", output);
-  fputs("  -o, --output FILE     Output file in json format\n", output);
+  fputs("  -o, --output FILE     Output file in json format, compressed with\n", output);
+  fputs("                        zstd or gzip if FILE ends with .zst or .gz,\n", output);
+  fputs("                        the binary index if it ends with .idx\n", output);
   fputs("  <file 1> <file 2>...  Input files in json format\n", output);
   fputs("\n", output);
 
+  fputs("metrics - Print counters and latencies of sysextmgrd in Prometheus format\n", output);
+  fputs("Options for metrics:\n", output);
+  fputs("  -j, --json            Print the reply of sysextmgrd as json\n", output);
+  fputs("\n", output);
+
+  fputs("plan - Show the updates for other systems like snapshots\n", output);
+  fputs("Options for plan:\n", output);
+  fputs("  -r, --root DIR        Root directory of a target, can be repeated\n", output);
+  fputs("  -o, --os-release FILE os-release file of a target, can be repeated\n", output);
+  fputs("  -u, --url URL         Remote directory with sysext images\n", output);
+  fputs("  -v, --verbose         Also list images without update\n", output);
+  fputs("\n", output);
+
+  fputs("prefetch - Download newer images into the store without using them\n", output);
+  fputs("Options for prefetch:\n", output);
+  fputs("  -q, --quiet           Don't print the downloaded images\n", output);
+  fputs("  -u, --url URL         Remote directory with sysext images\n", output);
+  fputs("\n", output);
+
   fputs("update - Check if there are newer images available and update them\n", output);
   fputs("Options for update:\n", output);
   fputs("  -q, --quiet           Return 0 if updates exist, else ENODATA\n", output);
   fputs("  -u, --url URL         Remote directory with sysext images\n", output);
   fputs("\n", output);
 
+  fputs("verify - Check the images of the store against their SHA256 sums\n", output);
+  fputs("Options for verify:\n", output);
+  fputs("  -q, --quiet           Only set the exit status\n", output);
+  fputs("  <name 1> <name 2>...  Image files to check, default all\n", output);
+  fputs("\n", output);
+
   fputs("Generic options:\n", output);
   fputs("  -h, --help          Display this help message and exit\n", output);
   fputs("  -v, --version       Print version number and exit\n", output);
@@ -210,6 +264,27 @@ main_create_json(int argc, char **argv)
   return EXIT_SUCCESS;
 }
 
+static int
+write_catalog_index(sd_json_variant *json, int fd)
+{
+  _cleanup_(free_image_deps_list) struct image_deps **images = NULL;
+  size_t n = sd_json_variant_elements(json);
+  int r;
+
+  images = calloc(n + 1, sizeof(struct image_deps *));
+  if (images == NULL)
+    oom();
+
+  for (size_t i = 0; i < n; i++)
+    {
+      r = parse_image_deps(sd_json_variant_by_index(json, i), &images[i]);
+      if (r < 0)
+	return r;
+    }
+
+  return catalog_index_write(fd, images);
+}
+
 static int
 main_merge_json(int argc, char **argv)
 {
@@ -219,6 +294,7 @@ main_merge_json(int argc, char **argv)
   };
   _cleanup_(sd_json_variant_unrefp) sd_json_variant *json = NULL;
   _cleanup_fclose_ FILE *of = NULL;
+  enum compression compression = COMPRESSION_NONE;
   char *output = NULL;
   int c, r;
 
@@ -264,6 +340,14 @@ main_merge_json(int argc, char **argv)
 
   if (output)
     {
+      compression = compression_from_suffix(output);
+      if (!compression_supported(compression))
+	{
+	  fprintf(stderr, "Compression of %s is not supported by this build\n",
+		  output);
+	  return EXIT_FAILURE;
+	}
+
       of = fopen(output, "w");
       if (of == NULL)
 	{
@@ -271,7 +355,19 @@ main_merge_json(int argc, char **argv)
 	  return EXIT_FAILURE;
 	}
     }
-  r = sd_json_variant_dump(json, SD_JSON_FORMAT_NEWLINE /* SD_JSON_FORMAT_PRETTY_AUTO */, of, NULL);
+
+  if (output && endswith(output, ".idx"))
+    r = write_catalog_index(json, fileno(of));
+  else if (compression != COMPRESSION_NONE)
+    {
+      _cleanup_free_ char *str = NULL;
+
+      r = sd_json_variant_format(json, SD_JSON_FORMAT_NEWLINE, &str);
+      if (r >= 0)
+	r = write_compressed(fileno(of), compression, str, strlen(str));
+    }
+  else
+    r = sd_json_variant_dump(json, SD_JSON_FORMAT_NEWLINE /* SD_JSON_FORMAT_PRETTY_AUTO */, of, NULL);
   if (r < 0)
     {
       fprintf(stderr, "Failed to write json data: %s\n", strerror(-r));
@@ -281,6 +377,44 @@ main_merge_json(int argc, char **argv)
   return EXIT_SUCCESS;
 }
 
+/* Returns 0 if fn is no binary index */
+static int
+dump_catalog_index(const char *fn)
+{
+  _cleanup_(free_catalog_indexp) struct catalog_index *idx = NULL;
+  _cleanup_close_ int fd = -EBADF;
+  int r;
+
+  fd = open(fn, O_RDONLY|O_CLOEXEC);
+  if (fd < 0)
+    return 0;
+
+  r = catalog_index_open(fd, &idx);
+  if (r == -EBADMSG)
+    return 0;
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to open index (%s): %s\n", fn, strerror(-r));
+      return r;
+    }
+
+  for (size_t i = 0; i < catalog_index_entries(idx); i++)
+    {
+      _cleanup_(free_image_depsp) struct image_deps *e = NULL;
+
+      r = catalog_index_get(idx, i, &e);
+      if (r < 0)
+	{
+	  fprintf(stderr, "Failed to read entry %zu of %s: %s\n", i, fn,
+		  strerror(-r));
+	  return r;
+	}
+      dump_image_deps(e);
+    }
+
+  return 1;
+}
+
 static int
 main_dump_json(int argc, char **argv)
 {
@@ -311,6 +445,12 @@ main_dump_json(int argc, char **argv)
     {
       _cleanup_(free_image_deps_list) struct image_deps **images = NULL;
 
+      r = dump_catalog_index(argv[i]);
+      if (r > 0)
+	continue;
+      if (r < 0)
+	return EXIT_FAILURE;
+
       r = load_image_json(AT_FDCWD, argv[i], &images);
       if (r < 0)
 	return EXIT_FAILURE;
@@ -334,20 +474,34 @@ main(int argc, char **argv)
 
   if (argc == 1)
     usage(EXIT_FAILURE);
+  else if (strcmp(argv[1], "batch") == 0)
+    return main_batch(--argc, ++argv);
   else if (strcmp(argv[1], "create-json") == 0)
     return main_create_json(--argc, ++argv);
   else if (strcmp(argv[1], "check") == 0)
     return main_check(--argc, ++argv);
+  else if (strcmp(argv[1], "cleanup") == 0)
+    return main_cleanup(--argc, ++argv);
   else if (strcmp(argv[1], "dump-json") == 0)
     return main_dump_json(--argc, ++argv);
+  else if (strcmp(argv[1], "import") == 0)
+    return main_import(--argc, ++argv);
   else if (strcmp(argv[1], "install") == 0)
     return main_install(--argc, ++argv);
   else if (strcmp(argv[1], "list") == 0)
     return main_list(--argc, ++argv);
   else if (strcmp(argv[1], "merge-json") == 0)
     return main_merge_json(--argc, ++argv);
+  else if (strcmp(argv[1], "metrics") == 0)
+    return main_metrics(--argc, ++argv);
+  else if (strcmp(argv[1], "plan") == 0)
+    return main_plan(--argc, ++argv);
+  else if (strcmp(argv[1], "prefetch") == 0)
+    return main_prefetch(--argc, ++argv);
   else if (strcmp(argv[1], "update") == 0)
     return main_update(--argc, ++argv);
+  else if (strcmp(argv[1], "verify") == 0)
+    return main_verify(--argc, ++argv);
 
   while ((c = getopt_long(argc, argv, "hv", longopts, NULL)) != -1)
     {
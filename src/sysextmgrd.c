@@ -19,12 +19,18 @@
 #include "config.h"
 
 #include <assert.h>
+#include <inttypes.h>
 #include <limits.h>
+#include <stdarg.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <libintl.h>
 #include <syslog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
 #include <systemd/sd-daemon.h>
 #include <systemd/sd-varlink.h>
 
@@ -32,13 +38,26 @@
 #include "mkdir_p.h"
 #include "sysextmgr.h"
 #include "osrelease.h"
+#include "host-profile.h"
 #include "download.h"
 #include "images-list.h"
+#include "discover-images.h"
+#include "catalog.h"
+#include "mirror.h"
+#include "store.h"
+#include "store-lock.h"
+#include "store-refs.h"
+#include "store-gc.h"
+#include "store-verify.h"
+#include "link-switch.h"
+#include "sha256.h"
 #include "extension-util.h"
 #include "tmpfile-util.h"
 #include "architecture.h"
 #include "strv.h"
 #include "log_msg.h"
+#include "subscribers.h"
+#include "metrics.h"
 
 #include "varlink-org.openSUSE.sysextmgr.h"
 
@@ -143,6 +162,43 @@ vl_method_get_environment(sd_varlink *link, sd_json_variant *parameters,
 #endif
 }
 
+static int
+vl_method_get_metrics(sd_varlink *link, sd_json_variant *parameters,
+		      sd_varlink_method_flags_t _unused_(flags),
+		      void _unused_(*userdata))
+{
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *metrics = NULL;
+  uid_t peer_uid;
+  int r;
+
+  log_msg(LOG_INFO, "Varlink method \"GetMetrics\" called...");
+
+  r = sd_varlink_dispatch(link, parameters, NULL, NULL);
+  if (r != 0)
+    return r;
+
+  r = sd_varlink_get_peer_uid(link, &peer_uid);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Failed to get peer UID: %s", strerror(-r));
+      return r;
+    }
+  if (peer_uid != 0)
+    {
+      log_msg(LOG_WARNING, "GetMetrics: peer UID %i denied", peer_uid);
+      return sd_varlink_error(link, SD_VARLINK_ERROR_PERMISSION_DENIED, parameters);
+    }
+
+  r = metrics_to_json(&metrics);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Failed to build metrics: %s", strerror(-r));
+      return r;
+    }
+
+  return sd_varlink_reply(link, metrics);
+}
+
 static int
 vl_method_quit(sd_varlink *link, sd_json_variant *parameters,
 	       sd_varlink_method_flags_t _unused_(flags),
@@ -202,30 +258,21 @@ oom(void)
   exit (1);
 }
 
-/* compare the image names, but move NULL to the end
-   of the list */
-static int
-image_cmp(const void *a, const void *b)
-{
-  const struct image_entry *const *i_a = a;
-  const struct image_entry *const *i_b = b;
-
-  if (a == NULL && b == NULL)
-    return 0;
-
-  if (a == NULL)
-    return 1;
-
-  if (b == NULL)
-    return -1;
-
-  return strverscmp((*i_a)->deps->image_name, (*i_b)->deps->image_name);
-}
-
 struct parameters {
   char *url;
   bool verbose;
   char *install;
+  char **names;
+  bool only_installed;
+  bool only_compatible;
+  uint64_t offset;
+  uint64_t limit;   /* 0 means no limit */
+  sd_json_variant *targets;
+  bool dry_run;
+  uint32_t keep_versions;
+  uint32_t max_store_size;  /* MiB */
+  char *image_name;
+  char *sha256;
 };
 
 static void
@@ -233,568 +280,3430 @@ parameters_free(struct parameters *var)
 {
   var->url = mfree(var->url);
   var->install = mfree(var->install);
+  var->names = strv_free(var->names);
+  var->targets = sd_json_variant_unref(var->targets);
+  var->image_name = mfree(var->image_name);
+  var->sha256 = mfree(var->sha256);
+}
+
+#define USEC_PER_SEC  ((uint64_t) 1000000ULL)
+/* how often Install and Update report the download progress */
+#define PROGRESS_INTERVAL_USEC USEC_PER_SEC
+/* wait before retrying a failed download, doubled for every attempt */
+#define DOWNLOAD_RETRY_USEC (5*USEC_PER_SEC)
+
+/* systemd-pull and bspatch processes of all requests */
+static struct process_pool *helper_pool = NULL;
+/* systemd-dissect calls of all requests, they are limited by the
+   number of CPUs and not by the network */
+static struct process_pool *scan_pool = NULL;
+
+/* host profile from os-release, shared by all requests. A request
+   keeps its reference if os-release changes while it is running. */
+struct shared_osrelease {
+  unsigned n_ref;
+  struct host_profile *host;
+};
+
+static struct shared_osrelease *
+shared_osrelease_unref(struct shared_osrelease *os)
+{
+  if (!os)
+    return NULL;
+
+  assert(os->n_ref > 0);
+
+  if (--os->n_ref > 0)
+    return NULL;
+
+  free_host_profilep(&os->host);
+  return mfree(os);
+}
+
+/* Data which stays valid between requests, as long as inotify
+   reports no changes */
+static struct shared_osrelease *resident_osrelease = NULL;
+static char **resident_installed = NULL; /* images in extensions_dir */
+static bool resident_installed_valid = false;
+
+/* Event for Watch subscribers about an entry of a watched directory,
+   NULL if ev says nothing about a single entry */
+static const char *
+dir_event(const struct inotify_event *ev, const char *added,
+	  const char *removed)
+{
+  if (ev == NULL || ev->len == 0 || (ev->mask & IN_ISDIR))
+    return NULL;
+
+  /* temporary files of downloads and link switches */
+  if (ev->name[0] == '.')
+    return NULL;
+
+  if (ev->mask & (IN_CREATE|IN_MOVED_TO))
+    return added;
+  if (ev->mask & (IN_DELETE|IN_MOVED_FROM))
+    return removed;
+
+  return NULL;
+}
+
+/* ev is NULL if it is unknown what changed */
+static void
+os_release_changed(const struct inotify_event _unused_(*ev))
+{
+  resident_osrelease = shared_osrelease_unref(resident_osrelease);
+  /* the compatibility of all images depends on os-release */
+  catalog_cache_flush();
+}
+
+static void
+store_changed(const struct inotify_event *ev)
+{
+  const char *event = dir_event(ev, "store-added", "store-removed");
+
+  catalog_cache_flush_local();
+
+  if (event)
+    subscribers_notify(event, ev->name, NULL);
 }
 
+static void
+extensions_changed(const struct inotify_event *ev)
+{
+  const char *event = dir_event(ev, "link-changed", "link-changed");
+
+  resident_installed = strv_free(resident_installed);
+  resident_installed_valid = false;
+
+  if (event)
+    subscribers_notify(event, ev->name, NULL);
+}
+
+#define WATCH_DIR_MASK (IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|	\
+			IN_CLOSE_WRITE|IN_ATTRIB|IN_DELETE_SELF|IN_MOVE_SELF| \
+			IN_ONLYDIR)
+#define WATCH_FILE_MASK (IN_MODIFY|IN_CLOSE_WRITE|IN_ATTRIB|IN_DELETE_SELF| \
+			 IN_MOVE_SELF)
+
+struct watch {
+  const char *path;
+  uint32_t mask;
+  void (*changed)(const struct inotify_event *ev);
+  sd_event_source *source;
+};
+
+/* paths are set in run_varlink(), after the config got read */
+static struct watch watches[] = {
+  { NULL, WATCH_FILE_MASK, os_release_changed, NULL },
+  { NULL, WATCH_DIR_MASK,  store_changed,      NULL },
+  { NULL, WATCH_DIR_MASK,  extensions_changed, NULL },
+};
+
 static int
-vl_method_list_images(sd_varlink *link, sd_json_variant *parameters,
-		      sd_varlink_method_flags_t _unused_(flags),
-		      void _unused_(*userdata))
+watch_handler(sd_event_source _unused_(*s), const struct inotify_event *ev,
+	      void *userdata)
 {
-  _cleanup_(sd_json_variant_unrefp) sd_json_variant *array = NULL;
-  _cleanup_(parameters_free) struct parameters p = {
-    .url = NULL,
-    .verbose = config.verbose,
-    .install = NULL,
-  };
-  static const sd_json_dispatch_field dispatch_table[] = {
-    { "URL",     SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct parameters, url), 0},
-    { "Verbose", SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool, offsetof(struct parameters, verbose), 0},
-    {}
-  };
-  _cleanup_(free_os_releasep) struct osrelease *osrelease = NULL;
-  _cleanup_(free_image_entry_list) struct image_entry **images = NULL;
-  _cleanup_(free_image_entry_list) struct image_entry **images_remote = NULL;
-  _cleanup_(free_image_entry_list) struct image_entry **images_local = NULL;
-  size_t n_remote = 0, n_local = 0, n_etc = 0;
-  const char *url = NULL;
-  int r;
+  struct watch *w = userdata;
 
-  log_msg(LOG_INFO, "Varlink method \"ListImages\" called...");
+  /* temporary files of downloads */
+  if (ev->len > 0 && ev->name[0] == '.')
+    return 0;
 
-  r = sd_varlink_dispatch(link, parameters, dispatch_table, &p);
-  if (r < 0)
+  log_msg(LOG_DEBUG, "'%s' changed, dropping cached data", w->path);
+  w->changed(ev);
+
+  /* the path is gone or points to another inode now, try again
+     with the next request */
+  if (ev->mask & (IN_DELETE_SELF|IN_MOVE_SELF|IN_IGNORED|IN_UNMOUNT))
+    w->source = sd_event_source_disable_unref(w->source);
+
+  return 0;
+}
+
+/* Called at the begin of every request. Without a watch, nothing
+   cached about this path can be trusted. */
+static void
+update_watches(sd_event *event)
+{
+  for (size_t i = 0; i < sizeof(watches)/sizeof(watches[0]); i++)
     {
-      log_msg(LOG_ERR, "List image request: varlink dispatch failed: %s", strerror(-r));
-      return r;
+      struct watch *w = &watches[i];
+      int r;
+
+      if (w->source)
+	continue;
+
+      r = sd_event_add_inotify(event, &w->source, w->path, w->mask,
+			       watch_handler, w);
+      if (r < 0)
+	log_msg(LOG_DEBUG, "Cannot watch '%s': %s", w->path, strerror(-r));
+      /* something could have been changed before the watch got added */
+      w->changed(NULL);
     }
+}
 
-  /* Only allow URL or verbose argument if called by root */
-  if (p.url || p.verbose != config.verbose)
+static void
+free_watches(void)
+{
+  for (size_t i = 0; i < sizeof(watches)/sizeof(watches[0]); i++)
+    watches[i].source = sd_event_source_disable_unref(watches[i].source);
+
+  os_release_changed(NULL);
+  extensions_changed(NULL);
+  catalog_cache_free();
+}
+
+static int
+get_os_release(struct shared_osrelease **res)
+{
+  if (resident_osrelease == NULL)
     {
-      uid_t peer_uid;
-      r = sd_varlink_get_peer_uid(link, &peer_uid);
+      _cleanup_(free_host_profilep) struct host_profile *host = NULL;
+      struct osrelease *o = NULL;
+      int r;
+
+      r = load_os_release(NULL, &o);
       if (r < 0)
 	{
-	  log_msg(LOG_ERR, "Failed to get peer UID: %s", strerror(-r));
+	  free_os_releasep(&o);
 	  return r;
 	}
-      if (peer_uid != 0)
-	{
-	  log_msg(LOG_WARNING, "ListImages: peer UID %i denied with additional options", peer_uid);
-	  return sd_varlink_error(link, SD_VARLINK_ERROR_PERMISSION_DENIED, parameters);
-	}
+
+      r = host_profile_new(o, &host);
+      if (r < 0)
+	return r;
+
+      resident_osrelease = calloc(1, sizeof(struct shared_osrelease));
+      if (resident_osrelease == NULL)
+	return -ENOMEM;
+      resident_osrelease->n_ref = 1;
+      resident_osrelease->host = TAKE_PTR(host);
     }
 
-  r = load_os_release(NULL, &osrelease);
-  if (r < 0)
+  resident_osrelease->n_ref++;
+  *res = resident_osrelease;
+
+  return 0;
+}
+
+/* list of "installed" images visible to systemd-sysext. The list
+   belongs to the cache and is only valid until the next event. */
+static int
+get_installed_images(char ***res)
+{
+  if (!resident_installed_valid)
     {
-      _cleanup_free_ char *error = NULL;
-      if (asprintf(&error, "Couldn't read os-release file: %s", strerror(-r)) < 0)
-	error = NULL;
-      log_msg(LOG_ERR, "%s", error);
-      return sd_varlink_errorbo(link, "org.openSUSE.sysextmgr.InternalError",
-				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-                                SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
+      int r = discover_images(config.extensions_dir, &resident_installed);
+      if (r < 0 && r != -ENOENT)
+	return r;
+      resident_installed_valid = true;
     }
 
-  /* use URL from config if none got provided via parameter */
-  if (p.url)
-    url = p.url;
-  else
-    url = config.url;
+  *res = resident_installed;
+
+  return 0;
+}
+
+struct request;
+
+/* newer version of an installed image and its download into the store */
+struct update {
+  struct request *req;
+  const char *old;  /* image_name of the installed image, NULL for Install */
+  struct image_entry *new;
+  char *fn;     /* image in the store */
+  char *tmpfn;  /* temporary file for the download */
+  int fd;
+  int status;   /* exit status of systemd-pull */
+  bool finished;
+  unsigned attempts;     /* failed downloads so far */
+  sd_event_source *retry;
+  unsigned source;  /* index in config.peers, after them in urls */
+  char **urls;      /* repository of the image and its mirrors */
+  uint64_t started; /* CLOCK_MONOTONIC of the current download */
+  uint64_t fetched; /* and of its end, before the verification */
+  uint64_t synced;  /* bytes of tmpfn submitted for writeback */
+  char *base;     /* old image in the store for a delta update */
+  char *deltafn;  /* temporary file for the delta */
+  bool fetch;     /* downloaded by this or another request */
+  struct update *next_inflight;  /* list of running downloads */
+  struct update *waiters;  /* same image for other requests */
+  struct update *next_waiter;
+};
+
+struct update_list {
+  struct update *u;
+  size_t n;
+};
+
+static void inflight_remove(struct update *u);
+
+/* update lists of running requests, the store gets only cleaned up
+   if no other request is going to link an image */
+static unsigned n_update_lists = 0;
+
+static void
+free_update_list(struct update_list *l)
+{
+  if (l->u)
+    n_update_lists--;
 
-  if (url)
+  for (size_t i = 0; i < l->n; i++)
     {
-      r = image_remote_metadata(url, &images_remote, &n_remote, NULL, config.verify_signature, osrelease, p.verbose);
-      if (r < 0)
-        {
-	  _cleanup_free_ char *error = NULL;
-          if (asprintf(&error, "Fetching image data from '%s' failed: %s",
-		       url, strerror(-r)) < 0)
-	    error = NULL;
-	  log_msg(LOG_ERR, "%s", error);
-	  return sd_varlink_errorbo(link, "org.openSUSE.sysextmgr.InternalError",
-				    SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-				    SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
-        }
+      inflight_remove(&l->u[i]);
+      free_image_entryp(&l->u[i].new);
+      free(l->u[i].fn);
+      strv_free(l->u[i].urls);
+      unlink_and_free_tempfilep(&l->u[i].tmpfn);
+      closep(&l->u[i].fd);
+      l->u[i].retry = sd_event_source_disable_unref(l->u[i].retry);
+      free(l->u[i].base);
+      unlink_and_free_tempfilep(&l->u[i].deltafn);
     }
+  l->u = mfree(l->u);
+  l->n = 0;
+}
+
+static int
+new_update_list(struct update_list *l, size_t n)
+{
+  l->u = calloc(n, sizeof(struct update));
+  if (l->u == NULL)
+    return -ENOMEM;
+  l->n = n;
+  n_update_lists++;
+
+  for (size_t i = 0; i < n; i++)
+    l->u[i].fd = -EBADF;
+
+  return 0;
+}
+
+/* Import copies and hashes the image in a helper process, which
+   writes the sum to sum_fd */
+struct import {
+  int fd;       /* image passed by the client */
+  int sum_fd;   /* memfd */
+  int status;   /* result of import_image() */
+  char sum[2 * SHA256_DIGEST_SIZE + 1];
+};
+
+static void
+free_import(struct import *im)
+{
+  if (im == NULL)
+    return;
+
+  closep(&im->fd);
+  closep(&im->sum_fd);
+  free(im);
+}
+
+/* Check, Install, ListImages and Update wait for helper processes.
+   The method callback returns after starting the first step, the
+   reply is sent by the last step. In between the event loop serves
+   other clients. */
+struct request {
+  sd_varlink *link;
+  sd_varlink_method_flags_t flags;
+  sd_event_source *progress;  /* timer for download progress messages */
+  struct parameters p;
+  char **repositories;  /* highest priority first */
+  struct shared_osrelease *os;
+  struct host_profile *host;
+  char **names;  /* images to install */
+  bool prefetch; /* download updates into the store, don't link them */
+  struct image_entry **images_etc;
+  size_t n_etc;
+  struct catalog *catalog;
+  struct update_list updates;
+  struct store_sum *sums;  /* images of Verify */
+  size_t n_sums;
+  struct import *import;   /* image of Import */
+  struct process_batch batch;
+};
+
+static struct request *
+free_request(struct request *req)
+{
+  if (!req)
+    return NULL;
+
+  req->progress = sd_event_source_disable_unref(req->progress);
+  free_update_list(&req->updates);
+  free_catalogp(&req->catalog);
+  free_image_entry_list(&req->images_etc);
+  store_sums_free(req->sums, req->n_sums);
+  free_import(req->import);
+  req->os = shared_osrelease_unref(req->os);
+  strv_free(req->names);
+  strv_free(req->repositories);
+  parameters_free(&req->p);
+  req->link = sd_varlink_unref(req->link);
+
+  return mfree(req);
+}
+
+static void
+free_requestp(struct request **req)
+{
+  if (!req || !*req)
+    return;
+
+  *req = free_request(*req);
+}
+
+static int
+new_request(sd_varlink *link, sd_varlink_method_flags_t flags,
+	    struct request **res)
+{
+  struct request *req;
+
+  req = calloc(1, sizeof(struct request));
+  if (req == NULL)
+    return -ENOMEM;
+
+  req->link = sd_varlink_ref(link);
+  req->flags = flags;
+  req->p.verbose = config.verbose;
+
+  update_watches(sd_varlink_get_event(link));
+
+  *res = req;
+
+  return 0;
+}
+
+static int
+request_get_os_release(struct request *req)
+{
+  int r;
 
-  /* local available images */
-  r = image_local_metadata(config.sysext_store_dir, &images_local, &n_local, NULL, osrelease, p.verbose);
+  r = get_os_release(&req->os);
   if (r < 0)
-    {
-      _cleanup_free_ char *error = NULL;
-      if (asprintf(&error, "Searching for images in '%s' failed: %s",
-		   config.sysext_store_dir, strerror(-r)) < 0)
-	error = NULL;
+    return r;
 
-      log_msg(LOG_ERR, "%s", error);
-      return sd_varlink_errorbo(link, "org.openSUSE.sysextmgr.InternalError",
-				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-                                SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
-    }
+  req->host = req->os->host;
 
-  if ((n_local + n_remote) == 0)
-    {
-      log_msg(LOG_INFO, "No images found");
-      return sd_varlink_replybo(link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
-				SD_JSON_BUILD_PAIR_VARIANT("Images", array));
-    }
+  return 0;
+}
 
-  /* list of "installed" images visible to systemd-sysext */
-  _cleanup_strv_free_ char **list_etc = NULL;
-  r = discover_images(config.extensions_dir, &list_etc);
-  if (r < 0 && r != -ENOENT)
-    {
-      _cleanup_free_ char *error = NULL;
-      if (asprintf(&error, "Searching for images in '%s' failed: %s",
-		   config.extensions_dir, strerror(-r)) < 0)
-	error = NULL;
+/* use the repositories from config if no URL got provided via
+   parameter */
+static int
+request_set_url(struct request *req)
+{
+  if (req->p.url)
+    return strv_extend(&req->repositories, req->p.url);
+
+  if (config.repositories == NULL)
+    return 0;
+
+  req->repositories = strv_copy(config.repositories);
+  if (req->repositories == NULL)
+    return -ENOMEM;
+
+  return 0;
+}
+
+/* for messages about the catalog of the request */
+static const char *
+request_repositories(const struct request *req)
+{
+  if (req->repositories == NULL)
+    return "no repository";
+  if (req->repositories[1] == NULL)
+    return req->repositories[0];
+
+  return "all repositories";
+}
+
+/* send an error reply with a message and free the request */
+static void __attribute__((format(printf, 3, 4)))
+request_fail(struct request *req, const char *error_id, const char *fmt, ...)
+{
+  _cleanup_free_ char *error = NULL;
+  va_list ap;
+
+  va_start(ap, fmt);
+  if (vasprintf(&error, fmt, ap) < 0)
+    error = NULL;
+  va_end(ap);
+
+  log_msg(LOG_ERR, "%s", error);
+  (void) sd_varlink_errorbo(req->link, error_id,
+			    SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
+			    SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
+  free_request(req);
+}
+
+/* same as returning a negative errno value from a method callback */
+static void
+request_fail_errno(struct request *req, int r)
+{
+  (void) sd_varlink_error_errno(req->link, r);
+  free_request(req);
+}
+
+/* If the client called us with "more", tell it about every step of
+   every image. The final reply stays the same as without "more". */
+static void
+request_progress(struct request *req, const struct update *u, const char *state)
+{
+  struct stat st = {};
+  bool have_size = false;
+  int r;
+
+  if (!(req->flags & SD_VARLINK_METHOD_MORE))
+    return;
+
+  /* systemd-pull does not tell us the size of the image, so the total
+     is only known after the download */
+  if (u->tmpfn && stat(u->tmpfn, &st) == 0)
+    have_size = true;
+
+  r = sd_varlink_notifybo(req->link,
+			  SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
+			  SD_JSON_BUILD_PAIR("Progress",
+			    SD_JSON_BUILD_OBJECT(
+			      SD_JSON_BUILD_PAIR_STRING("Image", u->new?u->new->deps->image_name:u->old),
+			      SD_JSON_BUILD_PAIR_CONDITION(u->new && u->old, "OldImage", SD_JSON_BUILD_STRING(u->old)),
+			      SD_JSON_BUILD_PAIR_STRING("State", state),
+			      SD_JSON_BUILD_PAIR_CONDITION(have_size, "BytesDone", SD_JSON_BUILD_UNSIGNED(st.st_size)),
+			      SD_JSON_BUILD_PAIR_CONDITION(have_size && u->finished, "BytesTotal", SD_JSON_BUILD_UNSIGNED(st.st_size)))));
+  if (r < 0)
+    log_msg(LOG_WARNING, "Failed to send progress message: %s", strerror(-r));
+}
+
+/* systemd-pull and bspatch may write the image to a new file and
+   rename it to tmpfn, which leaves u->fd on the orphaned placeholder
+   created by mkostemp. Switch to the file which is there now, so that
+   the writeback and the sync act on what gets renamed into the
+   store. */
+static void
+update_reopen(struct update *u)
+{
+  struct stat a, b;
+  int fd;
+
+  if (u->tmpfn == NULL)
+    return;
+
+  fd = open(u->tmpfn, O_RDWR|O_CLOEXEC);
+  if (fd < 0)
+    return;
 
-      log_msg(LOG_ERR, "%s", error);
-      return sd_varlink_errorbo(link, "org.openSUSE.sysextmgr.InternalError",
-				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-                                SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
+  if (u->fd >= 0 && fstat(u->fd, &a) == 0 && fstat(fd, &b) == 0 &&
+      a.st_ino == b.st_ino && a.st_dev == b.st_dev)
+    {
+      close(fd);
+      return;
     }
-  n_etc = strv_length(list_etc);
 
-  /* merge remote and local images */
-  images = calloc((n_remote + n_local + 1), sizeof(struct image_entry *));
-  if (images == NULL)
-    oom(); /* XXX */
+  closep(&u->fd);
+  u->fd = fd;
+  u->synced = 0;
+}
 
-  size_t n = 0;
+static int
+progress_timer(sd_event_source *s, uint64_t _unused_(usec), void *userdata)
+{
+  struct request *req = userdata;
 
-  for (size_t i = 0; i < n_remote; i++)
+  for (size_t i = 0; i < req->updates.n; i++)
     {
-      images[n] = TAKE_PTR(images_remote[i]);
+      struct update *u = &req->updates.u[i];
 
-      if (images[n]->deps)
-        images[n]->compatible = extension_release_validate(images[n]->deps->image_name,
-                                                           osrelease, "system",
-                                                           images[n]->deps, p.verbose);
-      n++;
+      if (u->tmpfn && !u->finished && !u->retry)
+	{
+	  if (config.drop_page_cache)
+	    {
+	      update_reopen(u);
+	      store_writeback(u->fd, &u->synced);
+	    }
+	  request_progress(req, u, "downloading");
+	}
     }
-  for (size_t i = 0; i < n_local; i++)
-    {
-      bool found = false;
 
-      for (size_t j = 0; j < n_etc; j++)
-        {
-          if (streq(list_etc[j], images_local[i]->deps->image_name))
-            images_local[i]->installed = true;
-        }
+  (void) sd_event_source_set_time_relative(s, PROGRESS_INTERVAL_USEC);
+  (void) sd_event_source_set_enabled(s, SD_EVENT_ONESHOT);
 
-      /* check if we know already the image */
-      for (size_t j = 0; j < n_remote; j++)
-        {
-          if (streq(images_local[i]->deps->image_name, images[j]->deps->image_name))
-            {
-              images[j]->local = true;
-              images[j]->installed = images_local[i]->installed;
-              found = true;
-              break;
-            }
-        }
+  return 0;
+}
 
-      if (!found)
+/* Report the size of running downloads until the batch is done and
+   keep their data out of the page cache. Progress messages are
+   optional, so errors are only logged. */
+static void
+request_start_progress(struct request *req)
+{
+  int r;
+
+  if (!(req->flags & SD_VARLINK_METHOD_MORE) && !config.drop_page_cache)
+    return;
+
+  r = sd_event_add_time_relative(sd_varlink_get_event(req->link), &req->progress,
+				 CLOCK_MONOTONIC, PROGRESS_INTERVAL_USEC, 0,
+				 progress_timer, req);
+  if (r < 0)
+    log_msg(LOG_WARNING, "Failed to create progress timer: %s", strerror(-r));
+}
+
+static int download_finished(int status, void *userdata);
+static void update_finish(struct update *u, int status);
+
+/* Compare the downloaded or created image with the sum from the
+   signed SHA256SUMS of the repository. Runs in a helper process, the
+   exit status is 0 if the image matches. */
+static int
+update_verify_child(void *arg)
+{
+  const struct update *u = arg;
+  _cleanup_close_ int fd = -EBADF;
+  char sum[2 * SHA256_DIGEST_SIZE + 1];
+  int r;
+
+  fd = open(u->tmpfn, O_RDONLY|O_CLOEXEC);
+  if (fd < 0)
+    r = -errno;
+  else
+    r = sha256_fd(fd, sum);
+  if (r < 0)
+    {
+      log_msg(LOG_WARNING, "Failed to hash '%s': %s", u->tmpfn, strerror(-r));
+      return EXIT_FAILURE;
+    }
+
+  return strcaseeq(sum, u->new->sha256) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Hashing a multi-GB image takes too long for the event loop, it
+   is done in scan_pool like Verify. done gets the exit status of
+   update_verify_child(). */
+static void
+update_verify_submit(struct update *u, process_done_t done)
+{
+  int r;
+
+  request_progress(u->req, u, "verifying");
+
+  r = process_pool_submit_func(scan_pool, &u->req->batch,
+			       u->new->deps->image_name,
+			       update_verify_child, u, done, u);
+  if (r < 0)
+    {
+      log_msg(LOG_WARNING, "Failed to verify '%s': %s",
+	      u->new->deps->image_name, strerror(-r));
+      process_pool_complete(scan_pool, &u->req->batch, EXIT_FAILURE, done, u);
+    }
+}
+
+static bool
+update_from_peer(const struct update *u)
+{
+  return u->source < strv_length(config.peers);
+}
+
+static const char *
+update_source_url(const struct update *u)
+{
+  if (update_from_peer(u))
+    return config.peers[u->source];
+
+  return u->urls[u->source - strv_length(config.peers)];
+}
+
+/* The catalog took the image from its repository, it gets
+   downloaded from there or the mirrors of it */
+static int
+update_set_urls(struct update *u)
+{
+  const char *url = u->new->repository;
+
+  if (url == NULL)
+    url = u->req->repositories[0];
+
+  return mirror_list(url, &u->urls);
+}
+
+/* for messages about the download */
+static const char *
+update_repository(const struct update *u)
+{
+  if (u->new->repository)
+    return u->new->repository;
+
+  return request_repositories(u->req);
+}
+
+/* first mirror after the peers */
+static void
+update_reset_source(struct update *u)
+{
+  u->source = strv_length(config.peers);
+}
+
+static uint64_t
+update_now(const struct update *u)
+{
+  uint64_t t = 0;
+
+  (void) sd_event_now(sd_varlink_get_event(u->req->link), CLOCK_MONOTONIC, &t);
+
+  return t;
+}
+
+/* Peers are tried first, they serve the images of their store
+   without SHA256SUMS. Their images get verified against the sum
+   of the repository, so they are only used if the sum is known.
+   After them the mirrors of the repository are tried. */
+static int
+update_download_submit(struct update *u)
+{
+  if (!store_valid_sha256(u->new->sha256) && update_from_peer(u))
+    update_reset_source(u);
+
+  u->started = update_now(u);
+
+  if (update_from_peer(u))
+    {
+      log_msg(LOG_DEBUG, "Trying '%s' from peer '%s'",
+	      u->new->deps->image_name, config.peers[u->source]);
+      return download_submit(helper_pool, &u->req->batch,
+			     config.peers[u->source],
+			     u->new->deps->image_name, u->tmpfn,
+			     false, download_finished, u);
+    }
+
+  /* the signature of SHA256SUMS is already verified, an image with
+     a sum is checked against it in download_finished() */
+  return download_submit(helper_pool, &u->req->batch, update_source_url(u),
+			 u->new->deps->image_name, u->tmpfn,
+			 config.verify_signature && !store_valid_sha256(u->new->sha256),
+			 download_finished, u);
+}
+
+/* The peer or mirror does not have the image or sent something
+   else, try the next source */
+static void
+download_next_source(struct update *u)
+{
+  int r;
+
+  u->source++;
+
+  if (u->fd >= 0 && ftruncate(u->fd, 0) < 0)
+    log_msg(LOG_WARNING, "Failed to truncate '%s': %m", u->tmpfn);
+
+  r = update_download_submit(u);
+  if (r < 0)
+    update_finish(u, r);
+}
+
+/* The image is maybe in the store since another request downloaded
+   it, or the same content is in the store under another name. Then
+   no download is needed. Returns 1 in this case. */
+static int
+update_reuse_object(struct update *u)
+{
+  int r;
+
+  if (access(u->fn, F_OK) == 0)
+    {
+      u->new->local = true;
+      return 1;
+    }
+
+  r = store_reuse_object(config.sysext_store_dir, u->new->sha256, u->fn);
+  if (r < 0)
+    log_msg(LOG_WARNING, "Failed to link '%s' from the store: %s",
+	    u->fn, strerror(-r));
+  else if (r > 0)
+    {
+      log_msg(LOG_INFO, "Content of '%s' is already in the store",
+	      u->new->deps->image_name);
+      u->new->local = true;
+      request_progress(u->req, u, "reused");
+    }
+
+  return r;
+}
+
+/* make a completely downloaded image available for other names
+   with the same content */
+static void
+update_add_object(const struct update *u)
+{
+  int r;
+
+  if (!store_valid_sha256(u->new->sha256))
+    return;
+
+  r = store_add_object(config.sysext_store_dir, u->fn, u->new->sha256);
+  if (r < 0)
+    log_msg(LOG_WARNING, "Failed to add '%s' to the store index: %s",
+	    u->fn, strerror(-r));
+}
+
+/* Downloads of all requests which are not finished yet. A request
+   for an image which is already downloaded for another request
+   waits for this download instead of starting its own. */
+static struct update *inflight = NULL;
+
+static void
+inflight_remove(struct update *u)
+{
+  for (struct update **p = &inflight; *p; p = &(*p)->next_inflight)
+    if (*p == u)
+      {
+	*p = u->next_inflight;
+	u->next_inflight = NULL;
+	return;
+      }
+}
+
+/* Either wait for a running download of the same image, or become
+   the download others wait for. Returns true if u waits. The batch
+   of the request must be started. */
+static bool
+update_join_download(struct update *u)
+{
+  struct update *owner;
+
+  u->fetch = true;
+
+  for (owner = inflight; owner; owner = owner->next_inflight)
+    if (streq(owner->fn, u->fn))
+      break;
+
+  if (owner == NULL)
+    {
+      u->next_inflight = inflight;
+      inflight = u;
+      return false;
+    }
+
+  log_msg(LOG_INFO, "Waiting for running download of '%s'",
+	  u->new->deps->image_name);
+  u->tmpfn = mfree(u->tmpfn);
+  unlink_and_free_tempfilep(&u->deltafn);
+  u->base = mfree(u->base);
+  u->next_waiter = owner->waiters;
+  owner->waiters = u;
+  process_batch_hold(&u->req->batch);
+  request_progress(u->req, u, "waiting");
+
+  return true;
+}
+
+/* Move the verified download into the store */
+static int
+update_commit_download(struct update *u)
+{
+  _cleanup_close_ int lock = -EBADF;
+
+  update_reopen(u);
+  if (u->fd >= 0)
+    {
+      int r = store_flush_file(u->fd, config.drop_page_cache);
+
+      if (r < 0)
+	log_msg(LOG_WARNING, "Failed to write back '%s': %s", u->tmpfn,
+		strerror(-r));
+    }
+
+  lock = store_lock(config.sysext_store_dir, true);
+  if (lock < 0)
+    {
+      log_msg(LOG_ERR, "Failed to lock '%s': %s",
+	      config.sysext_store_dir, strerror(-lock));
+      return lock;
+    }
+
+  if (rename(u->tmpfn, u->fn) < 0)
+    {
+      int r = -errno;
+
+      log_msg(LOG_ERR, "Error to rename '%s' to '%s': %m", u->tmpfn, u->fn);
+      return r;
+    }
+  u->tmpfn = mfree(u->tmpfn);
+  update_add_object(u);
+
+  return 0;
+}
+
+/* The download of u is done, successful or not. A complete image
+   gets moved into the store right away, so that requests waiting
+   for it and later ones find it there. */
+static void
+update_finish(struct update *u, int status)
+{
+  struct update *w;
+
+  u->finished = true;
+  if (status == 0)
+    {
+      request_progress(u->req, u, "downloaded");
+      status = update_commit_download(u);
+    }
+  u->status = status;
+  inflight_remove(u);
+
+  while ((w = u->waiters))
+    {
+      u->waiters = w->next_waiter;
+      w->next_waiter = NULL;
+      w->status = status;
+      w->finished = true;
+      if (status == 0)
+	{
+	  w->new->local = true;
+	  request_progress(w->req, w, "downloaded");
+	}
+      /* can finish and free the request of w */
+      process_batch_release(&w->req->batch);
+    }
+}
+
+static int
+download_retry(sd_event_source _unused_(*s), uint64_t _unused_(usec),
+	       void *userdata)
+{
+  struct update *u = userdata;
+  int r;
+
+  u->retry = sd_event_source_disable_unref(u->retry);
+
+  /* systemd-pull cannot resume, every attempt starts at byte 0 */
+  if (u->fd >= 0 && ftruncate(u->fd, 0) < 0)
+    log_msg(LOG_WARNING, "Failed to truncate '%s': %m", u->tmpfn);
+
+  r = update_download_submit(u);
+  if (r < 0)
+    update_finish(u, r);
+
+  process_batch_release(&u->req->batch);
+
+  return 0;
+}
+
+/* Retry a failed systemd-pull after a delay. The batch stays
+   pending until the timer fired. Returns false if there are no
+   attempts left. */
+static bool
+download_schedule_retry(struct update *u)
+{
+  uint64_t delay;
+  int r;
+
+  if (u->attempts >= config.download_retries)
+    return false;
+
+  delay = DOWNLOAD_RETRY_USEC << (u->attempts < 6 ? u->attempts : 6);
+  u->attempts++;
+  /* all sources failed, start again with the best mirror */
+  update_reset_source(u);
+
+  r = sd_event_add_time_relative(sd_varlink_get_event(u->req->link), &u->retry,
+				 CLOCK_MONOTONIC, delay, 0,
+				 download_retry, u);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Failed to create retry timer: %s", strerror(-r));
+      return false;
+    }
+
+  log_msg(LOG_NOTICE, "Download of '%s' failed (%i), retrying in %" PRIu64 "s (%u/%u)",
+	  u->new->deps->image_name, u->status, delay / USEC_PER_SEC,
+	  u->attempts, config.download_retries);
+  request_progress(u->req, u, "retrying");
+  process_batch_hold(&u->req->batch);
+
+  return true;
+}
+
+/* every attempt counts, failed ones only with their time */
+static void
+update_record_download(const struct update *u, const char *fn, bool ok)
+{
+  struct stat st;
+
+  metrics_record(METRIC_DOWNLOAD, u->started, !ok);
+  if (ok && stat(fn, &st) == 0)
+    metrics_count(METRIC_DOWNLOAD_BYTES, st.st_size);
+}
+
+/* The download of u is done with status, match is false if the
+   image does not match its sum */
+static int
+download_checked(struct update *u, int status, bool match)
+{
+  if (update_from_peer(u))
+    {
+      bool ok = status == 0 && match;
+
+      update_record_download(u, u->tmpfn, ok);
+      if (!ok)
+	{
+	  log_msg(LOG_INFO, "Fetching '%s' from peer '%s' failed (%i)",
+		  u->new->deps->image_name, config.peers[u->source], status);
+	  download_next_source(u);
+	  return 0;
+	}
+      log_msg(LOG_INFO, "Fetched '%s' from peer '%s'",
+	      u->new->deps->image_name, config.peers[u->source]);
+    }
+  else
+    {
+      const char *url = update_source_url(u);
+      struct stat st;
+
+      if (status == 0 && !match)
+	{
+	  log_msg(LOG_ERR, "'%s' from '%s' does not match SHA256SUMS",
+		  u->new->deps->image_name, url);
+	  /* handled like a failed download */
+	  status = EXIT_FAILURE;
+	}
+      update_record_download(u, u->tmpfn, status == 0);
+
+      /* the time of the download, without the verification */
+      if (status == 0 && stat(u->tmpfn, &st) == 0)
+	mirror_report_download(url, st.st_size, u->fetched - u->started);
+    }
+
+  if (status > 0 && !update_from_peer(u))
+    {
+      const char *url = update_source_url(u);
+
+      mirror_report_failure(url);
+      if (u->urls[u->source - strv_length(config.peers) + 1])
+	{
+	  log_msg(LOG_NOTICE, "Download of '%s' from '%s' failed (%i), trying next mirror",
+		  u->new->deps->image_name, url, status);
+	  download_next_source(u);
+	  return 0;
+	}
+    }
+
+  u->status = status;
+
+  /* a negative status means systemd-pull could not be started,
+     trying again would not help */
+  if (status > 0 && download_schedule_retry(u))
+    return 0;
+
+  update_finish(u, status);
+
+  return 0;
+}
+
+/* process_done_t of update_verify_child() for downloads */
+static int
+download_verified(int status, void *userdata)
+{
+  return download_checked(userdata, 0, status == 0);
+}
+
+/* process_done_t of image downloads. Images from peers are always
+   verified, from mirrors if their sum is known. */
+static int
+download_finished(int status, void *userdata)
+{
+  struct update *u = userdata;
+
+  u->fetched = update_now(u);
+
+  if (status == 0 &&
+      (update_from_peer(u) || store_valid_sha256(u->new->sha256)))
+    {
+      update_verify_submit(u, download_verified);
+      return 0;
+    }
+
+  return download_checked(u, status, true);
+}
+
+/* The delta could not be used, download the full image instead */
+static void
+delta_fallback(struct update *u)
+{
+  int r;
+
+  u->base = mfree(u->base);
+  unlink_and_free_tempfilep(&u->deltafn);
+
+  if (u->fd >= 0 && ftruncate(u->fd, 0) < 0)
+    log_msg(LOG_WARNING, "Failed to truncate '%s': %m", u->tmpfn);
+
+  r = update_download_submit(u);
+  if (r < 0)
+    update_finish(u, r);
+}
+
+/* process_done_t of update_verify_child() for images created from
+   a delta */
+static int
+delta_verified(int status, void *userdata)
+{
+  struct update *u = userdata;
+
+  if (status != 0)
+    {
+      log_msg(LOG_WARNING, "Image '%s' created from delta does not match SHA256SUMS, downloading full image",
+	      u->new->deps->image_name);
+      delta_fallback(u);
+      return 0;
+    }
+
+  log_msg(LOG_INFO, "Created '%s' from '%s' and delta",
+	  u->new->deps->image_name, u->base);
+  unlink_and_free_tempfilep(&u->deltafn);
+
+  update_finish(u, 0);
+
+  return 0;
+}
+
+/* process_done_t of bspatch */
+static int
+delta_applied(int status, void *userdata)
+{
+  struct update *u = userdata;
+
+  if (status != 0)
+    {
+      log_msg(LOG_WARNING, "Applying delta for '%s' failed (%i), downloading full image",
+	      u->new->deps->image_name, status);
+      delta_fallback(u);
+      return 0;
+    }
+
+  /* the result must be the same as the published image */
+  update_verify_submit(u, delta_verified);
+
+  return 0;
+}
+
+/* process_done_t of the delta download */
+static int
+delta_downloaded(int status, void *userdata)
+{
+  struct update *u = userdata;
+  int r;
+
+  update_record_download(u, u->deltafn, status == 0);
+
+  if (status != 0)
+    {
+      log_msg(LOG_WARNING, "Download of delta for '%s' failed (%i), downloading full image",
+	      u->new->deps->image_name, status);
+      delta_fallback(u);
+      return 0;
+    }
+
+  request_progress(u->req, u, "patching");
+
+  r = delta_submit(helper_pool, &u->req->batch, u->base, u->deltafn,
+		   u->tmpfn, delta_applied, u);
+  if (r < 0)
+    delta_fallback(u);
+
+  return 0;
+}
+
+/* Use a delta from the installed image old to the new one, if the
+   repository has one and the old image is still in the store. Only
+   possible if the sum of the new image is known to verify the
+   result. */
+static void
+update_prepare_delta(struct update *u, const struct image_entry *old)
+{
+  struct stat st;
+  int fd;
+
+  if (!strv_contains(u->new->deltas, old->deps->image_name) ||
+      !store_valid_sha256(u->new->sha256) || !delta_supported())
+    return;
+
+  if (join_path(config.sysext_store_dir, old->deps->image_name, &u->base) < 0)
+    return;
+  if (stat(u->base, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+      u->base = mfree(u->base);
+      return;
+    }
+
+  if (asprintf(&u->deltafn, "%s/.%s"DELTA_SUFFIX".XXXXXX", config.sysext_store_dir,
+	       u->new->deps->image_name) < 0)
+    {
+      u->deltafn = NULL;
+      u->base = mfree(u->base);
+      return;
+    }
+  fd = mkostemp_safe(u->deltafn);
+  if (fd < 0)
+    {
+      u->deltafn = mfree(u->deltafn);
+      u->base = mfree(u->base);
+      return;
+    }
+  close(fd);
+}
+
+static int
+update_delta_download_submit(struct update *u)
+{
+  _cleanup_free_ char *fn = NULL;
+
+  if (asprintf(&fn, "%s"DELTA_FROM"%s"DELTA_SUFFIX,
+	       u->new->deps->image_name, u->old) < 0)
+    return -ENOMEM;
+
+  log_msg(LOG_INFO, "Downloading delta '%s'", fn);
+  u->started = update_now(u);
+
+  /* the image created from it gets verified */
+  return download_submit(helper_pool, &u->req->batch, u->urls[0],
+			 fn, u->deltafn, false, delta_downloaded, u);
+}
+
+/* Entries of a reply array. The entries get collected and the array
+   gets created once at the end, sd_json_variant_append_arraybo()
+   would copy the whole array for every entry. */
+struct reply_array {
+  sd_json_variant **v;
+  size_t n;
+  size_t max;
+};
+
+static void
+reply_array_done(struct reply_array *a)
+{
+  /* also frees a->v */
+  sd_json_variant_unref_many(a->v, a->n);
+  a->v = NULL;
+  a->n = a->max = 0;
+}
+
+static int
+reply_array_init(struct reply_array *a, size_t max)
+{
+  a->v = calloc(max > 0 ? max : 1, sizeof(sd_json_variant *));
+  if (a->v == NULL)
+    return -ENOMEM;
+  a->n = 0;
+  a->max = max;
+
+  return 0;
+}
+
+static int
+reply_array_take(struct reply_array *a, int r)
+{
+  if (r < 0)
+    return r;
+
+  a->n++;
+
+  return 0;
+}
+
+#define reply_array_appendbo(a, ...)					\
+  reply_array_take(a, (a)->n < (a)->max ?				\
+		   sd_json_buildo(&(a)->v[(a)->n], __VA_ARGS__) : -ENOBUFS)
+
+/* NULL without entries, like the replies always had */
+static int
+reply_array_finish(struct reply_array *a, sd_json_variant **res)
+{
+  int r = 0;
+
+  *res = NULL;
+  if (a->n > 0)
+    r = sd_json_variant_new_array(res, a->v, a->n);
+  reply_array_done(a);
+
+  return r;
+}
+
+static bool
+list_images_match(const struct request *req, const struct image_entry *e,
+		  bool installed)
+{
+  if (!strv_isempty(req->p.names) && !strv_contains(req->p.names, e->name))
+    return false;
+  if (req->p.only_installed && !installed)
+    return false;
+  if (req->p.only_compatible && !e->compatible)
+    return false;
+
+  return true;
+}
+
+static void
+list_images_catalog_done(int r, struct catalog *catalog, void *userdata)
+{
+  _cleanup_(free_requestp) struct request *req = userdata;
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *array = NULL;
+  _cleanup_(reply_array_done) struct reply_array reply = {};
+  char **list_etc = NULL;
+  struct image_entry **images;
+  uint64_t total = 0;
+  size_t max;
+
+  if (r < 0)
+    {
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Loading image data failed: %s", strerror(-r));
+      return;
+    }
+
+  req->catalog = catalog;
+
+  if (catalog->n_images == 0)
+    {
+      log_msg(LOG_INFO, "No images found");
+      (void) sd_varlink_replybo(req->link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
+				SD_JSON_BUILD_PAIR_VARIANT("Images", array),
+				SD_JSON_BUILD_PAIR_UNSIGNED("Total", 0));
+      return;
+    }
+
+  r = get_installed_images(&list_etc);
+  if (r < 0)
+    {
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Searching for images in '%s' failed: %s",
+		   config.extensions_dir, strerror(-r));
+      return;
+    }
+
+  max = catalog->n_images;
+  if (req->p.limit > 0 && req->p.limit < max)
+    max = req->p.limit;
+  r = reply_array_init(&reply, max);
+  if (r < 0)
+    {
+      request_fail_errno(TAKE_PTR(req), r);
+      return;
+    }
+
+  /* the catalog contains every image only once and is sorted */
+  images = catalog->images;
+
+  for (size_t i = 0; images[i] != NULL; i++)
+    {
+      /* the catalog can be shared with other requests, so don't
+	 store the state in it */
+      bool installed = images[i]->installed ||
+	strv_contains(list_etc, images[i]->deps->image_name);
+
+      if (!list_images_match(req, images[i], installed))
+	continue;
+
+      /* count all matches, so that the client knows the number of pages */
+      if (total++ < req->p.offset || reply.n >= reply.max)
+	continue;
+
+      r = reply_array_appendbo(&reply,
+			       SD_JSON_BUILD_PAIR_STRING("NAME", images[i]->name),
+			       SD_JSON_BUILD_PAIR_STRING("IMAGE_NAME", images[i]->deps->image_name),
+			       SD_JSON_BUILD_PAIR_STRING("SYSEXT_VERSION_ID", images[i]->deps->sysext_version_id),
+			       SD_JSON_BUILD_PAIR_STRING("SYSEXT_SCOPE", images[i]->deps->sysext_scope),
+			       SD_JSON_BUILD_PAIR_STRING("ID", images[i]->deps->id),
+			       SD_JSON_BUILD_PAIR_STRING("SYSEXT_LEVEL", images[i]->deps->sysext_level),
+			       SD_JSON_BUILD_PAIR_STRING("VERSION_ID", images[i]->deps->version_id),
+			       SD_JSON_BUILD_PAIR_STRING("ARCHITECTURE", images[i]->deps->architecture),
+			       SD_JSON_BUILD_PAIR_BOOLEAN("LOCAL", images[i]->local),
+			       SD_JSON_BUILD_PAIR_BOOLEAN("REMOTE", images[i]->remote),
+			       SD_JSON_BUILD_PAIR_STRING("REPOSITORY", images[i]->repository),
+			       SD_JSON_BUILD_PAIR_BOOLEAN("INSTALLED", installed),
+			       SD_JSON_BUILD_PAIR_BOOLEAN("COMPATIBLE", images[i]->compatible));
+      if (r < 0)
+	{
+	  request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		       "Building the list of images failed: %s", strerror(-r));
+	  return;
+	}
+    }
+
+  r = reply_array_finish(&reply, &array);
+  if (r < 0)
+    {
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Building the list of images failed: %s", strerror(-r));
+      return;
+    }
+
+  (void) sd_varlink_replybo(req->link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
+			    SD_JSON_BUILD_PAIR_VARIANT("Images", array),
+			    SD_JSON_BUILD_PAIR_UNSIGNED("Total", total));
+}
+
+static int
+vl_method_list_images(sd_varlink *link, sd_json_variant *parameters,
+		      sd_varlink_method_flags_t flags,
+		      void _unused_(*userdata))
+{
+  static const sd_json_dispatch_field dispatch_table[] = {
+    { "URL",            SD_JSON_VARIANT_STRING,        sd_json_dispatch_string,  offsetof(struct parameters, url), 0},
+    { "Verbose",        SD_JSON_VARIANT_BOOLEAN,       sd_json_dispatch_stdbool, offsetof(struct parameters, verbose), 0},
+    { "Names",          SD_JSON_VARIANT_ARRAY,         sd_json_dispatch_strv,    offsetof(struct parameters, names), 0},
+    { "OnlyInstalled",  SD_JSON_VARIANT_BOOLEAN,       sd_json_dispatch_stdbool, offsetof(struct parameters, only_installed), 0},
+    { "OnlyCompatible", SD_JSON_VARIANT_BOOLEAN,       sd_json_dispatch_stdbool, offsetof(struct parameters, only_compatible), 0},
+    { "Offset",         SD_JSON_VARIANT_UNSIGNED,      sd_json_dispatch_uint64,  offsetof(struct parameters, offset), 0},
+    { "Limit",          SD_JSON_VARIANT_UNSIGNED,      sd_json_dispatch_uint64,  offsetof(struct parameters, limit), 0},
+    {}
+  };
+  _cleanup_(free_requestp) struct request *req = NULL;
+  int r;
+
+  log_msg(LOG_INFO, "Varlink method \"ListImages\" called...");
+
+  r = new_request(link, flags, &req);
+  if (r < 0)
+    return r;
+
+  r = sd_varlink_dispatch(link, parameters, dispatch_table, &req->p);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "List image request: varlink dispatch failed: %s", strerror(-r));
+      return r;
+    }
+
+  /* Only allow URL or verbose argument if called by root */
+  if (req->p.url || req->p.verbose != config.verbose)
+    {
+      uid_t peer_uid;
+      r = sd_varlink_get_peer_uid(link, &peer_uid);
+      if (r < 0)
+	{
+	  log_msg(LOG_ERR, "Failed to get peer UID: %s", strerror(-r));
+	  return r;
+	}
+      if (peer_uid != 0)
+	{
+	  log_msg(LOG_WARNING, "ListImages: peer UID %i denied with additional options", peer_uid);
+	  return sd_varlink_error(link, SD_VARLINK_ERROR_PERMISSION_DENIED, parameters);
+	}
+    }
+
+  r = request_get_os_release(req);
+  if (r < 0)
+    {
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Couldn't read os-release file: %s", strerror(-r));
+      return 0;
+    }
+
+  r = request_set_url(req);
+  if (r < 0)
+    {
+      request_fail_errno(TAKE_PTR(req), r);
+      return 0;
+    }
+
+  /* remote and local available images, with Names only the
+     metadata of these images gets fetched */
+  load_catalog_async(helper_pool, scan_pool, req->repositories,
+		     config.sysext_store_dir,
+		     strv_isempty(req->p.names) ? NULL : req->p.names, false,
+		     config.verify_signature, req->host, req->p.verbose,
+		     list_images_catalog_done, req);
+  TAKE_PTR(req);
+
+  return 0;
+}
+
+static void
+check_catalog_done(int r, struct catalog *catalog, void *userdata)
+{
+  _cleanup_(free_requestp) struct request *req = userdata;
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *array = NULL;
+  _cleanup_(reply_array_done) struct reply_array reply = {};
+
+  if (r < 0)
+    {
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Loading image data failed: %s", strerror(-r));
+      return;
+    }
+
+  req->catalog = catalog;
+
+  r = reply_array_init(&reply, req->n_etc);
+  if (r < 0)
+    {
+      request_fail_errno(TAKE_PTR(req), r);
+      return;
+    }
+
+  for (size_t n = 0; n < req->n_etc; n++)
+    {
+      _cleanup_(free_image_entryp) struct image_entry *update = NULL;
+      struct image_entry *curr = req->images_etc[n];
+
+      r = get_latest_version(req->catalog, curr, &update);
+      if (update)
+        {
+	  log_msg(LOG_NOTICE, "Update available: %s -> %s", curr->deps->image_name, update->deps->image_name);
+
+	  r = reply_array_appendbo(&reply,
+				   SD_JSON_BUILD_PAIR_STRING("OldName", curr->deps->image_name),
+				   SD_JSON_BUILD_PAIR_STRING("NewName", update->deps->image_name));
+        }
+      else /* No update found */
+	r = reply_array_appendbo(&reply,
+				 SD_JSON_BUILD_PAIR_STRING("OldName", curr->deps->image_name),
+				 SD_JSON_BUILD_PAIR_STRING("NewName", NULL));
+      if (r < 0)
+	{
+	  request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		       "Building the list of updates failed: %s", strerror(-r));
+	  return;
+	}
+    }
+
+  r = reply_array_finish(&reply, &array);
+  if (r < 0)
+    {
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Building the list of updates failed: %s", strerror(-r));
+      return;
+    }
+
+  (void) sd_varlink_replybo(req->link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
+			    SD_JSON_BUILD_PAIR_VARIANT("Images", array));
+}
+
+static void
+check_installed_done(int r, struct image_entry **images, size_t n, void *userdata)
+{
+  struct request *req = userdata;
+
+  if (r < 0)
+    {
+      request_fail(req, "org.openSUSE.sysextmgr.InternalError",
+		   "Searching for images in '%s' failed: %s",
+		   config.extensions_dir, strerror(-r));
+      return;
+    }
+
+  req->images_etc = images;
+  req->n_etc = n;
+
+  if (req->n_etc == 0)
+    {
+      log_msg(LOG_NOTICE, "No installed images found.");
+      /* XXX provide error message to client */
+      (void) sd_varlink_replybo(req->link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
+				SD_JSON_BUILD_PAIR_VARIANT("Images", NULL));
+      free_request(req);
+      return;
+    }
+
+  /* fetch remote and local image data only once for all installed
+     images, only the newest compatible versions are needed */
+  load_catalog_async(helper_pool, scan_pool, req->repositories,
+		     config.sysext_store_dir, NULL, true,
+		     config.verify_signature, req->host, req->p.verbose,
+		     check_catalog_done, req);
+}
+
+static int
+vl_method_check(sd_varlink *link, sd_json_variant *parameters,
+		sd_varlink_method_flags_t flags,
+		void _unused_(*userdata))
+{
+  static const sd_json_dispatch_field dispatch_table[] = {
+    { "URL",     SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct parameters, url), 0},
+    { "Verbose", SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool, offsetof(struct parameters, verbose), 0},
+    {}
+  };
+  _cleanup_(free_requestp) struct request *req = NULL;
+  int r;
+
+  log_msg(LOG_INFO, "Varlink method \"Check\" called...");
+
+  r = new_request(link, flags, &req);
+  if (r < 0)
+    return r;
+
+  r = sd_varlink_dispatch(link, parameters, dispatch_table, &req->p);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Check request: varlink dispatch failed: %s", strerror(-r));
+      return r;
+    }
+
+  /* Only allow URL or verbose argument if called by root */
+  if (req->p.url || req->p.verbose != config.verbose)
+    {
+      uid_t peer_uid;
+      r = sd_varlink_get_peer_uid(link, &peer_uid);
+      if (r < 0)
+        {
+          log_msg(LOG_ERR, "Failed to get peer UID: %s", strerror(-r));
+          return r;
+        }
+      if (peer_uid != 0)
+        {
+	  if (req->p.url)
+	    {
+	      log_msg(LOG_WARNING, "Check: peer UID %i denied with additional options", peer_uid);
+	      return sd_varlink_error(link, SD_VARLINK_ERROR_PERMISSION_DENIED, parameters);
+	    }
+	  /* Ignore changed verbose flag, only root is allowed to set that */
+	  req->p.verbose = config.verbose;
+        }
+    }
+
+  r = request_set_url(req);
+  if (r < 0)
+    {
+      request_fail_errno(TAKE_PTR(req), r);
+      return 0;
+    }
+
+  r = request_get_os_release(req);
+  if (r < 0)
+    {
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Couldn't read os-release file: %s", strerror(-r));
+      return 0;
+    }
+
+  /* list of "installed" images visible to systemd-sysext */
+  image_local_metadata_async(scan_pool, config.extensions_dir, NULL,
+			     req->host, req->p.verbose,
+			     check_installed_done, req);
+  TAKE_PTR(req);
+
+  return 0;
+}
+
+/* Plan: the updates for other systems, e.g. snapshots or the next
+   release, from the catalog of the running one. The catalog does
+   not depend on the host, only the compatibility of its images. */
+struct plan_target {
+  char *root;
+  char *os_release;
+};
+
+static void
+plan_target_free(struct plan_target *var)
+{
+  var->root = mfree(var->root);
+  var->os_release = mfree(var->os_release);
+}
+
+/* installed images of the target, the ones of the host if it has no root */
+static int
+plan_installed_images(const struct plan_target *t, char ***res)
+{
+  _cleanup_free_ char *path = NULL;
+  char **list = NULL;
+  int r;
+
+  if (t->root == NULL)
+    {
+      r = get_installed_images(&list);
+      if (r < 0)
+	return r;
+      *res = strv_copy(list);
+      if (list && *res == NULL)
+	return -ENOMEM;
+      return 0;
+    }
+
+  if (asprintf(&path, "%s/%s", t->root, config.extensions_dir) < 0)
+    return -ENOMEM;
+
+  r = discover_images(path, res);
+  if (r == -ENOENT)
+    {
+      *res = NULL;
+      return 0;
+    }
+
+  return r;
+}
+
+static int
+plan_target_updates(const struct catalog *catalog, struct host_profile *host,
+		    char **installed, sd_json_variant **res)
+{
+  _cleanup_(reply_array_done) struct reply_array reply = {};
+  int r;
+
+  r = reply_array_init(&reply, strv_length(installed));
+  if (r < 0)
+    return r;
+
+  STRV_FOREACH(name, installed)
+    {
+      _cleanup_(free_image_entryp) struct image_entry *update = NULL;
+      const struct image_entry *curr = catalog_find_image(catalog, *name);
+
+      /* not in the store: nothing known about the version */
+      if (curr)
+	{
+	  r = get_latest_version_for_host(catalog, curr, host, &update);
+	  if (r < 0)
+	    return r;
+	}
+
+      r = reply_array_appendbo(&reply,
+			       SD_JSON_BUILD_PAIR_STRING("OldImage", *name),
+			       SD_JSON_BUILD_PAIR_STRING("NewImage", update ? update->deps->image_name : NULL));
+      if (r < 0)
+	return r;
+    }
+
+  return reply_array_finish(&reply, res);
+}
+
+/* step describes what failed */
+static int
+plan_target_images(const struct catalog *catalog, const struct plan_target *t,
+		   sd_json_variant **res, const char **step)
+{
+  _cleanup_(free_host_profilep) struct host_profile *host = NULL;
+  _cleanup_strv_free_ char **installed = NULL;
+  struct osrelease *osrelease = NULL;
+  int r;
+
+  *step = "Either Root or OsRelease is required";
+  if ((t->root == NULL) == (t->os_release == NULL))
+    return -EINVAL;
+
+  *step = "Couldn't read os-release";
+  if (t->root)
+    r = load_os_release(t->root, &osrelease);
+  else
+    r = parse_os_release(t->os_release, &osrelease);
+  if (r < 0)
+    {
+      free_os_releasep(&osrelease);
+      return r;
+    }
+
+  *step = "Couldn't create host profile";
+  r = host_profile_new(osrelease, &host);
+  if (r < 0)
+    return r;
+
+  *step = "Searching for installed images failed";
+  r = plan_installed_images(t, &installed);
+  if (r < 0)
+    return r;
+
+  *step = "Building the list of updates failed";
+  return plan_target_updates(catalog, host, installed, res);
+}
+
+static int
+plan_target(const struct catalog *catalog, sd_json_variant *target,
+	    size_t index, sd_json_variant **res)
+{
+  static const sd_json_dispatch_field dispatch_table[] = {
+    { "Root",      SD_JSON_VARIANT_STRING, sd_json_dispatch_string, offsetof(struct plan_target, root), 0},
+    { "OsRelease", SD_JSON_VARIANT_STRING, sd_json_dispatch_string, offsetof(struct plan_target, os_release), 0},
+    {}
+  };
+  _cleanup_(plan_target_free) struct plan_target t = {};
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *images = NULL;
+  _cleanup_free_ char *error = NULL;
+  const char *step = NULL;
+  int r;
+
+  r = sd_json_dispatch(target, dispatch_table, SD_JSON_ALLOW_EXTENSIONS, &t);
+  if (r < 0)
+    return r;
+
+  /* a broken target does not spoil the plans of the others */
+  r = plan_target_images(catalog, &t, &images, &step);
+  if (r < 0)
+    {
+      if (asprintf(&error, "%s: %s", step, strerror(-r)) < 0)
+	return -ENOMEM;
+      log_msg(LOG_WARNING, "Plan for target %zu: %s", index, error);
+    }
+
+  return sd_json_buildo(res,
+			SD_JSON_BUILD_PAIR_UNSIGNED("Index", index),
+			SD_JSON_BUILD_PAIR_STRING("Root", t.root),
+			SD_JSON_BUILD_PAIR_VARIANT("Images", images),
+			SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error));
+}
+
+static void
+plan_catalog_done(int r, struct catalog *catalog, void *userdata)
+{
+  _cleanup_(free_requestp) struct request *req = userdata;
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *array = NULL;
+  _cleanup_(reply_array_done) struct reply_array reply = {};
+  size_t n = sd_json_variant_elements(req->p.targets);
+
+  if (r < 0)
+    {
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Loading image data failed: %s", strerror(-r));
+      return;
+    }
+
+  req->catalog = catalog;
+
+  r = reply_array_init(&reply, n);
+  if (r < 0)
+    {
+      request_fail_errno(TAKE_PTR(req), r);
+      return;
+    }
+
+  for (size_t i = 0; i < n; i++)
+    {
+      r = reply_array_take(&reply, plan_target(req->catalog,
+					       sd_json_variant_by_index(req->p.targets, i),
+					       i, &reply.v[reply.n]));
+      if (r < 0)
+	{
+	  request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		       "Building the plans failed: %s", strerror(-r));
+	  return;
+	}
+    }
+
+  r = reply_array_finish(&reply, &array);
+  if (r < 0)
+    {
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Building the plans failed: %s", strerror(-r));
+      return;
+    }
+
+  (void) sd_varlink_replybo(req->link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
+			    SD_JSON_BUILD_PAIR_VARIANT("Plans", array));
+}
+
+static int
+vl_method_plan(sd_varlink *link, sd_json_variant *parameters,
+	       sd_varlink_method_flags_t flags,
+	       void _unused_(*userdata))
+{
+  static const sd_json_dispatch_field dispatch_table[] = {
+    { "URL",     SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct parameters, url), 0},
+    { "Verbose", SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool, offsetof(struct parameters, verbose), 0},
+    { "Targets", SD_JSON_VARIANT_ARRAY,   sd_json_dispatch_variant, offsetof(struct parameters, targets), SD_JSON_MANDATORY},
+    {}
+  };
+  _cleanup_(free_requestp) struct request *req = NULL;
+  bool with_root = false;
+  int r;
+
+  log_msg(LOG_INFO, "Varlink method \"Plan\" called...");
+
+  r = new_request(link, flags, &req);
+  if (r < 0)
+    return r;
+
+  r = sd_varlink_dispatch(link, parameters, dispatch_table, &req->p);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Plan request: varlink dispatch failed: %s", strerror(-r));
+      return r;
+    }
+
+  for (size_t i = 0; i < sd_json_variant_elements(req->p.targets); i++)
+    if (sd_json_variant_by_key(sd_json_variant_by_index(req->p.targets, i), "Root"))
+      with_root = true;
+
+  /* reading other root directories requires root rights, too */
+  if (req->p.url || with_root || req->p.verbose != config.verbose)
+    {
+      uid_t peer_uid;
+      r = sd_varlink_get_peer_uid(link, &peer_uid);
+      if (r < 0)
+        {
+          log_msg(LOG_ERR, "Failed to get peer UID: %s", strerror(-r));
+          return r;
+        }
+      if (peer_uid != 0)
+        {
+	  if (req->p.url || with_root)
+	    {
+	      log_msg(LOG_WARNING, "Plan: peer UID %i denied with additional options", peer_uid);
+	      return sd_varlink_error(link, SD_VARLINK_ERROR_PERMISSION_DENIED, parameters);
+	    }
+	  req->p.verbose = config.verbose;
+        }
+    }
+
+  r = request_set_url(req);
+  if (r < 0)
+    {
+      request_fail_errno(TAKE_PTR(req), r);
+      return 0;
+    }
+
+  r = request_get_os_release(req);
+  if (r < 0)
+    {
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Couldn't read os-release file: %s", strerror(-r));
+      return 0;
+    }
+
+  /* the other systems need the metadata of all images, not only
+     of the newest ones compatible with the running system */
+  load_catalog_async(helper_pool, scan_pool, req->repositories,
+		     config.sysext_store_dir, NULL, false,
+		     config.verify_signature, req->host, req->p.verbose,
+		     plan_catalog_done, req);
+  TAKE_PTR(req);
+
+  return 0;
+}
+
+/* Background check for Watch subscribers. It does the same as Check
+   and sends the updates which were not found before as
+   "update-available" events. */
+struct announced_update {
+  char *old_image;
+  char *new_image;
+};
+
+static sd_event_source *refresh_timer = NULL;
+static bool refresh_running = false;
+static struct announced_update *announced = NULL;
+static size_t n_announced = 0;
+
+struct refresh {
+  struct shared_osrelease *os;
+  struct image_entry **images_etc;
+  size_t n_etc;
+};
+
+static void
+free_announced(struct announced_update *l, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    {
+      free(l[i].old_image);
+      free(l[i].new_image);
+    }
+  free(l);
+}
+
+static bool
+update_announced(const char *old_image, const char *new_image)
+{
+  for (size_t i = 0; i < n_announced; i++)
+    if (streq(announced[i].old_image, old_image) &&
+	streq(announced[i].new_image, new_image))
+      return true;
+
+  return false;
+}
+
+static int refresh_start(sd_event_source *s, uint64_t usec, void *userdata);
+
+/* run the background check in usec */
+static void
+refresh_arm(sd_event *event, uint64_t usec)
+{
+  int r;
+
+  if (config.watch_refresh_interval == 0)
+    return;
+
+  if (refresh_timer)
+    {
+      (void) sd_event_source_set_time_relative(refresh_timer, usec);
+      (void) sd_event_source_set_enabled(refresh_timer, SD_EVENT_ONESHOT);
+      return;
+    }
+
+  r = sd_event_add_time_relative(event, &refresh_timer, CLOCK_MONOTONIC,
+				 usec, USEC_PER_SEC, refresh_start, NULL);
+  if (r < 0)
+    log_msg(LOG_ERR, "Failed to add refresh timer: %s", strerror(-r));
+}
+
+#define REFRESH_INTERVAL_USEC ((uint64_t) config.watch_refresh_interval * USEC_PER_SEC)
+
+static void
+refresh_finish(struct refresh *rf)
+{
+  refresh_running = false;
+  rf->os = shared_osrelease_unref(rf->os);
+  free_image_entry_list(&rf->images_etc);
+  free(rf);
+
+  if (refresh_timer && subscriber_count() > 0)
+    refresh_arm(sd_event_source_get_event(refresh_timer), REFRESH_INTERVAL_USEC);
+}
+
+static void
+refresh_catalog_done(int r, struct catalog *catalog, void *userdata)
+{
+  struct refresh *rf = userdata;
+  struct announced_update *found;
+  size_t n_found = 0;
+
+  if (r < 0)
+    {
+      log_msg(LOG_WARNING, "Background check: loading image data failed: %s",
+	      strerror(-r));
+      refresh_finish(rf);
+      return;
+    }
+
+  found = calloc(rf->n_etc, sizeof(struct announced_update));
+  if (found == NULL)
+    {
+      log_msg(LOG_ERR, "Background check: %s", strerror(ENOMEM));
+      catalog_unref(catalog);
+      refresh_finish(rf);
+      return;
+    }
+
+  for (size_t i = 0; i < rf->n_etc; i++)
+    {
+      _cleanup_(free_image_entryp) struct image_entry *update = NULL;
+      const char *old_image = rf->images_etc[i]->deps->image_name;
+
+      if (get_latest_version(catalog, rf->images_etc[i], &update) < 0 ||
+	  update == NULL)
+	continue;
+
+      if (!update_announced(old_image, update->deps->image_name))
+	subscribers_notify("update-available", update->deps->image_name,
+			   old_image);
+
+      found[n_found].old_image = strdup(old_image);
+      found[n_found].new_image = strdup(update->deps->image_name);
+      n_found++;
+      if (found[n_found - 1].old_image == NULL ||
+	  found[n_found - 1].new_image == NULL)
+	break;
+    }
+
+  /* an update which disappears gets announced again if it comes back */
+  free_announced(announced, n_announced);
+  announced = found;
+  n_announced = n_found;
+
+  catalog_unref(catalog);
+  refresh_finish(rf);
+}
+
+static void
+refresh_installed_done(int r, struct image_entry **images, size_t n,
+		       void *userdata)
+{
+  struct refresh *rf = userdata;
+
+  if (r < 0)
+    {
+      log_msg(LOG_WARNING, "Background check: searching for images in '%s' failed: %s",
+	      config.extensions_dir, strerror(-r));
+      refresh_finish(rf);
+      return;
+    }
+
+  rf->images_etc = images;
+  rf->n_etc = n;
+
+  if (n == 0)
+    {
+      free_announced(announced, n_announced);
+      announced = NULL;
+      n_announced = 0;
+      refresh_finish(rf);
+      return;
+    }
+
+  load_catalog_async(helper_pool, scan_pool, config.repositories,
+		     config.sysext_store_dir, NULL, true,
+		     config.verify_signature, rf->os->host, false,
+		     refresh_catalog_done, rf);
+}
+
+static int
+refresh_start(sd_event_source *s, uint64_t _unused_(usec),
+	      void _unused_(*userdata))
+{
+  struct refresh *rf;
+  int r;
+
+  if (refresh_running || subscriber_count() == 0)
+    return 0;
+
+  /* a watch could be gone since the last request */
+  update_watches(sd_event_source_get_event(s));
+
+  rf = calloc(1, sizeof(struct refresh));
+  if (rf == NULL)
+    {
+      refresh_arm(sd_event_source_get_event(s), REFRESH_INTERVAL_USEC);
+      return 0;
+    }
+
+  r = get_os_release(&rf->os);
+  if (r < 0)
+    {
+      log_msg(LOG_WARNING, "Background check: couldn't read os-release file: %s",
+	      strerror(-r));
+      free(rf);
+      refresh_arm(sd_event_source_get_event(s), REFRESH_INTERVAL_USEC);
+      return 0;
+    }
+
+  refresh_running = true;
+  image_local_metadata_async(scan_pool, config.extensions_dir, NULL,
+			     rf->os->host, false, refresh_installed_done, rf);
+
+  return 0;
+}
+
+static void
+free_refresh(void)
+{
+  refresh_timer = sd_event_source_disable_unref(refresh_timer);
+  free_announced(announced, n_announced);
+  announced = NULL;
+  n_announced = 0;
+}
+
+static int
+vl_method_watch(sd_varlink *link, sd_json_variant *parameters,
+		sd_varlink_method_flags_t flags,
+		void _unused_(*userdata))
+{
+  sd_event *event = sd_varlink_get_event(link);
+  int r;
+
+  log_msg(LOG_INFO, "Varlink method \"Watch\" called...");
+
+  r = sd_varlink_dispatch(link, parameters, NULL, NULL);
+  if (r != 0)
+    return r;
+
+  if (!(flags & SD_VARLINK_METHOD_MORE))
+    return sd_varlink_error(link, SD_VARLINK_ERROR_EXPECTED_MORE, NULL);
+
+  r = subscriber_add(link);
+  if (r < 0)
+    return r;
+
+  update_watches(event);
+
+  r = subscriber_notify(link, "subscribed", NULL, NULL);
+  /* the updates found by the background check so far */
+  for (size_t i = 0; r >= 0 && i < n_announced; i++)
+    r = subscriber_notify(link, "update-available",
+			  announced[i].new_image, announced[i].old_image);
+  if (r < 0)
+    {
+      subscriber_remove(link);
+      return r;
+    }
+
+  /* the first subscriber starts the background check at once */
+  if (refresh_timer == NULL ||
+      (!refresh_running && sd_event_source_get_enabled(refresh_timer, NULL) == 0))
+    refresh_arm(event, 0);
+
+  return 0;
+}
+
+static void
+vl_disconnect(sd_varlink_server _unused_(*s), sd_varlink *link,
+	      void _unused_(*userdata))
+{
+  if (subscriber_remove(link) && subscriber_count() == 0 && refresh_timer)
+    (void) sd_event_source_set_enabled(refresh_timer, SD_EVENT_OFF);
+}
+
+#define SYSTEMD_SYSEXT_PATH "/usr/bin/systemd-sysext"
+
+/* Only one "systemd-sysext refresh" runs at a time, link changes
+   while it runs are merged into one more run afterwards */
+static bool sysext_refresh_running = false;
+static bool sysext_refresh_pending = false;
+
+static void sysext_refresh(void);
+
+static int
+sysext_refresh_done(int status, void _unused_(*userdata))
+{
+  sysext_refresh_running = false;
+
+  if (status != 0)
+    log_msg(LOG_ERR, "systemd-sysext refresh failed (%i)", status);
+
+  if (sysext_refresh_pending)
+    sysext_refresh();
+
+  return 0;
+}
+
+static void
+sysext_refresh(void)
+{
+  static const char *const argv[] = { SYSTEMD_SYSEXT_PATH, "refresh", NULL };
+  int r;
+
+  if (!config.sysext_refresh)
+    return;
+
+  if (sysext_refresh_running)
+    {
+      sysext_refresh_pending = true;
+      return;
+    }
+
+  sysext_refresh_pending = false;
+  sysext_refresh_running = true;
+  r = process_pool_submit(helper_pool, NULL, argv, -EBADF,
+			  sysext_refresh_done, NULL);
+  if (r < 0)
+    {
+      sysext_refresh_running = false;
+      log_msg(LOG_ERR, "Failed to start systemd-sysext refresh: %s", strerror(-r));
+    }
+}
+
+/* Switch the links of all images of the request in one transaction,
+   either all or none of them get changed. Returns the number of
+   changed links or a negative errno value. */
+static int
+request_switch_links(struct request *req, bool replace)
+{
+  _cleanup_free_ struct link_switch *l = NULL;
+  _cleanup_strv_free_ char **names = NULL;
+  _cleanup_close_ int lock = -EBADF;
+  uint64_t start;
+  size_t n = 0;
+  int r;
+
+  l = calloc(req->updates.n, sizeof(struct link_switch));
+  names = calloc(req->updates.n + 1, sizeof(char *));
+  if ((l == NULL && req->updates.n > 0) || names == NULL)
+    return -ENOMEM;
+
+  for (size_t i = 0; i < req->updates.n; i++)
+    {
+      struct update *u = &req->updates.u[i];
+
+      if (u->new == NULL)
+	continue;
+
+      if (asprintf(&names[n], "%s.raw", u->new->name) < 0)
+	{
+	  names[n] = NULL;
+	  return -ENOMEM;
+	}
+      l[n].name = names[n];
+      l[n].target = u->fn;
+      n++;
+    }
+
+  if (n == 0)
+    return 0;
+
+  /* readers see the links either before or after the switch */
+  lock = store_lock(config.sysext_store_dir, true);
+  if (lock < 0)
+    return lock;
+
+  start = metrics_now();
+  r = link_switch_commit(config.extensions_dir, l, n, replace);
+  metrics_record(METRIC_LINK, start, r < 0);
+  link_switch_done(l, n);
+  if (r < 0)
+    return r;
+
+  /* still with the lock, so the index matches the links */
+  int k = store_refs_update(config.sysext_store_dir, config.extensions_dir);
+  if (k < 0)
+    log_msg(LOG_WARNING, "Failed to update the reference index of '%s': %s",
+	    config.sysext_store_dir, strerror(-k));
+
+  for (size_t i = 0; i < req->updates.n; i++)
+    if (req->updates.u[i].new)
+      request_progress(req, &req->updates.u[i], "linked");
+
+  /* one remount for all images, none if nothing changed */
+  if (r > 0)
+    sysext_refresh();
+
+  return r;
+}
+
+/* Remove the images of the store which the policy does not keep.
+   The references of new or changed snapshots are read first, the
+   catalog of req groups the images by name and version. */
+static int
+request_gc(struct request *req, const struct store_gc_policy *policy,
+	   bool dry_run, struct store_gc_result *res)
+{
+  _cleanup_(store_refs_free) struct store_refs refs = {};
+  _cleanup_close_ int lock = -EBADF;
+  int r;
+
+  assert(req->catalog);
+
+  if (n_update_lists > (req->updates.u ? 1 : 0))
+    return -EBUSY;
+
+  lock = store_lock(config.sysext_store_dir, true);
+  if (lock < 0)
+    return lock;
+
+  r = store_refs_load(config.sysext_store_dir, &refs);
+  if (r < 0)
+    return r;
+
+  r = store_refs_sync(&refs, config.extensions_dir, config.snapshots_dir);
+  if (r < 0)
+    return r;
+  if (r > 0)
+    {
+      int k = store_refs_save(config.sysext_store_dir, &refs);
+      if (k < 0)
+	log_msg(LOG_WARNING, "Failed to write the reference index of '%s': %s",
+		config.sysext_store_dir, strerror(-k));
+    }
+
+  r = store_gc(config.sysext_store_dir, req->catalog, &refs, policy,
+	       dry_run, res);
+  if (r < 0)
+    return r;
+
+  log_msg(LOG_INFO, "Cleanup of '%s': %zu images, %" PRIu64 " bytes %s",
+	  config.sysext_store_dir, strv_length(res->removed), res->freed,
+	  dry_run ? "could be freed" : "freed");
+
+  return 0;
+}
+
+static void
+config_gc_policy(struct store_gc_policy *policy)
+{
+  policy->keep_versions = config.gc_keep_versions;
+  policy->max_size = (uint64_t) config.gc_max_store_size * 1024 * 1024;
+}
+
+static void
+update_downloads_done(int error, void *userdata)
+{
+  _cleanup_(free_requestp) struct request *req = userdata;
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *array = NULL;
+  _cleanup_(reply_array_done) struct reply_array reply = {};
+  int r;
+
+  req->progress = sd_event_source_disable_unref(req->progress);
+
+  if (error < 0)
+    {
+      request_fail_errno(TAKE_PTR(req), error);
+      return;
+    }
+
+  /* before anything gets changed */
+  r = reply_array_init(&reply, req->n_etc);
+  if (r < 0)
+    {
+      request_fail_errno(TAKE_PTR(req), r);
+      return;
+    }
+
+  for (size_t n = 0; n < req->n_etc; n++)
+    {
+      struct update *u = &req->updates.u[n];
+      const char *old_name = u->old;
+
+      if (u->new)
         {
-          images[n] = TAKE_PTR(images_local[i]);
-          n++;
+          /* the downloaded images are already in the store */
+          if (u->fetch)
+            {
+              if (u->status < 0)
+		{
+		  request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.DownloadError",
+			       "Failed to download '%s' from '%s': %s",
+			       u->new->deps->image_name, update_repository(u), strerror(-u->status));
+		  return;
+		}
+	      else if (u->status > 0)
+		{
+		  request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.DownloadError",
+			       "Failed to download '%s' from '%s': systemd-pull failed (%i)",
+			       u->new->deps->image_name, update_repository(u), u->status);
+		  return;
+		}
+            }
+
+	  r = reply_array_appendbo(&reply,
+				   SD_JSON_BUILD_PAIR_STRING("OldName", old_name),
+				   SD_JSON_BUILD_PAIR_STRING("NewName", u->new->deps->image_name));
         }
-      else /* Free unused images_local[i] */
-        free_image_entryp(&images_local[i]);
+      else /* No update found */
+	r = reply_array_appendbo(&reply,
+				 SD_JSON_BUILD_PAIR_STRING("OldName", old_name),
+				 SD_JSON_BUILD_PAIR_STRING("NewName", NULL));
+      if (r < 0)
+	{
+	  request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		       "Building the list of updated images failed: %s", strerror(-r));
+	  return;
+	}
+    }
+
+  /* a later Update finds the images in the store and only needs
+     to switch the symlinks */
+  if (!req->prefetch)
+    {
+      r = request_switch_links(req, true);
+      if (r < 0)
+	{
+	  request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		       "Switching the links in '%s' failed: %s",
+		       config.extensions_dir, strerror(-r));
+	  return;
+	}
+    }
+
+  r = reply_array_finish(&reply, &array);
+  if (r < 0)
+    {
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Building the list of updated images failed: %s", strerror(-r));
+      return;
+    }
+
+  (void) sd_varlink_replybo(req->link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
+			    SD_JSON_BUILD_PAIR_VARIANT(req->prefetch ? "Prefetched" : "Updated", array));
+
+  /* the old versions are no longer linked now */
+  if (!req->prefetch && config.gc_after_update)
+    {
+      _cleanup_(store_gc_result_free) struct store_gc_result res = {};
+      struct store_gc_policy policy;
+
+      config_gc_policy(&policy);
+      r = request_gc(req, &policy, false, &res);
+      if (r == -EBUSY)
+	log_msg(LOG_INFO, "Cleanup of '%s' skipped, other updates are running",
+		config.sysext_store_dir);
+      else if (r < 0)
+	log_msg(LOG_WARNING, "Cleanup of '%s' failed: %s",
+		config.sysext_store_dir, strerror(-r));
+    }
+}
+
+static void
+update_catalog_done(int r, struct catalog *catalog, void *userdata)
+{
+  struct request *req = userdata;
+  bool need_download = false;
+
+  if (r < 0)
+    {
+      request_fail(req, "org.openSUSE.sysextmgr.InternalError",
+		   "Loading image data failed: %s", strerror(-r));
+      return;
+    }
+
+  req->catalog = catalog;
+
+  r = new_update_list(&req->updates, req->n_etc);
+  if (r < 0)
+    {
+      request_fail_errno(req, r);
+      return;
+    }
+
+  /* first search all updates, afterwards download them at the same
+     time */
+  for (size_t n = 0; n < req->n_etc; n++)
+    {
+      struct update *u = &req->updates.u[n];
+
+      u->req = req;
+      u->old = req->images_etc[n]->deps->image_name;
+
+      r = get_latest_version(req->catalog, req->images_etc[n], &u->new);
+      if (u->new == NULL)
+	{
+	  request_progress(req, u, "up-to-date");
+	  continue;
+	}
+
+      log_msg(LOG_NOTICE, "Updating %s -> %s", req->images_etc[n]->deps->image_name, u->new->deps->image_name);
+
+      r = join_path(config.sysext_store_dir, u->new->deps->image_name, &u->fn);
+      if (r < 0) /* XXX return error msg */
+	{
+	  request_fail_errno(req, r);
+	  return;
+	}
+
+      if (!u->new->local && u->new->remote && update_reuse_object(u) <= 0)
+	{
+	  assert(req->repositories);
+
+	  r = update_set_urls(u);
+	  if (r < 0)
+	    {
+	      request_fail_errno(req, r);
+	      return;
+	    }
+	  if (asprintf(&u->tmpfn, "%s/.%s.XXXXXX", config.sysext_store_dir, u->new->deps->image_name) < 0)
+	    {
+	      u->tmpfn = NULL;
+	      request_fail_errno(req, -ENOMEM);
+	      return;
+	    }
+	  update_prepare_delta(u, req->images_etc[n]);
+	  need_download = true;
+	}
+      request_progress(req, u, "resolved");
+    }
+
+  if (need_download)
+    {
+      /* make sure directory exists and is a directory */
+      r = mkdir_p(config.sysext_store_dir, 0755);
+      if (r < 0)
+	{
+	  request_fail(req, "org.openSUSE.sysextmgr.InternalError",
+		       "Failed to create directory '%s': %s",
+		       config.sysext_store_dir, strerror(-r));
+	  return;
+	}
+    }
+
+  process_batch_begin(&req->batch, update_downloads_done, req);
+  /* prefetching happens ahead of time, don't slow down the system */
+  req->batch.background = req->prefetch || config.background_downloads;
+  request_start_progress(req);
+  for (size_t n = 0; n < req->n_etc; n++)
+    {
+      struct update *u = &req->updates.u[n];
+
+      if (u->tmpfn == NULL || update_join_download(u))
+	continue;
+
+      u->fd = mkostemp_safe(u->tmpfn);
+      if (u->fd < 0)
+	{
+	  update_finish(u, u->fd);
+	  continue;
+	}
+
+      /* errors are reported after all downloads are done */
+      if (u->deltafn)
+	r = update_delta_download_submit(u);
+      else
+	r = update_download_submit(u);
+      if (r < 0)
+	update_finish(u, r);
+    }
+  process_batch_end(&req->batch, 0);
+}
+
+static void
+update_installed_done(int r, struct image_entry **images, size_t n, void *userdata)
+{
+  struct request *req = userdata;
+
+  if (r < 0)
+    {
+      request_fail(req, "org.openSUSE.sysextmgr.InternalError",
+		   "Searching for images in '%s' failed: %s",
+		   config.extensions_dir, strerror(-r));
+      return;
+    }
+
+  req->images_etc = images;
+  req->n_etc = n;
+
+  if (req->n_etc == 0)
+    {
+      log_msg(LOG_NOTICE, "No installed images found.");
+      /* XXX provide error message to client */
+      (void) sd_varlink_replybo(req->link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
+				SD_JSON_BUILD_PAIR_VARIANT(req->prefetch ? "Prefetched" : "Updated", NULL));
+      free_request(req);
+      return;
+    }
+
+  /* fetch remote and local image data only once for all installed
+     images, only the newest compatible versions are needed */
+  load_catalog_async(helper_pool, scan_pool, req->repositories,
+		     config.sysext_store_dir, NULL, true,
+		     config.verify_signature, req->host, req->p.verbose,
+		     update_catalog_done, req);
+}
+
+/* Prefetch is an Update which stops after the downloads */
+static int
+start_update(sd_varlink *link, sd_json_variant *parameters,
+	     sd_varlink_method_flags_t flags, const char *method,
+	     bool prefetch)
+{
+  static const sd_json_dispatch_field dispatch_table[] = {
+    { "URL",     SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct parameters, url), 0},
+    { "Verbose", SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool, offsetof(struct parameters, verbose), 0},
+    { "Install", SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct parameters, install), 0},
+    {}
+  };
+  _cleanup_(free_requestp) struct request *req = NULL;
+  int r;
+
+  log_msg(LOG_INFO, "Varlink method \"%s\" called...", method);
+
+  r = new_request(link, flags, &req);
+  if (r < 0)
+    return r;
+  req->prefetch = prefetch;
+
+  r = sd_varlink_dispatch(link, parameters, dispatch_table, &req->p);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "%s request: varlink dispatch failed: %s", method, strerror(-r));
+      return r;
+    }
+
+  /* only root is allowed to update images */
+  uid_t peer_uid;
+  r = sd_varlink_get_peer_uid(link, &peer_uid);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Failed to get peer UID: %s", strerror(-r));
+      return r;
+    }
+  if (peer_uid != 0)
+    {
+      log_msg(LOG_WARNING, "%s: peer UID %i denied to update images",
+	      method, peer_uid);
+      return sd_varlink_error(link, SD_VARLINK_ERROR_PERMISSION_DENIED, parameters);
+    }
+
+  r = request_set_url(req);
+  if (r < 0)
+    {
+      request_fail_errno(TAKE_PTR(req), r);
+      return 0;
+    }
+
+  r = request_get_os_release(req);
+  if (r < 0)
+    {
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Couldn't read os-release file: %s", strerror(-r));
+      return 0;
+    }
+
+  /* list of "installed" images visible to systemd-sysext */
+  image_local_metadata_async(scan_pool, config.extensions_dir, NULL,
+			     req->host, req->p.verbose,
+			     update_installed_done, req);
+  TAKE_PTR(req);
+
+  return 0;
+}
+
+static int
+vl_method_update(sd_varlink *link, sd_json_variant *parameters,
+		 sd_varlink_method_flags_t flags,
+		 void _unused_(*userdata))
+{
+  return start_update(link, parameters, flags, "Update", false);
+}
+
+static int
+vl_method_prefetch(sd_varlink *link, sd_json_variant *parameters,
+		   sd_varlink_method_flags_t flags,
+		   void _unused_(*userdata))
+{
+  return start_update(link, parameters, flags, "Prefetch", true);
+}
+
+static void
+cleanup_catalog_done(int r, struct catalog *catalog, void *userdata)
+{
+  _cleanup_(free_requestp) struct request *req = userdata;
+  _cleanup_(store_gc_result_free) struct store_gc_result res = {};
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *removed = NULL;
+  struct store_gc_policy policy = {
+    .keep_versions = req->p.keep_versions,
+    .max_size = (uint64_t) req->p.max_store_size * 1024 * 1024,
+  };
+
+  if (r < 0)
+    {
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Loading image data failed: %s", strerror(-r));
+      return;
+    }
+
+  req->catalog = catalog;
+
+  r = request_gc(req, &policy, req->p.dry_run, &res);
+  if (r == -EBUSY)
+    {
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Updates are running, try again later");
+      return;
+    }
+  if (r < 0)
+    {
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Cleanup of '%s' failed: %s", config.sysext_store_dir,
+		   strerror(-r));
+      return;
+    }
+
+  if (!strv_isempty(res.removed))
+    {
+      r = sd_json_variant_new_array_strv(&removed, res.removed);
+      if (r < 0)
+	{
+	  request_fail_errno(TAKE_PTR(req), r);
+	  return;
+	}
+    }
+
+  (void) sd_varlink_replybo(req->link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
+			    SD_JSON_BUILD_PAIR_VARIANT("Removed", removed),
+			    SD_JSON_BUILD_PAIR_UNSIGNED("FreedBytes", res.freed),
+			    SD_JSON_BUILD_PAIR_UNSIGNED("StoreBytes", res.size));
+}
+
+static int
+vl_method_cleanup(sd_varlink *link, sd_json_variant *parameters,
+		  sd_varlink_method_flags_t flags,
+		  void _unused_(*userdata))
+{
+  static const sd_json_dispatch_field dispatch_table[] = {
+    { "DryRun",       SD_JSON_VARIANT_BOOLEAN,  sd_json_dispatch_stdbool, offsetof(struct parameters, dry_run), 0},
+    { "KeepVersions", SD_JSON_VARIANT_UNSIGNED, sd_json_dispatch_uint32,  offsetof(struct parameters, keep_versions), 0},
+    { "MaxStoreSize", SD_JSON_VARIANT_UNSIGNED, sd_json_dispatch_uint32,  offsetof(struct parameters, max_store_size), 0},
+    { "Verbose",      SD_JSON_VARIANT_BOOLEAN,  sd_json_dispatch_stdbool, offsetof(struct parameters, verbose), 0},
+    {}
+  };
+  _cleanup_(free_requestp) struct request *req = NULL;
+  uid_t peer_uid;
+  int r;
+
+  log_msg(LOG_INFO, "Varlink method \"Cleanup\" called...");
+
+  r = new_request(link, flags, &req);
+  if (r < 0)
+    return r;
+
+  /* the configured policy, unless the caller gives another one */
+  req->p.keep_versions = config.gc_keep_versions;
+  req->p.max_store_size = config.gc_max_store_size;
+
+  r = sd_varlink_dispatch(link, parameters, dispatch_table, &req->p);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Cleanup request: varlink dispatch failed: %s", strerror(-r));
+      return r;
+    }
+
+  r = sd_varlink_get_peer_uid(link, &peer_uid);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Failed to get peer UID: %s", strerror(-r));
+      return r;
+    }
+  if (peer_uid != 0)
+    {
+      log_msg(LOG_WARNING, "Cleanup: peer UID %i denied", peer_uid);
+      return sd_varlink_error(link, SD_VARLINK_ERROR_PERMISSION_DENIED, parameters);
+    }
+
+  r = request_get_os_release(req);
+  if (r < 0)
+    {
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Couldn't read os-release file: %s", strerror(-r));
+      return 0;
+    }
+
+  /* only the local images matter, no URL */
+  load_catalog_async(helper_pool, scan_pool, NULL, config.sysext_store_dir,
+		     NULL, false, config.verify_signature, req->host,
+		     req->p.verbose, cleanup_catalog_done, req);
+  TAKE_PTR(req);
+
+  return 0;
+}
+
+/* the file name of an image directly in the store */
+static bool
+valid_image_name(const char *name)
+{
+  return !isempty(name) && name[0] != '.' && strchr(name, '/') == NULL &&
+    (endswith(name, ".raw") || endswith(name, ".img"));
+}
+
+/* Copy the image in fd into the store as name. Like a download it is
+   written to a temporary file in the store first and only the link
+   into the store happens under the exclusive lock. An existing image
+   is never replaced, importing the same content again succeeds. Runs
+   in a helper process. */
+static int
+import_image(int fd, const char *name, const char *sha256,
+	     char sum[2 * SHA256_DIGEST_SIZE + 1])
+{
+  _cleanup_(unlink_and_free_tempfilep) char *tmpfn = NULL;
+  _cleanup_free_ char *fn = NULL;
+  _cleanup_close_ int outfd = -EBADF;
+  _cleanup_close_ int lock = -EBADF;
+  int r;
+
+  r = mkdir_p(config.sysext_store_dir, 0755);
+  if (r < 0)
+    return r;
+
+  r = join_path(config.sysext_store_dir, name, &fn);
+  if (r < 0)
+    return r;
+
+  if (asprintf(&tmpfn, "%s/.%s.XXXXXX", config.sysext_store_dir, name) < 0)
+    {
+      tmpfn = NULL;
+      return -ENOMEM;
+    }
+
+  outfd = mkostemp_safe(tmpfn);
+  if (outfd < 0)
+    {
+      tmpfn = mfree(tmpfn);
+      return outfd;
+    }
+
+  r = store_copy_fd(fd, outfd, config.drop_page_cache, sum);
+  if (r < 0)
+    return r;
+
+  r = store_flush_file(outfd, config.drop_page_cache);
+  if (r < 0)
+    return r;
+
+  if (sha256 && !strcaseeq(sum, sha256))
+    return -EBADMSG;
+
+  lock = store_lock(config.sysext_store_dir, true);
+  if (lock < 0)
+    return lock;
+
+  if (link(tmpfn, fn) < 0)
+    {
+      r = -errno;
+      if (r == -EEXIST && sha256_file_matches(fn, sum) > 0)
+	return 0;
+      return r;
+    }
+
+  r = store_add_object(config.sysext_store_dir, fn, sum);
+  if (r < 0)
+    log_msg(LOG_WARNING, "Failed to add '%s' to the store index: %s",
+	    fn, strerror(-r));
+
+  return 0;
+}
+
+/* runs in a process of scan_pool, the exit status is the errno
+   value of import_image() */
+static int
+import_image_child(void *arg)
+{
+  const struct request *req = arg;
+  char sum[2 * SHA256_DIGEST_SIZE + 1] = "";
+  int r;
+
+  r = import_image(req->import->fd, req->p.image_name, req->p.sha256, sum);
+  if (!isempty(sum) &&
+      pwrite(req->import->sum_fd, sum, strlen(sum), 0) != (ssize_t) strlen(sum))
+    return EIO;
+
+  return -r;
+}
+
+static int
+import_image_done(int status, void *userdata)
+{
+  struct import *im = userdata;
+  ssize_t n;
+
+  /* a negative status: the helper could not be started */
+  im->status = status < 0 ? status : -status;
+
+  n = pread(im->sum_fd, im->sum, sizeof(im->sum) - 1, 0);
+  im->sum[n > 0 ? n : 0] = '\0';
+
+  return 0;
+}
+
+static void
+import_done(int error, void *userdata)
+{
+  _cleanup_(free_requestp) struct request *req = userdata;
+  const struct import *im = req->import;
+  int r = error < 0 ? error : im->status;
+
+  if (r == -EBADMSG)
+    {
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "SHA256 sum of '%s' is %s, expected %s",
+		   req->p.image_name, im->sum, req->p.sha256);
+      return;
+    }
+  if (r == -EEXIST)
+    {
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Other image '%s' already in the store", req->p.image_name);
+      return;
+    }
+  if (r < 0)
+    {
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Import of '%s' failed: %s", req->p.image_name, strerror(-r));
+      return;
+    }
+
+  log_msg(LOG_NOTICE, "Imported '%s' into '%s'", req->p.image_name,
+	  config.sysext_store_dir);
+
+  (void) sd_varlink_replybo(req->link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
+			    SD_JSON_BUILD_PAIR_STRING("SHA256", im->sum));
+}
+
+static int
+vl_method_import(sd_varlink *link, sd_json_variant *parameters,
+		 sd_varlink_method_flags_t flags,
+		 void _unused_(*userdata))
+{
+  static const sd_json_dispatch_field dispatch_table[] = {
+    { "Name",    SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct parameters, image_name), SD_JSON_MANDATORY},
+    { "SHA256",  SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct parameters, sha256), 0},
+    { "Verbose", SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool, offsetof(struct parameters, verbose), 0},
+    {}
+  };
+  _cleanup_(free_requestp) struct request *req = NULL;
+  _cleanup_close_ int fd = -EBADF;
+  struct stat st;
+  uid_t peer_uid;
+  int r;
+
+  log_msg(LOG_INFO, "Varlink method \"Import\" called...");
+
+  r = new_request(link, flags, &req);
+  if (r < 0)
+    return r;
+
+  r = sd_varlink_dispatch(link, parameters, dispatch_table, &req->p);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Import request: varlink dispatch failed: %s", strerror(-r));
+      return r;
+    }
+
+  r = sd_varlink_get_peer_uid(link, &peer_uid);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Failed to get peer UID: %s", strerror(-r));
+      return r;
+    }
+  if (peer_uid != 0)
+    {
+      log_msg(LOG_WARNING, "Import: peer UID %i denied", peer_uid);
+      return sd_varlink_error(link, SD_VARLINK_ERROR_PERMISSION_DENIED, parameters);
+    }
+
+  if (!valid_image_name(req->p.image_name))
+    return sd_varlink_error_invalid_parameter_name(link, "Name");
+  if (req->p.sha256 && !store_valid_sha256(req->p.sha256))
+    return sd_varlink_error_invalid_parameter_name(link, "SHA256");
+
+  fd = sd_varlink_take_fd(link, 0);
+  if (fd < 0)
+    {
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "No file descriptor of the image passed: %s", strerror(-fd));
+      return 0;
+    }
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Image '%s' is not a regular file", req->p.image_name);
+      return 0;
+    }
+
+  req->import = calloc(1, sizeof(struct import));
+  if (req->import == NULL)
+    return -ENOMEM;
+  req->import->fd = TAKE_FD(fd);
+  req->import->sum_fd = memfd_create("sysextmgr-import", MFD_CLOEXEC);
+  if (req->import->sum_fd < 0)
+    {
+      r = -errno;
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Failed to create memfd: %s", strerror(-r));
+      return 0;
+    }
+
+  /* copying and hashing a multi-GB image takes too long for the
+     event loop */
+  process_batch_begin(&req->batch, import_done, req);
+  r = process_pool_submit_func(scan_pool, &req->batch, "import",
+			       import_image_child, req, import_image_done,
+			       req->import);
+  if (r < 0)
+    req->import->status = r;
+  process_batch_end(&req->batch, 0);
+  TAKE_PTR(req);
+
+  return 0;
+}
+
+/* runs in a process of scan_pool */
+static int
+verify_image_child(void *arg)
+{
+  return store_verify_image(config.sysext_store_dir, arg, config.drop_page_cache);
+}
+
+static int
+verify_image_done(int status, void *userdata)
+{
+  struct store_sum *s = userdata;
+
+  if (status < 0 || status > VERIFY_UNKNOWN)
+    {
+      log_msg(LOG_ERR, "Verifying '%s' failed (%i)", s->image_name, status);
+      s->state = VERIFY_UNREADABLE;
+    }
+  else
+    s->state = status;
+
+  if (s->state == VERIFY_CORRUPT)
+    log_msg(LOG_ERR, "'%s' in the store does not match its SHA256 sum %s",
+	    s->image_name, s->sha256);
+  else if (s->state == VERIFY_UNREADABLE)
+    log_msg(LOG_ERR, "'%s' in the store could not be read", s->image_name);
+
+  return 0;
+}
+
+static void
+verify_done(int error, void *userdata)
+{
+  _cleanup_(free_requestp) struct request *req = userdata;
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *array = NULL;
+  _cleanup_(reply_array_done) struct reply_array reply = {};
+  uint64_t failed = 0;
+  int r;
+
+  r = reply_array_init(&reply, req->n_sums);
+  if (r < 0)
+    {
+      request_fail_errno(TAKE_PTR(req), r);
+      return;
+    }
+
+  for (size_t i = 0; i < req->n_sums; i++)
+    {
+      const struct store_sum *s = &req->sums[i];
+
+      if (s->state == VERIFY_CORRUPT || s->state == VERIFY_UNREADABLE)
+	failed++;
+
+      r = reply_array_appendbo(&reply,
+			       SD_JSON_BUILD_PAIR_STRING("Image", s->image_name),
+			       SD_JSON_BUILD_PAIR_STRING("State", verify_state_to_string(s->state)),
+			       SD_JSON_BUILD_PAIR_STRING("SHA256", s->sha256));
+      if (r < 0)
+	{
+	  request_fail_errno(TAKE_PTR(req), r);
+	  return;
+	}
     }
 
-  /* sort list */
-  qsort(images, n, sizeof(struct image_entry *), image_cmp);
-
-  for (size_t i = 0; images[i] != NULL; i++)
+  r = reply_array_finish(&reply, &array);
+  if (r < 0)
     {
-      r = sd_json_variant_append_arraybo(&array,
-					 SD_JSON_BUILD_PAIR_STRING("NAME", images[i]->name),
-					 SD_JSON_BUILD_PAIR_STRING("IMAGE_NAME", images[i]->deps->image_name),
-					 SD_JSON_BUILD_PAIR_STRING("SYSEXT_VERSION_ID", images[i]->deps->sysext_version_id),
-					 SD_JSON_BUILD_PAIR_STRING("SYSEXT_SCOPE", images[i]->deps->sysext_scope),
-					 SD_JSON_BUILD_PAIR_STRING("ID", images[i]->deps->id),
-					 SD_JSON_BUILD_PAIR_STRING("SYSEXT_LEVEL", images[i]->deps->sysext_level),
-					 SD_JSON_BUILD_PAIR_STRING("VERSION_ID", images[i]->deps->version_id),
-					 SD_JSON_BUILD_PAIR_STRING("ARCHITECTURE", images[i]->deps->architecture),
-					 SD_JSON_BUILD_PAIR_BOOLEAN("LOCAL", images[i]->local),
-					 SD_JSON_BUILD_PAIR_BOOLEAN("REMOTE", images[i]->remote),
-					 SD_JSON_BUILD_PAIR_BOOLEAN("INSTALLED", images[i]->installed),
-					 SD_JSON_BUILD_PAIR_BOOLEAN("COMPATIBLE", images[i]->compatible));
-      if(r < 0)
-	{
-	  log_msg(LOG_ERR, "Appending array failed: %s", strerror(-r));
-	  /* XXX */
-	}
+      request_fail_errno(TAKE_PTR(req), r);
+      return;
     }
 
-  return sd_varlink_replybo(link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
-			    SD_JSON_BUILD_PAIR_VARIANT("Images", array));
+  log_msg(failed ? LOG_WARNING : LOG_INFO, "Verified %zu images in '%s', %" PRIu64 " failed",
+	  req->n_sums, config.sysext_store_dir, failed);
+
+  (void) sd_varlink_replybo(req->link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
+			    SD_JSON_BUILD_PAIR_VARIANT("Images", array),
+			    SD_JSON_BUILD_PAIR_UNSIGNED("Failed", failed));
 }
 
+/* Hash the images of the store again and compare them with the sum
+   of their object, which was recorded by the download or Import.
+   The images are hashed at the same time in scan_pool, one process
+   per image. No store lock is held, an image removed in the
+   meantime is reported as removed. */
 static int
-vl_method_check(sd_varlink *link, sd_json_variant *parameters,
-		sd_varlink_method_flags_t _unused_(flags),
-		void _unused_(*userdata))
+vl_method_verify(sd_varlink *link, sd_json_variant *parameters,
+		 sd_varlink_method_flags_t flags,
+		 void _unused_(*userdata))
 {
-  _cleanup_(sd_json_variant_unrefp) sd_json_variant *array = NULL;
-  _cleanup_(parameters_free) struct parameters p = {
-    .url = NULL,
-    .verbose = config.verbose,
-    .install = NULL
-  };
   static const sd_json_dispatch_field dispatch_table[] = {
-    { "URL",     SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct parameters, url), 0},
+    { "Names",   SD_JSON_VARIANT_ARRAY,   sd_json_dispatch_strv,    offsetof(struct parameters, names), 0},
     { "Verbose", SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool, offsetof(struct parameters, verbose), 0},
     {}
   };
-  _cleanup_(free_os_releasep) struct osrelease *osrelease = NULL;
-  _cleanup_(free_image_entry_list) struct image_entry **images_etc = NULL;
-  size_t n_etc = 0;
-  const char *url = NULL;
+  _cleanup_(free_requestp) struct request *req = NULL;
+  uid_t peer_uid;
   int r;
 
-  log_msg(LOG_INFO, "Varlink method \"Check\" called...");
+  log_msg(LOG_INFO, "Varlink method \"Verify\" called...");
 
-  r = load_os_release(NULL, &osrelease);
+  r = new_request(link, flags, &req);
+  if (r < 0)
+    return r;
+
+  r = sd_varlink_dispatch(link, parameters, dispatch_table, &req->p);
   if (r < 0)
     {
-      _cleanup_free_ char *error = NULL;
-      if (asprintf(&error, "Couldn't read os-release file: %s", strerror(-r)) < 0)
-	error = NULL;
-      log_msg(LOG_ERR, "%s", error);
-      return sd_varlink_errorbo(link, "org.openSUSE.sysextmgr.InternalError",
-				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-                                SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
+      log_msg(LOG_ERR, "Verify request: varlink dispatch failed: %s", strerror(-r));
+      return r;
     }
 
-  r = sd_varlink_dispatch(link, parameters, dispatch_table, &p);
+  r = sd_varlink_get_peer_uid(link, &peer_uid);
   if (r < 0)
     {
-      log_msg(LOG_ERR, "Check request: varlink dispatch failed: %s", strerror(-r));
+      log_msg(LOG_ERR, "Failed to get peer UID: %s", strerror(-r));
       return r;
     }
+  /* reads the whole store */
+  if (peer_uid != 0)
+    {
+      log_msg(LOG_WARNING, "Verify: peer UID %i denied", peer_uid);
+      return sd_varlink_error(link, SD_VARLINK_ERROR_PERMISSION_DENIED, parameters);
+    }
 
-  /* Only allow URL or verbose argument if called by root */
-  if (p.url || p.verbose != config.verbose)
+  r = store_list_sums(config.sysext_store_dir,
+		      strv_isempty(req->p.names) ? NULL : req->p.names,
+		      &req->sums, &req->n_sums);
+  if (r < 0 && r != -ENOENT)
     {
-      uid_t peer_uid;
-      r = sd_varlink_get_peer_uid(link, &peer_uid);
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Reading '%s' failed: %s", config.sysext_store_dir, strerror(-r));
+      return 0;
+    }
+
+  process_batch_begin(&req->batch, verify_done, req);
+  for (size_t i = 0; i < req->n_sums; i++)
+    {
+      struct store_sum *s = &req->sums[i];
+
+      if (s->sha256 == NULL)
+	{
+	  log_msg(LOG_NOTICE, "'%s' has no SHA256 sum in the store, not verified",
+		  s->image_name);
+	  continue;
+	}
+
+      r = process_pool_submit_func(scan_pool, &req->batch, "verify",
+				   verify_image_child, s, verify_image_done, s);
       if (r < 0)
-        {
-          log_msg(LOG_ERR, "Failed to get peer UID: %s", strerror(-r));
-          return r;
-        }
-      if (peer_uid != 0)
-        {
-	  if (p.url)
-	    {
-	      log_msg(LOG_WARNING, "Check: peer UID %i denied with additional options", peer_uid);
-	      return sd_varlink_error(link, SD_VARLINK_ERROR_PERMISSION_DENIED, parameters);
-	    }
-	  /* Ignore changed verbose flag, only root is allowed to set that */
-	  p.verbose = config.verbose;
-        }
+	{
+	  s->state = VERIFY_UNREADABLE;
+	  log_msg(LOG_ERR, "Failed to verify '%s': %s", s->image_name, strerror(-r));
+	}
     }
+  process_batch_end(&req->batch, 0);
+  TAKE_PTR(req);
 
-  /* use URL from config if none got provided via parameter */
-  if (p.url)
-    url = p.url;
-  else
-    url = config.url;
+  return 0;
+}
+
+static void
+install_link(struct request *req)
+{
+  _cleanup_(sd_json_variant_unrefp) sd_json_variant *array = NULL;
+  int r;
 
-  r = load_os_release(NULL, &osrelease);
+  /* make sure directory exists and is a directory */
+  r = mkdir_p(config.extensions_dir, 0755);
   if (r < 0)
     {
-      _cleanup_free_ char *error = NULL;
-      if (asprintf(&error, "Couldn't read os-release file: %s", strerror(-r)) < 0)
-	error = NULL;
-      log_msg(LOG_ERR, "%s", error);
-      return sd_varlink_errorbo(link, "org.openSUSE.sysextmgr.InternalError",
-				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-                                SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
+      request_fail(req, "org.openSUSE.sysextmgr.InternalError",
+		   "Failed to create directory '%s': %s",
+		   config.extensions_dir, strerror(-r));
+      return;
     }
 
-  /* list of "installed" images visible to systemd-sysext */
-  r = image_local_metadata(config.extensions_dir, &images_etc, &n_etc, NULL, osrelease, p.verbose);
+  r = request_switch_links(req, false);
   if (r < 0)
     {
-      _cleanup_free_ char *error = NULL;
-      if (asprintf(&error, "Searching for images in '%s' failed: %s",
-		   config.extensions_dir, strerror(-r)) < 0)
-	error = NULL;
-
-      log_msg(LOG_ERR, "%s", error);
-      return sd_varlink_errorbo(link, "org.openSUSE.sysextmgr.InternalError",
-				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-                                SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
-    }
-  if (n_etc == 0)
-    {
-      log_msg(LOG_NOTICE, "No installed images found.");
-      /* XXX provide error message to client */
-      return sd_varlink_replybo(link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
-				SD_JSON_BUILD_PAIR_VARIANT("Images", array));
+      request_fail(req, "org.openSUSE.sysextmgr.InternalError",
+		   "Creating the links in '%s' failed: %s",
+		   config.extensions_dir, strerror(-r));
+      return;
     }
 
-  for (size_t n = 0; n < n_etc; n++)
+  for (size_t n = 0; n < req->updates.n; n++)
     {
-      _cleanup_(free_image_entryp) struct image_entry *update = NULL;
-
-      r = get_latest_version(images_etc[n], &update, url, config.verify_signature, osrelease, p.verbose);
-      if (update)
-        {
-	  log_msg(LOG_NOTICE, "Update available: %s -> %s", images_etc[n]->deps->image_name, update->deps->image_name);
-
-	  r = sd_json_variant_append_arraybo(&array,
-					     SD_JSON_BUILD_PAIR_STRING("OldName", images_etc[n]->deps->image_name),
-					     SD_JSON_BUILD_PAIR_STRING("NewName", update->deps->image_name));
-        }
-      else /* No update found */
-	r = sd_json_variant_append_arraybo(&array,
-					   SD_JSON_BUILD_PAIR_STRING("OldName", images_etc[n]->deps->image_name),
-					   SD_JSON_BUILD_PAIR_STRING("NewName", NULL));
-      if(r < 0)
+      r = sd_json_variant_append_arrayb(&array, SD_JSON_BUILD_STRING(req->updates.u[n].new->deps->image_name));
+      if (r < 0)
 	{
-	  log_msg(LOG_ERR, "Appending array failed: %s", strerror(-r));
-	  /* XXX */
+	  request_fail_errno(req, r);
+	  return;
 	}
     }
 
-  return sd_varlink_replybo(link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
-			    SD_JSON_BUILD_PAIR_VARIANT("Images", array));
+  (void) sd_varlink_replybo(req->link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
+			    SD_JSON_BUILD_PAIR_VARIANT("Installed", array));
+  free_request(req);
 }
 
 static void
-unlink_and_free_tempfilep(char **p)
+install_download_done(int error, void *userdata)
 {
-  if (p == NULL || *p == NULL)
-    return;
-
-  /* If the file is created with mkstemp(), it will (almost always) change the suffix.
-   * Treat this as a sign that the file was successfully created. We ignore both the rare case
-   * where the original suffix is used and unlink failures. */
-  if (!endswith(*p, ".XXXXXX"))
-    (void) unlink(*p);
-
-  *p = mfree(*p);
-}
+  struct request *req = userdata;
+  struct update *failed = NULL;
 
-static int
-vl_method_update(sd_varlink *link, sd_json_variant *parameters,
-		 sd_varlink_method_flags_t _unused_(flags),
-		 void _unused_(*userdata))
-{
-  _cleanup_(sd_json_variant_unrefp) sd_json_variant *array = NULL;
-  _cleanup_(parameters_free) struct parameters p = {
-    .url = NULL,
-    .verbose = config.verbose,
-    .install = NULL
-  };
-  static const sd_json_dispatch_field dispatch_table[] = {
-    { "URL",     SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct parameters, url), 0},
-    { "Verbose", SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool, offsetof(struct parameters, verbose), 0},
-    { "Install", SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct parameters, install), 0},
-    {}
-  };
-  _cleanup_(free_os_releasep) struct osrelease *osrelease = NULL;
-  _cleanup_(free_image_entry_list) struct image_entry **images_etc = NULL;
-  size_t n_etc = 0;
-  const char *url = NULL;
-  int r;
+  req->progress = sd_event_source_disable_unref(req->progress);
 
-  log_msg(LOG_INFO, "Varlink method \"Update\" called...");
+  if (error < 0)
+    {
+      request_fail_errno(req, error);
+      return;
+    }
 
-  r = sd_varlink_dispatch(link, parameters, dispatch_table, &p);
-  if (r < 0)
+  /* all complete downloads are already in the store, even if
+     another one failed, so that they don't need to be fetched again */
+  for (size_t n = 0; n < req->updates.n && failed == NULL; n++)
     {
-      log_msg(LOG_ERR, "Update request: varlink dispatch failed: %s", strerror(-r));
-      return r;
+      struct update *u = &req->updates.u[n];
+
+      if (u->fetch && u->status != 0)
+	failed = u;
     }
 
-  /* only root is allowed to update images */
-  uid_t peer_uid;
-  r = sd_varlink_get_peer_uid(link, &peer_uid);
-  if (r < 0)
+  if (failed && failed->status < 0)
     {
-      log_msg(LOG_ERR, "Failed to get peer UID: %s", strerror(-r));
-      return r;
+      request_fail(req, "org.openSUSE.sysextmgr.DownloadError",
+		   "Failed to download '%s' from '%s': %s",
+		   failed->new->deps->image_name, update_repository(failed),
+		   strerror(-failed->status));
+      return;
     }
-  if (peer_uid != 0)
+  else if (failed)
     {
-      log_msg(LOG_WARNING, "Update: peer UID %i denied to update images",
-	      peer_uid);
-      return sd_varlink_error(link, SD_VARLINK_ERROR_PERMISSION_DENIED, parameters);
+      request_fail(req, "org.openSUSE.sysextmgr.DownloadError",
+		   "Failed to download '%s' from '%s': systemd-pull failed (%i)",
+		   failed->new->deps->image_name, update_repository(failed),
+		   failed->status);
+      return;
     }
 
-  /* use URL from config if none got provided via parameter */
-  if (p.url)
-    url = p.url;
-  else
-    url = config.url;
+  install_link(req);
+}
+
+static void
+install_catalog_done(int r, struct catalog *catalog, void *userdata)
+{
+  struct request *req = userdata;
+  size_t n_names = strv_length(req->names);
+  bool need_download = false;
 
-  r = load_os_release(NULL, &osrelease);
   if (r < 0)
     {
-      _cleanup_free_ char *error = NULL;
-      if (asprintf(&error, "Couldn't read os-release file: %s", strerror(-r)) < 0)
-	error = NULL;
-      log_msg(LOG_ERR, "%s", error);
-      return sd_varlink_errorbo(link, "org.openSUSE.sysextmgr.InternalError",
-				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-                                SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
+      request_fail(req, "org.openSUSE.sysextmgr.InternalError",
+		   "Failed to load image data from '%s': %s",
+		   request_repositories(req), strerror(-r));
+      return;
     }
 
-  /* list of "installed" images visible to systemd-sysext */
-  r = image_local_metadata(config.extensions_dir, &images_etc, &n_etc, NULL, osrelease, p.verbose);
+  req->catalog = catalog;
+
+  r = new_update_list(&req->updates, n_names);
   if (r < 0)
     {
-      _cleanup_free_ char *error = NULL;
-      if (asprintf(&error, "Searching for images in '%s' failed: %s",
-		   config.extensions_dir, strerror(-r)) < 0)
-	error = NULL;
+      request_fail_errno(req, r);
+      return;
+    }
+
+  struct image_deps wanted_deps = {
+    .architecture = (char *)architecture_to_string(uname_architecture()),
+  };
+
+  /* resolve all images first, nothing gets downloaded if one of them
+     is not available */
+  for (size_t n = 0; n < n_names; n++)
+    {
+      struct update *u = &req->updates.u[n];
+      struct image_entry wanted = {
+	.name = req->names[n],
+	.deps = &wanted_deps
+      };
+
+      u->req = req;
+
+      r = get_latest_version(req->catalog, &wanted, &u->new);
+      if (r < 0)
+	{
+	  request_fail(req, "org.openSUSE.sysextmgr.InternalError",
+		       "Failed to get latest version for '%s' from '%s': %s",
+		       req->names[n], request_repositories(req), strerror(-r));
+	  return;
+	}
+      if (!u->new)
+	{
+	  request_fail(req, "org.openSUSE.sysextmgr.NoEntryFound",
+		       "Failed to find compatible version for '%s' from '%s'",
+		       req->names[n], request_repositories(req));
+	  return;
+	}
+
+      log_msg(LOG_NOTICE, "Installing %s", u->new->deps->image_name);
+
+      r = join_path(config.sysext_store_dir, u->new->deps->image_name, &u->fn);
+      if (r < 0) /* XXX return error msg */
+	{
+	  request_fail_errno(req, r);
+	  return;
+	}
+
+      if (!u->new->local && u->new->remote && update_reuse_object(u) <= 0)
+	{
+	  assert(req->repositories);
 
-      log_msg(LOG_ERR, "%s", error);
-      return sd_varlink_errorbo(link, "org.openSUSE.sysextmgr.InternalError",
-				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-                                SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
+	  r = update_set_urls(u);
+	  if (r < 0)
+	    {
+	      request_fail_errno(req, r);
+	      return;
+	    }
+	  if (asprintf(&u->tmpfn, "%s/.%s.XXXXXX", config.sysext_store_dir, u->new->deps->image_name) < 0)
+	    {
+	      u->tmpfn = NULL;
+	      request_fail_errno(req, -ENOMEM);
+	      return;
+	    }
+	  need_download = true;
+	}
+      request_progress(req, u, "resolved");
     }
-  if (n_etc == 0)
+
+  if (need_download)
     {
-      log_msg(LOG_NOTICE, "No installed images found.");
-      /* XXX provide error message to client */
-      return sd_varlink_replybo(link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
-				SD_JSON_BUILD_PAIR_VARIANT("Updated", array));
+      /* make sure directory exists and is a directory */
+      r = mkdir_p(config.sysext_store_dir, 0755);
+      if (r < 0)
+	{
+	  request_fail(req, "org.openSUSE.sysextmgr.InternalError",
+		       "Failed to create directory '%s': %s",
+		       config.sysext_store_dir, strerror(-r));
+	  return;
+	}
     }
 
-  for (size_t n = 0; n < n_etc; n++)
+  /* without downloads the batch is done immediately */
+  process_batch_begin(&req->batch, install_download_done, req);
+  req->batch.background = config.background_downloads;
+  if (need_download)
+    request_start_progress(req);
+  for (size_t n = 0; n < n_names; n++)
     {
-      _cleanup_(free_image_entryp) struct image_entry *update = NULL;
+      struct update *u = &req->updates.u[n];
 
-      r = get_latest_version(images_etc[n], &update, url, config.verify_signature, osrelease, p.verbose);
-      if (update)
-        {
-          _cleanup_free_ char *fn = NULL;
-          _cleanup_free_ char *linkfn = NULL;
+      if (u->tmpfn == NULL || update_join_download(u))
+	continue;
 
-	  log_msg(LOG_NOTICE, "Updating %s -> %s", images_etc[n]->deps->image_name, update->deps->image_name);
+      u->fd = mkostemp_safe(u->tmpfn);
+      if (u->fd < 0)
+	{
+	  update_finish(u, u->fd);
+	  continue;
+	}
 
-          r = join_path(config.sysext_store_dir, update->deps->image_name, &fn);
-          if (r < 0) /* XXX return error msg */
-            return r;
+      /* errors are reported after all downloads are done */
+      r = update_download_submit(u);
+      if (r < 0)
+	update_finish(u, r);
+    }
+  process_batch_end(&req->batch, 0);
+}
 
-          if (asprintf(&linkfn, "%s/%s.raw", config.extensions_dir, update->name) < 0)
-            return -ENOMEM;
+/* Merge the single name of "Install", which older clients use, and
+   the list of "Names" and remove duplicates. */
+static int
+install_names(const struct parameters *p, char ***res)
+{
+  size_t n = strv_length(p->names) + (p->install ? 1 : 0);
+  _cleanup_strv_free_ char **l = NULL;
+  size_t k = 0;
 
-          if (!update->local && update->remote)
-            {
-              _cleanup_(unlink_and_free_tempfilep) char *tmpfn = NULL;
-              _cleanup_close_ int fd = -EBADF;
-
-              assert(url);
-
-              if (asprintf(&tmpfn, "%s/.%s.XXXXXX", config.sysext_store_dir, update->deps->image_name) < 0)
-                return -ENOMEM;
-
-              fd = mkostemp_safe(tmpfn);
-
-              r = download(url, update->deps->image_name, tmpfn, config.verify_signature);
-              if (r < 0)
-                {
-		  _cleanup_free_ char *error = NULL;
-		  if (asprintf(&error, "Failed to download '%s' from '%s': %s",
-			       update->deps->image_name, url, strerror(-r)) < 0)
-		    error = NULL;
-
-		  log_msg(LOG_ERR, "%s", error);
-		  return sd_varlink_errorbo(link, "org.openSUSE.sysextmgr.DownloadError",
-					    SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-					    SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
-                }
-
-              if (rename(tmpfn, fn) < 0)
-                {
-		  _cleanup_free_ char *error = NULL;
-		  if (asprintf(&error, "Error to rename '%s' to '%s': %m", tmpfn, fn) < 0)
-		    error = NULL;
-
-		  log_msg(LOG_ERR, "%s", error);
-		  return sd_varlink_errorbo(link, "org.openSUSE.sysextmgr.InternalError",
-					    SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-					    SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
-                }
-            }
+  l = calloc(n + 1, sizeof(char *));
+  if (l == NULL)
+    return -ENOMEM;
 
-          if (unlink(linkfn) < 0)
-            {
-	      _cleanup_free_ char *error = NULL;
-	      if (asprintf(&error, "Error to delete '%s': %m", linkfn) < 0)
-		error = NULL;
-
-	      log_msg(LOG_ERR, "%s", error);
-	      return sd_varlink_errorbo(link, "org.openSUSE.sysextmgr.InternalError",
-					SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-					SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
-            }
+  for (size_t i = 0; i < n; i++)
+    {
+      const char *name;
 
-          if (symlink(fn, linkfn) < 0)
-            {
-	      _cleanup_free_ char *error = NULL;
-	      if (asprintf(&error, "Error to symlink '%s' to '%s': %m", fn, linkfn) < 0)
-		error = NULL;
-
-	      log_msg(LOG_ERR, "%s", error);
-	      return sd_varlink_errorbo(link, "org.openSUSE.sysextmgr.InternalError",
-					SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-					SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
-            }
-	  r = sd_json_variant_append_arraybo(&array,
-					     SD_JSON_BUILD_PAIR_STRING("OldName", images_etc[n]->deps->image_name),
-					     SD_JSON_BUILD_PAIR_STRING("NewName", update->deps->image_name));
-        }
-      else /* No update found */
-	r = sd_json_variant_append_arraybo(&array,
-					   SD_JSON_BUILD_PAIR_STRING("OldName", images_etc[n]->deps->image_name),
-					   SD_JSON_BUILD_PAIR_STRING("NewName", NULL));
-      if(r < 0)
-	{
-	  log_msg(LOG_ERR, "Appending array failed: %s", strerror(-r));
-	  /* XXX */
-	}
+      if (p->install)
+	name = i == 0 ? p->install : p->names[i - 1];
+      else
+	name = p->names[i];
+
+      if (strv_contains(l, name))
+	continue;
+
+      l[k] = strdup(name);
+      if (l[k] == NULL)
+	return -ENOMEM;
+      k++;
     }
 
-  return sd_varlink_replybo(link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
-			    SD_JSON_BUILD_PAIR_VARIANT("Updated", array));
+  *res = TAKE_PTR(l);
+
+  return 0;
 }
 
 static int
 vl_method_install(sd_varlink *link, sd_json_variant *parameters,
-		  sd_varlink_method_flags_t _unused_(flags),
+		  sd_varlink_method_flags_t flags,
 		  void _unused_(*userdata))
 {
-  _cleanup_(sd_json_variant_unrefp) sd_json_variant *array = NULL;
-  _cleanup_(parameters_free) struct parameters p = {
-    .url = NULL,
-    .verbose = config.verbose,
-    .install = NULL
-  };
   static const sd_json_dispatch_field dispatch_table[] = {
     { "URL",     SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct parameters, url), 0},
     { "Verbose", SD_JSON_VARIANT_BOOLEAN, sd_json_dispatch_stdbool, offsetof(struct parameters, verbose), 0},
-    { "Install", SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct parameters, install), SD_JSON_MANDATORY},
+    { "Install", SD_JSON_VARIANT_STRING,  sd_json_dispatch_string,  offsetof(struct parameters, install), 0},
+    { "Names",   SD_JSON_VARIANT_ARRAY,   sd_json_dispatch_strv,    offsetof(struct parameters, names), 0},
     {}
   };
-  _cleanup_(free_os_releasep) struct osrelease *osrelease = NULL;
-  _cleanup_(free_image_entryp) struct image_entry *new = NULL;
-  const char *url = NULL;
+  _cleanup_(free_requestp) struct request *req = NULL;
   int r;
 
   log_msg(LOG_INFO, "Varlink method \"Install\" called...");
 
-  r = sd_varlink_dispatch(link, parameters, dispatch_table, &p);
+  r = new_request(link, flags, &req);
+  if (r < 0)
+    return r;
+
+  r = sd_varlink_dispatch(link, parameters, dispatch_table, &req->p);
   if (r < 0)
     {
       log_msg(LOG_ERR, "Install request: varlink dispatch failed: %s", strerror(-r));
@@ -816,153 +3725,34 @@ vl_method_install(sd_varlink *link, sd_json_variant *parameters,
       return sd_varlink_error(link, SD_VARLINK_ERROR_PERMISSION_DENIED, parameters);
     }
 
-  /* use URL from config if none got provided via parameter */
-  if (p.url)
-    url = p.url;
-  else
-    url = config.url;
-
-  r = load_os_release(NULL, &osrelease);
-  if (r < 0)
-    {
-      _cleanup_free_ char *error = NULL;
-      if (asprintf(&error, "Couldn't read os-release file: %s", strerror(-r)) < 0)
-	error = NULL;
-      log_msg(LOG_ERR, "%s", error);
-      return sd_varlink_errorbo(link, "org.openSUSE.sysextmgr.InternalError",
-				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-                                SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
-    }
-
-  struct image_deps wanted_deps = {
-    .architecture = (char *)architecture_to_string(uname_architecture()),
-  };
-  struct image_entry wanted = {
-    .name = p.install,
-    .deps = &wanted_deps
-  };
-
-  r = get_latest_version(&wanted, &new, url, config.verify_signature, osrelease, p.verbose);
+  r = install_names(&req->p, &req->names);
   if (r < 0)
-    {
-      _cleanup_free_ char *error = NULL;
-      if (asprintf(&error, "Failed to get latest version for '%s' from '%s': %s",
-		   p.install, url, strerror(-r)) < 0)
-	error = NULL;
-
-      log_msg(LOG_ERR, "%s", error);
-      return sd_varlink_errorbo(link, "org.openSUSE.sysextmgr.InternalError",
-				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-				SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
-    }
-  if (!new)
-    {
-      _cleanup_free_ char *error = NULL;
-      if (asprintf(&error, "Failed to find compatible version for '%s' from '%s'",
-		   p.install, url) < 0)
-	error = NULL;
-
-      log_msg(LOG_ERR, "%s", error);
-      return sd_varlink_errorbo(link, "org.openSUSE.sysextmgr.NoEntryFound",
-				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-				SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
-    }
-
-  _cleanup_free_ char *fn = NULL;
-  _cleanup_free_ char *linkfn = NULL;
-
-  log_msg(LOG_NOTICE, "Installing %s", new->deps->image_name);
-
-  r = join_path(config.sysext_store_dir, new->deps->image_name, &fn);
-  if (r < 0) /* XXX return error msg */
     return r;
+  if (strv_length(req->names) == 0)
+    return sd_varlink_error_invalid_parameter_name(link, "Names");
 
-  if (asprintf(&linkfn, "%s/%s.raw", config.extensions_dir, new->name) < 0)
-    return -ENOMEM;
-
-  if (!new->local && new->remote)
+  r = request_set_url(req);
+  if (r < 0)
     {
-      _cleanup_(unlink_and_free_tempfilep) char *tmpfn = NULL;
-      _cleanup_close_ int fd = -EBADF;
-
-      assert(url);
-
-      /* make sure directory exists and is a directory */
-      r = mkdir_p(config.sysext_store_dir, 0755);
-      if (r < 0)
-	{
-	  _cleanup_free_ char *error = NULL;
-	  if (asprintf(&error, "Failed to create directory '%s': %s",
-		       config.sysext_store_dir, strerror(-r)) < 0)
-	    error = NULL;
-
-	  log_msg(LOG_ERR, "%s", error);
-	  return sd_varlink_errorbo(link, "org.openSUSE.sysextmgr.InternalError",
-				    SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-				    SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
-	}
-
-      if (asprintf(&tmpfn, "%s/.%s.XXXXXX", config.sysext_store_dir, new->deps->image_name) < 0)
-	return -ENOMEM;
-
-      fd = mkostemp_safe(tmpfn);
-
-      r = download(url, new->deps->image_name, tmpfn, config.verify_signature);
-      if (r < 0)
-	{
-	  _cleanup_free_ char *error = NULL;
-	  if (asprintf(&error, "Failed to download '%s' from '%s': %s",
-		       new->deps->image_name, url, strerror(-r)) < 0)
-	    error = NULL;
-
-	  log_msg(LOG_ERR, "%s", error);
-	  return sd_varlink_errorbo(link, "org.openSUSE.sysextmgr.DownloadError",
-				    SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-				    SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
-	}
-
-      if (rename(tmpfn, fn) < 0)
-	{
-	  _cleanup_free_ char *error = NULL;
-	  if (asprintf(&error, "Error to rename '%s' to '%s': %m", tmpfn, fn) < 0)
-	    error = NULL;
-
-	  log_msg(LOG_ERR, "%s", error);
-	  return sd_varlink_errorbo(link, "org.openSUSE.sysextmgr.InternalError",
-				    SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-				    SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
-	}
+      request_fail_errno(TAKE_PTR(req), r);
+      return 0;
     }
 
-  /* make sure directory exists and is a directory */
-  r = mkdir_p(config.extensions_dir, 0755);
+  r = request_get_os_release(req);
   if (r < 0)
     {
-      _cleanup_free_ char *error = NULL;
-      if (asprintf(&error, "Failed to create directory '%s': %s",
-		   config.extensions_dir, strerror(-r)) < 0)
-	error = NULL;
-
-      log_msg(LOG_ERR, "%s", error);
-      return sd_varlink_errorbo(link, "org.openSUSE.sysextmgr.InternalError",
-				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-				SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
+      request_fail(TAKE_PTR(req), "org.openSUSE.sysextmgr.InternalError",
+		   "Couldn't read os-release file: %s", strerror(-r));
+      return 0;
     }
 
-  if (symlink(fn, linkfn) < 0)
-    {
-      _cleanup_free_ char *error = NULL;
-      if (asprintf(&error, "Error to symlink '%s' to '%s': %m", fn, linkfn) < 0)
-	error = NULL;
-
-      log_msg(LOG_ERR, "%s", error);
-      return sd_varlink_errorbo(link, "org.openSUSE.sysextmgr.InternalError",
-				SD_JSON_BUILD_PAIR_BOOLEAN("Success", false),
-				SD_JSON_BUILD_PAIR_STRING("ErrorMsg", error?error:"Out of Memory"));
-    }
+  /* one catalog snapshot for all images */
+  load_catalog_async(helper_pool, scan_pool, req->repositories, config.sysext_store_dir,
+		     req->names, true, config.verify_signature, req->host,
+		     req->p.verbose, install_catalog_done, req);
+  TAKE_PTR(req);
 
-  return sd_varlink_replybo(link, SD_JSON_BUILD_PAIR_BOOLEAN("Success", true),
-			    SD_JSON_BUILD_PAIR_STRING("Installed", new->deps->image_name));
+  return 0;
 }
 
 
@@ -986,9 +3776,10 @@ announce_stopping(void)
     log_msg(LOG_ERR, "sd_notify(STOPPING) failed: %s", strerror(-r));
 }
 
+/* image data kept between two runs, in the cache directory */
+#define STATE_FILE "catalog.state"
+
 /* event loop which quits after 30 seconds idle time */
-#define USEC_PER_SEC  ((uint64_t) 1000000ULL)
-#define DEFAULT_EXIT_USEC (30*USEC_PER_SEC)
 
 static int
 varlink_event_loop_with_idle(sd_event *e, sd_varlink_server *s)
@@ -1003,11 +3794,14 @@ varlink_event_loop_with_idle(sd_event *e, sd_varlink_server *s)
       if (r == SD_EVENT_FINISHED)
 	break;
 
-      r = sd_event_run(e, DEFAULT_EXIT_USEC);
+      r = sd_event_run(e, (uint64_t) config.idle_exit_timeout * USEC_PER_SEC);
       if (r < 0)
 	return r;
 
-      if (r == 0 && (sd_varlink_server_current_connections(s) == 0))
+      /* don't quit while a download of a disconnected client
+	 is still running */
+      if (r == 0 && (sd_varlink_server_current_connections(s) == 0) &&
+	  !process_pool_busy(helper_pool) && !process_pool_busy(scan_pool))
 	sd_event_exit(e, 0);
     }
 
@@ -1021,9 +3815,11 @@ varlink_event_loop_with_idle(sd_event *e, sd_varlink_server *s)
 static int
 run_varlink(void)
 {
+  unsigned max_scans;
   int r;
   _cleanup_(sd_event_unrefp) sd_event *event = NULL;
   _cleanup_(sd_varlink_server_unrefp) sd_varlink_server *varlink_server = NULL;
+  _cleanup_free_ char *state_fn = NULL;
 
   r = mkdir_p(_VARLINK_SYSEXTMGR_SOCKET_DIR, 0755);
   if (r < 0)
@@ -1041,7 +3837,48 @@ run_varlink(void)
       return r;
     }
 
-  r = sd_varlink_server_new(&varlink_server, SD_VARLINK_SERVER_ACCOUNT_UID|SD_VARLINK_SERVER_INHERIT_USERDATA);
+  /* systemd-pull and systemd-dissect calls of all requests run in
+     separate pools, the children are reaped by the main event loop */
+  r = process_pool_new(&helper_pool, event, config.max_parallel_downloads);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Failed to create process pool: %s",
+	       strerror(-r));
+      return r;
+    }
+
+  max_scans = config.max_parallel_scans;
+  if (max_scans == 0)
+    {
+      long n = sysconf(_SC_NPROCESSORS_ONLN);
+      max_scans = n > 0 ? (unsigned) n : 1;
+    }
+  r = process_pool_new(&scan_pool, event, max_scans);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Failed to create process pool: %s",
+	       strerror(-r));
+      return r;
+    }
+
+  /* keep the image data of the store and remote between requests,
+     inotify tells us about changes */
+  watches[0].path = "/etc/os-release";
+  watches[1].path = config.sysext_store_dir;
+  watches[2].path = config.extensions_dir;
+  catalog_cache_enable((uint64_t) config.remote_cache_ttl * USEC_PER_SEC);
+
+  /* start with the image data of the last run, e.g. before the
+     idle exit of a socket activated daemon */
+  if (join_path(config.cache_dir ? config.cache_dir : SYSEXTMGR_CACHE_DIR,
+		STATE_FILE, &state_fn) < 0)
+    state_fn = NULL;
+  else
+    catalog_cache_restore(state_fn);
+
+  /* Import gets the image as file descriptor */
+  r = sd_varlink_server_new(&varlink_server, SD_VARLINK_SERVER_ACCOUNT_UID|SD_VARLINK_SERVER_INHERIT_USERDATA|
+			    SD_VARLINK_SERVER_ALLOW_FD_PASSING_INPUT);
   if (r < 0)
     {
       log_msg(LOG_ERR, "Failed to allocate varlink server: %s",
@@ -1071,13 +3908,20 @@ run_varlink(void)
 
   r = sd_varlink_server_bind_method_many(varlink_server,
 					 "org.openSUSE.sysextmgr.Check",          vl_method_check,
+					 "org.openSUSE.sysextmgr.Plan",           vl_method_plan,
 					 "org.openSUSE.sysextmgr.Install",        vl_method_install,
 					 "org.openSUSE.sysextmgr.ListImages",     vl_method_list_images,
 					 "org.openSUSE.sysextmgr.Update",         vl_method_update,
+					 "org.openSUSE.sysextmgr.Prefetch",       vl_method_prefetch,
+					 "org.openSUSE.sysextmgr.Cleanup",        vl_method_cleanup,
+					 "org.openSUSE.sysextmgr.Import",         vl_method_import,
+					 "org.openSUSE.sysextmgr.Verify",         vl_method_verify,
 					 "org.openSUSE.sysextmgr.GetEnvironment", vl_method_get_environment,
+					 "org.openSUSE.sysextmgr.GetMetrics",     vl_method_get_metrics,
 					 "org.openSUSE.sysextmgr.Ping",           vl_method_ping,
 					 "org.openSUSE.sysextmgr.Quit",           vl_method_quit,
-					 "org.openSUSE.sysextmgr.SetLogLevel",    vl_method_set_log_level);
+					 "org.openSUSE.sysextmgr.SetLogLevel",    vl_method_set_log_level,
+					 "org.openSUSE.sysextmgr.Watch",          vl_method_watch);
   if (r < 0)
     {
       log_msg(LOG_ERR, "Failed to bind Varlink methods: %s",
@@ -1087,6 +3931,15 @@ run_varlink(void)
 
   sd_varlink_server_set_userdata(varlink_server, event);
 
+  /* a Watch call ends with the connection */
+  r = sd_varlink_server_bind_disconnect(varlink_server, vl_disconnect);
+  if (r < 0)
+    {
+      log_msg(LOG_ERR, "Failed to bind disconnect handler: %s",
+	      strerror(-r));
+      return r;
+    }
+
   r = sd_varlink_server_attach_event(varlink_server, event, SD_EVENT_PRIORITY_NORMAL);
   if (r < 0)
     {
@@ -1119,6 +3972,21 @@ run_varlink(void)
     r = sd_event_loop(event);
   announce_stopping();
 
+  subscribers_free();
+  free_refresh();
+  if (state_fn)
+    {
+      int k = catalog_cache_save(state_fn, resident_osrelease ?
+				 resident_osrelease->host : NULL);
+      if (k < 0)
+	log_msg(LOG_WARNING, "Failed to write state file '%s': %s",
+		state_fn, strerror(-k));
+    }
+  free_watches();
+  helper_pool = free_process_pool(helper_pool);
+  scan_pool = free_process_pool(scan_pool);
+  mirror_free();
+
   return r;
 }
 
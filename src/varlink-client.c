@@ -1,10 +1,32 @@
 // SPDX-License-Identifier: GPL-2.0-or-later
 
+#include <assert.h>
+#include <stdbool.h>
+
 #include "basics.h"
 #include "varlink-client.h"
 
+/* connection shared by the commands of a batch */
+static struct {
+  bool enabled;
+  sd_varlink *link;
+} batch;
+
+void
+varlink_batch_begin(void)
+{
+  batch.enabled = true;
+}
+
+void
+varlink_batch_end(void)
+{
+  batch.link = sd_varlink_flush_close_unref(batch.link);
+  batch.enabled = false;
+}
+
 int
-connect_to_sysextmgrd(sd_varlink **ret, const char *socket)
+connect_to_sysextmgrd_private(sd_varlink **ret, const char *socket)
 {
   _cleanup_(sd_varlink_unrefp) sd_varlink *link = NULL;
   int r;
@@ -19,3 +41,122 @@ connect_to_sysextmgrd(sd_varlink **ret, const char *socket)
   *ret = TAKE_PTR(link);
   return 0;
 }
+
+/* In a batch, the connection of the previous command gets reused as
+   long as sysextmgrd did not close it. Only one call is running on
+   it at any time. */
+int
+connect_to_sysextmgrd(sd_varlink **ret, const char *socket)
+{
+  int r;
+
+  if (!batch.enabled)
+    return connect_to_sysextmgrd_private(ret, socket);
+
+  if (batch.link && sd_varlink_is_connected(batch.link) > 0)
+    {
+      *ret = sd_varlink_ref(batch.link);
+      return 0;
+    }
+
+  batch.link = sd_varlink_unref(batch.link);
+  r = connect_to_sysextmgrd_private(&batch.link, socket);
+  if (r < 0)
+    return r;
+
+  *ret = sd_varlink_ref(batch.link);
+  return 0;
+}
+
+struct call_more {
+  varlink_progress_t progress;
+  void *userdata;
+  sd_json_variant *result;
+  char *error_id;
+  bool done;
+};
+
+static int
+call_more_reply(sd_varlink *link, sd_json_variant *parameters,
+		const char *error_id, sd_varlink_reply_flags_t flags,
+		void _unused_(*userdata))
+{
+  struct call_more *c = sd_varlink_get_userdata(link);
+
+  if (error_id || !(flags & SD_VARLINK_REPLY_CONTINUES))
+    {
+      c->result = sd_json_variant_ref(parameters);
+      if (error_id)
+	{
+	  c->error_id = strdup(error_id);
+	  if (c->error_id == NULL)
+	    return -ENOMEM;
+	}
+      c->done = true;
+      return 0;
+    }
+
+  if (c->progress)
+    c->progress(parameters, c->userdata);
+
+  return 0;
+}
+
+/* Like sd_varlink_call(), but with "more": progress gets called for
+   every intermediate reply. The final reply and error_id are returned
+   and need to be freed by the caller. */
+int
+varlink_call_more(sd_varlink *link, const char *method,
+		  sd_json_variant *params, varlink_progress_t progress,
+		  void *userdata, sd_json_variant **ret_result,
+		  char **ret_error_id)
+{
+  struct call_more c = {
+    .progress = progress,
+    .userdata = userdata,
+    .result = NULL,
+    .error_id = NULL,
+    .done = false,
+  };
+  int r;
+
+  assert(ret_result);
+  assert(ret_error_id);
+
+  sd_varlink_set_userdata(link, &c);
+
+  r = sd_varlink_bind_reply(link, call_more_reply);
+  if (r < 0)
+    return r;
+
+  r = sd_varlink_observe(link, method, params);
+  if (r < 0)
+    return r;
+
+  while (!c.done)
+    {
+      r = sd_varlink_process(link);
+      if (r < 0)
+	break;
+      if (r > 0)
+	continue;
+
+      r = sd_varlink_wait(link, UINT64_MAX);
+      if (r < 0)
+	break;
+    }
+
+  sd_varlink_set_userdata(link, NULL);
+
+  if (r < 0)
+    {
+      sd_json_variant_unref(c.result);
+      free(c.error_id);
+      return r;
+    }
+
+  *ret_result = c.result;
+  *ret_error_id = c.error_id;
+
+  return 0;
+}
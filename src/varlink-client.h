@@ -3,13 +3,33 @@
 #pragma once
 
 #include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <systemd/sd-varlink.h>
 
 #define VARLINK_IS_NOT_RUNNING(r) (r == -ECONNREFUSED || r == -ENOENT || r == -ECONNRESET || r == -EACCES)
 
+typedef void (*varlink_progress_t)(sd_json_variant *parameters, void *userdata);
+
 extern int connect_to_sysextmgrd(sd_varlink **ret, const char *socket);
+/* a connection which is never shared with other commands */
+extern int connect_to_sysextmgrd_private(sd_varlink **ret, const char *socket);
+/* between these calls, connect_to_sysextmgrd() returns the same
+   connection again */
+extern void varlink_batch_begin(void);
+extern void varlink_batch_end(void);
+extern int varlink_call_more(sd_varlink *link, const char *method,
+		sd_json_variant *params, varlink_progress_t progress,
+		void *userdata, sd_json_variant **ret_result,
+		char **ret_error_id);
 extern int varlink_list_images (const char *url);
 extern int varlink_check (const char *url);
 extern int varlink_update (const char *url);
-extern int varlink_install (const char *name, const char *url);
+extern int varlink_prefetch (const char *url);
+extern int varlink_install (char **names, const char *url);
+extern int varlink_metrics (bool json);
+extern int varlink_plan (const char *url, char **roots, char **os_releases);
+extern int varlink_cleanup (bool dry_run, int64_t keep_versions, int64_t max_size, bool quiet);
+extern int varlink_import (const char *path, const char *name, const char *sha256, bool quiet);
+extern int varlink_verify (char **names, bool quiet);
 
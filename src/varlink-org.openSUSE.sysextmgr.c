@@ -23,6 +23,8 @@ static SD_VARLINK_DEFINE_STRUCT_TYPE(ImageData,
 				     SD_VARLINK_DEFINE_FIELD(LOCAL,             SD_VARLINK_BOOL,   SD_VARLINK_NULLABLE),
 				     SD_VARLINK_FIELD_COMMENT("Image is remote available at URL"),
 				     SD_VARLINK_DEFINE_FIELD(REMOTE,            SD_VARLINK_BOOL,   SD_VARLINK_NULLABLE),
+				     SD_VARLINK_FIELD_COMMENT("URL of the repository providing the remote image"),
+				     SD_VARLINK_DEFINE_FIELD(REPOSITORY,        SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
 				     SD_VARLINK_FIELD_COMMENT("Image is installed (linked into /etc/extensions)"),
 				     SD_VARLINK_DEFINE_FIELD(INSTALLED,         SD_VARLINK_BOOL,   SD_VARLINK_NULLABLE),
 				     SD_VARLINK_FIELD_COMMENT("Image is compatible to installed OS and HW architecture"),
@@ -34,6 +36,18 @@ static SD_VARLINK_DEFINE_STRUCT_TYPE(UpdatedImage,
 				     SD_VARLINK_FIELD_COMMENT("New Image Name"),
 				     SD_VARLINK_DEFINE_FIELD(NewImage, SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
 
+static SD_VARLINK_DEFINE_STRUCT_TYPE(Progress,
+				     SD_VARLINK_FIELD_COMMENT("Image this progress message is about"),
+				     SD_VARLINK_DEFINE_FIELD(Image,      SD_VARLINK_STRING, 0),
+				     SD_VARLINK_FIELD_COMMENT("Installed image which gets replaced"),
+				     SD_VARLINK_DEFINE_FIELD(OldImage,   SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
+				     SD_VARLINK_FIELD_COMMENT("One of up-to-date, resolved, downloading, downloaded or linked"),
+				     SD_VARLINK_DEFINE_FIELD(State,      SD_VARLINK_STRING, 0),
+				     SD_VARLINK_FIELD_COMMENT("Number of bytes downloaded so far"),
+				     SD_VARLINK_DEFINE_FIELD(BytesDone,  SD_VARLINK_INT,    SD_VARLINK_NULLABLE),
+				     SD_VARLINK_FIELD_COMMENT("Size of the image, only known after the download"),
+				     SD_VARLINK_DEFINE_FIELD(BytesTotal, SD_VARLINK_INT,    SD_VARLINK_NULLABLE));
+
 static SD_VARLINK_DEFINE_METHOD(
                 Check,
                 SD_VARLINK_FIELD_COMMENT("URL of remote sysext images, requires root rights"),
@@ -47,18 +61,54 @@ static SD_VARLINK_DEFINE_METHOD(
                 SD_VARLINK_FIELD_COMMENT("Error Message"),
                 SD_VARLINK_DEFINE_OUTPUT(ErrorMsg, SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
 
+static SD_VARLINK_DEFINE_STRUCT_TYPE(PlanTarget,
+				     SD_VARLINK_FIELD_COMMENT("Root directory of the target, e.g. a snapshot, requires root rights"),
+				     SD_VARLINK_DEFINE_FIELD(Root,       SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
+				     SD_VARLINK_FIELD_COMMENT("Content of the os-release file of the target, the installed images of the host are used"),
+				     SD_VARLINK_DEFINE_FIELD(OsRelease,  SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
+
+static SD_VARLINK_DEFINE_STRUCT_TYPE(TargetPlan,
+				     SD_VARLINK_FIELD_COMMENT("Position of the target in Targets"),
+				     SD_VARLINK_DEFINE_FIELD(Index,      SD_VARLINK_INT, 0),
+				     SD_VARLINK_FIELD_COMMENT("Root directory of the target"),
+				     SD_VARLINK_DEFINE_FIELD(Root,       SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
+				     SD_VARLINK_FIELD_COMMENT("Installed images and their compatible updates for the target"),
+				     SD_VARLINK_DEFINE_FIELD_BY_TYPE(Images, UpdatedImage, SD_VARLINK_ARRAY | SD_VARLINK_NULLABLE),
+				     SD_VARLINK_FIELD_COMMENT("Why no plan could be made for this target"),
+				     SD_VARLINK_DEFINE_FIELD(ErrorMsg,   SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
+
 static SD_VARLINK_DEFINE_METHOD(
+                Plan,
+                SD_VARLINK_FIELD_COMMENT("URL of remote sysext images, requires root rights"),
+                SD_VARLINK_DEFINE_INPUT(URL, SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Verbose logging to journald"),
+		SD_VARLINK_DEFINE_INPUT(Verbose, SD_VARLINK_BOOL, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Systems to compute the updates for"),
+		SD_VARLINK_DEFINE_INPUT_BY_TYPE(Targets, PlanTarget, SD_VARLINK_ARRAY),
+		SD_VARLINK_FIELD_COMMENT("If call succeeded"),
+		SD_VARLINK_DEFINE_OUTPUT(Success, SD_VARLINK_BOOL, 0),
+                SD_VARLINK_FIELD_COMMENT("One entry for every target"),
+		SD_VARLINK_DEFINE_OUTPUT_BY_TYPE(Plans, TargetPlan, SD_VARLINK_ARRAY | SD_VARLINK_NULLABLE),
+                SD_VARLINK_FIELD_COMMENT("Error Message"),
+                SD_VARLINK_DEFINE_OUTPUT(ErrorMsg, SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
+
+static SD_VARLINK_DEFINE_METHOD_FULL(
                 Install,
-		SD_VARLINK_FIELD_COMMENT("Name of sysext images"),
-                SD_VARLINK_DEFINE_INPUT(Install, SD_VARLINK_STRING, 0),
+                SD_VARLINK_SUPPORTS_MORE,
+		SD_VARLINK_FIELD_COMMENT("Name of a sysext image, same as Names with one entry"),
+                SD_VARLINK_DEFINE_INPUT(Install, SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
+                SD_VARLINK_FIELD_COMMENT("Names of sysext images, installed together"),
+                SD_VARLINK_DEFINE_INPUT(Names, SD_VARLINK_STRING, SD_VARLINK_ARRAY | SD_VARLINK_NULLABLE),
                 SD_VARLINK_FIELD_COMMENT("URL of remote sysext images"),
                 SD_VARLINK_DEFINE_INPUT(URL, SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
                 SD_VARLINK_FIELD_COMMENT("Verbose logging to journald"),
                 SD_VARLINK_DEFINE_INPUT(Verbose, SD_VARLINK_BOOL, SD_VARLINK_NULLABLE),
                 SD_VARLINK_FIELD_COMMENT("If call succeeded"),
                 SD_VARLINK_DEFINE_OUTPUT(Success, SD_VARLINK_BOOL, 0),
-                SD_VARLINK_FIELD_COMMENT("Data of sysext images"),
-                SD_VARLINK_DEFINE_OUTPUT_BY_TYPE(Images, ImageData, SD_VARLINK_ARRAY | SD_VARLINK_NULLABLE),
+                SD_VARLINK_FIELD_COMMENT("Full names of the installed images"),
+                SD_VARLINK_DEFINE_OUTPUT(Installed, SD_VARLINK_STRING, SD_VARLINK_ARRAY | SD_VARLINK_NULLABLE),
+                SD_VARLINK_FIELD_COMMENT("Progress of the installation, only with 'more'"),
+                SD_VARLINK_DEFINE_OUTPUT_BY_TYPE(Progress, Progress, SD_VARLINK_NULLABLE),
                 SD_VARLINK_FIELD_COMMENT("Error Message"),
                 SD_VARLINK_DEFINE_OUTPUT(ErrorMsg, SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
 
@@ -68,15 +118,28 @@ static SD_VARLINK_DEFINE_METHOD(
                 SD_VARLINK_DEFINE_INPUT(URL, SD_VARLINK_STRING,  SD_VARLINK_NULLABLE),
 		SD_VARLINK_FIELD_COMMENT("Verbose logging to journald"),
 		SD_VARLINK_DEFINE_INPUT(Verbose, SD_VARLINK_BOOL, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Only list images with one of these names"),
+		SD_VARLINK_DEFINE_INPUT(Names, SD_VARLINK_STRING, SD_VARLINK_ARRAY | SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Only list installed images"),
+		SD_VARLINK_DEFINE_INPUT(OnlyInstalled, SD_VARLINK_BOOL, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Only list images compatible to the OS"),
+		SD_VARLINK_DEFINE_INPUT(OnlyCompatible, SD_VARLINK_BOOL, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Number of matching images to skip"),
+		SD_VARLINK_DEFINE_INPUT(Offset, SD_VARLINK_INT, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Maximal number of images to return, 0 for all"),
+		SD_VARLINK_DEFINE_INPUT(Limit, SD_VARLINK_INT, SD_VARLINK_NULLABLE),
 		SD_VARLINK_FIELD_COMMENT("If call succeeded"),
 		SD_VARLINK_DEFINE_OUTPUT(Success, SD_VARLINK_BOOL, 0),
                 SD_VARLINK_FIELD_COMMENT("Data of sysext images"),
 		SD_VARLINK_DEFINE_OUTPUT_BY_TYPE(Images, ImageData, SD_VARLINK_ARRAY | SD_VARLINK_NULLABLE),
+                SD_VARLINK_FIELD_COMMENT("Number of matching images, independent of Offset and Limit"),
+		SD_VARLINK_DEFINE_OUTPUT(Total, SD_VARLINK_INT, SD_VARLINK_NULLABLE),
                 SD_VARLINK_FIELD_COMMENT("Error Message"),
                 SD_VARLINK_DEFINE_OUTPUT(ErrorMsg, SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
 
-static SD_VARLINK_DEFINE_METHOD(
+static SD_VARLINK_DEFINE_METHOD_FULL(
                 Update,
+                SD_VARLINK_SUPPORTS_MORE,
                 SD_VARLINK_FIELD_COMMENT("URL of remote sysext images, requires root rights"),
                 SD_VARLINK_DEFINE_INPUT(URL, SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
 		SD_VARLINK_FIELD_COMMENT("Verbose logging to journald"),
@@ -85,9 +148,96 @@ static SD_VARLINK_DEFINE_METHOD(
 		SD_VARLINK_DEFINE_OUTPUT(Success, SD_VARLINK_BOOL, 0),
                 SD_VARLINK_FIELD_COMMENT("List of updated images"),
 		SD_VARLINK_DEFINE_OUTPUT_BY_TYPE(Images, UpdatedImage, SD_VARLINK_ARRAY | SD_VARLINK_NULLABLE),
+                SD_VARLINK_FIELD_COMMENT("Progress of the update, only with 'more'"),
+		SD_VARLINK_DEFINE_OUTPUT_BY_TYPE(Progress, Progress, SD_VARLINK_NULLABLE),
+                SD_VARLINK_FIELD_COMMENT("Error Message"),
+                SD_VARLINK_DEFINE_OUTPUT(ErrorMsg, SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
+
+static SD_VARLINK_DEFINE_METHOD_FULL(
+                Prefetch,
+                SD_VARLINK_SUPPORTS_MORE,
+                SD_VARLINK_FIELD_COMMENT("URL of remote sysext images, requires root rights"),
+                SD_VARLINK_DEFINE_INPUT(URL, SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Verbose logging to journald"),
+		SD_VARLINK_DEFINE_INPUT(Verbose, SD_VARLINK_BOOL, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("If call succeeded"),
+		SD_VARLINK_DEFINE_OUTPUT(Success, SD_VARLINK_BOOL, 0),
+                SD_VARLINK_FIELD_COMMENT("Installed images and the newer versions now in the store"),
+		SD_VARLINK_DEFINE_OUTPUT_BY_TYPE(Prefetched, UpdatedImage, SD_VARLINK_ARRAY | SD_VARLINK_NULLABLE),
+                SD_VARLINK_FIELD_COMMENT("Progress of the downloads, only with 'more'"),
+		SD_VARLINK_DEFINE_OUTPUT_BY_TYPE(Progress, Progress, SD_VARLINK_NULLABLE),
+                SD_VARLINK_FIELD_COMMENT("Error Message"),
+                SD_VARLINK_DEFINE_OUTPUT(ErrorMsg, SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
+
+static SD_VARLINK_DEFINE_METHOD(
+                Cleanup,
+                SD_VARLINK_FIELD_COMMENT("Only report what would be removed"),
+                SD_VARLINK_DEFINE_INPUT(DryRun, SD_VARLINK_BOOL, SD_VARLINK_NULLABLE),
+                SD_VARLINK_FIELD_COMMENT("Versions to keep per name, 0 keeps all, default gc_keep_versions"),
+                SD_VARLINK_DEFINE_INPUT(KeepVersions, SD_VARLINK_INT, SD_VARLINK_NULLABLE),
+                SD_VARLINK_FIELD_COMMENT("Size limit of the store in MiB, 0 is no limit, default gc_max_store_size"),
+                SD_VARLINK_DEFINE_INPUT(MaxStoreSize, SD_VARLINK_INT, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Verbose logging to journald"),
+		SD_VARLINK_DEFINE_INPUT(Verbose, SD_VARLINK_BOOL, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("If call succeeded"),
+		SD_VARLINK_DEFINE_OUTPUT(Success, SD_VARLINK_BOOL, 0),
+                SD_VARLINK_FIELD_COMMENT("Images removed from the store"),
+                SD_VARLINK_DEFINE_OUTPUT(Removed, SD_VARLINK_STRING, SD_VARLINK_ARRAY | SD_VARLINK_NULLABLE),
+                SD_VARLINK_FIELD_COMMENT("Bytes freed"),
+                SD_VARLINK_DEFINE_OUTPUT(FreedBytes, SD_VARLINK_INT, SD_VARLINK_NULLABLE),
+                SD_VARLINK_FIELD_COMMENT("Bytes of the images remaining in the store"),
+                SD_VARLINK_DEFINE_OUTPUT(StoreBytes, SD_VARLINK_INT, SD_VARLINK_NULLABLE),
+                SD_VARLINK_FIELD_COMMENT("Error Message"),
+                SD_VARLINK_DEFINE_OUTPUT(ErrorMsg, SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
+
+static SD_VARLINK_DEFINE_METHOD(
+                Import,
+                SD_VARLINK_FIELD_COMMENT("File name of the image in the store, the image itself is passed as file descriptor"),
+                SD_VARLINK_DEFINE_INPUT(Name, SD_VARLINK_STRING, 0),
+                SD_VARLINK_FIELD_COMMENT("Expected SHA256 sum of the image"),
+                SD_VARLINK_DEFINE_INPUT(SHA256, SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Verbose logging to journald"),
+		SD_VARLINK_DEFINE_INPUT(Verbose, SD_VARLINK_BOOL, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("If call succeeded"),
+		SD_VARLINK_DEFINE_OUTPUT(Success, SD_VARLINK_BOOL, 0),
+                SD_VARLINK_FIELD_COMMENT("SHA256 sum of the imported image"),
+                SD_VARLINK_DEFINE_OUTPUT(SHA256, SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
                 SD_VARLINK_FIELD_COMMENT("Error Message"),
                 SD_VARLINK_DEFINE_OUTPUT(ErrorMsg, SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
 
+static SD_VARLINK_DEFINE_STRUCT_TYPE(VerifiedImage,
+				     SD_VARLINK_FIELD_COMMENT("File name of the image in the store"),
+				     SD_VARLINK_DEFINE_FIELD(Image,  SD_VARLINK_STRING, 0),
+				     SD_VARLINK_FIELD_COMMENT("One of ok, corrupt, unreadable, removed or unknown (no recorded sum)"),
+				     SD_VARLINK_DEFINE_FIELD(State,  SD_VARLINK_STRING, 0),
+				     SD_VARLINK_FIELD_COMMENT("SHA256 sum recorded when the image was stored"),
+				     SD_VARLINK_DEFINE_FIELD(SHA256, SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
+
+static SD_VARLINK_DEFINE_METHOD(
+                Verify,
+                SD_VARLINK_FIELD_COMMENT("File names of the images to verify, default all images of the store"),
+                SD_VARLINK_DEFINE_INPUT(Names, SD_VARLINK_STRING, SD_VARLINK_ARRAY | SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("Verbose logging to journald"),
+		SD_VARLINK_DEFINE_INPUT(Verbose, SD_VARLINK_BOOL, SD_VARLINK_NULLABLE),
+		SD_VARLINK_FIELD_COMMENT("If call succeeded"),
+		SD_VARLINK_DEFINE_OUTPUT(Success, SD_VARLINK_BOOL, 0),
+                SD_VARLINK_FIELD_COMMENT("State of every image"),
+                SD_VARLINK_DEFINE_OUTPUT_BY_TYPE(Images, VerifiedImage, SD_VARLINK_ARRAY | SD_VARLINK_NULLABLE),
+                SD_VARLINK_FIELD_COMMENT("Number of corrupt or unreadable images"),
+                SD_VARLINK_DEFINE_OUTPUT(Failed, SD_VARLINK_INT, SD_VARLINK_NULLABLE),
+                SD_VARLINK_FIELD_COMMENT("Error Message"),
+                SD_VARLINK_DEFINE_OUTPUT(ErrorMsg, SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
+
+static SD_VARLINK_DEFINE_METHOD_FULL(
+                Watch,
+                SD_VARLINK_REQUIRES_MORE,
+                SD_VARLINK_FIELD_COMMENT("One of subscribed, store-added, store-removed, link-changed or update-available"),
+                SD_VARLINK_DEFINE_OUTPUT(Event, SD_VARLINK_STRING, 0),
+                SD_VARLINK_FIELD_COMMENT("File name of the image or link the event is about"),
+                SD_VARLINK_DEFINE_OUTPUT(Image, SD_VARLINK_STRING, SD_VARLINK_NULLABLE),
+                SD_VARLINK_FIELD_COMMENT("Installed image the update is for"),
+                SD_VARLINK_DEFINE_OUTPUT(OldImage, SD_VARLINK_STRING, SD_VARLINK_NULLABLE));
+
 static SD_VARLINK_DEFINE_METHOD(
 		Quit,
 		SD_VARLINK_FIELD_COMMENT("Optional error code for exit function"),
@@ -110,6 +260,39 @@ static SD_VARLINK_DEFINE_METHOD(
                 SD_VARLINK_FIELD_COMMENT("Returns the current environment block, i.e. the contents of environ[]."),
                 SD_VARLINK_DEFINE_OUTPUT(Environment, SD_VARLINK_STRING, SD_VARLINK_NULLABLE|SD_VARLINK_ARRAY));
 
+static SD_VARLINK_DEFINE_STRUCT_TYPE(HistogramBucket,
+				     SD_VARLINK_FIELD_COMMENT("Upper bound of the bucket in usec"),
+				     SD_VARLINK_DEFINE_FIELD(LE,    SD_VARLINK_INT, 0),
+				     SD_VARLINK_FIELD_COMMENT("Number of calls which took at most LE usec"),
+				     SD_VARLINK_DEFINE_FIELD(Count, SD_VARLINK_INT, 0));
+
+static SD_VARLINK_DEFINE_STRUCT_TYPE(PhaseMetrics,
+				     SD_VARLINK_FIELD_COMMENT("One of sums-fetch, index-fetch, json-fetch, dissect, validate, download or link"),
+				     SD_VARLINK_DEFINE_FIELD(Name,      SD_VARLINK_STRING, 0),
+				     SD_VARLINK_FIELD_COMMENT("Number of calls"),
+				     SD_VARLINK_DEFINE_FIELD(Count,     SD_VARLINK_INT,    0),
+				     SD_VARLINK_FIELD_COMMENT("Number of failed calls"),
+				     SD_VARLINK_DEFINE_FIELD(Failed,    SD_VARLINK_INT,    0),
+				     SD_VARLINK_FIELD_COMMENT("Time of all calls in usec"),
+				     SD_VARLINK_DEFINE_FIELD(TotalUSec, SD_VARLINK_INT,    0),
+				     SD_VARLINK_FIELD_COMMENT("Time of the slowest call in usec"),
+				     SD_VARLINK_DEFINE_FIELD(MaxUSec,   SD_VARLINK_INT,    0),
+				     SD_VARLINK_FIELD_COMMENT("Latency histogram, cumulative"),
+				     SD_VARLINK_DEFINE_FIELD_BY_TYPE(Buckets, HistogramBucket, SD_VARLINK_ARRAY));
+
+static SD_VARLINK_DEFINE_STRUCT_TYPE(CounterMetric,
+				     SD_VARLINK_FIELD_COMMENT("One of download-bytes, catalog-cached, catalog-loaded, metadata-cached or metadata-skipped"),
+				     SD_VARLINK_DEFINE_FIELD(Name,  SD_VARLINK_STRING, 0),
+				     SD_VARLINK_DEFINE_FIELD(Value, SD_VARLINK_INT,    0));
+
+static SD_VARLINK_DEFINE_METHOD(
+                GetMetrics,
+                SD_VARLINK_FIELD_COMMENT("Counters and latencies of all phases since the start, requires root rights"),
+                SD_VARLINK_DEFINE_OUTPUT_BY_TYPE(Phases, PhaseMetrics, SD_VARLINK_ARRAY),
+                SD_VARLINK_DEFINE_OUTPUT_BY_TYPE(Counters, CounterMetric, SD_VARLINK_ARRAY),
+                SD_VARLINK_FIELD_COMMENT("Downloaded bytes divided by the time of all download attempts"),
+                SD_VARLINK_DEFINE_OUTPUT(DownloadBytesPerSecond, SD_VARLINK_INT, 0));
+
 static SD_VARLINK_DEFINE_ERROR(NoEntryFound);
 static SD_VARLINK_DEFINE_ERROR(InternalError);
 static SD_VARLINK_DEFINE_ERROR(DownloadError);
@@ -120,12 +303,26 @@ SD_VARLINK_DEFINE_INTERFACE(
 		SD_VARLINK_INTERFACE_COMMENT("SysextMgr control APIs"),
 		SD_VARLINK_SYMBOL_COMMENT("Check for newer compatible images for installed onces"),
                 &vl_method_Check,
-		SD_VARLINK_SYMBOL_COMMENT("Install newest compatible image with this name"),
+		SD_VARLINK_SYMBOL_COMMENT("Compute the updates for other systems like snapshots from the same image data"),
+                &vl_method_Plan,
+		SD_VARLINK_SYMBOL_COMMENT("Install newest compatible images with these names"),
                 &vl_method_Install,
 		SD_VARLINK_SYMBOL_COMMENT("List all images including dependencies"),
                 &vl_method_ListImages,
 		SD_VARLINK_SYMBOL_COMMENT("Update installed images"),
                 &vl_method_Update,
+		SD_VARLINK_SYMBOL_COMMENT("Download updates of installed images without switching to them"),
+                &vl_method_Prefetch,
+		SD_VARLINK_SYMBOL_COMMENT("Remove images of the store which are not linked and not kept by the retention policy, requires root rights"),
+                &vl_method_Cleanup,
+		SD_VARLINK_SYMBOL_COMMENT("Copy an image passed as file descriptor into the store, requires root rights"),
+                &vl_method_Import,
+		SD_VARLINK_SYMBOL_COMMENT("Check the images of the store against the SHA256 sums recorded when they were stored, requires root rights"),
+                &vl_method_Verify,
+		SD_VARLINK_SYMBOL_COMMENT("Result of Verify for one image"),
+                &vl_type_VerifiedImage,
+		SD_VARLINK_SYMBOL_COMMENT("Report changes of the store and of installed images and new updates"),
+                &vl_method_Watch,
  		SD_VARLINK_SYMBOL_COMMENT("Stop the daemon"),
                 &vl_method_Quit,
 		SD_VARLINK_SYMBOL_COMMENT("Checks if the service is running."),
@@ -134,6 +331,8 @@ SD_VARLINK_DEFINE_INTERFACE(
                 &vl_method_SetLogLevel,
                 SD_VARLINK_SYMBOL_COMMENT("Get current environment block."),
                 &vl_method_GetEnvironment,
+		SD_VARLINK_SYMBOL_COMMENT("Get counters and latency histograms of the request phases"),
+                &vl_method_GetMetrics,
 		SD_VARLINK_SYMBOL_COMMENT("No entry found"),
                 &vl_error_NoEntryFound,
 		SD_VARLINK_SYMBOL_COMMENT("Internal Error"),
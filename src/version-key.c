@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "basics.h"
+#include "version-key.h"
+
+/* A digit run is stored as '0', the number of significant digits + 1
+   and the digits. '0' itself does not occur otherwise, so a number
+   sorts where the digits would sort. A longer number is the larger
+   one, the count is never 0 and the key has no NUL byte. */
+#define NUMBER_MARK '0'
+#define MAX_DIGITS 254
+
+int
+version_key_new(const char *version, char **res)
+{
+  _cleanup_free_ char *key = NULL;
+  size_t n = 0;
+
+  assert(version);
+  assert(res);
+
+  /* worst case is "0.0.0", every digit becomes 3 bytes */
+  key = malloc(3 * strlen(version) + 1);
+  if (key == NULL)
+    return -ENOMEM;
+
+  for (const char *p = version; *p;)
+    {
+      const char *start;
+      size_t len;
+
+      if (*p < '0' || *p > '9')
+	{
+	  key[n++] = *p++;
+	  continue;
+	}
+
+      while (*p == '0')
+	p++;
+      start = p;
+      while (*p >= '0' && *p <= '9')
+	p++;
+      len = p - start;
+      /* saturate, nobody uses such version numbers */
+      if (len > MAX_DIGITS)
+	len = MAX_DIGITS;
+
+      key[n++] = NUMBER_MARK;
+      key[n++] = (char) (len + 1);
+      memcpy(key + n, start, len);
+      n += len;
+    }
+  key[n] = '\0';
+
+  *res = TAKE_PTR(key);
+
+  return 0;
+}
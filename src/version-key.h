@@ -0,0 +1,10 @@
+//SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+/* A version string converted into a key which compares with
+   strcmp(). Runs of digits compare by their numeric value, all other
+   characters by their value, with a number sorting after "." or "-"
+   and before letters or "~", like strverscmp() does. Leading zeros
+   are ignored, so "1.05" is the same as "1.5". */
+extern int version_key_new(const char *version, char **res);
@@ -0,0 +1,648 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/* Benchmarks of the catalog and update paths of sysextmgrd against a
+   synthetic repository. The downloads are done by
+   fake-systemd-pull.sh, which copies file:// URLs and sleeps
+   SYSEXTMGR_BENCH_LATENCY seconds first. */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "basics.h"
+#include "sysextmgr.h"
+#include "architecture.h"
+#include "host-profile.h"
+#include "images-list.h"
+#include "extrelease.h"
+#include "sums.h"
+#include "catalog.h"
+#include "catalog-index.h"
+#include "sha256.h"
+#include "metrics.h"
+#include "log_msg.h"
+
+/* versions of every image name in the repository */
+#define VERSIONS_PER_NAME 3
+
+/* input size of the parser cases, for the throughput */
+static uint64_t parsed_bytes = 0;
+
+void
+oom(void)
+{
+  log_msg(LOG_CRIT, "Out of memory");
+  exit (1);
+}
+
+void
+usage(int retval)
+{
+  fputs("Usage: bench-sysextmgr generate <directory> <images> [--no-index]\n"
+	"       bench-sysextmgr <case> <images> [iterations]\n\n"
+	"Cases: remote, remote-noindex, remote-lazy, load-json, load-index, list, check, validate,\n"
+	"       parse-sums, parse-release\n",
+	stderr);
+  exit(retval);
+}
+
+static int
+write_file(const char *dir, const char *fn, const char *data, size_t len,
+	   char hex[2 * SHA256_DIGEST_SIZE + 1])
+{
+  _cleanup_free_ char *path = NULL;
+  _cleanup_close_ int fd = -EBADF;
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  struct sha256_ctx ctx;
+
+  if (asprintf(&path, "%s/%s", dir, fn) < 0)
+    return -ENOMEM;
+
+  fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+  if (fd < 0)
+    return -errno;
+  if (write(fd, data, len) != (ssize_t) len)
+    return -EIO;
+
+  sha256_init(&ctx);
+  sha256_update(&ctx, data, len);
+  sha256_final(&ctx, digest);
+  for (size_t i = 0; i < SHA256_DIGEST_SIZE; i++)
+    sprintf(hex + 2 * i, "%02x", digest[i]);
+
+  return 0;
+}
+
+/* One in ten images is built for another distribution, the rest
+   shares a few extension-release tuples like a real repository. */
+static int
+image_json(size_t i, const char *arch, char **res)
+{
+  return asprintf(res,
+		  "{\"image_name\":\"ext%zu-1.%zu.%s.raw\",\"sysext\":{"
+		  "\"ID\":\"%s\",\"VERSION_ID\":\"%zu\",\"SYSEXT_VERSION_ID\":\"1.%zu\","
+		  "\"SYSEXT_SCOPE\":\"system\",\"ARCHITECTURE\":\"%s\"}}",
+		  i / VERSIONS_PER_NAME, i % VERSIONS_PER_NAME, arch,
+		  i % 10 == 9 ? "other" : "bench", 1 + i % 2,
+		  i % VERSIONS_PER_NAME, arch);
+}
+
+static int
+load_index(const char *dir, struct image_deps ***res)
+{
+  _cleanup_free_ char *fn = NULL;
+
+  if (asprintf(&fn, "%s/sysext-deps.json", dir) < 0)
+    return -ENOMEM;
+
+  return load_image_json(-1, fn, res);
+}
+
+/* the binary index with the entries of sysext-deps.json */
+static int
+write_binary_index(const char *dir, FILE *sums)
+{
+  _cleanup_(free_image_deps_list) struct image_deps **deps = NULL;
+  _cleanup_free_ char *fn = NULL;
+  _cleanup_close_ int fd = -EBADF;
+  char hex[2 * SHA256_DIGEST_SIZE + 1];
+  int r;
+
+  r = load_index(dir, &deps);
+  if (r < 0)
+    return r;
+
+  if (asprintf(&fn, "%s/%s", dir, CATALOG_INDEX) < 0)
+    return -ENOMEM;
+  fd = open(fn, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+  if (fd < 0)
+    return -errno;
+
+  r = catalog_index_write(fd, deps);
+  if (r < 0)
+    return r;
+  r = sha256_fd(fd, hex);
+  if (r < 0)
+    return r;
+  fprintf(sums, "%s *%s\n", hex, CATALOG_INDEX);
+
+  return 0;
+}
+
+/* SHA256SUMS, one json per image and, with index, sysext-deps.json
+   and sysext-deps.idx. The images themselves are not needed by any
+   benchmark. */
+static int
+generate_repo(const char *dir, size_t n, bool index)
+{
+  const char *arch = architecture_to_string(uname_architecture());
+  _cleanup_fclose_ FILE *sums = NULL;
+  _cleanup_fclose_ FILE *idx = NULL;
+  _cleanup_free_ char *sumsfn = NULL;
+  _cleanup_free_ char *idxbuf = NULL;
+  size_t idxlen = 0;
+  char hex[2 * SHA256_DIGEST_SIZE + 1];
+  int r;
+
+  if (arch == NULL)
+    return -EINVAL;
+
+  if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+    return -errno;
+
+  if (asprintf(&sumsfn, "%s/SHA256SUMS", dir) < 0)
+    return -ENOMEM;
+  sums = fopen(sumsfn, "we");
+  if (sums == NULL)
+    return -errno;
+
+  if (index)
+    {
+      idx = open_memstream(&idxbuf, &idxlen);
+      if (idx == NULL)
+	return -ENOMEM;
+      fputc('[', idx);
+    }
+
+  for (size_t i = 0; i < n; i++)
+    {
+      _cleanup_free_ char *json = NULL;
+      _cleanup_free_ char *fn = NULL;
+      size_t len;
+
+      if (image_json(i, arch, &json) < 0)
+	return -ENOMEM;
+      if (asprintf(&fn, "ext%zu-1.%zu.%s.raw", i / VERSIONS_PER_NAME,
+		   i % VERSIONS_PER_NAME, arch) < 0)
+	return -ENOMEM;
+      len = strlen(json);
+
+      /* the images are never downloaded, any sum will do */
+      fprintf(sums, "%064zx *%s\n", i + 1, fn);
+
+      free(fn);
+      if (asprintf(&fn, "ext%zu-1.%zu.%s.raw.json", i / VERSIONS_PER_NAME,
+		   i % VERSIONS_PER_NAME, arch) < 0)
+	return -ENOMEM;
+      r = write_file(dir, fn, json, len, hex);
+      if (r < 0)
+	return r;
+      fprintf(sums, "%s *%s\n", hex, fn);
+
+      if (idx)
+	fprintf(idx, "%s%s", i > 0 ? ",\n" : "", json);
+    }
+
+  if (idx)
+    {
+      fputs("]\n", idx);
+      if (fflush(idx) != 0)
+	return -ENOMEM;
+      r = write_file(dir, "sysext-deps.json", idxbuf, idxlen, hex);
+      if (r < 0)
+	return r;
+      fprintf(sums, "%s *sysext-deps.json\n", hex);
+
+      r = write_binary_index(dir, sums);
+      if (r < 0)
+	return r;
+    }
+
+  if (fflush(sums) != 0)
+    return -errno;
+
+  return 0;
+}
+
+static int
+host_new(struct host_profile **res)
+{
+  struct osrelease *o;
+
+  o = calloc(1, sizeof(struct osrelease));
+  if (o == NULL)
+    return -ENOMEM;
+  o->id = strdup("bench");
+  o->version_id = strdup("1");
+  if (o->id == NULL || o->version_id == NULL)
+    {
+      free_os_releasep(&o);
+      return -ENOMEM;
+    }
+
+  return host_profile_new(o, res);
+}
+
+/* what sysextmgrd does with the binary index: map it and look up
+   every image of SHA256SUMS */
+static int
+lookup_binary_index(const char *dir, struct image_deps **deps)
+{
+  _cleanup_(free_catalog_indexp) struct catalog_index *idx = NULL;
+  _cleanup_free_ char *fn = NULL;
+  _cleanup_close_ int fd = -EBADF;
+  int r;
+
+  if (asprintf(&fn, "%s/%s", dir, CATALOG_INDEX) < 0)
+    return -ENOMEM;
+  fd = open(fn, O_RDONLY|O_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+
+  r = catalog_index_open(fd, &idx);
+  if (r < 0)
+    return r;
+
+  for (size_t i = 0; deps[i]; i++)
+    {
+      _cleanup_(free_image_depsp) struct image_deps *e = NULL;
+      const char *image_name = deps[i]->image_name;
+
+      r = catalog_index_lookup(idx, image_name,
+			       image_name_len(image_name, strlen(image_name)),
+			       &e);
+      if (r < 0)
+	return r;
+      if (r == 0)
+	{
+	  fprintf(stderr, "'%s' is not in the index\n", image_name);
+	  return -EIO;
+	}
+    }
+
+  return 0;
+}
+
+/* entries like the ones of a remote fetch, the first of every
+   VERSIONS_PER_NAME also as local copy */
+static int
+entries_from_deps(struct image_deps **deps, struct image_entry ***remote,
+		  size_t *n_remote, struct image_entry ***local, size_t *n_local)
+{
+  size_t n = 0;
+
+  while (deps[n])
+    n++;
+
+  *remote = calloc(n + 1, sizeof(struct image_entry *));
+  *local = calloc(n + 1, sizeof(struct image_entry *));
+  if (*remote == NULL || *local == NULL)
+    return -ENOMEM;
+  *n_remote = *n_local = 0;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      struct image_entry *e = calloc(1, sizeof(struct image_entry));
+      const char *dash;
+
+      if (e == NULL)
+	return -ENOMEM;
+      (*remote)[(*n_remote)++] = e;
+      dash = strchr(deps[i]->image_name, '-');
+      e->name = strndup(deps[i]->image_name,
+			dash ? (size_t) (dash - deps[i]->image_name) : 0);
+      if (e->name == NULL || dup_image_deps(deps[i], &e->deps) < 0)
+	return -ENOMEM;
+      e->remote = true;
+      e->compatible = true;
+
+      if (i % VERSIONS_PER_NAME == 0)
+	{
+	  struct image_entry *l;
+
+	  if (dup_image_entry(e, &l) < 0)
+	    return -ENOMEM;
+	  (*local)[(*n_local)++] = l;
+	  l->remote = false;
+	  l->local = true;
+	}
+    }
+
+  return 0;
+}
+
+struct remote_result {
+  int r;
+  size_t n;
+};
+
+static void
+remote_done(int r, struct image_entry **images, size_t n, void *userdata)
+{
+  struct remote_result *res = userdata;
+
+  res->r = r;
+  res->n = n;
+  free_image_entry_list(&images);
+}
+
+static int
+run_remote(const char *repo, size_t n_images, bool lazy,
+	   struct host_profile *host)
+{
+  _cleanup_(free_process_poolp) struct process_pool *pool = NULL;
+  _cleanup_free_ char *url = NULL;
+  struct remote_result res = { .r = -EINPROGRESS };
+  int r;
+
+  if (asprintf(&url, "file://%s", repo) < 0)
+    return -ENOMEM;
+
+  r = process_pool_new(&pool, NULL, config.max_parallel_downloads);
+  if (r < 0)
+    return r;
+
+  image_remote_metadata_async(pool, url, NULL, lazy, false, host, false,
+			      remote_done, &res);
+  r = process_pool_wait(pool);
+  if (r < 0)
+    return r;
+  if (res.r < 0)
+    return res.r;
+  if (res.n != n_images)
+    {
+      fprintf(stderr, "Got %zu of %zu images\n", res.n, n_images);
+      return -EIO;
+    }
+
+  return 0;
+}
+
+static int
+file_size(const char *dir, const char *fn, uint64_t *res)
+{
+  _cleanup_free_ char *path = NULL;
+  struct stat st;
+
+  if (asprintf(&path, "%s/%s", dir, fn) < 0)
+    return -ENOMEM;
+  if (stat(path, &st) < 0)
+    return -errno;
+  *res = st.st_size;
+
+  return 0;
+}
+
+/* SHA256SUMS of the repository like a remote fetch without filter */
+static int
+parse_sums(const char *dir, size_t n_images)
+{
+  _cleanup_(free_sums) struct sums s = {};
+  _cleanup_free_ char *fn = NULL;
+  int r;
+
+  if (asprintf(&fn, "%s/SHA256SUMS", dir) < 0)
+    return -ENOMEM;
+
+  r = file_size(dir, "SHA256SUMS", &parsed_bytes);
+  if (r < 0)
+    return r;
+
+  r = sums_from_file(fn, NULL, &s);
+  if (r < 0)
+    return r;
+  if (s.n_images != n_images)
+    {
+      fprintf(stderr, "Got %zu of %zu images\n", s.n_images, n_images);
+      return -EIO;
+    }
+
+  return 0;
+}
+
+/* the extension-release of every image, as systemd-dissect writes
+   it for a local scan */
+static int
+parse_release(size_t n_images)
+{
+  static const char release[] =
+    "ID=bench\n"
+    "VERSION_ID=1\n"
+    "SYSEXT_LEVEL=1.0\n"
+    "SYSEXT_VERSION_ID=1.0\n"
+    "SYSEXT_SCOPE=system\n"
+    "# the images of the benchmark are never dissected\n"
+    "ARCHITECTURE=x86-64\n";
+  _cleanup_close_ int fd = -EBADF;
+  int r;
+
+  fd = memfd_create("bench-release", MFD_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+  if (write(fd, release, strlen(release)) != (ssize_t) strlen(release))
+    return -EIO;
+
+  for (size_t i = 0; i < n_images; i++)
+    {
+      _cleanup_(free_image_depsp) struct image_deps *e = NULL;
+
+      r = load_ext_release("ext-1.0.x86-64.raw", fd, &e);
+      if (r < 0)
+	return r;
+    }
+  parsed_bytes = (uint64_t) n_images * strlen(release);
+
+  return 0;
+}
+
+static int
+run_case(const char *name, const char *repo, size_t n_images,
+	 struct image_deps **deps, struct image_entry **remote, size_t n_remote,
+	 struct image_entry **local, size_t n_local)
+{
+  int r;
+
+  if (startswith(name, "remote"))
+    {
+      _cleanup_(free_host_profilep) struct host_profile *host = NULL;
+
+      r = host_new(&host);
+      if (r < 0)
+	return r;
+
+      return run_remote(repo, n_images, streq(name, "remote-lazy"), host);
+    }
+  else if (streq(name, "load-json"))
+    {
+      struct image_deps **l = NULL;
+
+      r = file_size(repo, "sysext-deps.json", &parsed_bytes);
+      if (r < 0)
+	return r;
+
+      r = load_index(repo, &l);
+      free_image_deps_list(&l);
+      return r;
+    }
+  else if (streq(name, "parse-sums"))
+    return parse_sums(repo, n_images);
+  else if (streq(name, "parse-release"))
+    return parse_release(n_images);
+  else if (streq(name, "load-index"))
+    return lookup_binary_index(repo, deps);
+  else if (streq(name, "validate"))
+    {
+      _cleanup_(free_host_profilep) struct host_profile *host = NULL;
+
+      r = host_new(&host);
+      if (r < 0)
+	return r;
+
+      for (size_t i = 0; deps[i]; i++)
+	(void) host_profile_validate(host, deps[i]->image_name, "system",
+				     deps[i], false);
+      return 0;
+    }
+  else if (streq(name, "list") || streq(name, "check"))
+    {
+      _cleanup_(free_catalogp) struct catalog *c = NULL;
+
+      c = calloc(1, sizeof(struct catalog));
+      if (c == NULL)
+	return -ENOMEM;
+      c->n_ref = 1;
+
+      r = catalog_build(c, remote, n_remote, local, n_local);
+      if (r < 0 || streq(name, "list"))
+	return r;
+
+      /* every name installed in its oldest version */
+      for (size_t i = 0; i < c->n_names; i++)
+	{
+	  const struct catalog_name *cn = &c->names[i];
+	  struct image_entry *new = NULL;
+
+	  r = get_latest_version(c, cn->versions[cn->n_versions - 1], &new);
+	  if (r < 0)
+	    return r;
+	}
+      return 0;
+    }
+
+  usage(EXIT_FAILURE);
+  return -EINVAL;
+}
+
+static int
+remove_entry(const char *path, const struct stat *st _unused_,
+	     int type _unused_, struct FTW *ftw _unused_)
+{
+  return remove(path);
+}
+
+int
+main(int argc, char **argv)
+{
+  _cleanup_free_ char *repo = NULL;
+  struct image_deps **deps = NULL;
+  struct image_entry **remote = NULL, **local = NULL;
+  size_t n_remote = 0, n_local = 0;
+  char tmpdir[] = "/tmp/sysextmgr-bench-XXXXXX";
+  uint64_t best = UINT64_MAX, total = 0;
+  unsigned long n, iterations = 3;
+  struct rusage ru;
+  int r;
+
+  if (argc < 4 && (argc < 3 || streq(argv[1], "generate")))
+    usage(EXIT_FAILURE);
+
+  set_max_log_level(LOG_WARNING);
+
+  if (streq(argv[1], "generate"))
+    {
+      n = strtoul(argv[3], NULL, 10);
+      r = generate_repo(argv[2], n, !(argc > 4 && streq(argv[4], "--no-index")));
+      if (r < 0)
+	{
+	  fprintf(stderr, "Failed to generate repository: %s\n", strerror(-r));
+	  return EXIT_FAILURE;
+	}
+      return EXIT_SUCCESS;
+    }
+
+  n = strtoul(argv[2], NULL, 10);
+  if (argc > 3)
+    iterations = strtoul(argv[3], NULL, 10);
+  if (n == 0 || iterations == 0)
+    usage(EXIT_FAILURE);
+
+  if (mkdtemp(tmpdir) == NULL)
+    {
+      fprintf(stderr, "Failed to create temporary directory: %m\n");
+      return EXIT_FAILURE;
+    }
+
+  /* the metadata cache of the remote fetch is written here */
+  config.cache_dir = tmpdir;
+  config.max_parallel_downloads = 4;
+
+  if (asprintf(&repo, "%s/repo", tmpdir) < 0)
+    oom();
+  r = generate_repo(repo, n, !streq(argv[1], "remote-noindex") &&
+		    !streq(argv[1], "remote-lazy"));
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to generate repository: %s\n", strerror(-r));
+      goto finish;
+    }
+
+  if (streq(argv[1], "validate") || streq(argv[1], "list") ||
+      streq(argv[1], "check") || streq(argv[1], "load-index"))
+    {
+      r = load_index(repo, &deps);
+      if (r >= 0)
+	r = entries_from_deps(deps, &remote, &n_remote, &local, &n_local);
+      if (r < 0)
+	{
+	  fprintf(stderr, "Failed to load images: %s\n", strerror(-r));
+	  goto finish;
+	}
+    }
+
+  /* the first remote run fills the metadata cache, the later ones
+     show the warm path */
+  for (unsigned long i = 0; i < iterations; i++)
+    {
+      uint64_t start = metrics_now(), usec;
+
+      r = run_case(argv[1], repo, n, deps, remote, n_remote, local, n_local);
+      if (r < 0)
+	{
+	  fprintf(stderr, "%s failed: %s\n", argv[1], strerror(-r));
+	  goto finish;
+	}
+
+      usec = metrics_now() - start;
+      total += usec;
+      if (usec < best)
+	best = usec;
+      printf("%s images=%lu run=%lu time=%.3fms\n", argv[1], n, i + 1,
+	     (double) usec / 1000);
+    }
+
+  getrusage(RUSAGE_SELF, &ru);
+  printf("%s images=%lu min=%.3fms avg=%.3fms maxrss=%ldKiB\n", argv[1], n,
+	 (double) best / 1000, (double) total / iterations / 1000, ru.ru_maxrss);
+  if (parsed_bytes > 0 && best > 0)
+    printf("%s images=%lu bytes=%" PRIu64 " throughput=%.1fMiB/s\n", argv[1], n,
+	   parsed_bytes, (double) parsed_bytes / best * 1000000 / (1024 * 1024));
+
+ finish:
+  free_image_entry_list(&remote);
+  free_image_entry_list(&local);
+  free_image_deps_list(&deps);
+  nftw(tmpdir, remove_entry, 16, FTW_DEPTH|FTW_PHYS);
+
+  return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Stand-in for systemd-pull in the benchmarks: copies a file:// URL
+# after sleeping SYSEXTMGR_BENCH_LATENCY seconds.
+# Called as: fake-systemd-pull.sh raw --direct --verify <mode> <url> <dest>
+
+url="$5"
+dest="$6"
+
+if [ -n "$SYSEXTMGR_BENCH_LATENCY" ]; then
+    sleep "$SYSEXTMGR_BENCH_LATENCY"
+fi
+
+case "$url" in
+    file://*)
+	exec cp "${url#file://}" "$dest"
+	;;
+    *)
+	echo "Unsupported URL: $url" >&2
+	exit 1
+	;;
+esac
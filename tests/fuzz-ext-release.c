@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/* load_ext_release() of the extension-release file of an image as
+   written by systemd-dissect */
+
+#include "config.h"
+
+#include "basics.h"
+#include "sysextmgr.h"
+#include "image-deps.h"
+#include "extrelease.h"
+#include "fuzz.h"
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  _cleanup_(free_image_depsp) struct image_deps *e = NULL;
+  _cleanup_close_ int fd = -EBADF;
+
+  fd = fuzz_memfd(data, size);
+  if (fd < 0)
+    return 0;
+
+  (void) load_ext_release("fuzz-1.0.x86-64.raw", fd, &e);
+
+  return 0;
+}
@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/* load_image_json() with parse_image_deps() of every entry, as done
+   for the json files and sysext-deps.json of a repository. gzip and
+   zstd compressed input is decompressed first. */
+
+#include "config.h"
+
+#include <stdio.h>
+
+#include "basics.h"
+#include "sysextmgr.h"
+#include "image-deps.h"
+#include "fuzz.h"
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  _cleanup_(free_image_deps_list) struct image_deps **images = NULL;
+  _cleanup_free_ char *path = NULL;
+  _cleanup_close_ int fd = -EBADF;
+
+  fd = fuzz_memfd(data, size);
+  if (fd < 0)
+    return 0;
+
+  /* load_image_json() opens the file itself */
+  if (asprintf(&path, "/proc/self/fd/%i", fd) < 0)
+    oom();
+  (void) load_image_json(-1, path, &images);
+
+  return 0;
+}
@@ -0,0 +1,95 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/* Driver of the fuzz targets without libFuzzer: every argument is an
+   input file, without arguments stdin is read. That replays a corpus
+   in "meson test" and is enough for AFL, e.g.
+   "afl-fuzz -i seeds -o findings -- tests/fuzz-image-json @@". */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "basics.h"
+#include "fuzz.h"
+
+static int
+read_input(FILE *fp, uint8_t **res, size_t *size)
+{
+  _cleanup_free_ uint8_t *buf = NULL;
+  size_t len = 0, max = 0;
+
+  for (;;)
+    {
+      size_t n;
+
+      if (len == max)
+	{
+	  uint8_t *p;
+
+	  max = max ? max * 2 : 4096;
+	  p = realloc(buf, max);
+	  if (p == NULL)
+	    return -ENOMEM;
+	  buf = p;
+	}
+
+      n = fread(buf + len, 1, max - len, fp);
+      len += n;
+      if (n == 0)
+	break;
+    }
+  if (ferror(fp))
+    return -EIO;
+
+  *res = TAKE_PTR(buf);
+  *size = len;
+
+  return 0;
+}
+
+static int
+run_file(const char *fn)
+{
+  _cleanup_fclose_ FILE *fp = NULL;
+  _cleanup_free_ uint8_t *data = NULL;
+  size_t size = 0;
+  int r;
+
+  if (fn)
+    {
+      fp = fopen(fn, "re");
+      if (fp == NULL)
+	{
+	  fprintf(stderr, "Failed to open '%s': %s\n", fn, strerror(errno));
+	  return -errno;
+	}
+    }
+
+  r = read_input(fp ? fp : stdin, &data, &size);
+  if (r < 0)
+    {
+      fprintf(stderr, "Failed to read '%s': %s\n", fn ? fn : "-", strerror(-r));
+      return r;
+    }
+
+  LLVMFuzzerTestOneInput(data, size);
+  printf("%s: %zu bytes\n", fn ? fn : "-", size);
+
+  return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  if (argc < 2)
+    return run_file(NULL) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+  for (int i = 1; i < argc; i++)
+    if (run_file(argv[i]) < 0)
+      return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}
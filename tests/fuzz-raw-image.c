@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/* raw_image_copy_file() of the extension-release file of an image,
+   the GPT and EROFS parser which runs inside of sysextmgrd */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <sys/mman.h>
+
+#include "basics.h"
+#include "raw-image.h"
+#include "fuzz.h"
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  _cleanup_close_ int fd = -EBADF, out = -EBADF;
+  char fn[64];
+
+  fd = fuzz_memfd(data, size);
+  if (fd < 0)
+    return 0;
+  out = memfd_create("fuzz-output", MFD_CLOEXEC);
+  if (out < 0)
+    return 0;
+
+  /* it opens the image by name */
+  snprintf(fn, sizeof(fn), "/proc/self/fd/%i", fd);
+  (void) raw_image_copy_file(fn, "/usr/lib/extension-release.d/extension-release.test", out);
+
+  return 0;
+}
@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/* sums_parse() of SHA256SUMS, once for all images and once with a
+   filter like the one of Install, followed by the lookups of the json
+   files */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "basics.h"
+#include "sysextmgr.h"
+#include "sums.h"
+#include "fuzz.h"
+
+static void
+parse(const uint8_t *data, size_t size, char *const *filter)
+{
+  _cleanup_(free_sums) struct sums s = {};
+  char *buf;
+
+  /* sums_parse() needs a NUL terminated buffer it owns */
+  buf = malloc(size + 1);
+  if (buf == NULL)
+    oom();
+  memcpy(buf, data, size);
+  buf[size] = '\0';
+
+  if (sums_parse(buf, filter, &s) < 0)
+    return;
+
+  (void) sums_json_hash(&s, SYSEXT_DEPS_INDEX);
+  for (size_t i = 0; i < s.n_jsons; i++)
+    (void) sums_json_hash(&s, s.jsons[i].fn);
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  char *filter[] = { (char *) "k3s", (char *) "strace", NULL };
+
+  parse(data, size, NULL);
+  parse(data, size, filter);
+
+  return 0;
+}
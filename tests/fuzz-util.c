@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "basics.h"
+#include "sysextmgr.h"
+#include "fuzz.h"
+
+/* running out of memory is a finding, not a clean exit */
+void
+oom(void)
+{
+  fputs("Out of memory\n", stderr);
+  abort();
+}
+
+void
+usage(int retval)
+{
+  exit(retval);
+}
+
+int
+fuzz_memfd(const uint8_t *data, size_t size)
+{
+  _cleanup_close_ int fd = -EBADF;
+
+  fd = memfd_create("fuzz-input", MFD_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+
+  for (size_t done = 0; done < size; )
+    {
+      ssize_t n = write(fd, data + done, size - done);
+
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -errno;
+	}
+      done += n;
+    }
+
+  return TAKE_FD(fd);
+}
@@ -0,0 +1,13 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Entry point of every fuzz target. Built with -Dfuzzer=true it is
+   called by libFuzzer, else by fuzz-main.c. */
+extern int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+/* memfd with a copy of data, the parsers read from an fd */
+extern int fuzz_memfd(const uint8_t *data, size_t size);
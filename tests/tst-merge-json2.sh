@@ -0,0 +1,20 @@
+#!/bin/sh
+
+set -e
+
+INPUT_DIR=../tests/tst-merge-json1.data/input
+OUTPUT_DIR=../tests/tst-merge-json2.data/output
+EXPECTED_DIR=../tests/tst-merge-json1.data/expected
+
+if [ -d ${OUTPUT_DIR} ]; then
+    rm -rf ${OUTPUT_DIR}
+fi
+mkdir -p ${OUTPUT_DIR}
+
+./sysextmgrcli merge-json -o "$OUTPUT_DIR/sysext-deps.json.gz" "${INPUT_DIR}/k3s-1.31.5+k3s1-29.1.x86-64.raw.json" "${INPUT_DIR}/strace-29.1.x86-64.raw.json"
+gzip -dc "${OUTPUT_DIR}/sysext-deps.json.gz" > "${OUTPUT_DIR}/sysext-deps.json"
+cmp "${OUTPUT_DIR}/sysext-deps.json" "${EXPECTED_DIR}/sysext-deps.json"
+
+# dump-json decompresses the index like sysextmgrd
+./sysextmgrcli dump-json "$OUTPUT_DIR/sysext-deps.json.gz" > "$OUTPUT_DIR/sysext-deps.json.out"
+cmp "${OUTPUT_DIR}/sysext-deps.json.out" ../tests/tst-dump-json1.data/expected/sysext-deps.json.out
@@ -0,0 +1,17 @@
+#!/bin/sh
+
+set -e
+
+INPUT_DIR=../tests/tst-merge-json1.data/input
+OUTPUT_DIR=../tests/tst-merge-json3.data/output
+EXPECTED_DIR=../tests/tst-dump-json1.data/expected
+
+if [ -d ${OUTPUT_DIR} ]; then
+    rm -rf ${OUTPUT_DIR}
+fi
+mkdir -p ${OUTPUT_DIR}
+
+# the binary index holds the same data as sysext-deps.json
+./sysextmgrcli merge-json -o "$OUTPUT_DIR/sysext-deps.idx" "${INPUT_DIR}/k3s-1.31.5+k3s1-29.1.x86-64.raw.json" "${INPUT_DIR}/strace-29.1.x86-64.raw.json"
+./sysextmgrcli dump-json "$OUTPUT_DIR/sysext-deps.idx" > "$OUTPUT_DIR/sysext-deps.idx.out"
+cmp "${OUTPUT_DIR}/sysext-deps.idx.out" "${EXPECTED_DIR}/sysext-deps.json.out"
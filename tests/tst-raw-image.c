@@ -0,0 +1,288 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/* raw_image_copy_file() with small EROFS images built here: plain,
+   inside a GPT with one partition and layouts which have to be left
+   to systemd-dissect. With a directory as argument the images are
+   written there instead, they are the seeds of fuzz-raw-image. */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "basics.h"
+#include "raw-image.h"
+
+#define BLKSZBITS 12
+#define BLKSZ (1U << BLKSZBITS)
+/* superblock, inodes with inline directories, data of the file */
+#define EROFS_SIZE (3 * BLKSZ)
+#define META_BLKADDR 1
+#define DATA_BLKADDR 2
+
+#define SECTOR 512
+#define GPT_ENTRIES 128
+#define GPT_ENTRY_SIZE 128
+#define GPT_FIRST_LBA 40
+/* room for the backup GPT at the end */
+#define GPT_SIZE ((GPT_FIRST_LBA + 33) * SECTOR + EROFS_SIZE)
+
+#define RELEASE_PATH "/usr/lib/extension-release.d/extension-release.test"
+#define RELEASE "ID=_any\nSYSEXT_SCOPE=system\n"
+
+enum {
+  LAYOUT_FLAT_PLAIN = 0,
+  LAYOUT_COMPRESSED_FULL = 1,
+  LAYOUT_FLAT_INLINE = 2,
+};
+
+static void
+put_le16(uint8_t *p, uint16_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void
+put_le32(uint8_t *p, uint32_t v)
+{
+  put_le16(p, v);
+  put_le16(p + 2, v >> 16);
+}
+
+static void
+put_le64(uint8_t *p, uint64_t v)
+{
+  put_le32(p, v);
+  put_le32(p + 4, v >> 32);
+}
+
+/* compact inode, returns the position after its inline data */
+static size_t
+put_inode(uint8_t *img, uint64_t nid, unsigned layout, uint16_t mode,
+	  uint32_t size, uint32_t blkaddr)
+{
+  uint8_t *p = img + META_BLKADDR * BLKSZ + nid * 32;
+
+  put_le16(p, layout << 1);
+  put_le16(p + 4, mode);
+  put_le16(p + 6, 1);
+  put_le32(p + 8, size);
+  put_le32(p + 16, blkaddr);
+  put_le32(p + 20, nid);
+
+  return META_BLKADDR * BLKSZ + nid * 32 + 32;
+}
+
+/* directory with ".", ".." and one entry, the data is stored inline */
+static uint64_t
+put_dir(uint8_t *img, uint64_t nid, uint64_t parent, const char *name,
+	uint64_t child, uint8_t child_type)
+{
+  const char *names[] = { ".", "..", name };
+  uint64_t nids[] = { nid, parent, child };
+  uint8_t types[] = { 2, 2, child_type };
+  size_t size = 3 * 12 + 1 + 2 + strlen(name), off = 3 * 12, pos;
+
+  pos = put_inode(img, nid, LAYOUT_FLAT_INLINE, S_IFDIR | 0755, size, 0);
+  for (size_t i = 0; i < 3; i++)
+    {
+      uint8_t *d = img + pos + i * 12;
+
+      put_le64(d, nids[i]);
+      put_le16(d + 8, off);
+      d[10] = types[i];
+      memcpy(img + pos + off, names[i], strlen(names[i]));
+      off += strlen(names[i]);
+    }
+
+  /* the next free inode slot */
+  return (pos + size - META_BLKADDR * BLKSZ + 31) / 32;
+}
+
+/* RELEASE_PATH with content in the layout of file_layout */
+static void
+build_erofs(uint8_t *img, unsigned file_layout)
+{
+  uint8_t *sb = img + 1024;
+  uint64_t usr, lib, erd, file;
+  size_t pos;
+
+  memset(img, 0, EROFS_SIZE);
+
+  put_le32(sb, 0xE0F5E1E2U);
+  sb[12] = BLKSZBITS;
+  put_le16(sb + 14, 0);  /* root nid */
+  put_le64(sb + 16, 5);  /* inodes */
+  put_le32(sb + 36, EROFS_SIZE / BLKSZ);
+  put_le32(sb + 40, META_BLKADDR);
+
+  usr = put_dir(img, 0, 0, "usr", 0, 2);
+  lib = put_dir(img, usr, 0, "lib", 0, 2);
+  erd = put_dir(img, lib, usr, "extension-release.d", 0, 2);
+  file = put_dir(img, erd, lib, "extension-release.test", 0, 1);
+
+  /* now that the nids are known */
+  put_dir(img, 0, 0, "usr", usr, 2);
+  put_dir(img, usr, 0, "lib", lib, 2);
+  put_dir(img, lib, usr, "extension-release.d", erd, 2);
+  put_dir(img, erd, lib, "extension-release.test", file, 1);
+
+  pos = put_inode(img, file, file_layout, S_IFREG | 0644, strlen(RELEASE),
+		  DATA_BLKADDR);
+  /* a file smaller than a block is all tail */
+  if (file_layout == LAYOUT_FLAT_INLINE)
+    memcpy(img + pos, RELEASE, strlen(RELEASE));
+  else
+    memcpy(img + DATA_BLKADDR * BLKSZ, RELEASE, strlen(RELEASE));
+}
+
+static void
+put_partition(uint8_t *entry, uint64_t first, uint64_t last)
+{
+  /* type and unique GUID, only "not unused" matters */
+  memset(entry, 0x11, 32);
+  put_le64(entry + 32, first);
+  put_le64(entry + 40, last);
+}
+
+static void
+build_gpt(uint8_t *img, unsigned n_partitions)
+{
+  uint8_t *hdr = img + SECTOR;
+  uint8_t *entries = img + 2 * SECTOR;
+  uint64_t last = GPT_FIRST_LBA + EROFS_SIZE / SECTOR - 1;
+
+  memset(img, 0, GPT_SIZE);
+  memcpy(hdr, "EFI PART", 8);
+  put_le32(hdr + 12, 92);
+  put_le64(hdr + 72, 2);
+  put_le32(hdr + 80, GPT_ENTRIES);
+  put_le32(hdr + 84, GPT_ENTRY_SIZE);
+
+  build_erofs(img + GPT_FIRST_LBA * SECTOR, LAYOUT_FLAT_PLAIN);
+  put_partition(entries, GPT_FIRST_LBA, last);
+  /* e.g. a verity partition */
+  if (n_partitions > 1)
+    put_partition(entries + GPT_ENTRY_SIZE, last + 1, last + 8);
+}
+
+static int
+write_image(const char *fn, const uint8_t *img, size_t size)
+{
+  _cleanup_close_ int fd = -EBADF;
+
+  fd = open(fn, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+  if (fd < 0 || write(fd, img, size) != (ssize_t) size)
+    {
+      fprintf(stderr, "Cannot write '%s': %m\n", fn);
+      return -1;
+    }
+
+  return 0;
+}
+
+/* raw_image_copy_file() reads from a path */
+static int
+test_image(const char *what, const uint8_t *img, size_t size,
+	   const char *path, int expected)
+{
+  _cleanup_close_ int in = -EBADF, out = -EBADF;
+  char fn[64], buf[256];
+  ssize_t n;
+  int r;
+
+  in = memfd_create("image", MFD_CLOEXEC);
+  out = memfd_create("output", MFD_CLOEXEC);
+  if (in < 0 || out < 0 || write(in, img, size) != (ssize_t) size)
+    {
+      fprintf(stderr, "%s: cannot create memfd: %m\n", what);
+      return -1;
+    }
+  snprintf(fn, sizeof(fn), "/proc/self/fd/%i", in);
+
+  r = raw_image_copy_file(fn, path, out);
+  if (r != expected)
+    {
+      fprintf(stderr, "%s: got %s, expected %s\n", what,
+	      r < 0 ? strerror(-r) : "success",
+	      expected < 0 ? strerror(-expected) : "success");
+      return -1;
+    }
+  if (r < 0)
+    return 0;
+
+  n = pread(out, buf, sizeof(buf), 0);
+  if (n != (ssize_t) strlen(RELEASE) || memcmp(buf, RELEASE, n) != 0)
+    {
+      fprintf(stderr, "%s: wrong content\n", what);
+      return -1;
+    }
+
+  return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  static uint8_t erofs[EROFS_SIZE], gpt[GPT_SIZE];
+  int failed = 0;
+
+  if (argc > 1)
+    {
+      _cleanup_free_ char *plain = NULL, *part = NULL;
+
+      build_erofs(erofs, LAYOUT_FLAT_PLAIN);
+      build_gpt(gpt, 1);
+      if (asprintf(&plain, "%s/erofs.raw", argv[1]) < 0 ||
+	  asprintf(&part, "%s/gpt-erofs.raw", argv[1]) < 0)
+	return EXIT_FAILURE;
+      if (write_image(plain, erofs, sizeof(erofs)) < 0 ||
+	  write_image(part, gpt, sizeof(gpt)) < 0)
+	return EXIT_FAILURE;
+      return EXIT_SUCCESS;
+    }
+
+  build_erofs(erofs, LAYOUT_FLAT_PLAIN);
+  failed += test_image("plain EROFS", erofs, sizeof(erofs), RELEASE_PATH, 0) < 0;
+  failed += test_image("missing file", erofs, sizeof(erofs),
+		       "/usr/lib/extension-release.d/extension-release.other",
+		       -ENOENT) < 0;
+  failed += test_image("directory", erofs, sizeof(erofs), "/usr/lib",
+		       -EOPNOTSUPP) < 0;
+  failed += test_image("truncated", erofs, BLKSZ + 40, RELEASE_PATH,
+		       -EBADMSG) < 0;
+
+  build_erofs(erofs, LAYOUT_FLAT_INLINE);
+  failed += test_image("inline file", erofs, sizeof(erofs), RELEASE_PATH,
+		       0) < 0;
+
+  /* compressed files are left to systemd-dissect */
+  build_erofs(erofs, LAYOUT_COMPRESSED_FULL);
+  failed += test_image("compressed file", erofs, sizeof(erofs),
+		       RELEASE_PATH, -EOPNOTSUPP) < 0;
+
+  build_erofs(erofs, LAYOUT_FLAT_PLAIN);
+  memcpy(erofs + 1024, "hsqs", 4);
+  failed += test_image("no EROFS", erofs, sizeof(erofs), RELEASE_PATH,
+		       -EOPNOTSUPP) < 0;
+
+  build_gpt(gpt, 1);
+  failed += test_image("GPT with one partition", gpt, sizeof(gpt),
+		       RELEASE_PATH, 0) < 0;
+
+  build_gpt(gpt, 2);
+  failed += test_image("GPT with two partitions", gpt, sizeof(gpt),
+		       RELEASE_PATH, -EOPNOTSUPP) < 0;
+
+  printf("%s\n", failed ? "FAILED" : "ok");
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
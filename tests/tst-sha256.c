@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/* Known answer tests of SHA-256 with the vectors of FIPS 180-2, run
+   with every block function compiled in which the CPU supports */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sha256.h"
+
+static const struct {
+  const char *msg;
+  const char *sum;
+} vectors[] = {
+  { "",
+    "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+  { "abc",
+    "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+  /* 448 bits, the padding needs a second block */
+  { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+    "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+  { "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmno"
+    "ijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+    "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1" },
+};
+
+/* one million times 'a' */
+#define MILLION_A_SUM "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"
+
+static int
+check(const char *impl, const char *what, struct sha256_ctx *ctx,
+      const char *expected)
+{
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  char hex[2 * SHA256_DIGEST_SIZE + 1];
+
+  sha256_final(ctx, digest);
+  sha256_hex(digest, hex);
+  if (strcmp(hex, expected) != 0)
+    {
+      fprintf(stderr, "%s: %s: got %s, expected %s\n", impl, what, hex, expected);
+      return -1;
+    }
+
+  return 0;
+}
+
+/* the chunk sizes make sha256_update() fill the buffer partially,
+   cross its boundary and pass whole blocks directly */
+static int
+test_million_a(const char *impl, const char *data, size_t chunk)
+{
+  struct sha256_ctx ctx;
+  char what[64];
+
+  sha256_init(&ctx);
+  for (size_t done = 0; done < 1000000; done += chunk)
+    sha256_update(&ctx, data, done + chunk > 1000000 ? 1000000 - done : chunk);
+
+  snprintf(what, sizeof(what), "1000000 x 'a' in chunks of %zu", chunk);
+  return check(impl, what, &ctx, MILLION_A_SUM);
+}
+
+static int
+test_implementation(const char *impl, const char *million_a)
+{
+  static const size_t chunks[] = { 1, 3, 63, 64, 65, 1000, 4096 + 7, 1000000 };
+  int failed = 0;
+
+  for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+    {
+      struct sha256_ctx ctx;
+
+      sha256_init(&ctx);
+      sha256_update(&ctx, vectors[i].msg, strlen(vectors[i].msg));
+      if (check(impl, vectors[i].msg, &ctx, vectors[i].sum) < 0)
+	failed++;
+    }
+
+  for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++)
+    if (test_million_a(impl, million_a, chunks[i]) < 0)
+      failed++;
+
+  return failed;
+}
+
+int
+main(void)
+{
+  const char *impl;
+  char *million_a;
+  int failed = 0;
+
+  million_a = malloc(1000000);
+  if (million_a == NULL)
+    return EXIT_FAILURE;
+  memset(million_a, 'a', 1000000);
+
+  for (size_t i = 0; (impl = sha256_implementation(i)); i++)
+    {
+      int r = sha256_use_implementation(impl);
+
+      if (r == -EOPNOTSUPP)
+	{
+	  printf("%s: not supported by this CPU, skipped\n", impl);
+	  continue;
+	}
+      if (r < 0)
+	{
+	  fprintf(stderr, "%s: cannot be selected: %s\n", impl, strerror(-r));
+	  failed++;
+	  continue;
+	}
+
+      r = test_implementation(impl, million_a);
+      printf("%s: %s\n", impl, r ? "FAILED" : "ok");
+      failed += r;
+    }
+
+  free(million_a);
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,180 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/* The keys of version_key_new() have to order with strcmp() like the
+   versions with strverscmp(), except for leading zeros */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "version-key.h"
+
+/* versions of real images and packages, compared in both directions */
+static const struct {
+  const char *a;
+  const char *b;
+} pairs[] = {
+  { "1.2.3", "1.2.10" },
+  { "30.3", "30.4" },
+  { "30.10", "30.9" },
+  { "6.12.1", "6.12.1-1.1" },
+  { "6.12.1-1.1", "6.12.1-2.1" },
+  { "6.12.1-10.1", "6.12.1-9.1" },
+  { "1.0", "1.0.1" },
+  { "1.0", "1.1" },
+  { "1.10", "1.9" },
+  { "2024.1", "2024.10" },
+  { "20240101", "20241231" },
+  { "1.0~rc1", "1.0" },
+  { "1.0~rc1", "1.0~rc2" },
+  { "1.0+git20240101", "1.0" },
+  { "1.0+git20240101", "1.0+git20240102" },
+  { "1.0+git9", "1.0+git10" },
+  { "1.0a", "1.0" },
+  { "1.0a", "1.0b" },
+  { "1a", "12" },
+  { "1.a", "1.2" },
+  { "1-2", "1.2" },
+  { "1_2", "1.2" },
+  { "v1.2", "v1.10" },
+  { "v2", "1" },
+  { "15.6", "16.0" },
+  { "250.4", "257.2" },
+  { "0.9", "0.10" },
+  { "0", "1" },
+  { "", "0" },
+  { "", "1.0" },
+  { "", "" },
+  { "1.2.3", "1.2.3" },
+};
+
+/* leading zeros are ignored, unlike in strverscmp() */
+static const struct {
+  const char *a;
+  const char *b;
+} same[] = {
+  { "1.05", "1.5" },
+  { "1.0", "1.00" },
+  { "007", "7" },
+  { "2024.01.02", "2024.1.2" },
+};
+
+static int
+sign(int r)
+{
+  return r < 0 ? -1 : r > 0;
+}
+
+static int
+key_cmp(const char *a, const char *b, int *res)
+{
+  char *ka = NULL, *kb = NULL;
+
+  if (version_key_new(a, &ka) < 0 || version_key_new(b, &kb) < 0)
+    {
+      free(ka);
+      free(kb);
+      fprintf(stderr, "version_key_new() failed\n");
+      return -1;
+    }
+  *res = sign(strcmp(ka, kb));
+  free(ka);
+  free(kb);
+
+  return 0;
+}
+
+static int
+test_order(const char *a, const char *b)
+{
+  int expected = sign(strverscmp(a, b)), got;
+
+  if (key_cmp(a, b, &got) < 0)
+    return -1;
+  if (got != expected)
+    {
+      fprintf(stderr, "'%s' <=> '%s': key gives %i, strverscmp() %i\n",
+	      a, b, got, expected);
+      return -1;
+    }
+
+  return 0;
+}
+
+/* every version up to 3 characters of these, without '0' there are
+   no leading zeros */
+static int
+test_all_short(void)
+{
+  static const char alphabet[] = "129.-+~a";
+  size_t n = sizeof(alphabet) - 1, n_versions = 1 + n + n * n + n * n * n;
+  char (*versions)[4];
+  size_t k = 0;
+  int failed = 0;
+
+  versions = calloc(n_versions, sizeof(*versions));
+  if (versions == NULL)
+    return 1;
+
+  k++;  /* the empty version */
+  for (size_t len = 1; len <= 3; len++)
+    {
+      size_t count = 1;
+
+      for (size_t i = 0; i < len; i++)
+	count *= n;
+      for (size_t v = 0; v < count; v++)
+	{
+	  size_t x = v;
+
+	  for (size_t i = 0; i < len; i++, x /= n)
+	    versions[k][i] = alphabet[x % n];
+	  k++;
+	}
+    }
+
+  for (size_t i = 0; i < n_versions && failed < 10; i++)
+    for (size_t j = 0; j < n_versions && failed < 10; j++)
+      if (test_order(versions[i], versions[j]) < 0)
+	failed++;
+
+  free(versions);
+
+  return failed;
+}
+
+int
+main(void)
+{
+  int failed = 0;
+
+  for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++)
+    {
+      if (test_order(pairs[i].a, pairs[i].b) < 0)
+	failed++;
+      if (test_order(pairs[i].b, pairs[i].a) < 0)
+	failed++;
+    }
+
+  for (size_t i = 0; i < sizeof(same) / sizeof(same[0]); i++)
+    {
+      int r;
+
+      if (key_cmp(same[i].a, same[i].b, &r) < 0)
+	failed++;
+      else if (r != 0)
+	{
+	  fprintf(stderr, "'%s' and '%s' should have the same key\n",
+		  same[i].a, same[i].b);
+	  failed++;
+	}
+    }
+
+  failed += test_all_short();
+
+  printf("%s\n", failed ? "FAILED" : "ok");
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}